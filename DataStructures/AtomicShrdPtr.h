@@ -0,0 +1,107 @@
+#ifndef ATOMICSHRDPTR_H
+#define ATOMICSHRDPTR_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// ShrdPtr with an atomic reference count, so copies of one pointer may be made and dropped
+// on different threads, as with std::shared_ptr; a single AtomicShrdPtr object is still not
+// safe to assign from one thread while another reads it. Moving leaves the source empty
+// without touching the count.
+template<typename T>
+class AtomicShrdPtr {
+private:
+    T *ptr;
+    std::atomic<size_t> *ref_count;
+
+    void add_ref() {
+        if (ref_count) {
+            ref_count->fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void release() {
+        if (ref_count) {
+            if (ref_count->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete ptr;
+                delete ref_count;
+            }
+            ptr = nullptr;
+            ref_count = nullptr;
+        }
+    }
+
+public:
+    explicit AtomicShrdPtr(T *p = nullptr)
+            : ptr(p), ref_count(p ? new std::atomic<size_t>(1) : nullptr) {}
+
+    AtomicShrdPtr(const AtomicShrdPtr<T> &other)
+            : ptr(other.ptr), ref_count(other.ref_count) {
+        add_ref();
+    }
+
+    AtomicShrdPtr(AtomicShrdPtr<T> &&other) noexcept
+            : ptr(other.ptr), ref_count(other.ref_count) {
+        other.ptr = nullptr;
+        other.ref_count = nullptr;
+    }
+
+    AtomicShrdPtr<T> &operator=(const AtomicShrdPtr<T> &other) {
+        if (this != &other) {
+            AtomicShrdPtr<T> copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    // The old pointee may own the source (a node moving one of its children up), so it
+    // is released only after the source has been taken.
+    AtomicShrdPtr<T> &operator=(AtomicShrdPtr<T> &&other) noexcept {
+        if (this != &other) {
+            AtomicShrdPtr<T> taken(std::move(other));
+            swap(taken);
+        }
+        return *this;
+    }
+
+    ~AtomicShrdPtr() {
+        release();
+    }
+
+    void swap(AtomicShrdPtr<T> &other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(ref_count, other.ref_count);
+    }
+
+    T &operator*() const {
+        return *ptr;
+    }
+
+    T *operator->() const {
+        return ptr;
+    }
+
+    explicit operator bool() const {
+        return ptr != nullptr;
+    }
+
+    bool operator!() const {
+        return ptr == nullptr;
+    }
+
+    void reset(T *p = nullptr) {
+        AtomicShrdPtr<T> replacement(p);
+        swap(replacement);
+    }
+
+    size_t use_count() const {
+        return ref_count ? ref_count->load(std::memory_order_acquire) : 0;
+    }
+
+    T *get() const {
+        return ptr;
+    }
+};
+
+#endif // ATOMICSHRDPTR_H
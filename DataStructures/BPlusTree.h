@@ -0,0 +1,637 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include "IOrderedDictionary.h"
+#include "KeySearch.h"
+#include "UnqPtr.h"
+#include <stdexcept>
+
+// B+ tree: all values live in the leaves, which are chained left to right, and the
+// internal nodes only hold separator keys. Full iteration is a walk along the leaf
+// chain, and a range scan is one descent to the first key followed by that walk.
+//
+// `order` is the minimum degree, as in BTree: every node holds at most 2 * order - 1
+// keys, and every node except the root at least order - 1.
+template<typename TKey, typename TElement>
+class BPlusTree : public IOrderedDictionary<TKey, TElement> {
+public:
+    BPlusTree(int order = 3);
+
+    virtual ~BPlusTree();
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
+
+private:
+    struct Node {
+        bool isLeaf;
+        int numKeys;
+        UnqPtr<TKey[]> keys;
+        UnqPtr<TElement[]> values;
+        UnqPtr<UnqPtr<Node>[]> children;
+        Node *next;
+
+        Node(bool leaf, int order);
+    };
+
+    UnqPtr<Node> root;
+    int order;
+    size_t count;
+
+    const Node *FindLeaf(const TKey &key) const;
+
+    int ChildIndex(const Node *x, const TKey &key) const;
+
+    int LeafIndex(const Node *x, const TKey &key) const;
+
+    TElement *FindOrInsert(const TKey &key, bool &inserted);
+
+    void SplitChild(Node *x, int i);
+
+    bool RemoveFromNode(Node *x, const TKey &key);
+
+    void Fill(Node *x, int idx);
+
+    void BorrowFromPrev(Node *x, int idx);
+
+    void BorrowFromNext(Node *x, int idx);
+
+    void Merge(Node *x, int idx);
+
+    const Node *FindStart(const TKey *lo, int &index) const;
+
+    void VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo, const TKey *hi);
+
+    class BPlusTreeIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        BPlusTreeIterator(const Node *startLeaf, int startIndex, const TKey *upperBound);
+
+        virtual ~BPlusTreeIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const Node *startLeaf;
+        int startIndex;
+        bool hasUpperBound;
+        TKey upperBound;
+        const Node *leaf;
+        int index;
+        bool started;
+    };
+};
+
+template<typename TKey, typename TElement>
+BPlusTree<TKey, TElement>::Node::Node(bool leaf, int order)
+        : isLeaf(leaf), numKeys(0), keys(new TKey[2 * order - 1]),
+          values(leaf ? new TElement[2 * order - 1] : nullptr),
+          children(leaf ? nullptr : new UnqPtr<Node>[2 * order]), next(nullptr) {
+}
+
+template<typename TKey, typename TElement>
+BPlusTree<TKey, TElement>::BPlusTree(int order)
+        : root(new Node(true, order)), order(order), count(0) {
+    if (order < 2)
+        throw std::invalid_argument("BPlusTree order must be at least 2.");
+}
+
+template<typename TKey, typename TElement>
+BPlusTree<TKey, TElement>::~BPlusTree() {
+}
+
+template<typename TKey, typename TElement>
+size_t BPlusTree<TKey, TElement>::GetCount() const {
+    return count;
+}
+
+template<typename TKey, typename TElement>
+size_t BPlusTree<TKey, TElement>::GetCapacity() const {
+    return count;
+}
+
+// Index of the child whose subtree may contain the key: separators equal to the key
+// belong to the right subtree, because a separator is a copy of that subtree's first key.
+template<typename TKey, typename TElement>
+int BPlusTree<TKey, TElement>::ChildIndex(const Node *x, const TKey &key) const {
+    return KeySearch<TKey>::UpperBound(x->keys.get(), x->numKeys, key);
+}
+
+// Position of the first leaf key that is not less than the key.
+template<typename TKey, typename TElement>
+int BPlusTree<TKey, TElement>::LeafIndex(const Node *x, const TKey &key) const {
+    return KeySearch<TKey>::LowerBound(x->keys.get(), x->numKeys, key);
+}
+
+template<typename TKey, typename TElement>
+const typename BPlusTree<TKey, TElement>::Node *BPlusTree<TKey, TElement>::FindLeaf(const TKey &key) const {
+    const Node *x = root.get();
+    while (!x->isLeaf)
+        x = x->children[ChildIndex(x, key)].get();
+    return x;
+}
+
+template<typename TKey, typename TElement>
+const TElement *BPlusTree<TKey, TElement>::FindPtr(const TKey &key) const {
+    const Node *leaf = FindLeaf(key);
+    int i = LeafIndex(leaf, key);
+    if (i < leaf->numKeys && leaf->keys[i] == key)
+        return &leaf->values[i];
+    return nullptr;
+}
+
+template<typename TKey, typename TElement>
+TElement *BPlusTree<TKey, TElement>::FindPtr(const TKey &key) {
+    return const_cast<TElement *>(static_cast<const BPlusTree *>(this)->FindPtr(key));
+}
+
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        return false;
+
+    element = *value;
+    return true;
+}
+
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::ContainsKey(const TKey &key) const {
+    return FindPtr(key) != nullptr;
+}
+
+template<typename TKey, typename TElement>
+TElement BPlusTree<TKey, TElement>::Get(const TKey &key) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+    return *value;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::Update(const TKey &key, const TElement &element) {
+    TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+
+    *value = element;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    bool inserted;
+    *FindOrInsert(key, inserted) = element;
+    return inserted;
+}
+
+template<typename TKey, typename TElement>
+TElement &BPlusTree<TKey, TElement>::GetOrAdd(const TKey &key) {
+    bool inserted;
+    return *FindOrInsert(key, inserted);
+}
+
+template<typename TKey, typename TElement>
+TElement *BPlusTree<TKey, TElement>::FindOrInsert(const TKey &key, bool &inserted) {
+    if (root->numKeys == 2 * order - 1) {
+        UnqPtr<Node> s(new Node(false, order));
+        s->children[0] = std::move(root);
+        root = std::move(s);
+        SplitChild(root.get(), 0);
+    }
+
+    Node *x = root.get();
+    while (!x->isLeaf) {
+        int i = ChildIndex(x, key);
+        if (x->children[i]->numKeys == 2 * order - 1) {
+            SplitChild(x, i);
+            if (!(key < x->keys[i]))
+                ++i;
+        }
+        x = x->children[i].get();
+    }
+
+    int i = LeafIndex(x, key);
+    if (i < x->numKeys && x->keys[i] == key) {
+        inserted = false;
+        return &x->values[i];
+    }
+
+    for (int j = x->numKeys; j > i; --j) {
+        x->keys[j] = x->keys[j - 1];
+        x->values[j] = x->values[j - 1];
+    }
+    x->keys[i] = key;
+    x->values[i] = TElement();
+    ++x->numKeys;
+    ++count;
+    inserted = true;
+    return &x->values[i];
+}
+
+// Splits the full child x->children[i]. A leaf keeps its first `order` entries and
+// copies the first key of the new right leaf up as the separator; an internal node
+// moves its median key up, exactly as in BTree.
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::SplitChild(Node *x, int i) {
+    Node *y = x->children[i].get();
+    UnqPtr<Node> z(new Node(y->isLeaf, order));
+    TKey separator;
+
+    if (y->isLeaf) {
+        z->numKeys = order - 1;
+        for (int j = 0; j < order - 1; ++j) {
+            z->keys[j] = y->keys[j + order];
+            z->values[j] = y->values[j + order];
+        }
+        y->numKeys = order;
+        z->next = y->next;
+        y->next = z.get();
+        separator = z->keys[0];
+    } else {
+        z->numKeys = order - 1;
+        for (int j = 0; j < order - 1; ++j)
+            z->keys[j] = y->keys[j + order];
+        for (int j = 0; j < order; ++j)
+            z->children[j] = std::move(y->children[j + order]);
+        y->numKeys = order - 1;
+        separator = y->keys[order - 1];
+    }
+
+    for (int j = x->numKeys; j >= i + 1; --j)
+        x->children[j + 1] = std::move(x->children[j]);
+    x->children[i + 1] = std::move(z);
+
+    for (int j = x->numKeys - 1; j >= i; --j)
+        x->keys[j + 1] = x->keys[j];
+    x->keys[i] = separator;
+    ++x->numKeys;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::TryRemove(const TKey &key) {
+    bool removed = RemoveFromNode(root.get(), key);
+    if (removed)
+        --count;
+
+    if (root->numKeys == 0 && !root->isLeaf) {
+        UnqPtr<Node> child(std::move(root->children[0]));
+        root = std::move(child);
+    }
+
+    return removed;
+}
+
+// Top-down removal: before descending into a child with the minimum number of keys it
+// is refilled from a sibling or merged with one, so the leaf can always give up an entry.
+// Separators equal to a removed key are left in place; they still split the key space.
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::RemoveFromNode(Node *x, const TKey &key) {
+    if (x->isLeaf) {
+        int i = LeafIndex(x, key);
+        if (i == x->numKeys || !(x->keys[i] == key))
+            return false;
+
+        for (int j = i + 1; j < x->numKeys; ++j) {
+            x->keys[j - 1] = x->keys[j];
+            x->values[j - 1] = x->values[j];
+        }
+        --x->numKeys;
+        return true;
+    }
+
+    int i = ChildIndex(x, key);
+    if (x->children[i]->numKeys < order) {
+        Fill(x, i);
+        i = ChildIndex(x, key);
+    }
+
+    return RemoveFromNode(x->children[i].get(), key);
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::Fill(Node *x, int idx) {
+    if (idx != 0 && x->children[idx - 1]->numKeys >= order)
+        BorrowFromPrev(x, idx);
+    else if (idx != x->numKeys && x->children[idx + 1]->numKeys >= order)
+        BorrowFromNext(x, idx);
+    else if (idx != x->numKeys)
+        Merge(x, idx);
+    else
+        Merge(x, idx - 1);
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::BorrowFromPrev(Node *x, int idx) {
+    Node *child = x->children[idx].get();
+    Node *sibling = x->children[idx - 1].get();
+
+    for (int i = child->numKeys - 1; i >= 0; --i)
+        child->keys[i + 1] = child->keys[i];
+
+    if (child->isLeaf) {
+        for (int i = child->numKeys - 1; i >= 0; --i)
+            child->values[i + 1] = child->values[i];
+
+        child->keys[0] = sibling->keys[sibling->numKeys - 1];
+        child->values[0] = sibling->values[sibling->numKeys - 1];
+        x->keys[idx - 1] = child->keys[0];
+    } else {
+        for (int i = child->numKeys; i >= 0; --i)
+            child->children[i + 1] = std::move(child->children[i]);
+
+        child->keys[0] = x->keys[idx - 1];
+        child->children[0] = std::move(sibling->children[sibling->numKeys]);
+        x->keys[idx - 1] = sibling->keys[sibling->numKeys - 1];
+    }
+
+    ++child->numKeys;
+    --sibling->numKeys;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::BorrowFromNext(Node *x, int idx) {
+    Node *child = x->children[idx].get();
+    Node *sibling = x->children[idx + 1].get();
+
+    if (child->isLeaf) {
+        child->keys[child->numKeys] = sibling->keys[0];
+        child->values[child->numKeys] = sibling->values[0];
+
+        for (int i = 1; i < sibling->numKeys; ++i) {
+            sibling->keys[i - 1] = sibling->keys[i];
+            sibling->values[i - 1] = sibling->values[i];
+        }
+        x->keys[idx] = sibling->keys[0];
+    } else {
+        child->keys[child->numKeys] = x->keys[idx];
+        child->children[child->numKeys + 1] = std::move(sibling->children[0]);
+        x->keys[idx] = sibling->keys[0];
+
+        for (int i = 1; i < sibling->numKeys; ++i)
+            sibling->keys[i - 1] = sibling->keys[i];
+        for (int i = 1; i <= sibling->numKeys; ++i)
+            sibling->children[i - 1] = std::move(sibling->children[i]);
+    }
+
+    ++child->numKeys;
+    --sibling->numKeys;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::Merge(Node *x, int idx) {
+    Node *child = x->children[idx].get();
+    Node *sibling = x->children[idx + 1].get();
+
+    if (child->isLeaf) {
+        for (int i = 0; i < sibling->numKeys; ++i) {
+            child->keys[child->numKeys + i] = sibling->keys[i];
+            child->values[child->numKeys + i] = sibling->values[i];
+        }
+        child->numKeys += sibling->numKeys;
+        child->next = sibling->next;
+    } else {
+        child->keys[child->numKeys] = x->keys[idx];
+        for (int i = 0; i < sibling->numKeys; ++i)
+            child->keys[child->numKeys + 1 + i] = sibling->keys[i];
+        for (int i = 0; i <= sibling->numKeys; ++i)
+            child->children[child->numKeys + 1 + i] = std::move(sibling->children[i]);
+        child->numKeys += sibling->numKeys + 1;
+    }
+
+    for (int i = idx + 1; i < x->numKeys; ++i)
+        x->keys[i - 1] = x->keys[i];
+    for (int i = idx + 2; i <= x->numKeys; ++i)
+        x->children[i - 1] = std::move(x->children[i]);
+    x->children[x->numKeys].reset();
+    --x->numKeys;
+}
+
+template<typename TKey, typename TElement>
+BPlusTree<TKey, TElement>::BPlusTreeIterator::BPlusTreeIterator(const Node *startLeaf, int startIndex,
+                                                                const TKey *upperBound)
+        : startLeaf(startLeaf), startIndex(startIndex), hasUpperBound(upperBound != nullptr),
+          upperBound(upperBound ? *upperBound : TKey()), leaf(nullptr), index(0), started(false) {
+}
+
+template<typename TKey, typename TElement>
+bool BPlusTree<TKey, TElement>::BPlusTreeIterator::MoveNext() {
+    if (!started) {
+        leaf = startLeaf;
+        index = startIndex;
+        started = true;
+    } else if (leaf) {
+        ++index;
+    }
+
+    while (leaf && index >= leaf->numKeys) {
+        leaf = leaf->next;
+        index = 0;
+    }
+
+    if (leaf && hasUpperBound && !(leaf->keys[index] < upperBound))
+        leaf = nullptr;
+
+    return leaf != nullptr;
+}
+
+// Copies leaf runs along the leaf chain.
+template<typename TKey, typename TElement>
+size_t BPlusTree<TKey, TElement>::BPlusTreeIterator::NextBatch(TKey *keys, TElement *values, size_t capacity) {
+    if (capacity == 0)
+        return 0;
+
+    // Step to the first entry not yet returned.
+    if (!started) {
+        leaf = startLeaf;
+        index = startIndex;
+        started = true;
+    } else if (leaf) {
+        ++index;
+    }
+
+    size_t copied = 0;
+    while (leaf && copied < capacity) {
+        if (index >= leaf->numKeys) {
+            leaf = leaf->next;
+            index = 0;
+            continue;
+        }
+        if (hasUpperBound && !(leaf->keys[index] < upperBound)) {
+            leaf = nullptr;
+            break;
+        }
+        keys[copied] = leaf->keys[index];
+        values[copied] = leaf->values[index];
+        ++copied;
+        ++index;
+    }
+
+    // Leave the last copied entry current; a short batch means the iteration is over.
+    if (copied == capacity)
+        --index;
+    else
+        leaf = nullptr;
+    return copied;
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::BPlusTreeIterator::Reset() {
+    leaf = nullptr;
+    index = 0;
+    started = false;
+}
+
+template<typename TKey, typename TElement>
+TKey BPlusTree<TKey, TElement>::BPlusTreeIterator::GetCurrentKey() const {
+    if (!leaf)
+        throw std::out_of_range("Iterator out of range");
+    return leaf->keys[index];
+}
+
+template<typename TKey, typename TElement>
+TElement BPlusTree<TKey, TElement>::BPlusTreeIterator::GetCurrentValue() const {
+    if (!leaf)
+        throw std::out_of_range("Iterator out of range");
+    return leaf->values[index];
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BPlusTree<TKey, TElement>::GetIterator() const {
+    int index;
+    const Node *leaf = FindStart(nullptr, index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BPlusTreeIterator(leaf, index, nullptr));
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    VisitRange(visitor, nullptr, nullptr);
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BPlusTree<TKey, TElement>::GetPartIterator(int part, int parts) const {
+    TreePartBounds<TKey> bounds = GetTreePartBounds<TKey>(root.get(), part, parts);
+    int index;
+    const Node *leaf = FindStart(bounds.Lo(), index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BPlusTreeIterator(leaf, index, bounds.Hi()));
+}
+
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) {
+    TreePartBounds<TKey> bounds = GetTreePartBounds<TKey>(root.get(), part, parts);
+    VisitRange(visitor, bounds.Lo(), bounds.Hi());
+}
+
+// Leaf and position of the first key not less than lo, or of the smallest key.
+template<typename TKey, typename TElement>
+const typename BPlusTree<TKey, TElement>::Node *BPlusTree<TKey, TElement>::FindStart(const TKey *lo,
+                                                                                    int &index) const {
+    if (lo) {
+        const Node *leaf = FindLeaf(*lo);
+        index = LeafIndex(leaf, *lo);
+        return leaf;
+    }
+    const Node *x = root.get();
+    while (!x->isLeaf)
+        x = x->children[0].get();
+    index = 0;
+    return x;
+}
+
+// Walks the leaf chain over the keys in [lo, hi) (a null bound is open), handing out
+// pointers into the leaves' value arrays.
+template<typename TKey, typename TElement>
+void BPlusTree<TKey, TElement>::VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo, const TKey *hi) {
+    int index;
+    Node *leaf = const_cast<Node *>(FindStart(lo, index));
+
+    EntryBatch<TKey, TElement> batch(visitor);
+    for (; leaf; leaf = leaf->next, index = 0) {
+        for (; index < leaf->numKeys; ++index) {
+            if (hi && !(leaf->keys[index] < *hi)) {
+                batch.Flush();
+                return;
+            }
+            batch.Add(leaf->keys[index], &leaf->values[index]);
+        }
+    }
+    batch.Flush();
+}
+
+// Keys equal to the bound can only sit in the leaf FindLeaf reaches, so both bounds are
+// a position in that leaf; the iterator moves on to the next leaf if it is past the end.
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BPlusTree<TKey, TElement>::LowerBound(const TKey &key) const {
+    const Node *leaf = FindLeaf(key);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BPlusTreeIterator(leaf, LeafIndex(leaf, key), nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BPlusTree<TKey, TElement>::UpperBound(const TKey &key) const {
+    const Node *leaf = FindLeaf(key);
+    int index = KeySearch<TKey>::UpperBound(leaf->keys.get(), leaf->numKeys, key);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BPlusTreeIterator(leaf, index, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BPlusTree<TKey, TElement>::GetRange(const TKey &lo,
+                                                                               const TKey &hi) const {
+    const Node *leaf = FindLeaf(lo);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BPlusTreeIterator(leaf, LeafIndex(leaf, lo), &hi));
+}
+
+#endif // BPLUSTREE_H
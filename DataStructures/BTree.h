@@ -1,16 +1,24 @@
 #ifndef BTREE_H
 #define BTREE_H
 
-#include "IDictionary.h"
-#include "ShrdPtr.h"
-#include "DynamicArraySmart.h"
+#include "BTreeCore.h"
+#include "IOrderedDictionary.h"
 #include "UnqPtr.h"
+#include <climits>
 #include <stdexcept>
-
-template<typename TKey, typename TElement>
-class BTree : public IDictionary<TKey, TElement> {
+#include <utility>
+
+// Order == 0 selects the runtime order passed to the constructor, with each node's
+// keys, values and children in separate heap arrays. Order > 0 fixes the minimum degree
+// at compile time and stores those arrays inline, so a node is a single allocation with
+// the keys packed together ahead of the values.
+// Each node owns its children outright; every traversal, including the iterator,
+// walks the tree through plain borrowed Node pointers. The insert, delete, visit and
+// iterator algorithms are BTreeCore's.
+template<typename TKey, typename TElement, int Order = 0>
+class BTree : public IOrderedDictionary<TKey, TElement> {
 public:
-    BTree(int order = 3);
+    BTree(int order = Order > 0 ? Order : 3);
 
     virtual ~BTree();
 
@@ -28,506 +36,337 @@ public:
 
     virtual void Update(const TKey &key, const TElement &element) override;
 
-    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
 
-private:
-    struct Node {
-        bool isLeaf;
-        int numKeys;
-        UnqPtr<TKey[]> keys;
-        UnqPtr<TElement[]> values;
-        UnqPtr<ShrdPtr<Node>[]> children;
+    virtual TElement *FindPtr(const TKey &key) override;
 
-        Node(bool leaf, int order);
-    };
+    virtual const TElement *FindPtr(const TKey &key) const override;
 
-    ShrdPtr<Node> root;
-    int order;
-    size_t count;
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
 
-    void SplitChild(ShrdPtr<Node> x, int i);
+    virtual TElement &GetOrAdd(const TKey &key) override;
 
-    void InsertNonFull(ShrdPtr<Node> x, const TKey &key, const TElement &value);
+    virtual bool TryRemove(const TKey &key) override;
 
-    TElement Search(ShrdPtr<Node> x, const TKey &key) const;
+    virtual void BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) override;
 
-    bool Contains(ShrdPtr<Node> x, const TKey &key) const;
+    // Builds an empty tree bottom-up from strictly increasing keys; a non-empty tree just
+    // upserts them. Nodes are filled to about fillFactor of their capacity (never below
+    // the minimum degree), so a factor under 1 leaves room for later inserts.
+    void BulkLoad(const KeyValue<TKey, TElement> *items, size_t count, double fillFactor);
 
-    void RemoveFromNode(ShrdPtr<Node> x, const TKey &key);
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
 
-    void RemoveFromLeaf(ShrdPtr<Node> x, int idx);
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
 
-    void RemoveFromNonLeaf(ShrdPtr<Node> x, int idx);
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
 
-    TKey GetPredecessor(ShrdPtr<Node> x, int idx);
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
 
-    TKey GetSuccessor(ShrdPtr<Node> x, int idx);
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
 
-    void Fill(ShrdPtr<Node> x, int idx);
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
 
-    void BorrowFromPrev(ShrdPtr<Node> x, int idx);
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
 
-    void BorrowFromNext(ShrdPtr<Node> x, int idx);
+private:
+    struct Node;
 
-    void Merge(ShrdPtr<Node> x, int idx);
+    struct NodeHeader {
+        bool isLeaf;
+        int numKeys;
+    };
 
-    class BTreeIterator : public IDictionaryIterator<TKey, TElement> {
-    public:
-        BTreeIterator(const BTree *tree);
+    template<int NodeOrder, typename Dummy = void>
+    struct NodeStorage {
+        TKey keys[2 * NodeOrder - 1];
+        TElement values[2 * NodeOrder - 1];
+        UnqPtr<Node> children[2 * NodeOrder];
 
-        virtual ~BTreeIterator() {}
+        explicit NodeStorage(int) {}
+    };
 
-        virtual bool MoveNext() override;
+    template<typename Dummy>
+    struct NodeStorage<0, Dummy> {
+        UnqPtr<TKey[]> keys;
+        UnqPtr<TElement[]> values;
+        UnqPtr<UnqPtr<Node>[]> children;
 
-        virtual void Reset() override;
+        explicit NodeStorage(int order)
+                : keys(new TKey[2 * order - 1]), values(new TElement[2 * order - 1]),
+                  children(new UnqPtr<Node>[2 * order]) {}
+    };
 
-        virtual TKey GetCurrentKey() const override;
+    struct Node : NodeHeader, NodeStorage<Order> {
+        Node(bool leaf, int order);
+    };
 
-        virtual TElement GetCurrentValue() const override;
+    // Nodes are owned by their one parent, so any node may be changed in place.
+    struct Links {
+        typedef UnqPtr<Node> Link;
 
-    private:
-        const BTree *tree;
-        struct StackNode {
-            ShrdPtr<Node> node;
-            int index;
-        };
-        DynamicArraySmart<StackNode> stack;
-        TKey currentKey;
-        TElement currentValue;
-        bool hasCurrent;
+        static Link NewNode(bool leaf, int order) {
+            return Link(new Node(leaf, order));
+        }
 
-        void PushLeftmost(ShrdPtr<Node> node);
+        static Node *Own(Link &slot) {
+            return slot.get();
+        }
     };
 
+    typedef BTreeCore<TKey, TElement, Node, Links> Core;
+    typedef typename Core::template Iterator<const UnqPtr<Node> &> BTreeIterator;
+
+    UnqPtr<Node> root;
+    int order;
+    size_t count;
+
+    UnqPtr<Node> BuildNode(const KeyValue<TKey, TElement> *items, int numKeys, UnqPtr<Node> *children);
+
     friend class BTreeTest;
 };
 
-template<typename TKey, typename TElement>
-BTree<TKey, TElement>::Node::Node(bool leaf, int order)
-        : isLeaf(leaf), numKeys(0), keys(new TKey[2 * order - 1]), values(new TElement[2 * order - 1]),
-          children(new ShrdPtr<Node>[2 * order]) {
+template<typename TKey, typename TElement, int Order>
+BTree<TKey, TElement, Order>::Node::Node(bool leaf, int order)
+        : NodeHeader{leaf, 0}, NodeStorage<Order>(order) {
 }
 
-template<typename TKey, typename TElement>
-BTree<TKey, TElement>::BTree(int order)
+template<typename TKey, typename TElement, int Order>
+BTree<TKey, TElement, Order>::BTree(int order)
         : root(new Node(true, order)), order(order), count(0) {
+    if (Order > 0 && order != Order)
+        throw std::invalid_argument("BTree order does not match the compile-time node order.");
 }
 
-template<typename TKey, typename TElement>
-BTree<TKey, TElement>::~BTree() {
+template<typename TKey, typename TElement, int Order>
+BTree<TKey, TElement, Order>::~BTree() {
 }
 
-template<typename TKey, typename TElement>
-size_t BTree<TKey, TElement>::GetCount() const {
+template<typename TKey, typename TElement, int Order>
+size_t BTree<TKey, TElement, Order>::GetCount() const {
     return count;
 }
 
-template<typename TKey, typename TElement>
-size_t BTree<TKey, TElement>::GetCapacity() const {
+template<typename TKey, typename TElement, int Order>
+size_t BTree<TKey, TElement, Order>::GetCapacity() const {
     return count;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::Add(const TKey &key, const TElement &element) {
-    if (ContainsKey(key)) {
-        Update(key, element);
-        return;
-    }
-
-    if (root->numKeys == 2 * order - 1) {
-        ShrdPtr<Node> s(new Node(false, order));
-        s->children[0] = root;
-        SplitChild(s, 0);
-        root = s;
-    }
-
-    InsertNonFull(root, key, element);
-    ++count;
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::InsertNonFull(ShrdPtr<Node> x, const TKey &key, const TElement &value) {
-    int i = x->numKeys - 1;
+template<typename TKey, typename TElement, int Order>
+bool BTree<TKey, TElement, Order>::Upsert(const TKey &key, const TElement &element) {
+    bool inserted;
+    *Core::FindOrInsert(root, order, key, inserted) = element;
+    if (inserted)
+        ++count;
+    return inserted;
+}
 
-    if (x->isLeaf) {
-        while (i >= 0 && key < x->keys[i]) {
-            x->keys[i + 1] = x->keys[i];
-            x->values[i + 1] = x->values[i];
-            --i;
-        }
-        x->keys[i + 1] = key;
-        x->values[i + 1] = value;
-        ++x->numKeys;
-    } else {
-        while (i >= 0 && key < x->keys[i])
-            --i;
-        ++i;
-        if (x->children[i]->numKeys == 2 * order - 1) {
-            SplitChild(x, i);
-            if (key > x->keys[i])
-                ++i;
-        }
-        InsertNonFull(x->children[i], key, value);
-    }
+template<typename TKey, typename TElement, int Order>
+TElement &BTree<TKey, TElement, Order>::GetOrAdd(const TKey &key) {
+    bool inserted;
+    TElement *value = Core::FindOrInsert(root, order, key, inserted);
+    if (inserted)
+        ++count;
+    return *value;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::SplitChild(ShrdPtr<Node> x, int i) {
-    ShrdPtr<Node> y = x->children[i];
-    ShrdPtr<Node> z(new Node(y->isLeaf, order));
-    z->numKeys = order - 1;
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) {
+    BulkLoad(items, count, 1.0);
+}
 
-    for (int j = 0; j < order - 1; ++j) {
-        z->keys[j] = y->keys[j + order];
-        z->values[j] = y->values[j + order];
+// Each level is cut into runs of keys separated by single keys that move up a level:
+// a level of S keys split into G nodes yields G - 1 separators, and those separators
+// are the keys of the next level, whose nodes adopt the G nodes as children in order.
+// G is chosen near the fill target but kept where every node gets order - 1 to
+// 2 * order - 1 keys, and the first level that fits in one node becomes the root.
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::BulkLoad(const KeyValue<TKey, TElement> *items, size_t count, double fillFactor) {
+    if (this->count != 0) {
+        for (size_t i = 0; i < count; ++i)
+            Upsert(items[i].key, items[i].value);
+        return;
     }
 
-    if (!y->isLeaf) {
-        for (int j = 0; j < order; ++j)
-            z->children[j] = y->children[j + order];
+    for (size_t i = 1; i < count; ++i) {
+        if (!(items[i - 1].key < items[i].key))
+            throw std::invalid_argument("BulkLoad requires strictly increasing keys.");
     }
+    if (count == 0)
+        return;
 
-    y->numKeys = order - 1;
-
-    for (int j = x->numKeys; j >= i + 1; --j)
-        x->children[j + 1] = x->children[j];
-    x->children[i + 1] = z;
+    const size_t degree = static_cast<size_t>(order);
+    const size_t maxKeys = 2 * degree - 1;
+    size_t target = static_cast<size_t>(fillFactor * maxKeys + 0.5);
+    if (target < degree - 1)
+        target = degree - 1;
+    if (target > maxKeys)
+        target = maxKeys;
+    if (target == 0)
+        target = 1;
+
+    const KeyValue<TKey, TElement> *levelItems = items;
+    size_t levelCount = count;
+    UnqPtr<KeyValue<TKey, TElement>[]> separators;
+    UnqPtr<UnqPtr<Node>[]> children;
+
+    while (levelCount > maxKeys) {
+        size_t slots = levelCount + 1;
+        size_t groups = (slots + target) / (target + 1);
+        if (groups < (slots + 2 * degree - 1) / (2 * degree))
+            groups = (slots + 2 * degree - 1) / (2 * degree);
+        if (groups > slots / degree)
+            groups = slots / degree;
+
+        if (groups > static_cast<size_t>(INT_MAX))
+            throw std::length_error("Too many entries for BTree bulk load.");
+
+        size_t nodeKeys = levelCount - (groups - 1);
+        UnqPtr<UnqPtr<Node>[]> nodes(new UnqPtr<Node>[groups]);
+        UnqPtr<KeyValue<TKey, TElement>[]> upper(new KeyValue<TKey, TElement>[groups - 1]);
+
+        size_t position = 0;
+        size_t child = 0;
+        for (size_t g = 0; g < groups; ++g) {
+            int numKeys = static_cast<int>(nodeKeys / groups + (g < nodeKeys % groups ? 1 : 0));
+            nodes[g] = BuildNode(levelItems + position, numKeys, children ? &children[child] : nullptr);
+            position += numKeys;
+            child += numKeys + 1;
+            if (g + 1 < groups)
+                upper[g] = levelItems[position++];
+        }
 
-    for (int j = x->numKeys - 1; j >= i; --j) {
-        x->keys[j + 1] = x->keys[j];
-        x->values[j + 1] = x->values[j];
+        separators = std::move(upper);
+        children = std::move(nodes);
+        levelItems = separators.get();
+        levelCount = groups - 1;
     }
-    x->keys[i] = y->keys[order - 1];
-    x->values[i] = y->values[order - 1];
-    ++x->numKeys;
-}
-
-template<typename TKey, typename TElement>
-TElement BTree<TKey, TElement>::Get(const TKey &key) const {
-    return Search(root, key);
-}
-
-template<typename TKey, typename TElement>
-TElement BTree<TKey, TElement>::Search(ShrdPtr<Node> x, const TKey &key) const {
-    int i = 0;
-    while (i < x->numKeys && key > x->keys[i])
-        ++i;
-
-    if (i < x->numKeys && key == x->keys[i])
-        return x->values[i];
 
-    if (x->isLeaf)
-        throw std::runtime_error("Key not found.");
-    else
-        return Search(x->children[i], key);
+    root = BuildNode(levelItems, static_cast<int>(levelCount), children ? &children[0] : nullptr);
+    this->count = count;
 }
 
-template<typename TKey, typename TElement>
-bool BTree<TKey, TElement>::ContainsKey(const TKey &key) const {
-    try {
-        Search(root, key);
-        return true;
+// Makes a node from consecutive entries; children, when given, are taken over in order.
+template<typename TKey, typename TElement, int Order>
+UnqPtr<typename BTree<TKey, TElement, Order>::Node>
+BTree<TKey, TElement, Order>::BuildNode(const KeyValue<TKey, TElement> *items, int numKeys, UnqPtr<Node> *children) {
+    UnqPtr<Node> node(new Node(children == nullptr, order));
+    for (int i = 0; i < numKeys; ++i) {
+        node->keys[i] = items[i].key;
+        node->values[i] = items[i].value;
     }
-    catch (const std::runtime_error &) {
-        return false;
+    if (children) {
+        for (int i = 0; i <= numKeys; ++i)
+            node->children[i] = std::move(children[i]);
     }
+    node->numKeys = numKeys;
+    return node;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::Update(const TKey &key, const TElement &element) {
-    ShrdPtr<Node> x = root;
-    while (true) {
-        int i = 0;
-        while (i < x->numKeys && key > x->keys[i])
-            ++i;
-
-        if (i < x->numKeys && key == x->keys[i]) {
-            x->values[i] = element;
-            return;
-        }
-
-        if (x->isLeaf)
-            throw std::runtime_error("Key not found.");
-
-        x = x->children[i];
-    }
-}
-
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::Remove(const TKey &key) {
-    if (!ContainsKey(key))
+template<typename TKey, typename TElement, int Order>
+TElement BTree<TKey, TElement, Order>::Get(const TKey &key) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
         throw std::runtime_error("Key not found.");
-
-    RemoveFromNode(root, key);
-    --count;
-
-    if (root->numKeys == 0) {
-        if (root->isLeaf) {
-            root.reset(new Node(true, order));
-        } else {
-            root = root->children[0];
-        }
-    }
+    return *value;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::RemoveFromNode(ShrdPtr<Node> x, const TKey &key) {
-    int idx = 0;
-    while (idx < x->numKeys && x->keys[idx] < key)
-        ++idx;
-
-    if (idx < x->numKeys && x->keys[idx] == key) {
-        if (x->isLeaf)
-            RemoveFromLeaf(x, idx);
-        else
-            RemoveFromNonLeaf(x, idx);
-    } else {
-        if (x->isLeaf)
-            throw std::runtime_error("Key not found.");
-
-        bool flag = ((idx == x->numKeys));
-
-        if (x->children[idx]->numKeys < order)
-            Fill(x, idx);
-
-        if (flag && idx > x->numKeys)
-            RemoveFromNode(x->children[idx - 1], key);
-        else
-            RemoveFromNode(x->children[idx], key);
-    }
+template<typename TKey, typename TElement, int Order>
+const TElement *BTree<TKey, TElement, Order>::FindPtr(const TKey &key) const {
+    int index;
+    const Node *x = Core::Search(root.get(), key, index);
+    return x ? &x->values[index] : nullptr;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::RemoveFromLeaf(ShrdPtr<Node> x, int idx) {
-    for (int i = idx + 1; i < x->numKeys; ++i) {
-        x->keys[i - 1] = x->keys[i];
-        x->values[i - 1] = x->values[i];
-    }
-    --x->numKeys;
+template<typename TKey, typename TElement, int Order>
+TElement *BTree<TKey, TElement, Order>::FindPtr(const TKey &key) {
+    return const_cast<TElement *>(static_cast<const BTree *>(this)->FindPtr(key));
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::RemoveFromNonLeaf(ShrdPtr<Node> x, int idx) {
-    TKey k = x->keys[idx];
-
-    if (x->children[idx]->numKeys >= order) {
-        TKey predKey = GetPredecessor(x, idx);
-        TElement predValue = x->values[idx];
-        x->keys[idx] = predKey;
-        x->values[idx] = predValue;
-        RemoveFromNode(x->children[idx], predKey);
-    } else if (x->children[idx + 1]->numKeys >= order) {
-        TKey succKey = GetSuccessor(x, idx);
-        TElement succValue = x->values[idx];
-        x->keys[idx] = succKey;
-        x->values[idx] = succValue;
-        RemoveFromNode(x->children[idx + 1], succKey);
-    } else {
-        Merge(x, idx);
-        RemoveFromNode(x->children[idx], k);
-    }
-}
-
-template<typename TKey, typename TElement>
-TKey BTree<TKey, TElement>::GetPredecessor(ShrdPtr<Node> x, int idx) {
-    ShrdPtr<Node> cur = x->children[idx];
-    while (!cur->isLeaf)
-        cur = cur->children[cur->numKeys];
-    return cur->keys[cur->numKeys - 1];
-}
+template<typename TKey, typename TElement, int Order>
+bool BTree<TKey, TElement, Order>::TryGet(const TKey &key, TElement &element) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        return false;
 
-template<typename TKey, typename TElement>
-TKey BTree<TKey, TElement>::GetSuccessor(ShrdPtr<Node> x, int idx) {
-    ShrdPtr<Node> cur = x->children[idx + 1];
-    while (!cur->isLeaf)
-        cur = cur->children[0];
-    return cur->keys[0];
+    element = *value;
+    return true;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::Fill(ShrdPtr<Node> x, int idx) {
-    if (idx != 0 && x->children[idx - 1]->numKeys >= order)
-        BorrowFromPrev(x, idx);
-    else if (idx != x->numKeys && x->children[idx + 1]->numKeys >= order)
-        BorrowFromNext(x, idx);
-    else {
-        if (idx != x->numKeys)
-            Merge(x, idx);
-        else
-            Merge(x, idx - 1);
-    }
+template<typename TKey, typename TElement, int Order>
+bool BTree<TKey, TElement, Order>::ContainsKey(const TKey &key) const {
+    return FindPtr(key) != nullptr;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::BorrowFromPrev(ShrdPtr<Node> x, int idx) {
-    ShrdPtr<Node> child = x->children[idx];
-    ShrdPtr<Node> sibling = x->children[idx - 1];
-
-    for (int i = child->numKeys - 1; i >= 0; --i) {
-        child->keys[i + 1] = child->keys[i];
-        child->values[i + 1] = child->values[i];
-    }
-
-    if (!child->isLeaf) {
-        for (int i = child->numKeys; i >= 0; --i)
-            child->children[i + 1] = child->children[i];
-    }
-
-    child->keys[0] = x->keys[idx - 1];
-    child->values[0] = x->values[idx - 1];
-
-    if (!child->isLeaf)
-        child->children[0] = sibling->children[sibling->numKeys];
-
-    x->keys[idx - 1] = sibling->keys[sibling->numKeys - 1];
-    x->values[idx - 1] = sibling->values[sibling->numKeys - 1];
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::Update(const TKey &key, const TElement &element) {
+    TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
 
-    ++child->numKeys;
-    --sibling->numKeys;
+    *value = element;
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::BorrowFromNext(ShrdPtr<Node> x, int idx) {
-    ShrdPtr<Node> child = x->children[idx];
-    ShrdPtr<Node> sibling = x->children[idx + 1];
-
-    child->keys[child->numKeys] = x->keys[idx];
-    child->values[child->numKeys] = x->values[idx];
-
-    if (!child->isLeaf)
-        child->children[child->numKeys + 1] = sibling->children[0];
-
-    x->keys[idx] = sibling->keys[0];
-    x->values[idx] = sibling->values[0];
-
-    for (int i = 1; i < sibling->numKeys; ++i) {
-        sibling->keys[i - 1] = sibling->keys[i];
-        sibling->values[i - 1] = sibling->values[i];
-    }
-
-    if (!sibling->isLeaf) {
-        for (int i = 1; i <= sibling->numKeys; ++i)
-            sibling->children[i - 1] = sibling->children[i];
-    }
-
-    ++child->numKeys;
-    --sibling->numKeys;
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::Merge(ShrdPtr<Node> x, int idx) {
-    ShrdPtr<Node> child = x->children[idx];
-    ShrdPtr<Node> sibling = x->children[idx + 1];
-
-    child->keys[order - 1] = x->keys[idx];
-    child->values[order - 1] = x->values[idx];
-
-    for (int i = 0; i < sibling->numKeys; ++i) {
-        child->keys[i + order] = sibling->keys[i];
-        child->values[i + order] = sibling->values[i];
-    }
-
-    if (!child->isLeaf) {
-        for (int i = 0; i <= sibling->numKeys; ++i)
-            child->children[i + order] = sibling->children[i];
-    }
-
-    for (int i = idx + 1; i < x->numKeys; ++i) {
-        x->keys[i - 1] = x->keys[i];
-        x->values[i - 1] = x->values[i];
-    }
-
-    for (int i = idx + 2; i <= x->numKeys; ++i)
-        x->children[i - 1] = x->children[i];
-
-    child->numKeys += sibling->numKeys + 1;
-    --x->numKeys;
-    sibling.reset();
+template<typename TKey, typename TElement, int Order>
+bool BTree<TKey, TElement, Order>::TryRemove(const TKey &key) {
+    bool removed = Core::Remove(root, order, key);
+    if (removed)
+        --count;
+    return removed;
 }
 
-template<typename TKey, typename TElement>
-BTree<TKey, TElement>::BTreeIterator::BTreeIterator(const BTree *tree)
-        : tree(tree), hasCurrent(false) {
-    Reset();
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement, Order>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(root));
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::BTreeIterator::Reset() {
-    stack = DynamicArraySmart<StackNode>();
-    hasCurrent = false;
-    if (tree->root) {
-        PushLeftmost(tree->root);
-    }
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement, Order>::LowerBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(root, &key, true));
 }
 
-template<typename TKey, typename TElement>
-void BTree<TKey, TElement>::BTreeIterator::PushLeftmost(ShrdPtr<Node> node) {
-    while (node && node->numKeys > 0) {
-        StackNode sn = {node, 0};
-        stack.Append(sn);
-        if (node->isLeaf)
-            break;
-        else
-            node = node->children[0];
-    }
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement, Order>::UpperBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(root, &key, false));
 }
 
-template<typename TKey, typename TElement>
-bool BTree<TKey, TElement>::BTreeIterator::MoveNext() {
-    while (stack.GetLength() > 0) {
-        StackNode &top = stack[stack.GetLength() - 1];
-
-        if (top.index < top.node->numKeys) {
-            if (top.node->numKeys == 0) {
-                stack.RemoveAt(stack.GetLength() - 1);
-                continue;
-            }
-
-            currentKey = top.node->keys[top.index];
-            currentValue = top.node->values[top.index];
-            hasCurrent = true;
-
-            if (!top.node->isLeaf) {
-                if (top.index + 1 <= top.node->numKeys) {
-                    ShrdPtr<Node> child = top.node->children[top.index + 1];
-                    ++top.index;
-                    PushLeftmost(child);
-                } else {
-                    ++top.index;
-                }
-            } else {
-                ++top.index;
-            }
-
-            return true;
-        } else {
-            stack.RemoveAt(stack.GetLength() - 1);
-        }
-    }
-
-    hasCurrent = false;
-    return false;
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement, Order>::GetRange(const TKey &lo,
+                                                                                  const TKey &hi) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(root, &lo, true, &hi));
 }
 
-
-template<typename TKey, typename TElement>
-TKey BTree<TKey, TElement>::BTreeIterator::GetCurrentKey() const {
-    if (!hasCurrent)
-        throw std::out_of_range("Iterator out of range");
-    return currentKey;
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    EntryBatch<TKey, TElement> batch(visitor);
+    Core::VisitRange(root.get(), nullptr, nullptr, batch);
+    batch.Flush();
 }
 
-template<typename TKey, typename TElement>
-TElement BTree<TKey, TElement>::BTreeIterator::GetCurrentValue() const {
-    if (!hasCurrent)
-        throw std::out_of_range("Iterator out of range");
-    return currentValue;
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement, Order>::GetPartIterator(int part,
+                                                                                        int parts) const {
+    TreePartBounds<TKey> bounds = GetTreePartBounds<TKey>(root.get(), part, parts);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(root, bounds.Lo(), true, bounds.Hi()));
 }
 
-
-template<typename TKey, typename TElement>
-UnqPtr<IDictionaryIterator<TKey, TElement>> BTree<TKey, TElement>::GetIterator() const {
-    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new BTreeIterator(this));
+template<typename TKey, typename TElement, int Order>
+void BTree<TKey, TElement, Order>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) {
+    TreePartBounds<TKey> bounds = GetTreePartBounds<TKey>(root.get(), part, parts);
+    EntryBatch<TKey, TElement> batch(visitor);
+    Core::VisitRange(root.get(), bounds.Lo(), bounds.Hi(), batch);
+    batch.Flush();
 }
 
 #endif // BTREE_H
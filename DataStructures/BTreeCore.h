@@ -0,0 +1,553 @@
+#ifndef BTREECORE_H
+#define BTREECORE_H
+
+#include "IDictionary.h"
+#include "IDictionaryIterator.h"
+#include "KeySearch.h"
+#include "DynamicArraySmart.h"
+#include <stdexcept>
+#include <utility>
+
+// The B-tree algorithms of BTree and PersistentBTree, written once against a node type and
+// a link policy, so the two trees differ only in how they hold their nodes. A node has
+// isLeaf, numKeys and keys, values and children arrays sized for the minimum degree
+// `order`. TLinks supplies
+//
+//   Link                           what children[] and the root hold; links move with
+//                                  std::move, which leaves the source empty;
+//   Link NewNode(bool leaf, int order);
+//   TNode *Own(Link &slot);        the node in the slot, made safe to change.
+//
+// Every node is owned through its slot before it is changed, and a node that is only read
+// is reached with get(), so a policy whose Own copies shared nodes turns every write into
+// a copy-on-write of the nodes it touches.
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+class BTreeCore {
+public:
+    typedef typename TLinks::Link Link;
+
+    // Single top-down pass: full nodes are split on the way down, as in the classic
+    // insertion, and the descent stops early if the key is met in any node. A split
+    // performed before the key turns out to exist leaves a valid tree, so it is harmless.
+    static TElement *FindOrInsert(Link &root, int order, const TKey &key, bool &inserted);
+
+    // Returns the node holding the key and its position there, or nullptr on a miss.
+    // Misses are the common case for sparse containers, so they are reported through
+    // the return value rather than an exception.
+    static const TNode *Search(const TNode *root, const TKey &key, int &index);
+
+    // Removes the key in one top-down pass that refills every child it descends into.
+    static bool Remove(Link &root, int order, const TKey &key);
+
+    // In-order walk over the keys in [lo, hi) (a null bound is open) handing out pointers
+    // into the nodes' value arrays. Subtrees below lo are skipped; returns false once hi
+    // is reached.
+    static bool VisitRange(TNode *x, const TKey *lo, const TKey *hi, EntryBatch<TKey, TElement> &batch);
+
+    // Without a start key the iteration begins at the smallest key, otherwise at the first
+    // key not less than it (inclusive) or greater than it. With an upper bound it stops
+    // before the first key that is not less than the bound. TRoot is how the iterator
+    // reaches the root: a reference to the tree's root link, read again on every Reset,
+    // or a link of its own that keeps one version of the tree alive.
+    template<typename TRoot>
+    class Iterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        Iterator(TRoot root, const TKey *start = nullptr, bool inclusive = true, const TKey *upperBound = nullptr);
+
+        virtual ~Iterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        TRoot root;
+        bool hasStart;
+        TKey start;
+        bool inclusive;
+        bool hasUpperBound;
+        TKey upperBound;
+        struct StackNode {
+            const TNode *node;
+            int index;
+        };
+        DynamicArraySmart<StackNode> stack;
+        TKey currentKey;
+        TElement currentValue;
+        bool hasCurrent;
+
+        void PushLeftmost(const TNode *node);
+
+        void Seek(const TNode *node);
+    };
+
+private:
+    static TNode *Own(Link &slot) {
+        return TLinks::Own(slot);
+    }
+
+    static void SplitChild(TNode *x, int i, int order);
+
+    static bool RemoveFromNode(TNode *x, int order, const TKey &key);
+
+    static void RemoveFromLeaf(TNode *x, int idx);
+
+    static void RemoveFromNonLeaf(TNode *x, int order, int idx);
+
+    static TKey GetPredecessor(const TNode *x, int idx, TElement &value);
+
+    static TKey GetSuccessor(const TNode *x, int idx, TElement &value);
+
+    static void Fill(TNode *x, int order, int idx);
+
+    static void BorrowFromPrev(TNode *x, int idx);
+
+    static void BorrowFromNext(TNode *x, int idx);
+
+    static void Merge(TNode *x, int order, int idx);
+};
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+TElement *BTreeCore<TKey, TElement, TNode, TLinks>::FindOrInsert(Link &root, int order, const TKey &key,
+                                                                 bool &inserted) {
+    TNode *x = Own(root);
+    if (x->numKeys == 2 * order - 1) {
+        Link s = TLinks::NewNode(false, order);
+        s->children[0] = std::move(root);
+        root = std::move(s);
+        x = root.get();
+        SplitChild(x, 0, order);
+    }
+
+    while (true) {
+        int i = KeySearch<TKey>::LowerBound(&x->keys[0], x->numKeys, key);
+
+        if (i < x->numKeys && key == x->keys[i]) {
+            inserted = false;
+            return &x->values[i];
+        }
+
+        if (x->isLeaf) {
+            for (int j = x->numKeys; j > i; --j) {
+                x->keys[j] = x->keys[j - 1];
+                x->values[j] = x->values[j - 1];
+            }
+            x->keys[i] = key;
+            x->values[i] = TElement();
+            ++x->numKeys;
+            inserted = true;
+            return &x->values[i];
+        }
+
+        if (x->children[i]->numKeys == 2 * order - 1) {
+            SplitChild(x, i, order);
+            if (key == x->keys[i]) {
+                inserted = false;
+                return &x->values[i];
+            }
+            if (key > x->keys[i])
+                ++i;
+        }
+
+        x = Own(x->children[i]);
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::SplitChild(TNode *x, int i, int order) {
+    TNode *y = Own(x->children[i]);
+    Link z = TLinks::NewNode(y->isLeaf, order);
+    z->numKeys = order - 1;
+
+    for (int j = 0; j < order - 1; ++j) {
+        z->keys[j] = y->keys[j + order];
+        z->values[j] = y->values[j + order];
+    }
+
+    if (!y->isLeaf) {
+        for (int j = 0; j < order; ++j)
+            z->children[j] = std::move(y->children[j + order]);
+    }
+
+    y->numKeys = order - 1;
+
+    for (int j = x->numKeys; j >= i + 1; --j)
+        x->children[j + 1] = std::move(x->children[j]);
+    x->children[i + 1] = std::move(z);
+
+    for (int j = x->numKeys - 1; j >= i; --j) {
+        x->keys[j + 1] = x->keys[j];
+        x->values[j + 1] = x->values[j];
+    }
+    x->keys[i] = y->keys[order - 1];
+    x->values[i] = y->values[order - 1];
+    ++x->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+const TNode *BTreeCore<TKey, TElement, TNode, TLinks>::Search(const TNode *root, const TKey &key, int &index) {
+    const TNode *x = root;
+    while (true) {
+        int i = KeySearch<TKey>::LowerBound(&x->keys[0], x->numKeys, key);
+
+        if (i < x->numKeys && key == x->keys[i]) {
+            index = i;
+            return x;
+        }
+
+        if (x->isLeaf)
+            return nullptr;
+
+        x = x->children[i].get();
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+bool BTreeCore<TKey, TElement, TNode, TLinks>::Remove(Link &root, int order, const TKey &key) {
+    bool removed = RemoveFromNode(Own(root), order, key);
+
+    // Rebalancing on the way down may empty the root even when the key is missing.
+    if (root->numKeys == 0 && !root->isLeaf) {
+        // Detach the child first: assigning it directly would destroy it with the old root.
+        Link child(std::move(root->children[0]));
+        root = std::move(child);
+    }
+
+    return removed;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+bool BTreeCore<TKey, TElement, TNode, TLinks>::RemoveFromNode(TNode *x, int order, const TKey &key) {
+    int idx = KeySearch<TKey>::LowerBound(&x->keys[0], x->numKeys, key);
+
+    if (idx < x->numKeys && x->keys[idx] == key) {
+        if (x->isLeaf)
+            RemoveFromLeaf(x, idx);
+        else
+            RemoveFromNonLeaf(x, order, idx);
+        return true;
+    }
+
+    if (x->isLeaf)
+        return false;
+
+    bool flag = ((idx == x->numKeys));
+
+    if (x->children[idx]->numKeys < order)
+        Fill(x, order, idx);
+
+    if (flag && idx > x->numKeys)
+        return RemoveFromNode(Own(x->children[idx - 1]), order, key);
+    else
+        return RemoveFromNode(Own(x->children[idx]), order, key);
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::RemoveFromLeaf(TNode *x, int idx) {
+    for (int i = idx + 1; i < x->numKeys; ++i) {
+        x->keys[i - 1] = x->keys[i];
+        x->values[i - 1] = x->values[i];
+    }
+    --x->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::RemoveFromNonLeaf(TNode *x, int order, int idx) {
+    TKey k = x->keys[idx];
+
+    if (x->children[idx]->numKeys >= order) {
+        TElement predValue;
+        TKey predKey = GetPredecessor(x, idx, predValue);
+        x->keys[idx] = predKey;
+        x->values[idx] = predValue;
+        RemoveFromNode(Own(x->children[idx]), order, predKey);
+    } else if (x->children[idx + 1]->numKeys >= order) {
+        TElement succValue;
+        TKey succKey = GetSuccessor(x, idx, succValue);
+        x->keys[idx] = succKey;
+        x->values[idx] = succValue;
+        RemoveFromNode(Own(x->children[idx + 1]), order, succKey);
+    } else {
+        Merge(x, order, idx);
+        RemoveFromNode(Own(x->children[idx]), order, k);
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+TKey BTreeCore<TKey, TElement, TNode, TLinks>::GetPredecessor(const TNode *x, int idx, TElement &value) {
+    const TNode *cur = x->children[idx].get();
+    while (!cur->isLeaf)
+        cur = cur->children[cur->numKeys].get();
+    value = cur->values[cur->numKeys - 1];
+    return cur->keys[cur->numKeys - 1];
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+TKey BTreeCore<TKey, TElement, TNode, TLinks>::GetSuccessor(const TNode *x, int idx, TElement &value) {
+    const TNode *cur = x->children[idx + 1].get();
+    while (!cur->isLeaf)
+        cur = cur->children[0].get();
+    value = cur->values[0];
+    return cur->keys[0];
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::Fill(TNode *x, int order, int idx) {
+    if (idx != 0 && x->children[idx - 1]->numKeys >= order)
+        BorrowFromPrev(x, idx);
+    else if (idx != x->numKeys && x->children[idx + 1]->numKeys >= order)
+        BorrowFromNext(x, idx);
+    else {
+        if (idx != x->numKeys)
+            Merge(x, order, idx);
+        else
+            Merge(x, order, idx - 1);
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::BorrowFromPrev(TNode *x, int idx) {
+    TNode *child = Own(x->children[idx]);
+    TNode *sibling = Own(x->children[idx - 1]);
+
+    for (int i = child->numKeys - 1; i >= 0; --i) {
+        child->keys[i + 1] = child->keys[i];
+        child->values[i + 1] = child->values[i];
+    }
+
+    if (!child->isLeaf) {
+        for (int i = child->numKeys; i >= 0; --i)
+            child->children[i + 1] = std::move(child->children[i]);
+    }
+
+    child->keys[0] = x->keys[idx - 1];
+    child->values[0] = x->values[idx - 1];
+
+    if (!child->isLeaf)
+        child->children[0] = std::move(sibling->children[sibling->numKeys]);
+
+    x->keys[idx - 1] = sibling->keys[sibling->numKeys - 1];
+    x->values[idx - 1] = sibling->values[sibling->numKeys - 1];
+
+    ++child->numKeys;
+    --sibling->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::BorrowFromNext(TNode *x, int idx) {
+    TNode *child = Own(x->children[idx]);
+    TNode *sibling = Own(x->children[idx + 1]);
+
+    child->keys[child->numKeys] = x->keys[idx];
+    child->values[child->numKeys] = x->values[idx];
+
+    if (!child->isLeaf)
+        child->children[child->numKeys + 1] = std::move(sibling->children[0]);
+
+    x->keys[idx] = sibling->keys[0];
+    x->values[idx] = sibling->values[0];
+
+    for (int i = 1; i < sibling->numKeys; ++i) {
+        sibling->keys[i - 1] = sibling->keys[i];
+        sibling->values[i - 1] = sibling->values[i];
+    }
+
+    if (!sibling->isLeaf) {
+        for (int i = 1; i <= sibling->numKeys; ++i)
+            sibling->children[i - 1] = std::move(sibling->children[i]);
+    }
+
+    ++child->numKeys;
+    --sibling->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+void BTreeCore<TKey, TElement, TNode, TLinks>::Merge(TNode *x, int order, int idx) {
+    TNode *child = Own(x->children[idx]);
+    TNode *sibling = Own(x->children[idx + 1]);
+
+    child->keys[order - 1] = x->keys[idx];
+    child->values[order - 1] = x->values[idx];
+
+    for (int i = 0; i < sibling->numKeys; ++i) {
+        child->keys[i + order] = sibling->keys[i];
+        child->values[i + order] = sibling->values[i];
+    }
+
+    if (!child->isLeaf) {
+        for (int i = 0; i <= sibling->numKeys; ++i)
+            child->children[i + order] = std::move(sibling->children[i]);
+    }
+
+    for (int i = idx + 1; i < x->numKeys; ++i) {
+        x->keys[i - 1] = x->keys[i];
+        x->values[i - 1] = x->values[i];
+    }
+
+    child->numKeys += sibling->numKeys + 1;
+
+    // Shifting the links left overwrites, and so frees, the sibling; when it is the
+    // last child nothing shifts over it and it is released explicitly.
+    for (int i = idx + 2; i <= x->numKeys; ++i)
+        x->children[i - 1] = std::move(x->children[i]);
+    x->children[x->numKeys].reset();
+    --x->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+bool BTreeCore<TKey, TElement, TNode, TLinks>::VisitRange(TNode *x, const TKey *lo, const TKey *hi,
+                                                          EntryBatch<TKey, TElement> &batch) {
+    int i = lo ? KeySearch<TKey>::LowerBound(&x->keys[0], x->numKeys, *lo) : 0;
+    for (; i < x->numKeys; ++i) {
+        if (!x->isLeaf && !VisitRange(Own(x->children[i]), lo, hi, batch))
+            return false;
+        lo = nullptr;
+        if (hi && !(x->keys[i] < *hi))
+            return false;
+        batch.Add(x->keys[i], &x->values[i]);
+    }
+    return x->isLeaf || VisitRange(Own(x->children[x->numKeys]), lo, hi, batch);
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::Iterator(TRoot root, const TKey *start, bool inclusive,
+                                                                    const TKey *upperBound)
+        : root(root), hasStart(start != nullptr), start(start ? *start : TKey()), inclusive(inclusive),
+          hasUpperBound(upperBound != nullptr), upperBound(upperBound ? *upperBound : TKey()),
+          hasCurrent(false) {
+    Reset();
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+void BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::Reset() {
+    stack = DynamicArraySmart<StackNode>();
+    hasCurrent = false;
+    if (hasStart)
+        Seek(root.get());
+    else
+        PushLeftmost(root.get());
+}
+
+// Builds the stack an in-order walk would have just before reaching the start key: each
+// node on the search path is pushed at the position of the first key past the start, so
+// keys on the left of the path are never visited.
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+void BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::Seek(const TNode *node) {
+    while (true) {
+        int i = inclusive ? KeySearch<TKey>::LowerBound(&node->keys[0], node->numKeys, start)
+                          : KeySearch<TKey>::UpperBound(&node->keys[0], node->numKeys, start);
+        StackNode sn = {node, i};
+        stack.Append(sn);
+
+        // On an exact match everything in children[i] is smaller than the start key.
+        if (node->isLeaf || (inclusive && i < node->numKeys && node->keys[i] == start))
+            break;
+        node = node->children[i].get();
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+void BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::PushLeftmost(const TNode *node) {
+    while (node && node->numKeys > 0) {
+        StackNode sn = {node, 0};
+        stack.Append(sn);
+        if (node->isLeaf)
+            break;
+        else
+            node = node->children[0].get();
+    }
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+bool BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::MoveNext() {
+    while (stack.GetLength() > 0) {
+        StackNode &top = stack[stack.GetLength() - 1];
+
+        if (top.index < top.node->numKeys) {
+            if (hasUpperBound && !(top.node->keys[top.index] < upperBound)) {
+                stack = DynamicArraySmart<StackNode>();
+                break;
+            }
+
+            currentKey = top.node->keys[top.index];
+            currentValue = top.node->values[top.index];
+            hasCurrent = true;
+
+            ++top.index;
+            if (!top.node->isLeaf)
+                PushLeftmost(top.node->children[top.index].get());
+
+            return true;
+        } else {
+            stack.RemoveAt(stack.GetLength() - 1);
+        }
+    }
+
+    hasCurrent = false;
+    return false;
+}
+
+// Runs of leaf keys are copied directly; MoveNext is only needed to step through an
+// internal node, which happens once per leaf.
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+size_t BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::NextBatch(TKey *keys, TElement *values,
+                                                                            size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && stack.GetLength() > 0) {
+        StackNode &top = stack[stack.GetLength() - 1];
+        if (top.node->isLeaf && top.index < top.node->numKeys) {
+            for (; top.index < top.node->numKeys && copied < capacity; ++top.index, ++copied) {
+                if (hasUpperBound && !(top.node->keys[top.index] < upperBound)) {
+                    stack = DynamicArraySmart<StackNode>();
+                    hasCurrent = false;
+                    return copied;
+                }
+                keys[copied] = top.node->keys[top.index];
+                values[copied] = top.node->values[top.index];
+            }
+            continue;
+        }
+        if (!Iterator::MoveNext())
+            break;
+        keys[copied] = currentKey;
+        values[copied] = currentValue;
+        ++copied;
+    }
+
+    hasCurrent = copied == capacity && copied > 0;
+    if (hasCurrent) {
+        currentKey = keys[copied - 1];
+        currentValue = values[copied - 1];
+    }
+    return copied;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+TKey BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::GetCurrentKey() const {
+    if (!hasCurrent)
+        throw std::out_of_range("Iterator out of range");
+    return currentKey;
+}
+
+template<typename TKey, typename TElement, typename TNode, typename TLinks>
+template<typename TRoot>
+TElement BTreeCore<TKey, TElement, TNode, TLinks>::Iterator<TRoot>::GetCurrentValue() const {
+    if (!hasCurrent)
+        throw std::out_of_range("Iterator out of range");
+    return currentValue;
+}
+
+#endif // BTREECORE_H
@@ -0,0 +1,500 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "MappedPageStore.h"
+#include "UnqPtr.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A page store that keeps a fixed number of pages in memory and the rest in a spill file,
+// for PagedBTree when its memory use has to stay under a set budget. It is the page file
+// of MappedPageStore read and written with pread and pwrite instead of mapped (POSIX
+// only), so either store can open a file the other wrote.
+//
+// The budget is divided into page-sized frames, allocated once. A page is read into a
+// frame when it is pinned and not resident; when no frame is free, the clock hand sweeps
+// the frames, skipping pinned ones and giving a second chance to those used since its last
+// pass, and evicts the first other one, writing it to the file first if it was pinned for
+// writing. The page table holds at most one entry per frame, so memory use is the budget
+// plus a fixed overhead, however large the file grows. The header page stays in memory
+// and is written by Sync and on destruction.
+//
+// The frame table, the clock and the counters are guarded by one mutex, and a page is
+// pinned before the lock is released, so const reads of the tree (range scans, part
+// iterators, TryGet) may run on several threads at once; each thread works on the pages
+// it has pinned. Unpinning only decrements the frame's atomic pin count. Writes to the
+// tree still need to be exclusive, as on the other dictionaries.
+//
+// Hits, misses, evictions and write-backs are counted for tuning the budget.
+class BufferPool
+{
+public:
+    typedef MappedPageStore::PageId PageId;
+
+    static constexpr size_t kPageSize = MappedPageStore::kPageSize;
+    static constexpr size_t kMetaSize = MappedPageStore::kMetaSize;
+    static constexpr size_t kDefaultBudget = size_t(64) << 20;
+    // An unpinned page can be evicted and its frame reused for another.
+    static constexpr bool kStablePages = false;
+    // The tree pins a handful of pages per operation, plus one per open iterator.
+    static constexpr size_t kMinFrames = 16;
+
+    // Keeps its page in a frame until destroyed or reassigned.
+    class PageRef
+    {
+    public:
+        PageRef() : pool(nullptr), frame(0), data(nullptr) {}
+
+        PageRef(PageRef&& other) noexcept : pool(other.pool), frame(other.frame), data(other.data)
+        {
+            other.pool = nullptr;
+            other.data = nullptr;
+        }
+
+        PageRef& operator=(PageRef&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                pool = other.pool;
+                frame = other.frame;
+                data = other.data;
+                other.pool = nullptr;
+                other.data = nullptr;
+            }
+            return *this;
+        }
+
+        PageRef(const PageRef&) = delete;
+        PageRef& operator=(const PageRef&) = delete;
+
+        ~PageRef()
+        {
+            Release();
+        }
+
+        char* Data() const
+        {
+            return data;
+        }
+
+    private:
+        friend class BufferPool;
+
+        // Taken under the pool's lock, so the frame cannot be chosen for eviction first.
+        PageRef(BufferPool* pool, size_t frame) : pool(pool), frame(frame), data(pool->FrameData(frame))
+        {
+            pool->frames[frame].pins.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Releasing orders this thread's writes to the page before a later eviction of it.
+        void Release()
+        {
+            if (pool)
+            {
+                pool->frames[frame].pins.fetch_sub(1, std::memory_order_release);
+            }
+            pool = nullptr;
+        }
+
+        BufferPool* pool;
+        size_t frame;
+        char* data;
+    };
+
+    // A pool over an unnamed temporary spill file, removed when the pool is destroyed.
+    explicit BufferPool(size_t budgetBytes = kDefaultBudget);
+
+    // Opens the page file at `path`, creating it if it does not exist.
+    explicit BufferPool(const std::string& path, size_t budgetBytes = kDefaultBudget);
+
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Makes the page resident and keeps it so while the reference lives; with `write` it
+    // is marked dirty and will be written back before its frame is reused.
+    PageRef Pin(PageId id, bool write);
+
+    // A zero-filled page.
+    PageId Allocate();
+
+    void Free(PageId id);
+
+    char* Meta();
+
+    const char* Meta() const;
+
+    size_t GetPageCount() const;
+
+    size_t GetFrameCount() const;
+
+    // Writes every dirty page and the header to the file and waits for them.
+    void Sync();
+
+    size_t GetHits() const;
+
+    size_t GetMisses() const;
+
+    size_t GetEvictions() const;
+
+    size_t GetWriteBacks() const;
+
+    void ResetCounters();
+
+private:
+    static constexpr PageId kNoPage = 0;
+
+    struct Frame
+    {
+        PageId id;
+        std::atomic<int> pins;
+        bool dirty;
+        bool referenced;
+
+        Frame() : id(kNoPage), pins(0), dirty(false), referenced(false) {}
+    };
+
+    FILE* temporary;
+    int fd;
+    MappedPageStore::FileHeader header;
+    UnqPtr<char[]> memory;
+    std::vector<Frame> frames;
+    std::unordered_map<PageId, size_t> table;
+    size_t hand;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t writeBacks;
+    mutable std::mutex lock;
+
+    void Open(size_t budgetBytes);
+
+    char* FrameData(size_t frame) const
+    {
+        return memory.get() + frame * kPageSize;
+    }
+
+    // The frame holding the page; a missing page is read in, or zero-filled if `load` is
+    // false because it is new. These and WriteBack are called with the lock held.
+    size_t Fetch(PageId id, bool load);
+
+    size_t Victim();
+
+    void WriteBack(size_t frame);
+
+    void ReadPage(PageId id, char* data) const;
+
+    void WritePage(PageId id, const char* data) const;
+
+    static std::runtime_error Failure(const std::string& what)
+    {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+};
+
+inline BufferPool::BufferPool(size_t budgetBytes) : temporary(std::tmpfile()), fd(-1)
+{
+    if (!temporary)
+    {
+        throw Failure("Cannot create a temporary spill file");
+    }
+    fd = fileno(temporary);
+    try
+    {
+        Open(budgetBytes);
+    }
+    catch (...)
+    {
+        std::fclose(temporary);
+        throw;
+    }
+}
+
+inline BufferPool::BufferPool(const std::string& path, size_t budgetBytes)
+        : temporary(nullptr), fd(::open(path.c_str(), O_RDWR | O_CREAT, 0644))
+{
+    if (fd < 0)
+    {
+        throw Failure("Cannot open page file " + path);
+    }
+    try
+    {
+        Open(budgetBytes);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+}
+
+// Reads only the header; the frames fill as pages are used.
+inline void BufferPool::Open(size_t budgetBytes)
+{
+    size_t frameCount = std::max(kMinFrames, budgetBytes / kPageSize);
+    memory.reset(new char[frameCount * kPageSize]);
+    frames = std::vector<Frame>(frameCount);
+    table.reserve(frameCount);
+    hand = 0;
+    ResetCounters();
+
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        throw Failure("Cannot stat the page file");
+    }
+    if (status.st_size == 0)
+    {
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.format, MappedPageStore::kFormat, sizeof(header.format));
+        header.pageSize = kPageSize;
+        header.pageCount = 1;
+        header.freeList = kNoPage;
+        return;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header.format, MappedPageStore::kFormat, sizeof(header.format)) != 0 ||
+        header.pageSize != kPageSize)
+    {
+        throw std::runtime_error("The file is not a page file of this format.");
+    }
+}
+
+// Leaves a named file complete for the next run; a temporary one just goes away.
+inline BufferPool::~BufferPool()
+{
+    if (temporary)
+    {
+        std::fclose(temporary);
+        return;
+    }
+    try
+    {
+        Sync();
+    }
+    catch (...)
+    {
+    }
+    ::close(fd);
+}
+
+inline BufferPool::PageRef BufferPool::Pin(PageId id, bool write)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t frame = Fetch(id, true);
+    frames[frame].dirty = frames[frame].dirty || write;
+    return PageRef(this, frame);
+}
+
+inline size_t BufferPool::Fetch(PageId id, bool load)
+{
+    auto found = table.find(id);
+    if (found != table.end())
+    {
+        ++hits;
+        frames[found->second].referenced = true;
+        return found->second;
+    }
+
+    ++misses;
+    size_t frame = Victim();
+    if (load)
+    {
+        ReadPage(id, FrameData(frame));
+    }
+    else
+    {
+        std::memset(FrameData(frame), 0, kPageSize);
+    }
+    frames[frame].id = id;
+    frames[frame].dirty = !load;
+    frames[frame].referenced = true;
+    table.emplace(id, frame);
+    return frame;
+}
+
+// The clock: two full sweeps clear every reference bit, so a frame that is still not
+// free after them is pinned, and the pool is too small for what is pinned at once.
+inline size_t BufferPool::Victim()
+{
+    for (size_t step = 0; step < 2 * frames.size(); ++step)
+    {
+        size_t frame = hand;
+        hand = (hand + 1) % frames.size();
+        Frame& candidate = frames[frame];
+        if (candidate.id == kNoPage)
+        {
+            return frame;
+        }
+        if (candidate.pins.load(std::memory_order_acquire) > 0)
+        {
+            continue;
+        }
+        if (candidate.referenced)
+        {
+            candidate.referenced = false;
+            continue;
+        }
+
+        WriteBack(frame);
+        table.erase(candidate.id);
+        candidate.id = kNoPage;
+        ++evictions;
+        return frame;
+    }
+    throw std::runtime_error("Every frame of the buffer pool is pinned.");
+}
+
+inline void BufferPool::WriteBack(size_t frame)
+{
+    if (frames[frame].dirty)
+    {
+        WritePage(frames[frame].id, FrameData(frame));
+        frames[frame].dirty = false;
+        ++writeBacks;
+    }
+}
+
+// A page past the end of the file was never written back, so it reads as zeros.
+inline void BufferPool::ReadPage(PageId id, char* data) const
+{
+    ssize_t read = pread(fd, data, kPageSize, static_cast<off_t>(id * kPageSize));
+    if (read < 0)
+    {
+        throw Failure("Cannot read from the page file");
+    }
+    std::memset(data + read, 0, kPageSize - static_cast<size_t>(read));
+}
+
+inline void BufferPool::WritePage(PageId id, const char* data) const
+{
+    if (pwrite(fd, data, kPageSize, static_cast<off_t>(id * kPageSize)) != static_cast<ssize_t>(kPageSize))
+    {
+        throw Failure("Cannot write to the page file");
+    }
+}
+
+// The page is not pinned here; holding the lock keeps its frame from being reused.
+inline BufferPool::PageId BufferPool::Allocate()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    PageId id = header.freeList;
+    if (id != kNoPage)
+    {
+        size_t frame = Fetch(id, true);
+        frames[frame].dirty = true;
+        std::memcpy(&header.freeList, FrameData(frame), sizeof(PageId));
+        std::memset(FrameData(frame), 0, kPageSize);
+        return id;
+    }
+
+    id = header.pageCount++;
+    Fetch(id, false);
+    return id;
+}
+
+inline void BufferPool::Free(PageId id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t frame = Fetch(id, true);
+    frames[frame].dirty = true;
+    std::memcpy(FrameData(frame), &header.freeList, sizeof(PageId));
+    header.freeList = id;
+}
+
+inline char* BufferPool::Meta()
+{
+    return header.meta;
+}
+
+inline const char* BufferPool::Meta() const
+{
+    return header.meta;
+}
+
+inline size_t BufferPool::GetPageCount() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return header.pageCount;
+}
+
+inline size_t BufferPool::GetFrameCount() const
+{
+    return frames.size();
+}
+
+// The file is extended to the full page count, so MappedPageStore accepts it too.
+inline void BufferPool::Sync()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t frame = 0; frame < frames.size(); ++frame)
+    {
+        if (frames[frame].id != kNoPage)
+        {
+            WriteBack(frame);
+        }
+    }
+
+    char page[kPageSize] = {};
+    std::memcpy(page, &header, sizeof(header));
+    WritePage(0, page);
+    struct stat status;
+    if (fstat(fd, &status) != 0 ||
+        (static_cast<uint64_t>(status.st_size) < header.pageCount * kPageSize &&
+         ftruncate(fd, static_cast<off_t>(header.pageCount * kPageSize)) != 0) ||
+        fsync(fd) != 0)
+    {
+        throw Failure("Cannot write the page file back");
+    }
+}
+
+inline size_t BufferPool::GetHits() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return hits;
+}
+
+inline size_t BufferPool::GetMisses() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return misses;
+}
+
+inline size_t BufferPool::GetEvictions() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return evictions;
+}
+
+inline size_t BufferPool::GetWriteBacks() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return writeBacks;
+}
+
+inline void BufferPool::ResetCounters()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    writeBacks = 0;
+}
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,745 @@
+#ifndef BUFFEREDBTREE_H
+#define BUFFEREDBTREE_H
+
+#include "IOrderedDictionary.h"
+#include "KeyValue.h"
+#include "UnqPtr.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Write-optimised B-tree (a B-epsilon tree). Entries live in linked leaves, as in a
+// B+-tree, and every internal node also holds a buffer of pending writes: a put or an
+// erase per key, sorted by key, newer than anything below it. A write only goes into the
+// root's buffer. When a buffer overflows, all of its messages are merged into the
+// children in one pass, into their buffers or, at the bottom, into the leaves, which are
+// then split as needed; so each write reaches its leaf in a batch with others, and the
+// cost of shifting leaf arrays is shared between them.
+//
+// Lookups stop at the first buffer on the path that has a message for the key. Add and
+// Discard are blind writes that touch only the root's buffer; Upsert, Update and TryRemove
+// look the key up first to report what they did, so they cost a descent more.
+// GetCount, iteration, FindPtr, GetOrAdd and the visits apply every pending message
+// first, so even the const ones can change the tree's layout. They do it under a lock,
+// and lookups that find messages pending read under the same lock, so const calls from
+// several threads are safe, as on the other dictionaries; once nothing is pending they
+// take no lock. Leaves and internal nodes are not merged after removals.
+template<typename TKey, typename TElement>
+class BufferedBTree : public IOrderedDictionary<TKey, TElement> {
+public:
+    BufferedBTree();
+
+    virtual ~BufferedBTree();
+
+    BufferedBTree(const BufferedBTree &) = delete;
+
+    BufferedBTree &operator=(const BufferedBTree &) = delete;
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual void Discard(const TKey &key) override;
+
+    // Builds an empty tree directly from full leaves; a non-empty tree just adds the items.
+    virtual void BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
+
+    // Applies every pending message to the leaves.
+    void Flush() const;
+
+    // Writes buffered since the last Flush; an upper bound on the messages still pending.
+    size_t GetPendingCount() const;
+
+private:
+    static constexpr size_t kLeafCapacity = 256;
+    static constexpr size_t kMaxFanout = 16;
+    static constexpr size_t kBufferCapacity = 256;
+
+    struct Message {
+        TKey key;
+        TElement value;
+        bool erase;
+    };
+
+    // Child i of an internal node holds the keys in [keys[i - 1], keys[i]).
+    struct Node {
+        bool isLeaf;
+        std::vector<TKey> keys;
+        std::vector<TElement> values;
+        std::vector<UnqPtr<Node>> children;
+        std::vector<Message> buffer;
+        Node *next;
+
+        explicit Node(bool leaf) : isLeaf(leaf), next(nullptr) {}
+    };
+
+    // A node split off to the right of another, with the first key it holds.
+    struct Split {
+        TKey separator;
+        UnqPtr<Node> node;
+    };
+
+    // Flushing and splitting change the layout but not the contents, so the const
+    // operations that need the messages applied may do it, holding flushLock. Writes
+    // raise pending and only a flush clears it, so a reader that sees it at zero reads a
+    // tree no other reader will change.
+    mutable UnqPtr<Node> root;
+    mutable size_t count;
+    mutable std::atomic<size_t> pending;
+    mutable std::mutex flushLock;
+
+    static size_t ChildIndex(const Node *node, const TKey &key);
+
+    bool Lookup(const TKey &key, TElement &element) const;
+
+    void Write(const Message &message);
+
+    // Merges the sorted messages into the subtree under node. An internal node takes them
+    // into its buffer and flushes it when it overflows or when `force` is set; the pieces
+    // the node had to be split into, beyond the first, go to `splits`.
+    void Apply(Node *node, const Message *messages, size_t n, bool force, std::vector<Split> &splits) const;
+
+    void MergeIntoLeaf(Node *leaf, const Message *messages, size_t n) const;
+
+    static void MergeIntoBuffer(Node *node, const Message *messages, size_t n);
+
+    void FlushBuffer(Node *node, bool force) const;
+
+    static void SplitLeaf(Node *leaf, std::vector<Split> &splits);
+
+    static void SplitInner(Node *node, std::vector<Split> &splits);
+
+    void GrowRoot(std::vector<Split> &splits) const;
+
+    const Node *FindLeaf(const TKey &key) const;
+
+    TreePartBounds<TKey> PartBounds(int part, int parts) const;
+
+    void VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo, const TKey *hi);
+
+    // Iterates the leaf chain from the start position up to an optional bound.
+    class LeafIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        LeafIterator(const BufferedBTree *tree, const TKey *start, bool inclusive, const TKey *upperBound);
+
+        virtual ~LeafIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const BufferedBTree *tree;
+        bool hasStart;
+        TKey start;
+        bool inclusive;
+        bool hasUpperBound;
+        TKey upperBound;
+        const Node *leaf;
+        size_t index;
+        bool started;
+
+        bool Valid() const;
+    };
+};
+
+template<typename TKey, typename TElement>
+BufferedBTree<TKey, TElement>::BufferedBTree() : root(new Node(true)), count(0), pending(0) {
+}
+
+template<typename TKey, typename TElement>
+BufferedBTree<TKey, TElement>::~BufferedBTree() {
+}
+
+template<typename TKey, typename TElement>
+size_t BufferedBTree<TKey, TElement>::ChildIndex(const Node *node, const TKey &key) {
+    return static_cast<size_t>(std::upper_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin());
+}
+
+template<typename TKey, typename TElement>
+size_t BufferedBTree<TKey, TElement>::GetCount() const {
+    Flush();
+    return count;
+}
+
+template<typename TKey, typename TElement>
+size_t BufferedBTree<TKey, TElement>::GetCapacity() const {
+    return GetCount();
+}
+
+template<typename TKey, typename TElement>
+size_t BufferedBTree<TKey, TElement>::GetPendingCount() const {
+    return pending.load(std::memory_order_acquire);
+}
+
+// A message newer than every buffer below the root; a tree that is a single leaf takes it
+// directly.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Write(const Message &message) {
+    std::vector<Split> splits;
+    if (root->isLeaf) {
+        MergeIntoLeaf(root.get(), &message, 1);
+        SplitLeaf(root.get(), splits);
+        GrowRoot(splits);
+        return;
+    }
+
+    std::vector<Message> &buffer = root->buffer;
+    auto position = std::lower_bound(buffer.begin(), buffer.end(), message.key,
+                                     [](const Message &m, const TKey &key) { return m.key < key; });
+    if (position != buffer.end() && position->key == message.key) {
+        *position = message;
+        return;
+    }
+    buffer.insert(position, message);
+    ++pending;
+    if (buffer.size() > kBufferCapacity) {
+        FlushBuffer(root.get(), false);
+        SplitInner(root.get(), splits);
+        GrowRoot(splits);
+    }
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Write(Message{key, element, false});
+}
+
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    bool inserted = !ContainsKey(key);
+    Write(Message{key, element, false});
+    return inserted;
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Update(const TKey &key, const TElement &element) {
+    if (!ContainsKey(key))
+        throw std::runtime_error("Key not found.");
+    Write(Message{key, element, false});
+}
+
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::TryRemove(const TKey &key) {
+    if (!ContainsKey(key))
+        return false;
+    Write(Message{key, TElement(), true});
+    return true;
+}
+
+// An erase message for a missing key just disappears when it reaches the leaf.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Discard(const TKey &key) {
+    Write(Message{key, TElement(), true});
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    if (pending.load(std::memory_order_acquire) == 0)
+        return Lookup(key, element);
+    std::lock_guard<std::mutex> lock(flushLock);
+    return Lookup(key, element);
+}
+
+// The first message met on the way down is the newest one for the key.
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::Lookup(const TKey &key, TElement &element) const {
+    const Node *node = root.get();
+    while (!node->isLeaf) {
+        const std::vector<Message> &buffer = node->buffer;
+        auto position = std::lower_bound(buffer.begin(), buffer.end(), key,
+                                         [](const Message &m, const TKey &k) { return m.key < k; });
+        if (position != buffer.end() && position->key == key) {
+            if (position->erase)
+                return false;
+            element = position->value;
+            return true;
+        }
+        node = node->children[ChildIndex(node, key)].get();
+    }
+
+    auto position = std::lower_bound(node->keys.begin(), node->keys.end(), key);
+    if (position == node->keys.end() || !(*position == key))
+        return false;
+    element = node->values[position - node->keys.begin()];
+    return true;
+}
+
+template<typename TKey, typename TElement>
+TElement BufferedBTree<TKey, TElement>::Get(const TKey &key) const {
+    TElement value;
+    if (!TryGet(key, value))
+        throw std::runtime_error("Key not found.");
+    return value;
+}
+
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::ContainsKey(const TKey &key) const {
+    TElement value;
+    return TryGet(key, value);
+}
+
+// A pointer into a buffer would move with the next flush, so values are only handed out
+// from the leaves.
+template<typename TKey, typename TElement>
+const TElement *BufferedBTree<TKey, TElement>::FindPtr(const TKey &key) const {
+    Flush();
+    const Node *leaf = FindLeaf(key);
+    auto position = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
+    if (position == leaf->keys.end() || !(*position == key))
+        return nullptr;
+    return &leaf->values[position - leaf->keys.begin()];
+}
+
+template<typename TKey, typename TElement>
+TElement *BufferedBTree<TKey, TElement>::FindPtr(const TKey &key) {
+    return const_cast<TElement *>(static_cast<const BufferedBTree *>(this)->FindPtr(key));
+}
+
+template<typename TKey, typename TElement>
+TElement &BufferedBTree<TKey, TElement>::GetOrAdd(const TKey &key) {
+    TElement *value = FindPtr(key);
+    if (value)
+        return *value;
+    Write(Message{key, TElement(), false});
+    return *FindPtr(key);
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Flush() const {
+    if (pending.load(std::memory_order_acquire) == 0)
+        return;
+    std::lock_guard<std::mutex> lock(flushLock);
+    if (pending.load(std::memory_order_relaxed) == 0)
+        return;
+    std::vector<Split> splits;
+    Apply(root.get(), nullptr, 0, true, splits);
+    GrowRoot(splits);
+    pending.store(0, std::memory_order_release);
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::Apply(Node *node, const Message *messages, size_t n, bool force,
+                                          std::vector<Split> &splits) const {
+    if (node->isLeaf) {
+        MergeIntoLeaf(node, messages, n);
+        SplitLeaf(node, splits);
+        return;
+    }
+
+    MergeIntoBuffer(node, messages, n);
+    if (force || node->buffer.size() > kBufferCapacity) {
+        FlushBuffer(node, force);
+        SplitInner(node, splits);
+    }
+}
+
+// Hands each child the run of the buffer that falls in its range, all in one pass, and
+// links the pieces the children split into in after them. Without `force` a child with no
+// messages is left alone.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::FlushBuffer(Node *node, bool force) const {
+    std::vector<Message> buffer;
+    buffer.swap(node->buffer);
+
+    std::vector<TKey> keys;
+    std::vector<UnqPtr<Node>> children;
+    keys.reserve(node->keys.size());
+    children.reserve(node->children.size());
+    size_t first = 0;
+    for (size_t c = 0; c < node->children.size(); ++c) {
+        size_t last = buffer.size();
+        if (c < node->keys.size()) {
+            last = static_cast<size_t>(std::lower_bound(buffer.begin() + first, buffer.end(), node->keys[c],
+                                                         [](const Message &m, const TKey &key) {
+                                                             return m.key < key;
+                                                         }) - buffer.begin());
+        }
+
+        std::vector<Split> childSplits;
+        if (force || last > first)
+            Apply(node->children[c].get(), buffer.data() + first, last - first, force, childSplits);
+        first = last;
+
+        if (c > 0)
+            keys.push_back(node->keys[c - 1]);
+        children.push_back(std::move(node->children[c]));
+        for (Split &split : childSplits) {
+            keys.push_back(split.separator);
+            children.push_back(std::move(split.node));
+        }
+    }
+    node->keys.swap(keys);
+    node->children.swap(children);
+}
+
+// Newer messages replace older ones for the same key.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::MergeIntoBuffer(Node *node, const Message *messages, size_t n) {
+    if (n == 0)
+        return;
+    std::vector<Message> &buffer = node->buffer;
+    std::vector<Message> merged;
+    merged.reserve(buffer.size() + n);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < buffer.size() || j < n) {
+        if (j == n || (i < buffer.size() && buffer[i].key < messages[j].key)) {
+            merged.push_back(buffer[i++]);
+        } else {
+            if (i < buffer.size() && buffer[i].key == messages[j].key)
+                ++i;
+            merged.push_back(messages[j++]);
+        }
+    }
+    buffer.swap(merged);
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::MergeIntoLeaf(Node *leaf, const Message *messages, size_t n) const {
+    if (n == 0)
+        return;
+    std::vector<TKey> keys;
+    std::vector<TElement> values;
+    keys.reserve(leaf->keys.size() + n);
+    values.reserve(leaf->keys.size() + n);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < leaf->keys.size() || j < n) {
+        if (j == n || (i < leaf->keys.size() && leaf->keys[i] < messages[j].key)) {
+            keys.push_back(leaf->keys[i]);
+            values.push_back(leaf->values[i]);
+            ++i;
+            continue;
+        }
+
+        bool present = i < leaf->keys.size() && leaf->keys[i] == messages[j].key;
+        if (present)
+            ++i;
+        if (!messages[j].erase) {
+            keys.push_back(messages[j].key);
+            values.push_back(messages[j].value);
+            if (!present)
+                ++count;
+        } else if (present) {
+            --count;
+        }
+        ++j;
+    }
+    leaf->keys.swap(keys);
+    leaf->values.swap(values);
+}
+
+// An overfull node of size m is cut into m / capacity + 1 even pieces, each below the
+// capacity; the first stays in place.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::SplitLeaf(Node *leaf, std::vector<Split> &splits) {
+    size_t size = leaf->keys.size();
+    if (size <= kLeafCapacity)
+        return;
+
+    size_t pieces = size / kLeafCapacity + 1;
+    Node *previous = leaf;
+    for (size_t p = 1; p < pieces; ++p) {
+        size_t first = size * p / pieces;
+        size_t last = size * (p + 1) / pieces;
+        UnqPtr<Node> piece(new Node(true));
+        piece->keys.assign(leaf->keys.begin() + first, leaf->keys.begin() + last);
+        piece->values.assign(leaf->values.begin() + first, leaf->values.begin() + last);
+        piece->next = previous->next;
+        previous->next = piece.get();
+        previous = piece.get();
+        splits.push_back(Split{piece->keys[0], std::move(piece)});
+    }
+    leaf->keys.resize(size / pieces);
+    leaf->values.resize(size / pieces);
+}
+
+// Called right after a flush, so the buffer is empty.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::SplitInner(Node *node, std::vector<Split> &splits) {
+    size_t size = node->children.size();
+    if (size <= kMaxFanout)
+        return;
+
+    size_t pieces = size / kMaxFanout + 1;
+    for (size_t p = 1; p < pieces; ++p) {
+        size_t first = size * p / pieces;
+        size_t last = size * (p + 1) / pieces;
+        UnqPtr<Node> piece(new Node(false));
+        for (size_t c = first; c < last; ++c) {
+            if (c > first)
+                piece->keys.push_back(node->keys[c - 1]);
+            piece->children.push_back(std::move(node->children[c]));
+        }
+        splits.push_back(Split{node->keys[first - 1], std::move(piece)});
+    }
+    node->children.resize(size / pieces);
+    node->keys.resize(size / pieces - 1);
+}
+
+// Puts the root and the pieces split off it under a new root, as often as it takes.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::GrowRoot(std::vector<Split> &splits) const {
+    while (!splits.empty()) {
+        UnqPtr<Node> newRoot(new Node(false));
+        newRoot->children.push_back(std::move(root));
+        for (Split &split : splits) {
+            newRoot->keys.push_back(split.separator);
+            newRoot->children.push_back(std::move(split.node));
+        }
+        root = std::move(newRoot);
+        splits.clear();
+        SplitInner(root.get(), splits);
+    }
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) {
+    if (this->count > 0 || GetPendingCount() > 0 || !root->isLeaf) {
+        for (size_t i = 0; i < count; ++i)
+            Add(items[i].key, items[i].value);
+        return;
+    }
+    for (size_t i = 1; i < count; ++i) {
+        if (!(items[i - 1].key < items[i].key))
+            throw std::invalid_argument("BulkLoad requires strictly increasing keys.");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        root->keys.push_back(items[i].key);
+        root->values.push_back(items[i].value);
+    }
+    this->count = count;
+    std::vector<Split> splits;
+    SplitLeaf(root.get(), splits);
+    GrowRoot(splits);
+}
+
+template<typename TKey, typename TElement>
+const typename BufferedBTree<TKey, TElement>::Node *BufferedBTree<TKey, TElement>::FindLeaf(const TKey &key) const {
+    const Node *node = root.get();
+    while (!node->isLeaf)
+        node = node->children[ChildIndex(node, key)].get();
+    return node;
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    Flush();
+    VisitRange(visitor, nullptr, nullptr);
+}
+
+// The split is taken after flushing, as the parts follow the layout that flushing changes.
+template<typename TKey, typename TElement>
+TreePartBounds<TKey> BufferedBTree<TKey, TElement>::PartBounds(int part, int parts) const {
+    Flush();
+    return SplitTreeByKeys<TKey>(static_cast<const Node *>(root.get()), part, parts,
+                                 [](const Node *node, std::vector<TKey> &keys, std::vector<const Node *> &children) {
+                                     keys.insert(keys.end(), node->keys.begin(), node->keys.end());
+                                     for (const UnqPtr<Node> &child : node->children)
+                                         children.push_back(child.get());
+                                     return node->isLeaf;
+                                 });
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BufferedBTree<TKey, TElement>::GetPartIterator(int part,
+                                                                                          int parts) const {
+    TreePartBounds<TKey> bounds = PartBounds(part, parts);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, bounds.Lo(), true, bounds.Hi()));
+}
+
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) {
+    TreePartBounds<TKey> bounds = PartBounds(part, parts);
+    VisitRange(visitor, bounds.Lo(), bounds.Hi());
+}
+
+// Walks the leaf chain of the flushed tree over the keys in [lo, hi) (a null bound is
+// open), handing out pointers into the leaves' value arrays.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo,
+                                               const TKey *hi) {
+    Node *leaf = root.get();
+    while (!leaf->isLeaf)
+        leaf = leaf->children[lo ? ChildIndex(leaf, *lo) : 0].get();
+    size_t i = lo ? static_cast<size_t>(std::lower_bound(leaf->keys.begin(), leaf->keys.end(), *lo) -
+                                        leaf->keys.begin())
+                  : 0;
+
+    EntryBatch<TKey, TElement> batch(visitor);
+    for (; leaf; leaf = leaf->next, i = 0) {
+        for (; i < leaf->keys.size(); ++i) {
+            if (hi && !(leaf->keys[i] < *hi)) {
+                batch.Flush();
+                return;
+            }
+            batch.Add(leaf->keys[i], &leaf->values[i]);
+        }
+    }
+    batch.Flush();
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BufferedBTree<TKey, TElement>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, nullptr, true, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BufferedBTree<TKey, TElement>::LowerBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &key, true, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BufferedBTree<TKey, TElement>::UpperBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &key, false, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> BufferedBTree<TKey, TElement>::GetRange(const TKey &lo,
+                                                                                   const TKey &hi) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &lo, true, &hi));
+}
+
+template<typename TKey, typename TElement>
+BufferedBTree<TKey, TElement>::LeafIterator::LeafIterator(const BufferedBTree *tree, const TKey *start,
+                                                          bool inclusive, const TKey *upperBound)
+        : tree(tree), hasStart(start != nullptr), start(start ? *start : TKey()), inclusive(inclusive),
+          hasUpperBound(upperBound != nullptr), upperBound(upperBound ? *upperBound : TKey()) {
+    Reset();
+}
+
+// Positions the iterator just before its first entry, applying pending messages first.
+template<typename TKey, typename TElement>
+void BufferedBTree<TKey, TElement>::LeafIterator::Reset() {
+    tree->Flush();
+    started = false;
+    if (!hasStart) {
+        const Node *node = tree->root.get();
+        while (!node->isLeaf)
+            node = node->children[0].get();
+        leaf = node;
+        index = 0;
+        return;
+    }
+
+    leaf = tree->FindLeaf(start);
+    auto position = inclusive ? std::lower_bound(leaf->keys.begin(), leaf->keys.end(), start)
+                              : std::upper_bound(leaf->keys.begin(), leaf->keys.end(), start);
+    index = static_cast<size_t>(position - leaf->keys.begin());
+}
+
+// Steps over exhausted and empty leaves; false at the end or at the upper bound.
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::LeafIterator::Valid() const {
+    return leaf && index < leaf->keys.size() && (!hasUpperBound || leaf->keys[index] < upperBound);
+}
+
+template<typename TKey, typename TElement>
+bool BufferedBTree<TKey, TElement>::LeafIterator::MoveNext() {
+    if (!leaf)
+        return false;
+    if (started)
+        ++index;
+    started = true;
+    while (leaf && index >= leaf->keys.size()) {
+        leaf = leaf->next;
+        index = 0;
+    }
+    if (!Valid()) {
+        leaf = nullptr;
+        return false;
+    }
+    return true;
+}
+
+template<typename TKey, typename TElement>
+size_t BufferedBTree<TKey, TElement>::LeafIterator::NextBatch(TKey *keys, TElement *values, size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && LeafIterator::MoveNext()) {
+        size_t run = std::min(leaf->keys.size() - index, capacity - copied);
+        for (size_t i = 0; i < run; ++i) {
+            if (hasUpperBound && !(leaf->keys[index + i] < upperBound)) {
+                run = i;
+                break;
+            }
+            keys[copied + i] = leaf->keys[index + i];
+            values[copied + i] = leaf->values[index + i];
+        }
+        copied += run;
+        if (run == 0) {
+            leaf = nullptr;
+            break;
+        }
+        index += run - 1;
+    }
+    return copied;
+}
+
+template<typename TKey, typename TElement>
+TKey BufferedBTree<TKey, TElement>::LeafIterator::GetCurrentKey() const {
+    if (!started || !Valid())
+        throw std::out_of_range("Iterator out of range");
+    return leaf->keys[index];
+}
+
+template<typename TKey, typename TElement>
+TElement BufferedBTree<TKey, TElement>::LeafIterator::GetCurrentValue() const {
+    if (!started || !Valid())
+        throw std::out_of_range("Iterator out of range");
+    return leaf->values[index];
+}
+
+#endif // BUFFEREDBTREE_H
@@ -0,0 +1,824 @@
+#ifndef CONCURRENTBTREE_H
+#define CONCURRENTBTREE_H
+
+#include "IOrderedDictionary.h"
+#include "IDictionaryIterator.h"
+#include "KeyValue.h"
+#include "UnqPtr.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// B+-tree for many concurrent readers and a few writers, synchronised by optimistic lock
+// coupling. Every node carries a version counter with a lock bit. A reader never writes
+// to the tree: it notes a node's version, reads what it needs and checks afterwards that
+// the version is unchanged, restarting from the root if it is not; on the way down it
+// validates the parent only after it has noted the child's version, so the path it
+// followed was consistent. A writer descends the same way and write-locks just the leaf
+// it changes, and, when a full node has to be split, that node and its parent; full nodes
+// are split on the way down, so a split never has to reach further up.
+//
+// Removals leave leaves underfull instead of merging them, and no node is freed before the
+// tree is, so a reader holding a stale pointer still points at a live node whose changed
+// version sends it back to the root. Keys are kept in atomics and values are read and
+// written with relaxed atomic accesses, which makes the optimistic reads well defined;
+// both types must be trivially copyable.
+//
+// Get, TryGet, ContainsKey, Add, Remove, Update, Upsert, TryRemove and VisitMutable may be
+// called from any number of threads; VisitMutable hands the visitor copies of one leaf's
+// values at a time and stores them back with the leaf locked. FindPtr and GetOrAdd hand
+// out pointers to the values in the leaves, which are only safe to use while no other
+// thread writes. Iterators copy one leaf at a time, so each leaf is read as it was at one
+// moment; entries inserted behind the iteration are not seen.
+template<typename TKey, typename TElement>
+class ConcurrentBTree : public IOrderedDictionary<TKey, TElement> {
+    static_assert(std::is_trivially_copyable<TKey>::value && std::is_trivially_copyable<TElement>::value,
+                  "ConcurrentBTree keeps keys and values in atomics, so they must be trivially copyable.");
+
+public:
+    ConcurrentBTree();
+
+    virtual ~ConcurrentBTree();
+
+    ConcurrentBTree(const ConcurrentBTree &) = delete;
+
+    ConcurrentBTree &operator=(const ConcurrentBTree &) = delete;
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
+
+    int GetHeight() const;
+
+private:
+    static constexpr int kLeafCapacity = 64;
+    static constexpr int kInnerCapacity = 64;
+
+    // Bit 1 of the version is the write lock. Locking adds 2 and unlocking adds 2 more, so
+    // every completed write leaves a new, unlocked version behind.
+    static constexpr uint64_t kLocked = 2;
+
+    struct Node {
+        mutable std::atomic<uint64_t> version;
+        std::atomic<int> count;
+        const bool isLeaf;
+
+        explicit Node(bool isLeaf) : version(0), count(0), isLeaf(isLeaf) {}
+
+        // Notes the version for a later Validate; false while a writer holds the node.
+        bool ReadLock(uint64_t &observed) const {
+            observed = version.load(std::memory_order_acquire);
+            return (observed & kLocked) == 0;
+        }
+
+        // True if nothing was written since ReadLock returned `observed`, so the reads in
+        // between saw one consistent state. The fence keeps those reads before the check.
+        bool Validate(uint64_t observed) const {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version.load(std::memory_order_relaxed) == observed;
+        }
+
+        // The release fence keeps the writes made under the lock from becoming visible
+        // ahead of the locked version, so a reader that sees any of them fails Validate.
+        bool Upgrade(uint64_t observed) {
+            if (!version.compare_exchange_strong(observed, observed + kLocked, std::memory_order_acquire))
+                return false;
+            std::atomic_thread_fence(std::memory_order_release);
+            return true;
+        }
+
+        void WriteUnlock() {
+            version.fetch_add(kLocked, std::memory_order_release);
+        }
+
+        int Count() const {
+            return count.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Values are plain objects so FindPtr can point at them; they are only accessed
+    // through LoadValue and StoreValue while other threads may be reading.
+    struct Leaf : Node {
+        std::atomic<TKey> keys[kLeafCapacity];
+        alignas(std::atomic<TElement>) TElement values[kLeafCapacity];
+
+        Leaf() : Node(true), keys(), values() {}
+
+        bool IsFull() const {
+            return this->Count() == kLeafCapacity;
+        }
+    };
+
+    // Child i holds the keys in [keys[i - 1], keys[i]).
+    struct Inner : Node {
+        std::atomic<TKey> keys[kInnerCapacity];
+        std::atomic<Node *> children[kInnerCapacity + 1];
+
+        Inner() : Node(false), keys(), children() {}
+
+        bool IsFull() const {
+            return this->Count() == kInnerCapacity;
+        }
+    };
+
+    std::atomic<Node *> root;
+    std::atomic<size_t> count;
+    std::atomic<size_t> leafCount;
+
+    static TKey LoadKey(const std::atomic<TKey> &key) {
+        return key.load(std::memory_order_relaxed);
+    }
+
+    // Relaxed atomic access to a value slot: std::atomic_ref where the library has it,
+    // otherwise the GCC and Clang builtins it is built on.
+    static TElement LoadValue(const TElement &slot);
+
+    static void StoreValue(TElement &slot, const TElement &value);
+
+    // First position in keys[0, count) whose key is not less than (or, with `upper`,
+    // greater than) the key. The count may be stale during an optimistic read, but it
+    // never exceeds the capacity.
+    static int Search(const std::atomic<TKey> *keys, int count, const TKey &key, bool upper);
+
+    static bool IsFull(const Node *node);
+
+    // Descends optimistically to the leaf that would hold the key, or to the leftmost leaf
+    // if key is null. On success the leaf's version is in `version` for the caller to
+    // validate, and `fence`, when given, gets the smallest separator above the leaf, the
+    // key the next leaf starts at. Returns null when the caller has to restart.
+    Leaf *Descend(const TKey *key, uint64_t &version, TKey *fence, bool *hasFence) const;
+
+    // Finds and write-locks the leaf for the key, splitting full nodes on the way down if
+    // `forInsert`, then returns func(leaf) with the leaf still locked.
+    template<typename Func>
+    auto WithLockedLeaf(const TKey &key, bool forInsert, Func func);
+
+    // Splits the write-locked full node; the parent, also write-locked, is null for the root.
+    void Split(Inner *parent, Node *node);
+
+    // Copies the value under the key, if any; false when the read has to be retried.
+    bool TryRead(const TKey &key, bool &found, TElement &value) const;
+
+    TElement *FindSlot(const TKey &key) const;
+
+    static void Restart();
+
+    static void Destroy(Node *node);
+
+    // Copies one leaf at a time from the position the bounds describe, up to `hi`.
+    class LeafIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        LeafIterator(const ConcurrentBTree *tree, const TKey *lo, bool inclusive, const TKey *hi);
+
+        virtual ~LeafIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const ConcurrentBTree *tree;
+        bool hasStart;
+        TKey start;
+        bool startInclusive;
+        bool hasHi;
+        TKey hi;
+        bool hasNext;
+        TKey next;
+        bool nextInclusive;
+        bool finished;
+        std::vector<KeyValue<TKey, TElement>> entries;
+        size_t index;
+        bool started;
+
+        bool LoadNextLeaf();
+    };
+};
+
+template<typename TKey, typename TElement>
+ConcurrentBTree<TKey, TElement>::ConcurrentBTree() : root(new Leaf()), count(0), leafCount(1) {
+}
+
+template<typename TKey, typename TElement>
+ConcurrentBTree<TKey, TElement>::~ConcurrentBTree() {
+    Destroy(root.load());
+}
+
+// Splits only add nodes, so every node ever allocated is still reachable from the root.
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Destroy(Node *node) {
+    if (!node->isLeaf) {
+        Inner *inner = static_cast<Inner *>(node);
+        for (int i = 0; i <= inner->Count(); ++i)
+            Destroy(inner->children[i].load());
+        delete inner;
+    } else {
+        delete static_cast<Leaf *>(node);
+    }
+}
+
+template<typename TKey, typename TElement>
+TElement ConcurrentBTree<TKey, TElement>::LoadValue(const TElement &slot) {
+#if defined(__cpp_lib_atomic_ref)
+    return std::atomic_ref<TElement>(const_cast<TElement &>(slot)).load(std::memory_order_relaxed);
+#else
+    TElement value;
+    __atomic_load(&slot, &value, __ATOMIC_RELAXED);
+    return value;
+#endif
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::StoreValue(TElement &slot, const TElement &value) {
+#if defined(__cpp_lib_atomic_ref)
+    std::atomic_ref<TElement>(slot).store(value, std::memory_order_relaxed);
+#else
+    TElement copy = value;
+    __atomic_store(&slot, &copy, __ATOMIC_RELAXED);
+#endif
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Restart() {
+    std::this_thread::yield();
+}
+
+template<typename TKey, typename TElement>
+int ConcurrentBTree<TKey, TElement>::Search(const std::atomic<TKey> *keys, int count, const TKey &key,
+                                            bool upper) {
+    int lo = 0;
+    int hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        TKey current = LoadKey(keys[mid]);
+        if (upper ? !(key < current) : current < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::IsFull(const Node *node) {
+    return node->isLeaf ? static_cast<const Leaf *>(node)->IsFull() : static_cast<const Inner *>(node)->IsFull();
+}
+
+template<typename TKey, typename TElement>
+typename ConcurrentBTree<TKey, TElement>::Leaf *
+ConcurrentBTree<TKey, TElement>::Descend(const TKey *key, uint64_t &version, TKey *fence, bool *hasFence) const {
+    if (hasFence)
+        *hasFence = false;
+
+    Node *node = root.load(std::memory_order_acquire);
+    uint64_t nodeVersion;
+    // A root split after the load would leave this node covering only the left half.
+    if (!node->ReadLock(nodeVersion) || node != root.load(std::memory_order_acquire))
+        return nullptr;
+
+    while (!node->isLeaf) {
+        Inner *inner = static_cast<Inner *>(node);
+        int count = inner->Count();
+        int pos = key ? Search(inner->keys, count, *key, true) : 0;
+        if (fence && pos < count) {
+            *fence = LoadKey(inner->keys[pos]);
+            *hasFence = true;
+        }
+        Node *child = inner->children[pos].load(std::memory_order_acquire);
+        if (!inner->Validate(nodeVersion))
+            return nullptr;
+
+        uint64_t childVersion;
+        if (!child->ReadLock(childVersion) || !inner->Validate(nodeVersion))
+            return nullptr;
+        node = child;
+        nodeVersion = childVersion;
+    }
+
+    version = nodeVersion;
+    return static_cast<Leaf *>(node);
+}
+
+template<typename TKey, typename TElement>
+template<typename Func>
+auto ConcurrentBTree<TKey, TElement>::WithLockedLeaf(const TKey &key, bool forInsert, Func func) {
+    while (true) {
+        Node *node = root.load(std::memory_order_acquire);
+        uint64_t nodeVersion;
+        if (!node->ReadLock(nodeVersion) || node != root.load(std::memory_order_acquire)) {
+            Restart();
+            continue;
+        }
+
+        Inner *parent = nullptr;
+        uint64_t parentVersion = 0;
+        bool restart = false;
+        while (true) {
+            if (forInsert && IsFull(node)) {
+                if (parent && !parent->Upgrade(parentVersion)) {
+                    restart = true;
+                    break;
+                }
+                if (!node->Upgrade(nodeVersion)) {
+                    if (parent)
+                        parent->WriteUnlock();
+                    restart = true;
+                    break;
+                }
+                if (!parent && node != root.load(std::memory_order_acquire)) {
+                    node->WriteUnlock();
+                    restart = true;
+                    break;
+                }
+                Split(parent, node);
+                node->WriteUnlock();
+                if (parent)
+                    parent->WriteUnlock();
+                // The key may now belong to the new sibling; descend again.
+                restart = true;
+                break;
+            }
+            if (node->isLeaf)
+                break;
+
+            Inner *inner = static_cast<Inner *>(node);
+            int pos = Search(inner->keys, inner->Count(), key, true);
+            Node *child = inner->children[pos].load(std::memory_order_acquire);
+            if (!inner->Validate(nodeVersion)) {
+                restart = true;
+                break;
+            }
+            uint64_t childVersion;
+            if (!child->ReadLock(childVersion) || !inner->Validate(nodeVersion)) {
+                restart = true;
+                break;
+            }
+            parent = inner;
+            parentVersion = nodeVersion;
+            node = child;
+            nodeVersion = childVersion;
+        }
+        if (restart) {
+            Restart();
+            continue;
+        }
+
+        // The leaf's range only changes when the leaf itself splits, so an unchanged
+        // version means it is still the leaf for the key.
+        Leaf *leaf = static_cast<Leaf *>(node);
+        if (!leaf->Upgrade(nodeVersion)) {
+            Restart();
+            continue;
+        }
+        auto result = func(leaf);
+        leaf->WriteUnlock();
+        return result;
+    }
+}
+
+// The new right sibling is filled in before its pointer is published with a release store,
+// so a reader that follows the pointer sees it complete.
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Split(Inner *parent, Node *node) {
+    TKey separator;
+    Node *right;
+    if (node->isLeaf) {
+        Leaf *left = static_cast<Leaf *>(node);
+        Leaf *sibling = new Leaf();
+        int total = left->Count();
+        int mid = total / 2;
+        for (int i = mid; i < total; ++i) {
+            sibling->keys[i - mid].store(LoadKey(left->keys[i]), std::memory_order_relaxed);
+            StoreValue(sibling->values[i - mid], LoadValue(left->values[i]));
+        }
+        sibling->count.store(total - mid, std::memory_order_relaxed);
+        left->count.store(mid, std::memory_order_relaxed);
+        separator = LoadKey(sibling->keys[0]);
+        right = sibling;
+        ++leafCount;
+    } else {
+        Inner *left = static_cast<Inner *>(node);
+        Inner *sibling = new Inner();
+        int total = left->Count();
+        int mid = total / 2;
+        separator = LoadKey(left->keys[mid]);
+        for (int i = mid + 1; i < total; ++i)
+            sibling->keys[i - mid - 1].store(LoadKey(left->keys[i]), std::memory_order_relaxed);
+        for (int i = mid + 1; i <= total; ++i)
+            sibling->children[i - mid - 1].store(left->children[i].load(std::memory_order_relaxed),
+                                                 std::memory_order_relaxed);
+        sibling->count.store(total - mid - 1, std::memory_order_relaxed);
+        left->count.store(mid, std::memory_order_relaxed);
+        right = sibling;
+    }
+
+    if (!parent) {
+        Inner *newRoot = new Inner();
+        newRoot->keys[0].store(separator, std::memory_order_relaxed);
+        newRoot->children[0].store(node, std::memory_order_relaxed);
+        newRoot->children[1].store(right, std::memory_order_relaxed);
+        newRoot->count.store(1, std::memory_order_relaxed);
+        root.store(newRoot, std::memory_order_release);
+        return;
+    }
+
+    // The parent was not full when the descent passed it and has not changed since.
+    int total = parent->Count();
+    int pos = Search(parent->keys, total, separator, true);
+    for (int i = total; i > pos; --i) {
+        parent->keys[i].store(LoadKey(parent->keys[i - 1]), std::memory_order_relaxed);
+        parent->children[i + 1].store(parent->children[i].load(std::memory_order_relaxed),
+                                      std::memory_order_relaxed);
+    }
+    parent->keys[pos].store(separator, std::memory_order_relaxed);
+    parent->children[pos + 1].store(right, std::memory_order_release);
+    parent->count.store(total + 1, std::memory_order_relaxed);
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::TryRead(const TKey &key, bool &found, TElement &value) const {
+    uint64_t version;
+    const Leaf *leaf = Descend(&key, version, nullptr, nullptr);
+    if (!leaf)
+        return false;
+
+    int total = leaf->Count();
+    int pos = Search(leaf->keys, total, key, false);
+    found = pos < total && LoadKey(leaf->keys[pos]) == key;
+    if (found)
+        value = LoadValue(leaf->values[pos]);
+    return leaf->Validate(version);
+}
+
+template<typename TKey, typename TElement>
+size_t ConcurrentBTree<TKey, TElement>::GetCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+template<typename TKey, typename TElement>
+size_t ConcurrentBTree<TKey, TElement>::GetCapacity() const {
+    return leafCount.load(std::memory_order_relaxed) * kLeafCapacity;
+}
+
+template<typename TKey, typename TElement>
+int ConcurrentBTree<TKey, TElement>::GetHeight() const {
+    while (true) {
+        Node *node = root.load(std::memory_order_acquire);
+        uint64_t version;
+        if (!node->ReadLock(version) || node != root.load(std::memory_order_acquire)) {
+            Restart();
+            continue;
+        }
+        // Every leaf is at the same depth and nodes never leave the tree, so following
+        // the first children needs no validation.
+        int height = 1;
+        while (!node->isLeaf) {
+            node = static_cast<Inner *>(node)->children[0].load(std::memory_order_acquire);
+            ++height;
+        }
+        return height;
+    }
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    bool found;
+    TElement value = TElement();
+    while (!TryRead(key, found, value))
+        Restart();
+    if (found)
+        element = value;
+    return found;
+}
+
+template<typename TKey, typename TElement>
+TElement ConcurrentBTree<TKey, TElement>::Get(const TKey &key) const {
+    TElement value;
+    if (!TryGet(key, value))
+        throw std::runtime_error("Key not found.");
+    return value;
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::ContainsKey(const TKey &key) const {
+    TElement value;
+    return TryGet(key, value);
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    return WithLockedLeaf(key, true, [&](Leaf *leaf) {
+        int total = leaf->Count();
+        int pos = Search(leaf->keys, total, key, false);
+        if (pos < total && LoadKey(leaf->keys[pos]) == key) {
+            StoreValue(leaf->values[pos], element);
+            return false;
+        }
+        for (int i = total; i > pos; --i) {
+            leaf->keys[i].store(LoadKey(leaf->keys[i - 1]), std::memory_order_relaxed);
+            StoreValue(leaf->values[i], LoadValue(leaf->values[i - 1]));
+        }
+        leaf->keys[pos].store(key, std::memory_order_relaxed);
+        StoreValue(leaf->values[pos], element);
+        leaf->count.store(total + 1, std::memory_order_relaxed);
+        ++count;
+        return true;
+    });
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Update(const TKey &key, const TElement &element) {
+    bool updated = WithLockedLeaf(key, false, [&](Leaf *leaf) {
+        int total = leaf->Count();
+        int pos = Search(leaf->keys, total, key, false);
+        if (pos == total || !(LoadKey(leaf->keys[pos]) == key))
+            return false;
+        StoreValue(leaf->values[pos], element);
+        return true;
+    });
+    if (!updated)
+        throw std::runtime_error("Key not found.");
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::TryRemove(const TKey &key) {
+    return WithLockedLeaf(key, false, [&](Leaf *leaf) {
+        int total = leaf->Count();
+        int pos = Search(leaf->keys, total, key, false);
+        if (pos == total || !(LoadKey(leaf->keys[pos]) == key))
+            return false;
+        for (int i = pos + 1; i < total; ++i) {
+            leaf->keys[i - 1].store(LoadKey(leaf->keys[i]), std::memory_order_relaxed);
+            StoreValue(leaf->values[i - 1], LoadValue(leaf->values[i]));
+        }
+        leaf->count.store(total - 1, std::memory_order_relaxed);
+        --count;
+        return true;
+    });
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+// The pointer is only meant for a caller that has the tree to itself.
+template<typename TKey, typename TElement>
+TElement *ConcurrentBTree<TKey, TElement>::FindSlot(const TKey &key) const {
+    while (true) {
+        uint64_t version;
+        Leaf *leaf = Descend(&key, version, nullptr, nullptr);
+        if (!leaf) {
+            Restart();
+            continue;
+        }
+        int total = leaf->Count();
+        int pos = Search(leaf->keys, total, key, false);
+        bool found = pos < total && LoadKey(leaf->keys[pos]) == key;
+        if (!leaf->Validate(version)) {
+            Restart();
+            continue;
+        }
+        return found ? &leaf->values[pos] : nullptr;
+    }
+}
+
+template<typename TKey, typename TElement>
+TElement *ConcurrentBTree<TKey, TElement>::FindPtr(const TKey &key) {
+    return FindSlot(key);
+}
+
+template<typename TKey, typename TElement>
+const TElement *ConcurrentBTree<TKey, TElement>::FindPtr(const TKey &key) const {
+    return FindSlot(key);
+}
+
+template<typename TKey, typename TElement>
+TElement &ConcurrentBTree<TKey, TElement>::GetOrAdd(const TKey &key) {
+    TElement *value = FindSlot(key);
+    if (value)
+        return *value;
+    Upsert(key, TElement());
+    return *FindSlot(key);
+}
+
+// Walks the leaves through Descend, one per separator. Each leaf is write-locked while the
+// visitor rewrites copies of its values, which are then stored back, so the visit can run
+// alongside other readers and writers.
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    TKey keys[kLeafCapacity];
+    TElement copies[kLeafCapacity];
+    TElement *values[kLeafCapacity];
+    for (int i = 0; i < kLeafCapacity; ++i)
+        values[i] = &copies[i];
+
+    TKey start = TKey();
+    bool hasStart = false;
+    while (true) {
+        TKey fence;
+        bool hasFence;
+        uint64_t version;
+        // An unchanged version also means the fence still bounds the leaf.
+        Leaf *leaf = Descend(hasStart ? &start : nullptr, version, &fence, &hasFence);
+        if (!leaf || !leaf->Upgrade(version)) {
+            Restart();
+            continue;
+        }
+        int total = leaf->Count();
+        for (int i = 0; i < total; ++i) {
+            keys[i] = LoadKey(leaf->keys[i]);
+            copies[i] = LoadValue(leaf->values[i]);
+        }
+        try {
+            if (total > 0)
+                visitor.Visit(keys, values, static_cast<size_t>(total));
+        } catch (...) {
+            leaf->WriteUnlock();
+            throw;
+        }
+        for (int i = 0; i < total; ++i)
+            StoreValue(leaf->values[i], copies[i]);
+        leaf->WriteUnlock();
+
+        if (!hasFence)
+            return;
+        start = fence;
+        hasStart = true;
+    }
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ConcurrentBTree<TKey, TElement>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, nullptr, true, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ConcurrentBTree<TKey, TElement>::LowerBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &key, true, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ConcurrentBTree<TKey, TElement>::UpperBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &key, false, nullptr));
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ConcurrentBTree<TKey, TElement>::GetRange(const TKey &lo,
+                                                                                     const TKey &hi) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new LeafIterator(this, &lo, true, &hi));
+}
+
+template<typename TKey, typename TElement>
+ConcurrentBTree<TKey, TElement>::LeafIterator::LeafIterator(const ConcurrentBTree *tree, const TKey *lo,
+                                                            bool inclusive, const TKey *hi)
+        : tree(tree), hasStart(lo != nullptr), start(lo ? *lo : TKey()), startInclusive(inclusive),
+          hasHi(hi != nullptr), hi(hi ? *hi : TKey()) {
+    Reset();
+}
+
+// Copies the entries past the current position from the next leaf that has any, retrying
+// a leaf whose version changed during the copy. After a leaf the iteration continues at
+// its upper separator; false once there is none or `hi` has been reached.
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::LeafIterator::LoadNextLeaf() {
+    entries.clear();
+    index = 0;
+    while (entries.empty() && !finished) {
+        TKey fence;
+        bool hasFence;
+        uint64_t version;
+        const Leaf *leaf = tree->Descend(hasNext ? &next : nullptr, version, &fence, &hasFence);
+        if (!leaf) {
+            Restart();
+            continue;
+        }
+
+        bool reachedHi = false;
+        int total = leaf->Count();
+        for (int i = 0; i < total; ++i) {
+            TKey key = LoadKey(leaf->keys[i]);
+            if (hasNext && (nextInclusive ? key < next : !(next < key)))
+                continue;
+            if (hasHi && !(key < hi)) {
+                reachedHi = true;
+                break;
+            }
+            entries.push_back(KeyValue<TKey, TElement>(key, LoadValue(leaf->values[i])));
+        }
+        if (!leaf->Validate(version)) {
+            entries.clear();
+            Restart();
+            continue;
+        }
+
+        if (reachedHi || !hasFence || (hasHi && !(fence < hi))) {
+            finished = true;
+        } else {
+            hasNext = true;
+            next = fence;
+            nextInclusive = true;
+        }
+    }
+    return !entries.empty();
+}
+
+template<typename TKey, typename TElement>
+bool ConcurrentBTree<TKey, TElement>::LeafIterator::MoveNext() {
+    if (started && index < entries.size())
+        ++index;
+    started = true;
+    return index < entries.size() || LoadNextLeaf();
+}
+
+template<typename TKey, typename TElement>
+size_t ConcurrentBTree<TKey, TElement>::LeafIterator::NextBatch(TKey *keys, TElement *values, size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && LeafIterator::MoveNext()) {
+        size_t run = entries.size() - index;
+        if (run > capacity - copied)
+            run = capacity - copied;
+        for (size_t i = 0; i < run; ++i) {
+            keys[copied + i] = entries[index + i].key;
+            values[copied + i] = entries[index + i].value;
+        }
+        copied += run;
+        index += run - 1;
+    }
+    return copied;
+}
+
+template<typename TKey, typename TElement>
+void ConcurrentBTree<TKey, TElement>::LeafIterator::Reset() {
+    hasNext = hasStart;
+    next = start;
+    nextInclusive = startInclusive;
+    finished = false;
+    entries.clear();
+    index = 0;
+    started = false;
+}
+
+template<typename TKey, typename TElement>
+TKey ConcurrentBTree<TKey, TElement>::LeafIterator::GetCurrentKey() const {
+    if (!started || index >= entries.size())
+        throw std::out_of_range("Iterator out of range");
+    return entries[index].key;
+}
+
+template<typename TKey, typename TElement>
+TElement ConcurrentBTree<TKey, TElement>::LeafIterator::GetCurrentValue() const {
+    if (!started || index >= entries.size())
+        throw std::out_of_range("Iterator out of range");
+    return entries[index].value;
+}
+
+#endif // CONCURRENTBTREE_H
@@ -0,0 +1,343 @@
+#ifndef CSRMATRIX_H
+#define CSRMATRIX_H
+
+#include "IDictionary.h"
+#include "IOrderedDictionary.h"
+#include "IndexPair.h"
+#include "KeyValue.h"
+#include "KeySearch.h"
+#include "SparseMatrix.h"
+#include "UnqPtr.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// Compressed sparse row storage: the nonzeros of row r are positions
+// rowPointers[r] .. rowPointers[r + 1] - 1 of the parallel columnIndices and values
+// arrays, sorted by column. A nonzero costs one int and one TElement, and a row is a
+// contiguous run, so scans read memory sequentially. The structure is append-only:
+// rows are added at the bottom, and existing entries can only change value or, through
+// Map, drop out when they become zero.
+template<typename TElement>
+class CsrMatrix {
+public:
+    // An empty matrix with no rows; rows are added with AppendRow.
+    explicit CsrMatrix(int columns)
+            : rows(0), columns(columns), rowPointers(1, 0)
+    {
+        if (columns < 0)
+        {
+            throw std::invalid_argument("Column count must not be negative.");
+        }
+    }
+
+    // Takes over ready CSR arrays after checking that they describe a valid matrix.
+    CsrMatrix(int rows, int columns, std::vector<size_t> rowPointers, std::vector<int> columnIndices,
+              std::vector<TElement> values)
+            : rows(rows), columns(columns), rowPointers(std::move(rowPointers)),
+              columnIndices(std::move(columnIndices)), values(std::move(values))
+    {
+        if (rows < 0 || columns < 0 || this->rowPointers.size() != static_cast<size_t>(rows) + 1 ||
+            this->rowPointers[0] != 0 || this->rowPointers[rows] != this->columnIndices.size() ||
+            this->columnIndices.size() != this->values.size())
+        {
+            throw std::invalid_argument("Inconsistent CSR arrays.");
+        }
+
+        for (int row = 0; row < rows; ++row)
+        {
+            if (this->rowPointers[row] > this->rowPointers[row + 1])
+            {
+                throw std::invalid_argument("Inconsistent CSR arrays.");
+            }
+            for (size_t k = this->rowPointers[row]; k < this->rowPointers[row + 1]; ++k)
+            {
+                int column = this->columnIndices[k];
+                if (column < 0 || column >= columns ||
+                    (k > this->rowPointers[row] && this->columnIndices[k - 1] >= column))
+                {
+                    throw std::invalid_argument("CSR column indices must be in range and increasing within a row.");
+                }
+            }
+        }
+    }
+
+    // Dictionaries that keep IndexPair order are read in a single pass; others are
+    // gathered and sorted first. Explicitly stored zeros are dropped.
+    static CsrMatrix FromSparseMatrix(const SparseMatrix<TElement>& matrix)
+    {
+        const IDictionary<IndexPair, TElement>& elements = matrix.GetElements();
+        std::vector<KeyValue<IndexPair, TElement>> entries;
+        entries.reserve(elements.GetCount());
+
+        auto iterator = elements.GetIterator();
+        ForEachEntry(*iterator, [&entries](const IndexPair& key, const TElement& value) {
+            if (value != TElement())
+            {
+                entries.emplace_back(key, value);
+            }
+        });
+
+        if (!dynamic_cast<const IOrderedDictionary<IndexPair, TElement>*>(&elements))
+        {
+            std::sort(entries.begin(), entries.end(),
+                      [](const KeyValue<IndexPair, TElement>& a, const KeyValue<IndexPair, TElement>& b) {
+                          return a.key < b.key;
+                      });
+        }
+
+        int rows = matrix.GetRows();
+        std::vector<size_t> rowPointers(static_cast<size_t>(rows) + 1, 0);
+        std::vector<int> columnIndices;
+        std::vector<TElement> values;
+        columnIndices.reserve(entries.size());
+        values.reserve(entries.size());
+
+        for (const KeyValue<IndexPair, TElement>& entry : entries)
+        {
+            ++rowPointers[entry.key.row + 1];
+            columnIndices.push_back(entry.key.column);
+            values.push_back(entry.value);
+        }
+        for (int row = 0; row < rows; ++row)
+        {
+            rowPointers[row + 1] += rowPointers[row];
+        }
+
+        CsrMatrix result(matrix.GetColumns());
+        result.rows = rows;
+        result.rowPointers = std::move(rowPointers);
+        result.columnIndices = std::move(columnIndices);
+        result.values = std::move(values);
+        return result;
+    }
+
+    // Copies the nonzeros into the given dictionary with one sorted bulk load.
+    SparseMatrix<TElement> ToSparseMatrix(UnqPtr<IDictionary<IndexPair, TElement>> dictionary) const
+    {
+        std::vector<KeyValue<IndexPair, TElement>> entries;
+        entries.reserve(values.size());
+        for (int row = 0; row < rows; ++row)
+        {
+            for (size_t k = rowPointers[row]; k < rowPointers[row + 1]; ++k)
+            {
+                entries.emplace_back(IndexPair(row, columnIndices[k]), values[k]);
+            }
+        }
+        return SparseMatrix<TElement>(rows, columns, std::move(dictionary), entries.data(), entries.size(), true);
+    }
+
+    int GetRows() const
+    {
+        return rows;
+    }
+
+    int GetColumns() const
+    {
+        return columns;
+    }
+
+    size_t GetNonZeroCount() const
+    {
+        return values.size();
+    }
+
+    // Appends a row whose entries have strictly increasing columns; zeros are skipped.
+    void AppendRow(const KeyValue<int, TElement>* entries, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (entries[i].key < 0 || entries[i].key >= columns || (i > 0 && entries[i - 1].key >= entries[i].key))
+            {
+                throw std::invalid_argument("Row entries must have increasing columns within bounds.");
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (entries[i].value != TElement())
+            {
+                columnIndices.push_back(entries[i].key);
+                values.push_back(entries[i].value);
+            }
+        }
+        rowPointers.push_back(values.size());
+        ++rows;
+    }
+
+    TElement GetElement(int row, int column) const
+    {
+        if (row < 0 || row >= rows || column < 0 || column >= columns)
+        {
+            throw std::out_of_range("Row or column index is out of bounds.");
+        }
+
+        size_t begin = rowPointers[row];
+        int length = static_cast<int>(rowPointers[row + 1] - begin);
+        int index = KeySearch<int>::LowerBound(columnIndices.data() + begin, length, column);
+        if (index < length && columnIndices[begin + index] == column)
+        {
+            return values[begin + index];
+        }
+        return TElement();
+    }
+
+    template<typename TFunc>
+    void ForEach(TFunc func) const
+    {
+        for (int row = 0; row < rows; ++row)
+        {
+            for (size_t k = rowPointers[row]; k < rowPointers[row + 1]; ++k)
+            {
+                func(IndexPair(row, columnIndices[k]), values[k]);
+            }
+        }
+    }
+
+    // Applies the function to every stored value in place. Entries that map to zero are
+    // dropped, as SparseMatrix::Map drops them, by compacting each row over its zeros.
+    template<typename TFunc>
+    void Map(TFunc func)
+    {
+        size_t kept = 0;
+        size_t begin = 0;
+        for (int row = 0; row < rows; ++row)
+        {
+            size_t end = rowPointers[row + 1];
+            for (size_t k = begin; k < end; ++k)
+            {
+                TElement value = func(values[k]);
+                if (value != TElement())
+                {
+                    columnIndices[kept] = columnIndices[k];
+                    values[kept] = value;
+                    ++kept;
+                }
+            }
+            begin = end;
+            rowPointers[row + 1] = kept;
+        }
+        columnIndices.resize(kept);
+        values.resize(kept);
+    }
+
+    template<typename TFunc>
+    TElement Reduce(TFunc func, TElement initial) const
+    {
+        TElement result = initial;
+        for (const TElement& value : values)
+        {
+            result = func(result, value);
+        }
+        return result;
+    }
+
+    UnqPtr<IDictionaryIterator<IndexPair, TElement>> GetIterator() const
+    {
+        return UnqPtr<IDictionaryIterator<IndexPair, TElement>>(new CsrIterator(this, 0, rows));
+    }
+
+    UnqPtr<IDictionaryIterator<IndexPair, TElement>> GetRowIterator(int row) const
+    {
+        if (row < 0 || row >= rows)
+        {
+            throw std::out_of_range("Row index is out of bounds.");
+        }
+        return UnqPtr<IDictionaryIterator<IndexPair, TElement>>(new CsrIterator(this, row, row + 1));
+    }
+
+    const std::vector<size_t>& GetRowPointers() const
+    {
+        return rowPointers;
+    }
+
+    const std::vector<int>& GetColumnIndices() const
+    {
+        return columnIndices;
+    }
+
+    const std::vector<TElement>& GetValues() const
+    {
+        return values;
+    }
+
+private:
+    int rows;
+    int columns;
+    std::vector<size_t> rowPointers;
+    std::vector<int> columnIndices;
+    std::vector<TElement> values;
+
+    // Walks rows [firstRow, endRow) in storage order.
+    class CsrIterator : public IDictionaryIterator<IndexPair, TElement>
+    {
+    public:
+        CsrIterator(const CsrMatrix* matrix, int firstRow, int endRow)
+                : matrix(matrix), firstRow(firstRow), endRow(endRow)
+        {
+            Reset();
+        }
+
+        bool MoveNext() override
+        {
+            if (started)
+            {
+                ++position;
+            }
+            started = true;
+
+            while (row < endRow && position >= matrix->rowPointers[row + 1])
+            {
+                ++row;
+            }
+            return row < endRow;
+        }
+
+        void Reset() override
+        {
+            row = firstRow;
+            position = matrix->rowPointers[firstRow];
+            started = false;
+        }
+
+        IndexPair GetCurrentKey() const override
+        {
+            if (!started || row >= endRow)
+            {
+                throw std::out_of_range("Iterator out of range");
+            }
+            return IndexPair(row, matrix->columnIndices[position]);
+        }
+
+        TElement GetCurrentValue() const override
+        {
+            if (!started || row >= endRow)
+            {
+                throw std::out_of_range("Iterator out of range");
+            }
+            return matrix->values[position];
+        }
+
+        size_t NextBatch(IndexPair* keys, TElement* values, size_t capacity) override
+        {
+            size_t copied = 0;
+            while (copied < capacity && CsrIterator::MoveNext())
+            {
+                keys[copied] = IndexPair(row, matrix->columnIndices[position]);
+                values[copied] = matrix->values[position];
+                ++copied;
+            }
+            return copied;
+        }
+
+    private:
+        const CsrMatrix* matrix;
+        int firstRow;
+        int endRow;
+        int row;
+        size_t position;
+        bool started;
+    };
+};
+
+#endif // CSRMATRIX_H
@@ -0,0 +1,518 @@
+#ifndef FLATHASHTABLE_H
+#define FLATHASHTABLE_H
+
+#include "IDictionary.h"
+#include "UnqPtr.h"
+#include "IndexPair.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing hash table in the "Swiss table" layout: keys, values and one-byte
+// control tags live in three flat arrays. Each slot's tag holds the low 7 bits of the
+// key's hash (or an empty/deleted marker), so a probe compares a whole group of tags
+// with a single SIMD instruction and only touches keys whose tag matched.
+template<typename TKey, typename TElement>
+class FlatHashTable : public IDictionary<TKey, TElement> {
+public:
+    FlatHashTable(size_t initialCapacity = 16);
+
+    virtual ~FlatHashTable();
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+private:
+    static constexpr int8_t kEmpty = -128;
+    static constexpr int8_t kDeleted = -2;
+
+    struct Group;
+
+    UnqPtr<int8_t[]> control;
+    UnqPtr<TKey[]> keys;
+    UnqPtr<TElement[]> values;
+    size_t count;
+    size_t tombstones;
+    size_t capacity;
+
+    size_t HashFunction(const TKey &key) const;
+
+    size_t FindIndex(const TKey &key, size_t hash) const;
+
+    size_t FindInsertSlot(size_t hash) const;
+
+    size_t Insert(const TKey &key, size_t hash);
+
+    void Resize(size_t newCapacity);
+
+    void VisitSlots(IEntryVisitor<TKey, TElement> &visitor, size_t firstSlot, size_t endSlot);
+
+    class FlatHashTableIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        FlatHashTableIterator(const FlatHashTable *hashTable, size_t firstSlot = 0, size_t endSlot = SIZE_MAX);
+
+        virtual ~FlatHashTableIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const FlatHashTable *hashTable;
+        size_t firstSlot;
+        size_t endSlot;
+        size_t slot;
+        bool started;
+    };
+};
+
+// Bitmask queries over one group of control bytes. Bit i of a result refers to slot
+// (group start + i). The group width is 32 with AVX2, 16 with SSE2 and on the portable path.
+template<typename TKey, typename TElement>
+struct FlatHashTable<TKey, TElement>::Group {
+#if defined(__AVX2__)
+    static constexpr size_t kWidth = 32;
+
+    __m256i ctrl;
+
+    explicit Group(const int8_t *pos)
+            : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pos))) {}
+
+    uint32_t Match(int8_t tag) const {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(tag), ctrl)));
+    }
+
+    uint32_t MatchEmpty() const {
+        return Match(kEmpty);
+    }
+
+    uint32_t MatchEmptyOrDeleted() const {
+        return static_cast<uint32_t>(_mm256_movemask_epi8(ctrl));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    static constexpr size_t kWidth = 16;
+
+    __m128i ctrl;
+
+    explicit Group(const int8_t *pos)
+            : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+    uint32_t Match(int8_t tag) const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl)));
+    }
+
+    uint32_t MatchEmpty() const {
+        return Match(kEmpty);
+    }
+
+    uint32_t MatchEmptyOrDeleted() const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+#else
+    static constexpr size_t kWidth = 16;
+
+    int8_t ctrl[kWidth];
+
+    explicit Group(const int8_t *pos) {
+        std::memcpy(ctrl, pos, kWidth);
+    }
+
+    uint32_t Match(int8_t tag) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kWidth; ++i) {
+            if (ctrl[i] == tag)
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+
+    uint32_t MatchEmpty() const {
+        return Match(kEmpty);
+    }
+
+    uint32_t MatchEmptyOrDeleted() const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kWidth; ++i) {
+            if (ctrl[i] < 0)
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+#endif
+
+    static int LowestBit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(mask);
+#else
+        int bit = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+};
+
+template<typename TKey, typename TElement>
+FlatHashTable<TKey, TElement>::FlatHashTable(size_t initialCapacity)
+        : count(0), tombstones(0), capacity(Group::kWidth) {
+    while (capacity < initialCapacity)
+        capacity *= 2;
+
+    control.reset(new int8_t[capacity]);
+    keys.reset(new TKey[capacity]);
+    values.reset(new TElement[capacity]);
+    std::memset(control.get(), kEmpty, capacity);
+}
+
+template<typename TKey, typename TElement>
+FlatHashTable<TKey, TElement>::~FlatHashTable() {
+
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::GetCount() const {
+    return count;
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::GetCapacity() const {
+    return capacity;
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::HashFunction(const TKey &key) const {
+    uint64_t hash;
+    if constexpr (std::is_same<TKey, IndexPair>::value) {
+        hash = IndexPairHash()(key);
+    } else {
+        hash = std::hash<TKey>()(key);
+    }
+
+    // std::hash<int> is the identity, so spread the bits before splitting the hash
+    // into a group index (high part) and a 7-bit tag (low part).
+    hash *= 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 32;
+    return static_cast<size_t>(hash);
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::FindIndex(const TKey &key, size_t hash) const {
+    const int8_t tag = static_cast<int8_t>(hash & 0x7F);
+    const size_t groupMask = capacity / Group::kWidth - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t step = 1; step <= groupMask + 1; ++step) {
+        const size_t base = group * Group::kWidth;
+        Group g(control.get() + base);
+
+        for (uint32_t mask = g.Match(tag); mask != 0; mask &= mask - 1) {
+            size_t index = base + Group::LowestBit(mask);
+            if (keys[index] == key)
+                return index;
+        }
+
+        if (g.MatchEmpty() != 0)
+            return capacity;
+
+        group = (group + step) & groupMask;
+    }
+
+    return capacity;
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::FindInsertSlot(size_t hash) const {
+    const size_t groupMask = capacity / Group::kWidth - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t step = 1;; ++step) {
+        const size_t base = group * Group::kWidth;
+        uint32_t mask = Group(control.get() + base).MatchEmptyOrDeleted();
+        if (mask != 0)
+            return base + Group::LowestBit(mask);
+
+        group = (group + step) & groupMask;
+    }
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::Insert(const TKey &key, size_t hash) {
+    if ((count + tombstones + 1) * 8 > capacity * 7) {
+        Resize(count * 2 >= capacity ? capacity * 2 : capacity);
+    }
+
+    size_t index = FindInsertSlot(hash);
+    if (control[index] == kDeleted)
+        --tombstones;
+
+    control[index] = static_cast<int8_t>(hash & 0x7F);
+    keys[index] = key;
+    ++count;
+    return index;
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement>
+bool FlatHashTable<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    size_t hash = HashFunction(key);
+    size_t index = FindIndex(key, hash);
+    if (index != capacity) {
+        values[index] = element;
+        return false;
+    }
+
+    values[Insert(key, hash)] = element;
+    return true;
+}
+
+template<typename TKey, typename TElement>
+TElement &FlatHashTable<TKey, TElement>::GetOrAdd(const TKey &key) {
+    size_t hash = HashFunction(key);
+    size_t index = FindIndex(key, hash);
+    if (index != capacity)
+        return values[index];
+
+    index = Insert(key, hash);
+    values[index] = TElement();
+    return values[index];
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+template<typename TKey, typename TElement>
+bool FlatHashTable<TKey, TElement>::TryRemove(const TKey &key) {
+    size_t index = FindIndex(key, HashFunction(key));
+    if (index == capacity)
+        return false;
+
+    // A probe for any key stops at the first group with an empty slot, so if this
+    // group still has one no probe sequence continues past it and the slot can be
+    // reused outright instead of leaving a tombstone.
+    size_t base = index - index % Group::kWidth;
+    if (Group(control.get() + base).MatchEmpty() != 0) {
+        control[index] = kEmpty;
+    } else {
+        control[index] = kDeleted;
+        ++tombstones;
+    }
+
+    keys[index] = TKey();
+    values[index] = TElement();
+    --count;
+    return true;
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::Update(const TKey &key, const TElement &element) {
+    TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+
+    *value = element;
+}
+
+template<typename TKey, typename TElement>
+const TElement *FlatHashTable<TKey, TElement>::FindPtr(const TKey &key) const {
+    size_t index = FindIndex(key, HashFunction(key));
+    return index != capacity ? &values[index] : nullptr;
+}
+
+template<typename TKey, typename TElement>
+TElement *FlatHashTable<TKey, TElement>::FindPtr(const TKey &key) {
+    return const_cast<TElement *>(static_cast<const FlatHashTable *>(this)->FindPtr(key));
+}
+
+template<typename TKey, typename TElement>
+bool FlatHashTable<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        return false;
+
+    element = *value;
+    return true;
+}
+
+template<typename TKey, typename TElement>
+bool FlatHashTable<TKey, TElement>::ContainsKey(const TKey &key) const {
+    return FindPtr(key) != nullptr;
+}
+
+template<typename TKey, typename TElement>
+TElement FlatHashTable<TKey, TElement>::Get(const TKey &key) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+
+    return *value;
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::Resize(size_t newCapacity) {
+    UnqPtr<int8_t[]> oldControl(std::move(control));
+    UnqPtr<TKey[]> oldKeys(std::move(keys));
+    UnqPtr<TElement[]> oldValues(std::move(values));
+    size_t oldCapacity = capacity;
+
+    control.reset(new int8_t[newCapacity]);
+    keys.reset(new TKey[newCapacity]);
+    values.reset(new TElement[newCapacity]);
+    std::memset(control.get(), kEmpty, newCapacity);
+    capacity = newCapacity;
+    tombstones = 0;
+
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldControl[i] < 0)
+            continue;
+
+        size_t hash = HashFunction(oldKeys[i]);
+        size_t index = FindInsertSlot(hash);
+        control[index] = static_cast<int8_t>(hash & 0x7F);
+        keys[index] = std::move(oldKeys[i]);
+        values[index] = std::move(oldValues[i]);
+    }
+}
+
+template<typename TKey, typename TElement>
+FlatHashTable<TKey, TElement>::FlatHashTableIterator::FlatHashTableIterator(const FlatHashTable *hashTable,
+                                                                            size_t firstSlot, size_t endSlot)
+        : hashTable(hashTable), firstSlot(firstSlot),
+          endSlot(endSlot < hashTable->capacity ? endSlot : hashTable->capacity), slot(firstSlot), started(false) {
+}
+
+template<typename TKey, typename TElement>
+bool FlatHashTable<TKey, TElement>::FlatHashTableIterator::MoveNext() {
+    if (started)
+        ++slot;
+    started = true;
+
+    while (slot < endSlot) {
+        if (hashTable->control[slot] >= 0)
+            return true;
+        ++slot;
+    }
+
+    return false;
+}
+
+template<typename TKey, typename TElement>
+size_t FlatHashTable<TKey, TElement>::FlatHashTableIterator::NextBatch(TKey *keys, TElement *values,
+                                                                       size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && FlatHashTableIterator::MoveNext()) {
+        keys[copied] = hashTable->keys[slot];
+        values[copied] = hashTable->values[slot];
+        ++copied;
+    }
+    return copied;
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::FlatHashTableIterator::Reset() {
+    slot = firstSlot;
+    started = false;
+}
+
+template<typename TKey, typename TElement>
+TKey FlatHashTable<TKey, TElement>::FlatHashTableIterator::GetCurrentKey() const {
+    if (!started || slot >= endSlot)
+        throw std::out_of_range("Iterator out of range");
+    return hashTable->keys[slot];
+}
+
+template<typename TKey, typename TElement>
+TElement FlatHashTable<TKey, TElement>::FlatHashTableIterator::GetCurrentValue() const {
+    if (!started || slot >= endSlot)
+        throw std::out_of_range("Iterator out of range");
+    return hashTable->values[slot];
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> FlatHashTable<TKey, TElement>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new FlatHashTableIterator(this));
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    VisitSlots(visitor, 0, capacity);
+}
+
+// Part p holds the slots [capacity * p / parts, capacity * (p + 1) / parts).
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> FlatHashTable<TKey, TElement>::GetPartIterator(int part,
+                                                                                           int parts) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(
+            new FlatHashTableIterator(this, capacity * part / parts, capacity * (part + 1) / parts));
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) {
+    VisitSlots(visitor, capacity * part / parts, capacity * (part + 1) / parts);
+}
+
+template<typename TKey, typename TElement>
+void FlatHashTable<TKey, TElement>::VisitSlots(IEntryVisitor<TKey, TElement> &visitor, size_t firstSlot,
+                                               size_t endSlot) {
+    EntryBatch<TKey, TElement> batch(visitor);
+    for (size_t slot = firstSlot; slot < endSlot; ++slot) {
+        if (control[slot] >= 0)
+            batch.Add(keys[slot], &values[slot]);
+    }
+    batch.Flush();
+}
+
+#endif // FLATHASHTABLE_H
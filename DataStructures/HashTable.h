@@ -7,6 +7,7 @@
 #include "ShrdPtr.h"
 #include "UnqPtr.h"
 #include "IndexPair.h"
+#include <cstdint>
 #include <functional>
 #include <stdexcept>
 #include <type_traits>
@@ -14,7 +15,7 @@
 template<typename TKey, typename TElement>
 class HashTable : public IDictionary<TKey, TElement> {
 public:
-    HashTable(size_t initialCapacity = 16);
+    HashTable(size_t initialCapacity = 16, bool incrementalRehash = false);
 
     virtual ~HashTable();
 
@@ -32,8 +33,32 @@ public:
 
     virtual void Update(const TKey &key, const TElement &element) override;
 
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual void BulkLoad(const KeyValue<TKey, TElement> *items, size_t itemCount) override;
+
+    virtual void BulkInsert(const KeyValue<TKey, TElement> *items, size_t itemCount) override;
+
     virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
 
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+    bool IsRehashing() const;
+
 private:
     struct KeyValuePair {
         TKey key;
@@ -42,17 +67,45 @@ private:
         KeyValuePair(const TKey &k, const TElement &v) : key(k), value(v) {}
     };
 
+    // Number of old buckets moved to the new table by each mutating call while an
+    // incremental rehash is in progress. Migration must finish before the new table
+    // reaches the load limit (0.75 * capacity inserts away), which needs > 4/3 per call.
+    static constexpr size_t kMigrationStep = 4;
+
     UnqPtr<DynamicArraySmart<LinkedListSmart<KeyValuePair>>> table;
     size_t count;
     size_t capacity;
 
+    bool incrementalRehash;
+    UnqPtr<DynamicArraySmart<LinkedListSmart<KeyValuePair>>> oldTable;
+    size_t oldCapacity;
+    size_t migrateIndex;
+
     size_t HashFunction(const TKey &key) const;
 
+    int FindInChain(const LinkedListSmart<KeyValuePair> &chain, const TKey &key) const;
+
+    LinkedListSmart<KeyValuePair> *FindChain(const TKey &key, size_t hash, int &position) const;
+
+    TElement &Insert(const TKey &key, const TElement &element, size_t hash);
+
     void Rehash();
 
+    void RehashTo(size_t newCapacity);
+
+    void BeginRehash();
+
+    void MigrateStep(size_t buckets);
+
+    size_t GetBucketCount() const;
+
+    LinkedListSmart<KeyValuePair> &GetBucket(size_t index) const;
+
+    void VisitBuckets(IEntryVisitor<TKey, TElement> &visitor, size_t firstBucket, size_t endBucket);
+
     class HashTableIterator : public IDictionaryIterator<TKey, TElement> {
     public:
-        HashTableIterator(const HashTable *hashTable);
+        HashTableIterator(const HashTable *hashTable, size_t firstBucket = 0, size_t endBucket = SIZE_MAX);
 
         virtual ~HashTableIterator() {}
 
@@ -64,17 +117,23 @@ private:
 
         virtual TElement GetCurrentValue() const override;
 
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
     private:
         const HashTable *hashTable;
+        size_t firstBucket;
+        size_t endBucket;
         size_t bucketIndex;
         int listIndex;
+
+        size_t GetEndBucket() const;
     };
 };
 
 template<typename TKey, typename TElement>
-HashTable<TKey, TElement>::HashTable(size_t initialCapacity)
+HashTable<TKey, TElement>::HashTable(size_t initialCapacity, bool incrementalRehash)
         : table(new DynamicArraySmart<LinkedListSmart<KeyValuePair>>(static_cast<int>(initialCapacity))), count(0),
-          capacity(initialCapacity) {
+          capacity(initialCapacity), incrementalRehash(incrementalRehash), oldCapacity(0), migrateIndex(0) {
     for (size_t i = 0; i < capacity; ++i) {
         table->Append(LinkedListSmart<KeyValuePair>());
     }
@@ -105,87 +164,211 @@ size_t HashTable<TKey, TElement>::HashFunction(const TKey &key) const {
 }
 
 template<typename TKey, typename TElement>
-void HashTable<TKey, TElement>::Add(const TKey &key, const TElement &element) {
-    size_t index = HashFunction(key) % capacity;
-    LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(index));
+bool HashTable<TKey, TElement>::IsRehashing() const {
+    return static_cast<bool>(oldTable);
+}
 
+template<typename TKey, typename TElement>
+int HashTable<TKey, TElement>::FindInChain(const LinkedListSmart<KeyValuePair> &chain, const TKey &key) const {
     for (int i = 0; i < chain.GetLength(); ++i) {
         if (chain.Get(i).key == key) {
-            chain.Get(i).value = element;
-            return;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+template<typename TKey, typename TElement>
+LinkedListSmart<typename HashTable<TKey, TElement>::KeyValuePair> *
+HashTable<TKey, TElement>::FindChain(const TKey &key, size_t hash, int &position) const {
+    LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(hash % capacity));
+    position = FindInChain(chain, key);
+    if (position >= 0) {
+        return &chain;
+    }
+
+    if (oldTable) {
+        size_t oldIndex = hash % oldCapacity;
+        if (oldIndex >= migrateIndex) {
+            LinkedListSmart<KeyValuePair> &oldChain = oldTable->Get(static_cast<int>(oldIndex));
+            position = FindInChain(oldChain, key);
+            if (position >= 0) {
+                return &oldChain;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+template<typename TKey, typename TElement>
+TElement &HashTable<TKey, TElement>::Insert(const TKey &key, const TElement &element, size_t hash) {
+    // Grow before appending so the returned reference is not invalidated by the rehash.
+    if (static_cast<double>(count + 1) / capacity > 0.75) {
+        if (incrementalRehash) {
+            BeginRehash();
+        } else {
+            Rehash();
         }
     }
 
+    LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(hash % capacity));
     chain.Append(KeyValuePair(key, element));
     ++count;
 
-    if (static_cast<double>(count) / capacity > 0.75) {
-        Rehash();
+    return chain.GetLast().value;
+}
+
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement>
+bool HashTable<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    if (oldTable) {
+        MigrateStep(kMigrationStep);
+    }
+
+    size_t hash = HashFunction(key);
+    int position;
+    LinkedListSmart<KeyValuePair> *found = FindChain(key, hash, position);
+    if (found) {
+        found->Get(position).value = element;
+        return false;
     }
+
+    Insert(key, element, hash);
+    return true;
+}
+
+template<typename TKey, typename TElement>
+TElement &HashTable<TKey, TElement>::GetOrAdd(const TKey &key) {
+    if (oldTable) {
+        MigrateStep(kMigrationStep);
+    }
+
+    size_t hash = HashFunction(key);
+    int position;
+    LinkedListSmart<KeyValuePair> *found = FindChain(key, hash, position);
+    if (found) {
+        return found->Get(position).value;
+    }
+
+    return Insert(key, TElement(), hash);
 }
 
 template<typename TKey, typename TElement>
 void HashTable<TKey, TElement>::Remove(const TKey &key) {
-    size_t index = HashFunction(key) % capacity;
-    LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(index));
+    if (!TryRemove(key)) {
+        throw std::runtime_error("Key not found.");
+    }
+}
 
-    for (int i = 0; i < chain.GetLength(); ++i) {
-        if (chain.Get(i).key == key) {
-            chain.RemoveAt(i);
-            --count;
-            return;
-        }
+template<typename TKey, typename TElement>
+bool HashTable<TKey, TElement>::TryRemove(const TKey &key) {
+    if (oldTable) {
+        MigrateStep(kMigrationStep);
     }
 
-    throw std::runtime_error("Key not found.");
+    int position;
+    LinkedListSmart<KeyValuePair> *found = FindChain(key, HashFunction(key), position);
+    if (!found) {
+        return false;
+    }
+
+    found->RemoveAt(position);
+    --count;
+    return true;
 }
 
 template<typename TKey, typename TElement>
 void HashTable<TKey, TElement>::Update(const TKey &key, const TElement &element) {
-    size_t index = HashFunction(key) % capacity;
-    LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(index));
+    if (oldTable) {
+        MigrateStep(kMigrationStep);
+    }
 
-    for (int i = 0; i < chain.GetLength(); ++i) {
-        if (chain.Get(i).key == key) {
-            chain.Get(i).value = element;
-            return;
-        }
+    TElement *value = FindPtr(key);
+    if (!value) {
+        throw std::runtime_error("Key not found.");
     }
 
-    throw std::runtime_error("Key not found.");
+    *value = element;
 }
 
 template<typename TKey, typename TElement>
-bool HashTable<TKey, TElement>::ContainsKey(const TKey &key) const {
-    size_t index = HashFunction(key) % capacity;
-    const LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(index));
+const TElement *HashTable<TKey, TElement>::FindPtr(const TKey &key) const {
+    int position;
+    LinkedListSmart<KeyValuePair> *found = FindChain(key, HashFunction(key), position);
+    return found ? &found->Get(position).value : nullptr;
+}
 
-    for (int i = 0; i < chain.GetLength(); ++i) {
-        if (chain.Get(i).key == key) {
-            return true;
-        }
+template<typename TKey, typename TElement>
+TElement *HashTable<TKey, TElement>::FindPtr(const TKey &key) {
+    return const_cast<TElement *>(static_cast<const HashTable *>(this)->FindPtr(key));
+}
+
+template<typename TKey, typename TElement>
+bool HashTable<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    const TElement *value = FindPtr(key);
+    if (!value) {
+        return false;
     }
 
-    return false;
+    element = *value;
+    return true;
+}
+
+template<typename TKey, typename TElement>
+bool HashTable<TKey, TElement>::ContainsKey(const TKey &key) const {
+    return FindPtr(key) != nullptr;
 }
 
 template<typename TKey, typename TElement>
 TElement HashTable<TKey, TElement>::Get(const TKey &key) const {
-    size_t index = HashFunction(key) % capacity;
-    const LinkedListSmart<KeyValuePair> &chain = table->Get(static_cast<int>(index));
+    const TElement *value = FindPtr(key);
+    if (!value) {
+        throw std::runtime_error("Key not found.");
+    }
 
-    for (int i = 0; i < chain.GetLength(); ++i) {
-        if (chain.Get(i).key == key) {
-            return chain.Get(i).value;
-        }
+    return *value;
+}
+
+// Key order does not matter to a hash table.
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::BulkLoad(const KeyValue<TKey, TElement> *items, size_t itemCount) {
+    BulkInsert(items, itemCount);
+}
+
+// Grows the table once, to the capacity the inserts would double it to, so the load
+// never rehashes midway.
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::BulkInsert(const KeyValue<TKey, TElement> *items, size_t itemCount) {
+    if (oldTable) {
+        MigrateStep(oldCapacity);
     }
 
-    throw std::runtime_error("Key not found.");
+    size_t newCapacity = capacity;
+    while (static_cast<double>(count + itemCount) / newCapacity > 0.75) {
+        newCapacity *= 2;
+    }
+    if (newCapacity != capacity) {
+        RehashTo(newCapacity);
+    }
+
+    for (size_t i = 0; i < itemCount; ++i) {
+        Upsert(items[i].key, items[i].value);
+    }
 }
 
 template<typename TKey, typename TElement>
 void HashTable<TKey, TElement>::Rehash() {
-    size_t newCapacity = capacity * 2;
+    RehashTo(capacity * 2);
+}
+
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::RehashTo(size_t newCapacity) {
     UnqPtr<DynamicArraySmart<LinkedListSmart<KeyValuePair>>> newTable(
             new DynamicArraySmart<LinkedListSmart<KeyValuePair>>(static_cast<int>(newCapacity)));
 
@@ -207,16 +390,59 @@ void HashTable<TKey, TElement>::Rehash() {
 }
 
 template<typename TKey, typename TElement>
-HashTable<TKey, TElement>::HashTableIterator::HashTableIterator(const HashTable *hashTable)
-        : hashTable(hashTable), bucketIndex(0), listIndex(-1) {
+void HashTable<TKey, TElement>::BeginRehash() {
+    if (oldTable) {
+        MigrateStep(oldCapacity);
+    }
+
+    size_t newCapacity = capacity * 2;
+    UnqPtr<DynamicArraySmart<LinkedListSmart<KeyValuePair>>> newTable(
+            new DynamicArraySmart<LinkedListSmart<KeyValuePair>>(static_cast<int>(newCapacity)));
+
+    for (size_t i = 0; i < newCapacity; ++i) {
+        newTable->Append(LinkedListSmart<KeyValuePair>());
+    }
+
+    oldTable = std::move(table);
+    oldCapacity = capacity;
+    migrateIndex = 0;
+    table = std::move(newTable);
+    capacity = newCapacity;
+}
+
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::MigrateStep(size_t buckets) {
+    for (size_t moved = 0; moved < buckets && migrateIndex < oldCapacity; ++moved, ++migrateIndex) {
+        LinkedListSmart<KeyValuePair> &chain = oldTable->Get(static_cast<int>(migrateIndex));
+        for (int j = 0; j < chain.GetLength(); ++j) {
+            const KeyValuePair &kvp = chain.Get(j);
+            size_t index = HashFunction(kvp.key) % capacity;
+            table->Get(static_cast<int>(index)).Append(kvp);
+        }
+        chain = LinkedListSmart<KeyValuePair>();
+    }
+
+    if (migrateIndex == oldCapacity) {
+        oldTable.reset();
+        oldCapacity = 0;
+        migrateIndex = 0;
+    }
+}
+
+template<typename TKey, typename TElement>
+HashTable<TKey, TElement>::HashTableIterator::HashTableIterator(const HashTable *hashTable, size_t firstBucket,
+                                                                size_t endBucket)
+        : hashTable(hashTable), firstBucket(firstBucket), endBucket(endBucket), bucketIndex(firstBucket),
+          listIndex(-1) {
 }
 
 template<typename TKey, typename TElement>
 bool HashTable<TKey, TElement>::HashTableIterator::MoveNext() {
     ++listIndex;
 
-    while (bucketIndex < hashTable->capacity) {
-        LinkedListSmart<KeyValuePair> &chain = hashTable->table->Get(static_cast<int>(bucketIndex));
+    size_t end = GetEndBucket();
+    while (bucketIndex < end) {
+        LinkedListSmart<KeyValuePair> &chain = hashTable->GetBucket(bucketIndex);
         if (listIndex < chain.GetLength()) {
             return true;
         } else {
@@ -228,27 +454,60 @@ bool HashTable<TKey, TElement>::HashTableIterator::MoveNext() {
     return false;
 }
 
+template<typename TKey, typename TElement>
+size_t HashTable<TKey, TElement>::HashTableIterator::NextBatch(TKey *keys, TElement *values, size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && HashTableIterator::MoveNext()) {
+        const KeyValuePair &kvp = hashTable->GetBucket(bucketIndex).Get(listIndex);
+        keys[copied] = kvp.key;
+        values[copied] = kvp.value;
+        ++copied;
+    }
+    return copied;
+}
+
 template<typename TKey, typename TElement>
 void HashTable<TKey, TElement>::HashTableIterator::Reset() {
-    bucketIndex = 0;
+    bucketIndex = firstBucket;
     listIndex = -1;
 }
 
+template<typename TKey, typename TElement>
+size_t HashTable<TKey, TElement>::HashTableIterator::GetEndBucket() const {
+    size_t bucketCount = hashTable->GetBucketCount();
+    return endBucket < bucketCount ? endBucket : bucketCount;
+}
+
+// While an incremental rehash is in progress the buckets of the old table that have
+// not been migrated yet are numbered after the buckets of the new one.
+template<typename TKey, typename TElement>
+size_t HashTable<TKey, TElement>::GetBucketCount() const {
+    return capacity + (oldTable ? oldCapacity : 0);
+}
+
+template<typename TKey, typename TElement>
+LinkedListSmart<typename HashTable<TKey, TElement>::KeyValuePair> &
+HashTable<TKey, TElement>::GetBucket(size_t index) const {
+    if (index < capacity)
+        return table->Get(static_cast<int>(index));
+    return oldTable->Get(static_cast<int>(index - capacity));
+}
+
 template<typename TKey, typename TElement>
 TKey HashTable<TKey, TElement>::HashTableIterator::GetCurrentKey() const {
-    if (bucketIndex >= hashTable->capacity)
+    if (bucketIndex >= GetEndBucket())
         throw std::out_of_range("Iterator out of range");
 
-    const LinkedListSmart<KeyValuePair> &chain = hashTable->table->Get(static_cast<int>(bucketIndex));
+    const LinkedListSmart<KeyValuePair> &chain = hashTable->GetBucket(bucketIndex);
     return chain.Get(listIndex).key;
 }
 
 template<typename TKey, typename TElement>
 TElement HashTable<TKey, TElement>::HashTableIterator::GetCurrentValue() const {
-    if (bucketIndex >= hashTable->capacity)
+    if (bucketIndex >= GetEndBucket())
         throw std::out_of_range("Iterator out of range");
 
-    const LinkedListSmart<KeyValuePair> &chain = hashTable->table->Get(static_cast<int>(bucketIndex));
+    const LinkedListSmart<KeyValuePair> &chain = hashTable->GetBucket(bucketIndex);
     return chain.Get(listIndex).value;
 }
 
@@ -257,4 +516,38 @@ UnqPtr<IDictionaryIterator<TKey, TElement>> HashTable<TKey, TElement>::GetIterat
     return UnqPtr<IDictionaryIterator<TKey, TElement>>(new HashTableIterator(this));
 }
 
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    VisitBuckets(visitor, 0, GetBucketCount());
+}
+
+// Part p holds the buckets [n * p / parts, n * (p + 1) / parts) of the n numbered by
+// GetBucketCount.
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> HashTable<TKey, TElement>::GetPartIterator(int part, int parts) const {
+    size_t bucketCount = GetBucketCount();
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(
+            new HashTableIterator(this, bucketCount * part / parts, bucketCount * (part + 1) / parts));
+}
+
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) {
+    size_t bucketCount = GetBucketCount();
+    VisitBuckets(visitor, bucketCount * part / parts, bucketCount * (part + 1) / parts);
+}
+
+template<typename TKey, typename TElement>
+void HashTable<TKey, TElement>::VisitBuckets(IEntryVisitor<TKey, TElement> &visitor, size_t firstBucket,
+                                             size_t endBucket) {
+    EntryBatch<TKey, TElement> batch(visitor);
+    for (size_t bucket = firstBucket; bucket < endBucket; ++bucket) {
+        LinkedListSmart<KeyValuePair> &chain = GetBucket(bucket);
+        for (int i = 0; i < chain.GetLength(); ++i) {
+            KeyValuePair &kvp = chain.Get(i);
+            batch.Add(kvp.key, &kvp.value);
+        }
+    }
+    batch.Flush();
+}
+
 #endif // HASHTABLE_H
@@ -3,7 +3,50 @@
 
 #include <cstddef>
 #include "IDictionaryIterator.h"
+#include "KeyValue.h"
 #include "UnqPtr.h"
+#include <stdexcept>
+
+// Receives the entries of a mutable traversal a batch at a time: keys[i] with a pointer
+// values[i] to the stored value, which may be rewritten in place.
+template <typename TKey, typename TElement>
+class IEntryVisitor
+{
+public:
+    virtual ~IEntryVisitor() {}
+
+    virtual void Visit(const TKey* keys, TElement* const* values, size_t count) = 0;
+};
+
+// Gathers entries for an IEntryVisitor and hands them over a full batch at a time;
+// Flush passes on whatever is left.
+template <typename TKey, typename TElement>
+class EntryBatch
+{
+public:
+    explicit EntryBatch(IEntryVisitor<TKey, TElement>& visitor) : visitor(visitor), count(0) {}
+
+    void Add(const TKey& key, TElement* value)
+    {
+        keys[count] = key;
+        values[count] = value;
+        if (++count == kIteratorBatch)
+            Flush();
+    }
+
+    void Flush()
+    {
+        if (count > 0)
+            visitor.Visit(keys, values, count);
+        count = 0;
+    }
+
+private:
+    IEntryVisitor<TKey, TElement>& visitor;
+    TKey keys[kIteratorBatch];
+    TElement* values[kIteratorBatch];
+    size_t count;
+};
 
 template <typename TKey, typename TElement>
 class IDictionary
@@ -16,11 +59,119 @@ public:
 
     virtual TElement Get(const TKey& key) const = 0;
     virtual bool ContainsKey(const TKey& key) const = 0;
+    // Inserts the key or overwrites its value. Unlike Upsert it does not report which, so a
+    // dictionary that buffers writes can take it without a lookup.
     virtual void Add(const TKey& key, const TElement& element) = 0;
     virtual void Remove(const TKey& key) = 0;
     virtual void Update(const TKey& key, const TElement& element) = 0;
 
+    // Single-traversal operations that never throw on a missing key. Pointers and
+    // references returned here stay valid until the next call that modifies the dictionary.
+    virtual bool TryGet(const TKey& key, TElement& element) const = 0;
+    virtual TElement* FindPtr(const TKey& key) = 0;
+    virtual const TElement* FindPtr(const TKey& key) const = 0;
+    virtual bool Upsert(const TKey& key, const TElement& element) = 0;
+    virtual TElement& GetOrAdd(const TKey& key) = 0;
+    virtual bool TryRemove(const TKey& key) = 0;
+
+    // Removes the key if it is present. Like Add it does not report what it did, so a
+    // dictionary that buffers writes can take it without a lookup; the default is TryRemove.
+    virtual void Discard(const TKey& key)
+    {
+        TryRemove(key);
+    }
+
+    // Adds `count` entries whose keys are strictly increasing. Ordered structures
+    // override this to build an empty dictionary in one pass; the default just upserts.
+    virtual void BulkLoad(const KeyValue<TKey, TElement>* items, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            Upsert(items[i].key, items[i].value);
+    }
+
+    // Adds `count` entries whose keys are distinct, in any order. Hash tables override
+    // this to grow once up front; the default just upserts.
+    virtual void BulkInsert(const KeyValue<TKey, TElement>* items, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            Upsert(items[i].key, items[i].value);
+    }
+
     virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const = 0;
+
+    // Hands every entry to the visitor in batches of up to kIteratorBatch, with pointers
+    // to the stored values. The visitor may rewrite values but must not add or remove
+    // entries. The default reads keys through the iterator and looks each one up;
+    // dictionaries override it to walk their storage directly.
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement>& visitor)
+    {
+        TKey keys[kIteratorBatch];
+        TElement copies[kIteratorBatch];
+        TElement* values[kIteratorBatch];
+        UnqPtr<IDictionaryIterator<TKey, TElement>> iterator = GetIterator();
+        size_t count;
+        do
+        {
+            count = iterator->NextBatch(keys, copies, kIteratorBatch);
+            for (size_t i = 0; i < count; ++i)
+                values[i] = FindPtr(keys[i]);
+            if (count > 0)
+                visitor.Visit(keys, values, count);
+        } while (count == kIteratorBatch);
+    }
+
+    // Splitting for parallel traversal: the entries are divided into `parts` disjoint
+    // ranges, numbered in iteration order, that together cover the dictionary. The split
+    // depends only on the dictionary's contents and layout, so the same part always holds
+    // the same entries; a part may be empty. The defaults put everything in part 0.
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int) const
+    {
+        if (part == 0)
+            return GetIterator();
+        return UnqPtr<IDictionaryIterator<TKey, TElement>>(new EmptyDictionaryIterator<TKey, TElement>());
+    }
+
+    // VisitMutable restricted to one part. Different parts may be visited concurrently.
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement>& visitor, int part, int)
+    {
+        if (part == 0)
+            VisitMutable(visitor);
+    }
+
+    // An independent dictionary holding the current entries, for another thread to read
+    // while this one keeps changing. Only dictionaries that can take one without copying
+    // the entries support it; the default throws.
+    virtual UnqPtr<IDictionary<TKey, TElement>> Snapshot() const
+    {
+        throw std::logic_error("This dictionary does not support snapshots.");
+    }
 };
 
+// Calls func(key, value) with a mutable reference to every stored value, in one pass
+// and without copying the entries out; with `parts` > 1 only the entries of `part`.
+template <typename TKey, typename TElement, typename TFunc>
+void ForEachMutable(IDictionary<TKey, TElement>& dictionary, TFunc&& func, int part = 0, int parts = 1)
+{
+    class Visitor : public IEntryVisitor<TKey, TElement>
+    {
+    public:
+        explicit Visitor(TFunc& func) : func(func) {}
+
+        void Visit(const TKey* keys, TElement* const* values, size_t count) override
+        {
+            for (size_t i = 0; i < count; ++i)
+                func(keys[i], *values[i]);
+        }
+
+    private:
+        TFunc& func;
+    };
+
+    Visitor visitor(func);
+    if (parts > 1)
+        dictionary.VisitMutablePart(visitor, part, parts);
+    else
+        dictionary.VisitMutable(visitor);
+}
+
 #endif // IDICTIONARY_H
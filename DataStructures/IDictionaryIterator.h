@@ -1,6 +1,9 @@
 #ifndef IDICTIONARYITERATOR_H
 #define IDICTIONARYITERATOR_H
 
+#include <cstddef>
+#include <stdexcept>
+
 template <typename TKey, typename TElement>
 class IDictionaryIterator
 {
@@ -14,6 +17,67 @@ public:
     virtual TKey GetCurrentKey() const = 0;
 
     virtual TElement GetCurrentValue() const = 0;
+
+    // Advances over up to `capacity` entries, copying them into the two arrays, and
+    // returns how many were copied; fewer than `capacity` means the iteration is over.
+    // Afterwards the last copied entry is the current one, as if MoveNext had been called
+    // that many times. The default goes through MoveNext and the getters; dictionaries
+    // override it to copy straight out of their storage with one virtual call per batch.
+    virtual size_t NextBatch(TKey* keys, TElement* values, size_t capacity)
+    {
+        size_t copied = 0;
+        while (copied < capacity && MoveNext())
+        {
+            keys[copied] = GetCurrentKey();
+            values[copied] = GetCurrentValue();
+            ++copied;
+        }
+        return copied;
+    }
 };
 
+// Iterator over nothing, for parts of a split that hold no entries.
+template <typename TKey, typename TElement>
+class EmptyDictionaryIterator : public IDictionaryIterator<TKey, TElement>
+{
+public:
+    virtual bool MoveNext() override
+    {
+        return false;
+    }
+
+    virtual void Reset() override {}
+
+    virtual TKey GetCurrentKey() const override
+    {
+        throw std::out_of_range("Iterator out of range");
+    }
+
+    virtual TElement GetCurrentValue() const override
+    {
+        throw std::out_of_range("Iterator out of range");
+    }
+};
+
+// Entries read per NextBatch call by ForEachEntry.
+constexpr size_t kIteratorBatch = 256;
+
+// Calls func(key, value) for every remaining entry. The entries arrive in batches, so
+// the loop around func is a plain array walk that the compiler can inline it into.
+template <typename TKey, typename TElement, typename TFunc>
+void ForEachEntry(IDictionaryIterator<TKey, TElement>& iterator, TFunc&& func)
+{
+    TKey keys[kIteratorBatch];
+    TElement values[kIteratorBatch];
+    size_t count;
+    do
+    {
+        count = iterator.NextBatch(keys, values, kIteratorBatch);
+        for (size_t i = 0; i < count; ++i)
+        {
+            func(keys[i], values[i]);
+        }
+    } while (count == kIteratorBatch);
+}
+
 #endif // IDICTIONARYITERATOR_H
@@ -0,0 +1,112 @@
+#ifndef IORDEREDDICTIONARY_H
+#define IORDEREDDICTIONARY_H
+
+#include "IDictionary.h"
+#include <cstddef>
+#include <vector>
+
+// A dictionary that keeps its keys sorted by operator< and can start an iteration at
+// any key. Positioning costs one descent, so reading k entries is O(log n + k).
+template <typename TKey, typename TElement>
+class IOrderedDictionary : public IDictionary<TKey, TElement>
+{
+public:
+    virtual ~IOrderedDictionary() {}
+
+    // Iterates, in ascending order, the keys that are not less than the key.
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey& key) const = 0;
+
+    // Iterates, in ascending order, the keys that are greater than the key.
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey& key) const = 0;
+
+    // Iterates the keys in [lo, hi) in ascending order.
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey& lo, const TKey& hi) const = 0;
+};
+
+// Separator keys per part that SplitTreeByKeys looks for before it stops descending.
+constexpr size_t kTreePartSeparators = 8;
+
+// Key range [lo, hi) of one part of a split search tree; a missing bound is open.
+template <typename TKey>
+struct TreePartBounds
+{
+    bool hasLo;
+    TKey lo;
+    bool hasHi;
+    TKey hi;
+
+    const TKey* Lo() const
+    {
+        return hasLo ? &lo : nullptr;
+    }
+
+    const TKey* Hi() const
+    {
+        return hasHi ? &hi : nullptr;
+    }
+};
+
+// Splits a search tree by key. The n keys of the shallowest level holding at least
+// kTreePartSeparators per part (or of the leaves) serve as separators: part p runs from
+// separator n * p / parts up to separator n * (p + 1) / parts, with the first part
+// unbounded below and the last above. Subtrees on one level differ in size by a small
+// constant factor, so the parts come out roughly even, and they depend only on the shape
+// of the tree.
+//
+// Nodes are reached through `expand(node, keys, children)`, which appends the node's keys
+// and, for an internal node, its children, and returns whether the node is a leaf; so
+// TNodeRef may be a pointer or a page ID.
+template <typename TKey, typename TNodeRef, typename TExpand>
+TreePartBounds<TKey> SplitTreeByKeys(TNodeRef root, int part, int parts, TExpand expand)
+{
+    std::vector<TNodeRef> level(1, root);
+    std::vector<TNodeRef> next;
+    std::vector<TKey> separators;
+    while (true)
+    {
+        separators.clear();
+        next.clear();
+        bool leaves = false;
+        for (const TNodeRef& node : level)
+            leaves = expand(node, separators, next);
+        if (separators.size() >= kTreePartSeparators * static_cast<size_t>(parts) || leaves)
+            break;
+        level.swap(next);
+    }
+
+    TreePartBounds<TKey> bounds = {false, TKey(), false, TKey()};
+    size_t n = separators.size();
+    if (n == 0)
+        return bounds;
+    if (part > 0)
+    {
+        bounds.hasLo = true;
+        bounds.lo = separators[n * part / parts];
+    }
+    if (part < parts - 1)
+    {
+        bounds.hasHi = true;
+        bounds.hi = separators[n * (part + 1) / parts];
+    }
+    return bounds;
+}
+
+// SplitTreeByKeys for a B-tree-shaped tree (nodes with keys, numKeys, isLeaf and children).
+template <typename TKey, typename TNode>
+TreePartBounds<TKey> GetTreePartBounds(const TNode* root, int part, int parts)
+{
+    return SplitTreeByKeys<TKey>(root, part, parts,
+                                 [](const TNode* node, std::vector<TKey>& keys, std::vector<const TNode*>& children)
+                                 {
+                                     for (int i = 0; i < node->numKeys; ++i)
+                                         keys.push_back(node->keys[i]);
+                                     if (!node->isLeaf)
+                                     {
+                                         for (int i = 0; i <= node->numKeys; ++i)
+                                             children.push_back(node->children[i].get());
+                                     }
+                                     return node->isLeaf;
+                                 });
+}
+
+#endif // IORDEREDDICTIONARY_H
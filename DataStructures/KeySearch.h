@@ -0,0 +1,188 @@
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include "IndexPair.h"
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Position search inside one sorted tree node. The strategy is picked at compile time
+// from the key type: generic keys use a branch-free binary search that only needs
+// operator<, while int and IndexPair keys first halve the range down to a short window
+// and then count the smaller keys in it with SIMD compares, so wide nodes stay cheap.
+template<typename TKey>
+struct KeySearch {
+    // Index of the first key that is not less than the key.
+    static int LowerBound(const TKey *keys, int count, const TKey &key);
+
+    // Index of the first key that is greater than the key.
+    static int UpperBound(const TKey *keys, int count, const TKey &key);
+};
+
+// Halves [0, count] until at most `window` keys remain that may still hold the answer.
+// Returns the offset of that window and leaves its size in `length`; every key before
+// the window satisfies `before`. The select compiles to a conditional move.
+template<typename TKey, typename TBefore>
+inline int NarrowKeyWindow(const TKey *keys, int &length, int window, TBefore before) {
+    const TKey *base = keys;
+    while (length > window) {
+        int half = length / 2;
+        base = before(base[half - 1]) ? base + half : base;
+        length -= half;
+    }
+    return static_cast<int>(base - keys);
+}
+
+template<typename TKey>
+int KeySearch<TKey>::LowerBound(const TKey *keys, int count, const TKey &key) {
+    if (count == 0)
+        return 0;
+    int length = count;
+    int base = NarrowKeyWindow(keys, length, 1, [&key](const TKey &k) { return k < key; });
+    return base + (keys[base] < key);
+}
+
+template<typename TKey>
+int KeySearch<TKey>::UpperBound(const TKey *keys, int count, const TKey &key) {
+    if (count == 0)
+        return 0;
+    int length = count;
+    int base = NarrowKeyWindow(keys, length, 1, [&key](const TKey &k) { return !(key < k); });
+    return base + !(key < keys[base]);
+}
+
+template<>
+struct KeySearch<int> {
+    static int LowerBound(const int *keys, int count, int key) {
+        int length = count;
+        int base = NarrowKeyWindow(keys, length, kWindow, [key](int k) { return k < key; });
+        return base + CountLess(keys + base, length, key);
+    }
+
+    static int UpperBound(const int *keys, int count, int key) {
+        // Integers are discrete: "<= key" is "< key + 1" unless key + 1 would overflow.
+        if (key == INT32_MAX)
+            return count;
+        return LowerBound(keys, count, key + 1);
+    }
+
+private:
+#if defined(__AVX2__)
+    static constexpr int kWindow = 32;
+
+    static int CountLess(const int *keys, int length, int key) {
+        __m256i needle = _mm256_set1_epi32(key);
+        int less = 0;
+        int i = 0;
+        for (; i + 8 <= length; i += 8) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, chunk)));
+            if (mask != 0xFF)
+                return less + __builtin_popcount(static_cast<unsigned>(mask));
+            less += 8;
+        }
+        for (; i < length && keys[i] < key; ++i)
+            ++less;
+        return less;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    static constexpr int kWindow = 16;
+
+    static int CountLess(const int *keys, int length, int key) {
+        __m128i needle = _mm_set1_epi32(key);
+        int less = 0;
+        int i = 0;
+        for (; i + 4 <= length; i += 4) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, chunk)));
+            if (mask != 0xF)
+                return less + (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+            less += 4;
+        }
+        for (; i < length && keys[i] < key; ++i)
+            ++less;
+        return less;
+    }
+#else
+    static constexpr int kWindow = 8;
+
+    static int CountLess(const int *keys, int length, int key) {
+        int less = 0;
+        while (less < length && keys[less] < key)
+            ++less;
+        return less;
+    }
+#endif
+};
+
+// An IndexPair is eight bytes, row first. Loaded as a 64-bit lane its halves are
+// swapped so the row becomes the high word, and the column is biased by 2^31 so the
+// low word compares as unsigned; one signed 64-bit compare then orders the pair
+// exactly like operator<.
+template<>
+struct KeySearch<IndexPair> {
+    static int LowerBound(const IndexPair *keys, int count, const IndexPair &key) {
+        return CountBeforePacked(keys, count, Pack(key));
+    }
+
+    static int UpperBound(const IndexPair *keys, int count, const IndexPair &key) {
+        // Keys <= key are exactly the keys < key + 1 in the packed order.
+        int64_t packed = Pack(key);
+        if (packed == INT64_MAX)
+            return count;
+        return CountBeforePacked(keys, count, packed + 1);
+    }
+
+private:
+    static_assert(sizeof(IndexPair) == 2 * sizeof(int32_t), "IndexPair must pack into 64 bits.");
+
+    static int64_t Pack(const IndexPair &key) {
+        uint64_t high = static_cast<uint64_t>(static_cast<uint32_t>(key.row)) << 32;
+        uint64_t low = static_cast<uint32_t>(key.column) ^ 0x80000000u;
+        return static_cast<int64_t>(high | low);
+    }
+
+    static int CountBeforePacked(const IndexPair *keys, int count, int64_t needle) {
+        int length = count;
+        int base = NarrowKeyWindow(keys, length, kWindow, [needle](const IndexPair &k) { return Pack(k) < needle; });
+        return base + CountBefore(keys + base, length, needle);
+    }
+
+#if defined(__AVX2__)
+    static constexpr int kWindow = 64;
+
+    // Number of keys whose packed value is below the packed needle.
+    static int CountBefore(const IndexPair *keys, int length, int64_t needle) {
+        __m256i packedNeedle = _mm256_set1_epi64x(needle);
+        __m256i bias = _mm256_set1_epi64x(0x80000000LL);
+        int less = 0;
+        int i = 0;
+        for (; i + 4 <= length; i += 4) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+            chunk = _mm256_xor_si256(_mm256_shuffle_epi32(chunk, 0xB1), bias);
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(packedNeedle, chunk)));
+            if (mask != 0xF)
+                return less + __builtin_popcount(static_cast<unsigned>(mask));
+            less += 4;
+        }
+        for (; i < length && Pack(keys[i]) < needle; ++i)
+            ++less;
+        return less;
+    }
+#else
+    static constexpr int kWindow = 8;
+
+    static int CountBefore(const IndexPair *keys, int length, int64_t needle) {
+        int less = 0;
+        while (less < length && Pack(keys[less]) < needle)
+            ++less;
+        return less;
+    }
+#endif
+};
+
+#endif // KEYSEARCH_H
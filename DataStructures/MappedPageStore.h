@@ -0,0 +1,295 @@
+#ifndef MAPPEDPAGESTORE_H
+#define MAPPEDPAGESTORE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A file of fixed-size pages mapped into memory with mmap (POSIX only).
+//
+// Page 0 is the file header: a format tag, the page count, the head of the free-page list
+// and kMetaSize bytes that belong to the structure stored in the file (PagedBTree keeps
+// its root and entry count there). Other pages are handed out by Allocate and addressed
+// by their PageId; freed pages are chained through their first bytes and reused.
+//
+// The whole address range the file may grow to is mapped once when the store opens, so
+// opening costs the same at any file size and page addresses never move: growing the file
+// only extends it with ftruncate. Nothing is read up front and nothing is cached by the
+// store; the kernel pages the mapping in on access and writes dirty pages back, and cold
+// pages simply drop out of its page cache. Where the address space is limited (ulimit -v,
+// sanitizers) and the range cannot be reserved, the store halves it until it can, down to
+// the size of the file; the file then grows only that far.
+class MappedPageStore
+{
+public:
+    typedef uint64_t PageId;
+
+    static constexpr size_t kPageSize = 4096;
+    static constexpr size_t kMetaSize = 256;
+    // Address space reserved for the mapping, not memory; the file can grow up to this.
+    static constexpr size_t kDefaultMaxBytes = sizeof(void*) == 8 ? size_t(1) << 40 : size_t(1) << 30;
+    // A page stays at one address for the store's lifetime, so a pointer into it needs no pin.
+    static constexpr bool kStablePages = true;
+
+    // A page in use. With the whole file mapped this is just its address; the tree code
+    // takes one per page it works on, so a store that moves pages in and out of memory
+    // can keep the page resident while the reference lives.
+    class PageRef
+    {
+    public:
+        PageRef() : data(nullptr) {}
+
+        char* Data() const
+        {
+            return data;
+        }
+
+    private:
+        friend class MappedPageStore;
+
+        explicit PageRef(char* data) : data(data) {}
+
+        char* data;
+    };
+
+    // A store over an unnamed temporary file, removed when the store is destroyed.
+    explicit MappedPageStore(size_t maxBytes = kDefaultMaxBytes);
+
+    // Opens the file at `path`, creating it if it does not exist.
+    explicit MappedPageStore(const std::string& path, size_t maxBytes = kDefaultMaxBytes);
+
+    ~MappedPageStore();
+
+    MappedPageStore(const MappedPageStore&) = delete;
+    MappedPageStore& operator=(const MappedPageStore&) = delete;
+
+    // `write` says whether the page will be changed; the kernel tracks that here.
+    PageRef Pin(PageId id, bool write) const;
+
+    // A zero-filled page.
+    PageId Allocate();
+
+    void Free(PageId id);
+
+    char* Meta();
+
+    const char* Meta() const;
+
+    size_t GetPageCount() const;
+
+    // Writes the dirty pages back to the file and waits for them.
+    void Sync();
+
+    // The layout of page 0, shared with BufferPool so either store can open the file.
+    struct FileHeader
+    {
+        char format[8];
+        uint64_t pageSize;
+        uint64_t pageCount;
+        PageId freeList;
+        char meta[kMetaSize];
+    };
+
+    static constexpr char kFormat[8] = {'S', 'P', 'M', 'P', 'A', 'G', 'E', '1'};
+
+private:
+    static constexpr size_t kInitialPages = 16;
+
+    FILE* temporary;
+    int fd;
+    char* base;
+    size_t maxBytes;
+    size_t filePages;
+
+    void Open(size_t maxBytes);
+
+    void Grow(size_t pages);
+
+    FileHeader* Header() const
+    {
+        return reinterpret_cast<FileHeader*>(base);
+    }
+
+    static std::runtime_error Failure(const std::string& what)
+    {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+};
+
+inline MappedPageStore::MappedPageStore(size_t maxBytes)
+        : temporary(std::tmpfile()), fd(-1), base(nullptr), filePages(0)
+{
+    if (!temporary)
+    {
+        throw Failure("Cannot create a temporary page file");
+    }
+    fd = fileno(temporary);
+    try
+    {
+        Open(maxBytes);
+    }
+    catch (...)
+    {
+        std::fclose(temporary);
+        throw;
+    }
+}
+
+inline MappedPageStore::MappedPageStore(const std::string& path, size_t maxBytes)
+        : temporary(nullptr), fd(::open(path.c_str(), O_RDWR | O_CREAT, 0644)), base(nullptr), filePages(0)
+{
+    if (fd < 0)
+    {
+        throw Failure("Cannot open page file " + path);
+    }
+    try
+    {
+        Open(maxBytes);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+}
+
+// A new file gets its header; an existing one is only checked, never read through.
+inline void MappedPageStore::Open(size_t maxBytes)
+{
+    this->maxBytes = maxBytes / kPageSize * kPageSize;
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        throw Failure("Cannot stat the page file");
+    }
+    filePages = static_cast<size_t>(status.st_size) / kPageSize;
+    if (static_cast<size_t>(status.st_size) % kPageSize != 0 || filePages * kPageSize > this->maxBytes)
+    {
+        throw std::runtime_error("The page file has an unexpected size.");
+    }
+
+    size_t leastBytes = std::max(filePages, kInitialPages) * kPageSize;
+    void* mapping = mmap(nullptr, this->maxBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    while (mapping == MAP_FAILED && errno == ENOMEM && this->maxBytes / 2 >= leastBytes)
+    {
+        this->maxBytes = this->maxBytes / 2 / kPageSize * kPageSize;
+        mapping = mmap(nullptr, this->maxBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED)
+    {
+        throw Failure("Cannot map the page file");
+    }
+    base = static_cast<char*>(mapping);
+    // Tree descents jump between pages, so read-ahead would mostly fetch pages not needed.
+    madvise(base, this->maxBytes, MADV_RANDOM);
+
+    if (filePages == 0)
+    {
+        Grow(kInitialPages);
+        FileHeader* header = Header();
+        std::memcpy(header->format, kFormat, sizeof(kFormat));
+        header->pageSize = kPageSize;
+        header->pageCount = 1;
+        header->freeList = 0;
+    }
+    else if (std::memcmp(Header()->format, kFormat, sizeof(kFormat)) != 0 || Header()->pageSize != kPageSize ||
+             Header()->pageCount > filePages)
+    {
+        munmap(base, this->maxBytes);
+        throw std::runtime_error("The file is not a page file of this format.");
+    }
+}
+
+inline MappedPageStore::~MappedPageStore()
+{
+    if (base)
+    {
+        munmap(base, maxBytes);
+    }
+    if (temporary)
+    {
+        std::fclose(temporary);
+    }
+    else if (fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+inline MappedPageStore::PageRef MappedPageStore::Pin(PageId id, bool) const
+{
+    return PageRef(base + id * kPageSize);
+}
+
+inline MappedPageStore::PageId MappedPageStore::Allocate()
+{
+    FileHeader* header = Header();
+    PageId id = header->freeList;
+    if (id != 0)
+    {
+        std::memcpy(&header->freeList, base + id * kPageSize, sizeof(PageId));
+        std::memset(base + id * kPageSize, 0, kPageSize);
+        return id;
+    }
+
+    if (header->pageCount == filePages)
+    {
+        Grow(filePages * 2);
+    }
+    return header->pageCount++;
+}
+
+inline void MappedPageStore::Free(PageId id)
+{
+    std::memcpy(base + id * kPageSize, &Header()->freeList, sizeof(PageId));
+    Header()->freeList = id;
+}
+
+// Doubling the file keeps the number of ftruncate calls logarithmic; the new pages read
+// as zeros and take no disk space until written.
+inline void MappedPageStore::Grow(size_t pages)
+{
+    pages = std::min(pages, maxBytes / kPageSize);
+    if (pages <= filePages)
+    {
+        throw std::runtime_error("The page file has reached its maximum size.");
+    }
+    if (ftruncate(fd, static_cast<off_t>(pages * kPageSize)) != 0)
+    {
+        throw Failure("Cannot extend the page file");
+    }
+    filePages = pages;
+}
+
+inline char* MappedPageStore::Meta()
+{
+    return Header()->meta;
+}
+
+inline const char* MappedPageStore::Meta() const
+{
+    return Header()->meta;
+}
+
+inline size_t MappedPageStore::GetPageCount() const
+{
+    return Header()->pageCount;
+}
+
+inline void MappedPageStore::Sync()
+{
+    if (msync(base, filePages * kPageSize, MS_SYNC) != 0)
+    {
+        throw Failure("Cannot write the page file back");
+    }
+}
+
+#endif // MAPPEDPAGESTORE_H
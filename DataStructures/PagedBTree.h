@@ -0,0 +1,870 @@
+#ifndef PAGEDBTREE_H
+#define PAGEDBTREE_H
+
+#include "IOrderedDictionary.h"
+#include "KeySearch.h"
+#include "MappedPageStore.h"
+#include "UnqPtr.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// B+ tree whose nodes are pages of a page store, by default a memory-mapped file, so the
+// tree can be far larger than memory and outlives the process: opening the file again
+// reads only the header, and the pages come in as the tree touches them. Child and leaf
+// links are page IDs. The algorithms are BPlusTree's; each node is sized to fill a page,
+// so its order follows from the key and value sizes. Keys and values are stored as raw
+// bytes and must be trivially copyable.
+//
+// Values handed out by FindPtr and GetOrAdd live in the pages. Over a store whose pages
+// stay put (MappedPageStore) the pointers stay valid until the entry is moved by a write,
+// as in BPlusTree, and const calls, FindPtr included, may run on several threads at once.
+// Over a store that evicts pages (BufferPool) the tree keeps the last handed-out page
+// pinned, so the pointer stays valid only until the next call on the tree, and const
+// FindPtr must not run concurrently with anything; readers on several threads use TryGet.
+template<typename TKey, typename TElement, typename TPageStore = MappedPageStore>
+class PagedBTree : public IOrderedDictionary<TKey, TElement> {
+    static_assert(std::is_trivially_copyable<TKey>::value && std::is_trivially_copyable<TElement>::value,
+                  "PagedBTree stores keys and values as bytes, so they must be trivially copyable.");
+
+public:
+    typedef typename TPageStore::PageId PageId;
+
+    // A tree in an unnamed temporary file. To bound the store, for example the address
+    // space a MappedPageStore reserves, build it and pass it in below.
+    PagedBTree();
+
+    // Opens the tree stored in the file at `path`, or starts an empty one there.
+    explicit PagedBTree(const std::string &path);
+
+    explicit PagedBTree(UnqPtr<TPageStore> store);
+
+    virtual ~PagedBTree();
+
+    PagedBTree(const PagedBTree &) = delete;
+
+    PagedBTree &operator=(const PagedBTree &) = delete;
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
+
+    // Writes the changed pages back to the file.
+    void Sync();
+
+    const TPageStore &GetStore() const;
+
+private:
+    static constexpr size_t kPageSize = TPageStore::kPageSize;
+
+    struct NodeHeader {
+        uint32_t isLeaf;
+        uint32_t numKeys;
+        PageId next;
+    };
+
+    // Kept in the store's meta area; the tag and sizes catch a file written for other types.
+    struct TreeMeta {
+        uint32_t format;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t reserved;
+        PageId root;
+        uint64_t count;
+    };
+
+    static_assert(sizeof(TreeMeta) <= TPageStore::kMetaSize, "The tree header must fit the store's meta area.");
+
+    static constexpr uint32_t kFormat = 0x50425431;
+
+    static constexpr size_t AlignUp(size_t n, size_t alignment) {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr size_t kKeysOffset = AlignUp(sizeof(NodeHeader), alignof(TKey));
+
+    static constexpr size_t kLeafValuesOffset(int order) {
+        return AlignUp(kKeysOffset + (2 * order - 1) * sizeof(TKey), alignof(TElement));
+    }
+
+    static constexpr size_t kChildrenOffset(int order) {
+        return AlignUp(kKeysOffset + (2 * order - 1) * sizeof(TKey), alignof(PageId));
+    }
+
+    // The largest minimum degree whose full node still fits a page.
+    static constexpr int FitOrder(bool leaf) {
+        int order = 1;
+        while (leaf ? kLeafValuesOffset(order + 1) + (2 * order + 1) * sizeof(TElement) <= kPageSize
+                    : kChildrenOffset(order + 1) + (2 * order + 2) * sizeof(PageId) <= kPageSize)
+            ++order;
+        return order;
+    }
+
+    static constexpr int kLeafOrder = FitOrder(true);
+    static constexpr int kInnerOrder = FitOrder(false);
+
+    static_assert(kLeafOrder >= 2 && kInnerOrder >= 2, "A page must hold at least three keys per node.");
+
+    // A node pinned in memory, with pointers into its page.
+    struct Node {
+        typename TPageStore::PageRef page;
+        PageId id;
+        NodeHeader *header;
+        TKey *keys;
+        TElement *values;
+        PageId *children;
+
+        Node() : id(0), header(nullptr), keys(nullptr), values(nullptr), children(nullptr) {}
+
+        bool IsLeaf() const {
+            return header->isLeaf != 0;
+        }
+
+        int NumKeys() const {
+            return static_cast<int>(header->numKeys);
+        }
+
+        int Order() const {
+            return IsLeaf() ? kLeafOrder : kInnerOrder;
+        }
+    };
+
+    UnqPtr<TPageStore> store;
+    TreeMeta *meta;
+    // The page behind the last pointer FindPtr or GetOrAdd handed out, kept pinned only
+    // when the store can evict it.
+    mutable Node handedOut;
+
+    void HandOut(Node &x) const;
+
+    void Open();
+
+    Node Load(PageId id, bool write) const;
+
+    void MarkWritten(Node &x) const;
+
+    Node NewNode(bool leaf);
+
+    Node FindLeaf(const TKey &key) const;
+
+    TElement *FindValue(const TKey &key, bool write) const;
+
+    static int ChildIndex(const Node &x, const TKey &key);
+
+    static int LeafIndex(const Node &x, const TKey &key);
+
+    TElement *FindOrInsert(const TKey &key, bool &inserted);
+
+    void SplitChild(Node &x, int i, Node &y);
+
+    bool RemoveFromNode(Node x, const TKey &key);
+
+    void Fill(Node &x, int idx);
+
+    void BorrowFromPrev(Node &x, int idx, Node &child, Node &sibling);
+
+    void BorrowFromNext(Node &x, int idx, Node &child, Node &sibling);
+
+    void Merge(Node &x, int idx, Node &child, Node &sibling);
+
+    Node FindStart(const TKey *lo, int &index) const;
+
+    TreePartBounds<TKey> PartBounds(int part, int parts) const;
+
+    void VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo, const TKey *hi);
+
+    class PagedTreeIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        PagedTreeIterator(const PagedBTree *tree, Node startLeaf, int startIndex, const TKey *upperBound);
+
+        virtual ~PagedTreeIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const PagedBTree *tree;
+        PageId startLeaf;
+        int startIndex;
+        bool hasUpperBound;
+        TKey upperBound;
+        Node leaf;
+        bool valid;
+        int index;
+        bool started;
+
+        void Start();
+
+        bool NextLeaf();
+    };
+};
+
+template<typename TKey, typename TElement, typename TPageStore>
+PagedBTree<TKey, TElement, TPageStore>::PagedBTree() : store(new TPageStore()) {
+    Open();
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+PagedBTree<TKey, TElement, TPageStore>::PagedBTree(const std::string &path) : store(new TPageStore(path)) {
+    Open();
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+PagedBTree<TKey, TElement, TPageStore>::PagedBTree(UnqPtr<TPageStore> store) : store(std::move(store)) {
+    Open();
+}
+
+// A fresh store gets an empty root leaf; a stored tree is used as it is.
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Open() {
+    meta = reinterpret_cast<TreeMeta *>(store->Meta());
+    if (meta->format == 0) {
+        meta->format = kFormat;
+        meta->keySize = sizeof(TKey);
+        meta->valueSize = sizeof(TElement);
+        meta->root = NewNode(true).id;
+        meta->count = 0;
+    } else if (meta->format != kFormat || meta->keySize != sizeof(TKey) || meta->valueSize != sizeof(TElement)) {
+        throw std::runtime_error("The page file holds a tree of other key or value types.");
+    }
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+PagedBTree<TKey, TElement, TPageStore>::~PagedBTree() {
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+typename PagedBTree<TKey, TElement, TPageStore>::Node
+PagedBTree<TKey, TElement, TPageStore>::Load(PageId id, bool write) const {
+    Node x;
+    x.page = store->Pin(id, write);
+    x.id = id;
+    char *data = x.page.Data();
+    x.header = reinterpret_cast<NodeHeader *>(data);
+    x.keys = reinterpret_cast<TKey *>(data + kKeysOffset);
+    x.values = reinterpret_cast<TElement *>(data + kLeafValuesOffset(kLeafOrder));
+    x.children = reinterpret_cast<PageId *>(data + kChildrenOffset(kInnerOrder));
+    return x;
+}
+
+// Nodes are read with write set to false and re-pinned for writing just before they are
+// changed, so a store that writes dirty pages back writes only those. The page is pinned
+// meanwhile, so it stays where the node's pointers point.
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::MarkWritten(Node &x) const {
+    x.page = store->Pin(x.id, true);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::HandOut(Node &x) const {
+    if (!TPageStore::kStablePages)
+        handedOut = std::move(x);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+typename PagedBTree<TKey, TElement, TPageStore>::Node PagedBTree<TKey, TElement, TPageStore>::NewNode(bool leaf) {
+    Node x = Load(store->Allocate(), true);
+    x.header->isLeaf = leaf ? 1 : 0;
+    x.header->numKeys = 0;
+    x.header->next = 0;
+    return x;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+size_t PagedBTree<TKey, TElement, TPageStore>::GetCount() const {
+    return static_cast<size_t>(meta->count);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+size_t PagedBTree<TKey, TElement, TPageStore>::GetCapacity() const {
+    return static_cast<size_t>(meta->count);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Sync() {
+    store->Sync();
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+const TPageStore &PagedBTree<TKey, TElement, TPageStore>::GetStore() const {
+    return *store;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+int PagedBTree<TKey, TElement, TPageStore>::ChildIndex(const Node &x, const TKey &key) {
+    return KeySearch<TKey>::UpperBound(x.keys, x.NumKeys(), key);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+int PagedBTree<TKey, TElement, TPageStore>::LeafIndex(const Node &x, const TKey &key) {
+    return KeySearch<TKey>::LowerBound(x.keys, x.NumKeys(), key);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+typename PagedBTree<TKey, TElement, TPageStore>::Node
+PagedBTree<TKey, TElement, TPageStore>::FindLeaf(const TKey &key) const {
+    Node x = Load(meta->root, false);
+    while (!x.IsLeaf())
+        x = Load(x.children[ChildIndex(x, key)], false);
+    return x;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::TryGet(const TKey &key, TElement &element) const {
+    Node leaf = FindLeaf(key);
+    int i = LeafIndex(leaf, key);
+    if (i == leaf.NumKeys() || !(leaf.keys[i] == key))
+        return false;
+
+    element = leaf.values[i];
+    return true;
+}
+
+// Only the non-const FindPtr hands out a value to write through, so only it pins the leaf
+// for writing.
+template<typename TKey, typename TElement, typename TPageStore>
+TElement *PagedBTree<TKey, TElement, TPageStore>::FindValue(const TKey &key, bool write) const {
+    Node leaf = FindLeaf(key);
+    int i = LeafIndex(leaf, key);
+    if (i == leaf.NumKeys() || !(leaf.keys[i] == key))
+        return nullptr;
+
+    if (write)
+        MarkWritten(leaf);
+    TElement *value = &leaf.values[i];
+    HandOut(leaf);
+    return value;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+const TElement *PagedBTree<TKey, TElement, TPageStore>::FindPtr(const TKey &key) const {
+    return FindValue(key, false);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+TElement *PagedBTree<TKey, TElement, TPageStore>::FindPtr(const TKey &key) {
+    return FindValue(key, true);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::ContainsKey(const TKey &key) const {
+    TElement value;
+    return TryGet(key, value);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+TElement PagedBTree<TKey, TElement, TPageStore>::Get(const TKey &key) const {
+    TElement value;
+    if (!TryGet(key, value))
+        throw std::runtime_error("Key not found.");
+    return value;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Update(const TKey &key, const TElement &element) {
+    TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+
+    *value = element;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::Upsert(const TKey &key, const TElement &element) {
+    bool inserted;
+    *FindOrInsert(key, inserted) = element;
+    return inserted;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+TElement &PagedBTree<TKey, TElement, TPageStore>::GetOrAdd(const TKey &key) {
+    bool inserted;
+    return *FindOrInsert(key, inserted);
+}
+
+// BPlusTree::FindOrInsert: full nodes are split on the way down, so the leaf has room.
+template<typename TKey, typename TElement, typename TPageStore>
+TElement *PagedBTree<TKey, TElement, TPageStore>::FindOrInsert(const TKey &key, bool &inserted) {
+    Node x = Load(meta->root, false);
+    if (x.NumKeys() == 2 * x.Order() - 1) {
+        Node s = NewNode(false);
+        s.children[0] = x.id;
+        meta->root = s.id;
+        SplitChild(s, 0, x);
+        x = std::move(s);
+    }
+
+    while (!x.IsLeaf()) {
+        int i = ChildIndex(x, key);
+        Node child = Load(x.children[i], false);
+        if (child.NumKeys() == 2 * child.Order() - 1) {
+            SplitChild(x, i, child);
+            if (!(key < x.keys[i]))
+                child = Load(x.children[i + 1], false);
+        }
+        x = std::move(child);
+    }
+
+    // The caller writes the value, so the leaf is written even when the key is found.
+    MarkWritten(x);
+    int i = LeafIndex(x, key);
+    if (i < x.NumKeys() && x.keys[i] == key) {
+        inserted = false;
+    } else {
+        std::memmove(x.keys + i + 1, x.keys + i, (x.NumKeys() - i) * sizeof(TKey));
+        std::memmove(x.values + i + 1, x.values + i, (x.NumKeys() - i) * sizeof(TElement));
+        x.keys[i] = key;
+        x.values[i] = TElement();
+        ++x.header->numKeys;
+        ++meta->count;
+        inserted = true;
+    }
+
+    TElement *value = &x.values[i];
+    HandOut(x);
+    return value;
+}
+
+// Splits the full child y = x.children[i] as BPlusTree::SplitChild does.
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::SplitChild(Node &x, int i, Node &y) {
+    int order = y.Order();
+    MarkWritten(x);
+    MarkWritten(y);
+    Node z = NewNode(y.IsLeaf());
+    TKey separator;
+
+    z.header->numKeys = order - 1;
+    std::memcpy(z.keys, y.keys + order, (order - 1) * sizeof(TKey));
+    if (y.IsLeaf()) {
+        std::memcpy(z.values, y.values + order, (order - 1) * sizeof(TElement));
+        y.header->numKeys = order;
+        z.header->next = y.header->next;
+        y.header->next = z.id;
+        separator = z.keys[0];
+    } else {
+        std::memcpy(z.children, y.children + order, order * sizeof(PageId));
+        y.header->numKeys = order - 1;
+        separator = y.keys[order - 1];
+    }
+
+    int n = x.NumKeys();
+    std::memmove(x.children + i + 2, x.children + i + 1, (n - i) * sizeof(PageId));
+    x.children[i + 1] = z.id;
+    std::memmove(x.keys + i + 1, x.keys + i, (n - i) * sizeof(TKey));
+    x.keys[i] = separator;
+    ++x.header->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::TryRemove(const TKey &key) {
+    handedOut = Node();
+    bool removed = RemoveFromNode(Load(meta->root, false), key);
+    if (removed)
+        --meta->count;
+
+    Node root = Load(meta->root, false);
+    if (root.NumKeys() == 0 && !root.IsLeaf()) {
+        meta->root = root.children[0];
+        PageId freed = root.id;
+        root = Node();
+        store->Free(freed);
+    }
+
+    return removed;
+}
+
+// BPlusTree::RemoveFromNode: a child with the minimum number of keys is refilled from a
+// sibling or merged with one before the descent continues into it.
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::RemoveFromNode(Node x, const TKey &key) {
+    while (!x.IsLeaf()) {
+        int i = ChildIndex(x, key);
+        Node child = Load(x.children[i], false);
+        if (child.NumKeys() < child.Order()) {
+            child = Node();
+            Fill(x, i);
+            child = Load(x.children[ChildIndex(x, key)], false);
+        }
+        x = std::move(child);
+    }
+
+    int i = LeafIndex(x, key);
+    if (i == x.NumKeys() || !(x.keys[i] == key))
+        return false;
+
+    MarkWritten(x);
+    std::memmove(x.keys + i, x.keys + i + 1, (x.NumKeys() - i - 1) * sizeof(TKey));
+    std::memmove(x.values + i, x.values + i + 1, (x.NumKeys() - i - 1) * sizeof(TElement));
+    --x.header->numKeys;
+    return true;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Fill(Node &x, int idx) {
+    Node child = Load(x.children[idx], false);
+    if (idx != 0) {
+        Node prev = Load(x.children[idx - 1], false);
+        if (prev.NumKeys() >= prev.Order()) {
+            BorrowFromPrev(x, idx, child, prev);
+            return;
+        }
+    }
+    if (idx != x.NumKeys()) {
+        Node next = Load(x.children[idx + 1], false);
+        if (next.NumKeys() >= next.Order())
+            BorrowFromNext(x, idx, child, next);
+        else
+            Merge(x, idx, child, next);
+        return;
+    }
+    Node prev = Load(x.children[idx - 1], false);
+    Merge(x, idx - 1, prev, child);
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::BorrowFromPrev(Node &x, int idx, Node &child, Node &sibling) {
+    MarkWritten(x);
+    MarkWritten(child);
+    MarkWritten(sibling);
+    int n = child.NumKeys();
+    int last = sibling.NumKeys() - 1;
+    std::memmove(child.keys + 1, child.keys, n * sizeof(TKey));
+
+    if (child.IsLeaf()) {
+        std::memmove(child.values + 1, child.values, n * sizeof(TElement));
+        child.keys[0] = sibling.keys[last];
+        child.values[0] = sibling.values[last];
+        x.keys[idx - 1] = child.keys[0];
+    } else {
+        std::memmove(child.children + 1, child.children, (n + 1) * sizeof(PageId));
+        child.keys[0] = x.keys[idx - 1];
+        child.children[0] = sibling.children[last + 1];
+        x.keys[idx - 1] = sibling.keys[last];
+    }
+
+    ++child.header->numKeys;
+    --sibling.header->numKeys;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::BorrowFromNext(Node &x, int idx, Node &child, Node &sibling) {
+    MarkWritten(x);
+    MarkWritten(child);
+    MarkWritten(sibling);
+    int n = child.NumKeys();
+    int m = sibling.NumKeys();
+
+    if (child.IsLeaf()) {
+        child.keys[n] = sibling.keys[0];
+        child.values[n] = sibling.values[0];
+        std::memmove(sibling.keys, sibling.keys + 1, (m - 1) * sizeof(TKey));
+        std::memmove(sibling.values, sibling.values + 1, (m - 1) * sizeof(TElement));
+        x.keys[idx] = sibling.keys[0];
+    } else {
+        child.keys[n] = x.keys[idx];
+        child.children[n + 1] = sibling.children[0];
+        x.keys[idx] = sibling.keys[0];
+        std::memmove(sibling.keys, sibling.keys + 1, (m - 1) * sizeof(TKey));
+        std::memmove(sibling.children, sibling.children + 1, m * sizeof(PageId));
+    }
+
+    ++child.header->numKeys;
+    --sibling.header->numKeys;
+}
+
+// Moves the right node into the left one and frees its page.
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::Merge(Node &x, int idx, Node &child, Node &sibling) {
+    MarkWritten(x);
+    MarkWritten(child);
+    int n = child.NumKeys();
+    int m = sibling.NumKeys();
+
+    if (child.IsLeaf()) {
+        std::memcpy(child.keys + n, sibling.keys, m * sizeof(TKey));
+        std::memcpy(child.values + n, sibling.values, m * sizeof(TElement));
+        child.header->numKeys = n + m;
+        child.header->next = sibling.header->next;
+    } else {
+        child.keys[n] = x.keys[idx];
+        std::memcpy(child.keys + n + 1, sibling.keys, m * sizeof(TKey));
+        std::memcpy(child.children + n + 1, sibling.children, (m + 1) * sizeof(PageId));
+        child.header->numKeys = n + m + 1;
+    }
+
+    int k = x.NumKeys();
+    std::memmove(x.keys + idx, x.keys + idx + 1, (k - idx - 1) * sizeof(TKey));
+    std::memmove(x.children + idx + 1, x.children + idx + 2, (k - idx - 1) * sizeof(PageId));
+    --x.header->numKeys;
+
+    PageId freed = sibling.id;
+    sibling = Node();
+    store->Free(freed);
+}
+
+// Leaf and position of the first key not less than lo, or of the smallest key.
+template<typename TKey, typename TElement, typename TPageStore>
+typename PagedBTree<TKey, TElement, TPageStore>::Node
+PagedBTree<TKey, TElement, TPageStore>::FindStart(const TKey *lo, int &index) const {
+    if (lo) {
+        Node leaf = FindLeaf(*lo);
+        index = LeafIndex(leaf, *lo);
+        return leaf;
+    }
+    Node x = Load(meta->root, false);
+    while (!x.IsLeaf())
+        x = Load(x.children[0], false);
+    index = 0;
+    return x;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    VisitRange(visitor, nullptr, nullptr);
+}
+
+// Reads the levels by page ID, with one page pinned at a time.
+template<typename TKey, typename TElement, typename TPageStore>
+TreePartBounds<TKey> PagedBTree<TKey, TElement, TPageStore>::PartBounds(int part, int parts) const {
+    return SplitTreeByKeys<TKey>(meta->root, part, parts,
+                                 [this](PageId id, std::vector<TKey> &keys, std::vector<PageId> &children) {
+                                     Node x = Load(id, false);
+                                     keys.insert(keys.end(), x.keys, x.keys + x.NumKeys());
+                                     if (!x.IsLeaf())
+                                         children.insert(children.end(), x.children, x.children + x.NumKeys() + 1);
+                                     return x.IsLeaf();
+                                 });
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PagedBTree<TKey, TElement, TPageStore>::GetPartIterator(int part,
+                                                                                                   int parts) const {
+    TreePartBounds<TKey> bounds = PartBounds(part, parts);
+    int index;
+    Node leaf = FindStart(bounds.Lo(), index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(
+            new PagedTreeIterator(this, std::move(leaf), index, bounds.Hi()));
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part,
+                                                              int parts) {
+    TreePartBounds<TKey> bounds = PartBounds(part, parts);
+    VisitRange(visitor, bounds.Lo(), bounds.Hi());
+}
+
+// Walks the leaf chain over the keys in [lo, hi) (a null bound is open); every leaf's
+// entries go to the visitor before the next leaf is pinned, since the pointers are into
+// the leaf's page.
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::VisitRange(IEntryVisitor<TKey, TElement> &visitor, const TKey *lo,
+                                                        const TKey *hi) {
+    int index;
+    PageId id = FindStart(lo, index).id;
+
+    EntryBatch<TKey, TElement> batch(visitor);
+    for (int i = index; id != 0; i = 0) {
+        Node leaf = Load(id, true);
+        for (; i < leaf.NumKeys(); ++i) {
+            if (hi && !(leaf.keys[i] < *hi)) {
+                batch.Flush();
+                return;
+            }
+            batch.Add(leaf.keys[i], &leaf.values[i]);
+        }
+        batch.Flush();
+        id = leaf.header->next;
+    }
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PagedBTree<TKey, TElement, TPageStore>::GetIterator() const {
+    int index;
+    Node leaf = FindStart(nullptr, index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PagedTreeIterator(this, std::move(leaf), index, nullptr));
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PagedBTree<TKey, TElement, TPageStore>::LowerBound(const TKey &key) const {
+    int index;
+    Node leaf = FindStart(&key, index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PagedTreeIterator(this, std::move(leaf), index, nullptr));
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PagedBTree<TKey, TElement, TPageStore>::UpperBound(const TKey &key) const {
+    Node leaf = FindLeaf(key);
+    int index = KeySearch<TKey>::UpperBound(leaf.keys, leaf.NumKeys(), key);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PagedTreeIterator(this, std::move(leaf), index, nullptr));
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PagedBTree<TKey, TElement, TPageStore>::GetRange(const TKey &lo,
+                                                                                            const TKey &hi) const {
+    int index;
+    Node leaf = FindStart(&lo, index);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PagedTreeIterator(this, std::move(leaf), index, &hi));
+}
+
+// Keeps only the current leaf pinned; Reset goes back to the start leaf by its ID.
+template<typename TKey, typename TElement, typename TPageStore>
+PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::PagedTreeIterator(const PagedBTree *tree, Node startLeaf,
+                                                                             int startIndex, const TKey *upperBound)
+        : tree(tree), startLeaf(startLeaf.id), startIndex(startIndex), hasUpperBound(upperBound != nullptr),
+          upperBound(upperBound ? *upperBound : TKey()), leaf(std::move(startLeaf)), valid(false), index(0),
+          started(false) {
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::Start() {
+    if (leaf.id != startLeaf)
+        leaf = tree->Load(startLeaf, false);
+    index = startIndex;
+    valid = true;
+    started = true;
+}
+
+// Moves to the next leaf of the chain, or ends the iteration.
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::NextLeaf() {
+    PageId next = leaf.header->next;
+    if (next == 0) {
+        valid = false;
+        return false;
+    }
+    leaf = tree->Load(next, false);
+    index = 0;
+    return true;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+bool PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::MoveNext() {
+    if (!started)
+        Start();
+    else if (valid)
+        ++index;
+
+    while (valid && index >= leaf.NumKeys())
+        NextLeaf();
+
+    if (valid && hasUpperBound && !(leaf.keys[index] < upperBound))
+        valid = false;
+
+    return valid;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+size_t PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::NextBatch(TKey *keys, TElement *values,
+                                                                           size_t capacity) {
+    if (capacity == 0)
+        return 0;
+
+    if (!started)
+        Start();
+    else if (valid)
+        ++index;
+
+    size_t copied = 0;
+    while (valid && copied < capacity) {
+        if (index >= leaf.NumKeys()) {
+            NextLeaf();
+            continue;
+        }
+        if (hasUpperBound && !(leaf.keys[index] < upperBound)) {
+            valid = false;
+            break;
+        }
+        keys[copied] = leaf.keys[index];
+        values[copied] = leaf.values[index];
+        ++copied;
+        ++index;
+    }
+
+    // Leave the last copied entry current; a short batch means the iteration is over.
+    if (copied == capacity)
+        --index;
+    else
+        valid = false;
+    return copied;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+void PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::Reset() {
+    valid = false;
+    index = 0;
+    started = false;
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+TKey PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::GetCurrentKey() const {
+    if (!valid)
+        throw std::out_of_range("Iterator out of range");
+    return leaf.keys[index];
+}
+
+template<typename TKey, typename TElement, typename TPageStore>
+TElement PagedBTree<TKey, TElement, TPageStore>::PagedTreeIterator::GetCurrentValue() const {
+    if (!valid)
+        throw std::out_of_range("Iterator out of range");
+    return leaf.values[index];
+}
+
+#endif // PAGEDBTREE_H
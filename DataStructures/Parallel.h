@@ -0,0 +1,50 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "ThreadPool.h"
+#include <cstddef>
+#include <thread>
+
+// Number of threads to use for `work` units when `requested` were asked for (0 means one
+// per hardware thread). Each thread gets at least `minWorkPerThread` units, so small
+// jobs stay on the calling thread instead of paying for task hand-off.
+inline int ResolveThreadCount(int requested, size_t work, size_t minWorkPerThread)
+{
+    size_t threads = requested > 0 ? static_cast<size_t>(requested) : std::thread::hardware_concurrency();
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    size_t byWork = minWorkPerThread > 0 ? work / minWorkPerThread : work;
+    if (threads > byWork)
+    {
+        threads = byWork > 0 ? byWork : 1;
+    }
+    return static_cast<int>(threads);
+}
+
+// Calls func(part) for part = 0 .. parts - 1 as tasks on the default ThreadPool; part 0
+// runs on the calling thread, which then helps with the rest. Returns once every part
+// has finished, rethrowing the first exception a part threw.
+template<typename Func>
+void RunPartitioned(int parts, Func func)
+{
+    if (parts <= 1)
+    {
+        if (parts == 1)
+        {
+            func(0);
+        }
+        return;
+    }
+
+    TaskGroup group;
+    for (int part = 1; part < parts; ++part)
+    {
+        group.Run([&func, part]() { func(part); });
+    }
+    func(0);
+    group.Wait();
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,96 @@
+#ifndef PARALLELTRAVERSAL_H
+#define PARALLELTRAVERSAL_H
+
+#include "IDictionary.h"
+#include "Parallel.h"
+#include <cstddef>
+#include <vector>
+
+// ForEach, Map and Reduce over a dictionary on several threads. Each thread walks its
+// own parts of the split described by IDictionary::GetPartIterator, so the callables run
+// concurrently on different entries and must not share unsynchronised state.
+
+// Entries per thread below which a traversal uses fewer threads.
+constexpr size_t kTraversalMinEntriesPerThread = 1 << 14;
+
+// A deterministic Reduce splits the entries into one part per kReducePartEntries, up to
+// kMaxReduceParts, whatever the thread count.
+constexpr size_t kReducePartEntries = 1 << 12;
+constexpr int kMaxReduceParts = 64;
+
+template<typename TKey, typename TElement, typename TFunc>
+void ParallelForEachEntry(const IDictionary<TKey, TElement>& dictionary, TFunc func, int threads = 0)
+{
+    int parts = ResolveThreadCount(threads, dictionary.GetCount(), kTraversalMinEntriesPerThread);
+    RunPartitioned(parts, [&](int part) {
+        auto iterator = parts > 1 ? dictionary.GetPartIterator(part, parts) : dictionary.GetIterator();
+        ForEachEntry(*iterator, func);
+    });
+}
+
+// Replaces every value with func(value) in place; entries that map to zero are removed
+// once all threads are done.
+template<typename TKey, typename TElement, typename TFunc>
+void ParallelMapValues(IDictionary<TKey, TElement>& dictionary, TFunc func, int threads = 0)
+{
+    int parts = ResolveThreadCount(threads, dictionary.GetCount(), kTraversalMinEntriesPerThread);
+    std::vector<std::vector<TKey>> zeros(parts);
+    RunPartitioned(parts, [&](int part) {
+        std::vector<TKey>& partZeros = zeros[part];
+        ForEachMutable(dictionary, [&](const TKey& key, TElement& value) {
+            value = func(value);
+            if (value == TElement())
+                partZeros.push_back(key);
+        }, part, parts);
+    });
+    for (const std::vector<TKey>& partZeros : zeros)
+    {
+        for (const TKey& key : partZeros)
+        {
+            dictionary.TryRemove(key);
+        }
+    }
+}
+
+// Folds every value into `initial` with func, which must be associative with `initial`
+// as its identity (0 for a sum): each part is folded separately, in iteration order,
+// and the part results are combined pairwise in a fixed binary tree. Normally there is
+// one part per thread. With `deterministic` the number of parts depends only on the
+// entry count, so a floating-point result is the same for every thread count.
+template<typename TKey, typename TElement, typename TFunc>
+TElement ParallelReduceValues(const IDictionary<TKey, TElement>& dictionary, TFunc func, TElement initial,
+                              int threads = 0, bool deterministic = false)
+{
+    size_t count = dictionary.GetCount();
+    int workers = ResolveThreadCount(threads, count, kTraversalMinEntriesPerThread);
+    int parts = workers;
+    if (deterministic)
+    {
+        size_t byCount = count / kReducePartEntries;
+        parts = byCount < 1 ? 1 : byCount > static_cast<size_t>(kMaxReduceParts) ? kMaxReduceParts
+                                                                                   : static_cast<int>(byCount);
+        workers = workers < parts ? workers : parts;
+    }
+
+    std::vector<TElement> partials(parts, initial);
+    RunPartitioned(workers, [&](int worker) {
+        for (int part = worker; part < parts; part += workers)
+        {
+            auto iterator = parts > 1 ? dictionary.GetPartIterator(part, parts) : dictionary.GetIterator();
+            TElement result = initial;
+            ForEachEntry(*iterator, [&](const TKey&, const TElement& value) { result = func(result, value); });
+            partials[part] = result;
+        }
+    });
+
+    for (int width = 1; width < parts; width *= 2)
+    {
+        for (int i = 0; i + width < parts; i += 2 * width)
+        {
+            partials[i] = func(partials[i], partials[i + width]);
+        }
+    }
+    return partials[0];
+}
+
+#endif // PARALLELTRAVERSAL_H
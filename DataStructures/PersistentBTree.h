@@ -0,0 +1,346 @@
+#ifndef PERSISTENTBTREE_H
+#define PERSISTENTBTREE_H
+
+#include "AtomicShrdPtr.h"
+#include "BTreeCore.h"
+#include "IOrderedDictionary.h"
+#include "UnqPtr.h"
+#include <mutex>
+#include <stdexcept>
+
+// B-tree whose nodes are shared through AtomicShrdPtr, so that a snapshot of the whole
+// tree is one more reference to the root. It runs BTreeCore's algorithms, like BTree, with
+// a link policy whose Own copies a node referenced from more than one place instead of
+// changing it: a write copies the nodes on its root-to-leaf path that are shared (the
+// siblings it borrows from or merges with included) and leaves the rest to both
+// versions, so with no snapshot alive the tree is updated in place like BTree.
+//
+// Snapshot, GetIterator, LowerBound, UpperBound, GetRange and GetPartIterator may be
+// called from any thread, even during a write: each copies the current root under a lock
+// held only for that copy, and then reads that version without locking, unaffected by
+// later writes. Writes run one at a time under a lock of their own. A point write changes
+// the tree in place and holds the root lock only for its O(log n) descent; VisitMutable
+// works on its own version of the tree, copying what readers still share, and publishes
+// it when it is done, so readers never wait through a whole traversal. The other
+// operations are for one thread at a time, as with BTree.
+template<typename TKey, typename TElement, int Order = 16>
+class PersistentBTree : public IOrderedDictionary<TKey, TElement> {
+    static_assert(Order >= 2, "A B-tree needs a minimum degree of at least 2.");
+
+public:
+    PersistentBTree();
+
+    virtual ~PersistentBTree();
+
+    PersistentBTree(const PersistentBTree &) = delete;
+
+    PersistentBTree &operator=(const PersistentBTree &) = delete;
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> LowerBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> UpperBound(const TKey &key) const override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetRange(const TKey &lo, const TKey &hi) const override;
+
+    // A tree sharing every node with this one, in O(1). Either can be written afterwards;
+    // the writes copy what they touch, so neither sees the other's changes.
+    virtual UnqPtr<IDictionary<TKey, TElement>> Snapshot() const override;
+
+private:
+    struct Node {
+        bool isLeaf;
+        int numKeys;
+        TKey keys[2 * Order - 1];
+        TElement values[2 * Order - 1];
+        AtomicShrdPtr<Node> children[2 * Order];
+
+        explicit Node(bool leaf) : isLeaf(leaf), numKeys(0) {}
+
+        // Copies the entries and child links in use; the children become shared.
+        Node(const Node &other);
+    };
+
+    struct Links {
+        typedef AtomicShrdPtr<Node> Link;
+
+        static Link NewNode(bool leaf, int) {
+            return Link(new Node(leaf));
+        }
+
+        static Node *Own(Link &slot);
+    };
+
+    typedef BTreeCore<TKey, TElement, Node, Links> Core;
+    // Holds its own link to the root it started from, so it reads that version.
+    typedef typename Core::template Iterator<AtomicShrdPtr<Node>> PersistentIterator;
+
+    AtomicShrdPtr<Node> root;
+    size_t count;
+    // Held for the whole of every write, so writes run one at a time.
+    std::mutex writeMutex;
+    // Held while the tree reachable from root changes or root is replaced, and by readers
+    // only while they copy root.
+    mutable std::mutex rootMutex;
+
+    PersistentBTree(const AtomicShrdPtr<Node> &root, size_t count);
+
+    AtomicShrdPtr<Node> LoadRoot() const;
+
+    TElement *FindOwned(const TKey &key);
+};
+
+template<typename TKey, typename TElement, int Order>
+PersistentBTree<TKey, TElement, Order>::Node::Node(const Node &other)
+        : isLeaf(other.isLeaf), numKeys(other.numKeys) {
+    for (int i = 0; i < numKeys; ++i) {
+        keys[i] = other.keys[i];
+        values[i] = other.values[i];
+    }
+    if (!isLeaf) {
+        for (int i = 0; i <= numKeys; ++i)
+            children[i] = other.children[i];
+    }
+}
+
+template<typename TKey, typename TElement, int Order>
+PersistentBTree<TKey, TElement, Order>::PersistentBTree() : root(new Node(true)), count(0) {
+}
+
+template<typename TKey, typename TElement, int Order>
+PersistentBTree<TKey, TElement, Order>::PersistentBTree(const AtomicShrdPtr<Node> &root, size_t count)
+        : root(root), count(count) {
+}
+
+template<typename TKey, typename TElement, int Order>
+PersistentBTree<TKey, TElement, Order>::~PersistentBTree() {
+}
+
+template<typename TKey, typename TElement, int Order>
+AtomicShrdPtr<typename PersistentBTree<TKey, TElement, Order>::Node>
+PersistentBTree<TKey, TElement, Order>::LoadRoot() const {
+    std::lock_guard<std::mutex> lock(rootMutex);
+    return root;
+}
+
+// A write either holds rootMutex or works on a version readers cannot reach, so no new
+// reference to the nodes it changes can appear meanwhile; a count of 1 means the node
+// belongs to this version alone. Copying a node shares its children, so the copying
+// carries on down the path.
+template<typename TKey, typename TElement, int Order>
+typename PersistentBTree<TKey, TElement, Order>::Node *
+PersistentBTree<TKey, TElement, Order>::Links::Own(AtomicShrdPtr<Node> &slot) {
+    if (slot.use_count() > 1)
+        slot = AtomicShrdPtr<Node>(new Node(*slot));
+    return slot.get();
+}
+
+template<typename TKey, typename TElement, int Order>
+size_t PersistentBTree<TKey, TElement, Order>::GetCount() const {
+    return count;
+}
+
+template<typename TKey, typename TElement, int Order>
+size_t PersistentBTree<TKey, TElement, Order>::GetCapacity() const {
+    return count;
+}
+
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionary<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::Snapshot() const {
+    std::lock_guard<std::mutex> lock(rootMutex);
+    return UnqPtr<IDictionary<TKey, TElement>>(new PersistentBTree(root, count));
+}
+
+template<typename TKey, typename TElement, int Order>
+void PersistentBTree<TKey, TElement, Order>::Add(const TKey &key, const TElement &element) {
+    Upsert(key, element);
+}
+
+template<typename TKey, typename TElement, int Order>
+bool PersistentBTree<TKey, TElement, Order>::Upsert(const TKey &key, const TElement &element) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    std::lock_guard<std::mutex> lock(rootMutex);
+    bool inserted;
+    *Core::FindOrInsert(root, Order, key, inserted) = element;
+    if (inserted)
+        ++count;
+    return inserted;
+}
+
+template<typename TKey, typename TElement, int Order>
+TElement &PersistentBTree<TKey, TElement, Order>::GetOrAdd(const TKey &key) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    std::lock_guard<std::mutex> lock(rootMutex);
+    bool inserted;
+    TElement *value = Core::FindOrInsert(root, Order, key, inserted);
+    if (inserted)
+        ++count;
+    return *value;
+}
+
+template<typename TKey, typename TElement, int Order>
+TElement PersistentBTree<TKey, TElement, Order>::Get(const TKey &key) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+    return *value;
+}
+
+template<typename TKey, typename TElement, int Order>
+const TElement *PersistentBTree<TKey, TElement, Order>::FindPtr(const TKey &key) const {
+    int index;
+    const Node *x = Core::Search(root.get(), key, index);
+    return x ? &x->values[index] : nullptr;
+}
+
+// A writable pointer may be written through later, so the path to it is owned first; a
+// miss copies nothing.
+template<typename TKey, typename TElement, int Order>
+TElement *PersistentBTree<TKey, TElement, Order>::FindOwned(const TKey &key) {
+    int index;
+    if (!Core::Search(root.get(), key, index))
+        return nullptr;
+
+    Node *x = Links::Own(root);
+    while (true) {
+        int i = KeySearch<TKey>::LowerBound(&x->keys[0], x->numKeys, key);
+        if (i < x->numKeys && key == x->keys[i])
+            return &x->values[i];
+        x = Links::Own(x->children[i]);
+    }
+}
+
+template<typename TKey, typename TElement, int Order>
+TElement *PersistentBTree<TKey, TElement, Order>::FindPtr(const TKey &key) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    std::lock_guard<std::mutex> lock(rootMutex);
+    return FindOwned(key);
+}
+
+template<typename TKey, typename TElement, int Order>
+bool PersistentBTree<TKey, TElement, Order>::TryGet(const TKey &key, TElement &element) const {
+    const TElement *value = FindPtr(key);
+    if (!value)
+        return false;
+
+    element = *value;
+    return true;
+}
+
+template<typename TKey, typename TElement, int Order>
+bool PersistentBTree<TKey, TElement, Order>::ContainsKey(const TKey &key) const {
+    return FindPtr(key) != nullptr;
+}
+
+template<typename TKey, typename TElement, int Order>
+void PersistentBTree<TKey, TElement, Order>::Update(const TKey &key, const TElement &element) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    std::lock_guard<std::mutex> lock(rootMutex);
+    TElement *value = FindOwned(key);
+    if (!value)
+        throw std::runtime_error("Key not found.");
+
+    *value = element;
+}
+
+template<typename TKey, typename TElement, int Order>
+void PersistentBTree<TKey, TElement, Order>::Remove(const TKey &key) {
+    if (!TryRemove(key))
+        throw std::runtime_error("Key not found.");
+}
+
+// Unlike BTree, a missing key returns before the descent, which would otherwise copy the
+// shared nodes it rebalances.
+template<typename TKey, typename TElement, int Order>
+bool PersistentBTree<TKey, TElement, Order>::TryRemove(const TKey &key) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    std::lock_guard<std::mutex> lock(rootMutex);
+    int index;
+    if (!Core::Search(root.get(), key, index))
+        return false;
+
+    Core::Remove(root, Order, key);
+    --count;
+    return true;
+}
+
+// Every node visited is owned first. The visit runs on a version of its own, which shares
+// every node with root until then, so the whole tree is copied and readers keep reading
+// the old version until the new one is published.
+template<typename TKey, typename TElement, int Order>
+void PersistentBTree<TKey, TElement, Order>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    std::lock_guard<std::mutex> write(writeMutex);
+    AtomicShrdPtr<Node> version = LoadRoot();
+    EntryBatch<TKey, TElement> batch(visitor);
+    Core::VisitRange(Links::Own(version), nullptr, nullptr, batch);
+    batch.Flush();
+
+    // The old version, left in `version`, is released after the lock.
+    std::lock_guard<std::mutex> lock(rootMutex);
+    root.swap(version);
+}
+
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PersistentIterator(LoadRoot()));
+}
+
+// Each part iterator reads the version current when it was created; parts taken from a
+// snapshot all read the same one.
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::GetPartIterator(int part,
+                                                                                                  int parts) const {
+    AtomicShrdPtr<Node> version = LoadRoot();
+    TreePartBounds<TKey> bounds = GetTreePartBounds<TKey>(version.get(), part, parts);
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(
+            new PersistentIterator(version, bounds.Lo(), true, bounds.Hi()));
+}
+
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::LowerBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PersistentIterator(LoadRoot(), &key, true));
+}
+
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::UpperBound(const TKey &key) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PersistentIterator(LoadRoot(), &key, false));
+}
+
+template<typename TKey, typename TElement, int Order>
+UnqPtr<IDictionaryIterator<TKey, TElement>> PersistentBTree<TKey, TElement, Order>::GetRange(const TKey &lo,
+                                                                                            const TKey &hi) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new PersistentIterator(LoadRoot(), &lo, true, &hi));
+}
+
+#endif // PERSISTENTBTREE_H
@@ -0,0 +1,381 @@
+#ifndef SHARDEDHASHTABLE_H
+#define SHARDEDHASHTABLE_H
+
+#include "IDictionary.h"
+#include "HashTable.h"
+#include "IndexPair.h"
+#include "KeyValue.h"
+#include "UnqPtr.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <vector>
+
+// HashTable split into independently locked shards so that several threads can read and
+// write one dictionary at once. A key's shard is picked from the high bits of its mixed
+// hash, leaving the low bits, which the shard's own HashTable uses, evenly spread. Each
+// shard is a HashTable behind a reader-writer lock and grows on its own, so a resize
+// only stalls the threads that touch that shard.
+//
+// Get, TryGet, ContainsKey, Add, Remove, Update, Upsert and TryRemove may be called from
+// any number of threads. FindPtr and GetOrAdd hand out pointers into a shard, which are
+// only safe to use while no other thread writes to that shard. Iterators read a snapshot:
+// each shard is copied under its lock as the iteration reaches it, so every entry is seen
+// as it was at that moment and later writes do not disturb the iteration.
+template<typename TKey, typename TElement>
+class ShardedHashTable : public IDictionary<TKey, TElement> {
+public:
+    // The shard count is rounded up to a power of two.
+    ShardedHashTable(size_t shardCount = 16, size_t initialCapacity = 16, bool incrementalRehash = false);
+
+    virtual ~ShardedHashTable();
+
+    virtual size_t GetCount() const override;
+
+    virtual size_t GetCapacity() const override;
+
+    virtual TElement Get(const TKey &key) const override;
+
+    virtual bool ContainsKey(const TKey &key) const override;
+
+    virtual void Add(const TKey &key, const TElement &element) override;
+
+    virtual void Remove(const TKey &key) override;
+
+    virtual void Update(const TKey &key, const TElement &element) override;
+
+    virtual bool TryGet(const TKey &key, TElement &element) const override;
+
+    virtual TElement *FindPtr(const TKey &key) override;
+
+    virtual const TElement *FindPtr(const TKey &key) const override;
+
+    virtual bool Upsert(const TKey &key, const TElement &element) override;
+
+    virtual TElement &GetOrAdd(const TKey &key) override;
+
+    virtual bool TryRemove(const TKey &key) override;
+
+    virtual void BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) override;
+
+    virtual void BulkInsert(const KeyValue<TKey, TElement> *items, size_t count) override;
+
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetIterator() const override;
+
+    virtual void VisitMutable(IEntryVisitor<TKey, TElement> &visitor) override;
+
+    // Part p covers the shards [n * p / parts, n * (p + 1) / parts) of the n shards, so at
+    // most n parts are non-empty.
+    virtual UnqPtr<IDictionaryIterator<TKey, TElement>> GetPartIterator(int part, int parts) const override;
+
+    virtual void VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part, int parts) override;
+
+    size_t GetShardCount() const;
+
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        HashTable<TKey, TElement> table;
+
+        Shard(size_t initialCapacity, bool incrementalRehash) : table(initialCapacity, incrementalRehash) {}
+    };
+
+    UnqPtr<UnqPtr<Shard>[]> shards;
+    size_t shardCount;
+    int shardBits;
+
+    size_t ShardIndex(const TKey &key) const;
+
+    Shard &GetShard(const TKey &key) const;
+
+    // Iterates copies of the shards [firstShard, endShard), taking one at a time.
+    class SnapshotIterator : public IDictionaryIterator<TKey, TElement> {
+    public:
+        SnapshotIterator(const ShardedHashTable *hashTable, size_t firstShard, size_t endShard);
+
+        virtual ~SnapshotIterator() {}
+
+        virtual bool MoveNext() override;
+
+        virtual void Reset() override;
+
+        virtual TKey GetCurrentKey() const override;
+
+        virtual TElement GetCurrentValue() const override;
+
+        virtual size_t NextBatch(TKey *keys, TElement *values, size_t capacity) override;
+
+    private:
+        const ShardedHashTable *hashTable;
+        size_t firstShard;
+        size_t endShard;
+        size_t nextShard;
+        std::vector<KeyValue<TKey, TElement>> entries;
+        size_t index;
+        bool started;
+
+        bool LoadNextShard();
+    };
+};
+
+template<typename TKey, typename TElement>
+ShardedHashTable<TKey, TElement>::ShardedHashTable(size_t shardCount, size_t initialCapacity, bool incrementalRehash)
+        : shardCount(1), shardBits(0) {
+    while (this->shardCount < shardCount) {
+        this->shardCount *= 2;
+        ++shardBits;
+    }
+    shards = UnqPtr<UnqPtr<Shard>[]>(new UnqPtr<Shard>[this->shardCount]);
+    for (size_t i = 0; i < this->shardCount; ++i) {
+        shards[i] = UnqPtr<Shard>(new Shard(initialCapacity, incrementalRehash));
+    }
+}
+
+template<typename TKey, typename TElement>
+ShardedHashTable<TKey, TElement>::~ShardedHashTable() {
+}
+
+// std::hash<int> is the identity, so the hash is multiplied through before its top bits
+// are taken.
+template<typename TKey, typename TElement>
+size_t ShardedHashTable<TKey, TElement>::ShardIndex(const TKey &key) const {
+    if (shardBits == 0)
+        return 0;
+
+    uint64_t hash;
+    if constexpr (std::is_same<TKey, IndexPair>::value) {
+        hash = IndexPairHash()(key);
+    } else {
+        hash = std::hash<TKey>()(key);
+    }
+    hash *= 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> (64 - shardBits));
+}
+
+template<typename TKey, typename TElement>
+typename ShardedHashTable<TKey, TElement>::Shard &ShardedHashTable<TKey, TElement>::GetShard(const TKey &key) const {
+    return *shards[ShardIndex(key)];
+}
+
+template<typename TKey, typename TElement>
+size_t ShardedHashTable<TKey, TElement>::GetShardCount() const {
+    return shardCount;
+}
+
+template<typename TKey, typename TElement>
+size_t ShardedHashTable<TKey, TElement>::GetCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < shardCount; ++i) {
+        std::shared_lock<std::shared_mutex> lock(shards[i]->mutex);
+        count += shards[i]->table.GetCount();
+    }
+    return count;
+}
+
+template<typename TKey, typename TElement>
+size_t ShardedHashTable<TKey, TElement>::GetCapacity() const {
+    size_t capacity = 0;
+    for (size_t i = 0; i < shardCount; ++i) {
+        std::shared_lock<std::shared_mutex> lock(shards[i]->mutex);
+        capacity += shards[i]->table.GetCapacity();
+    }
+    return capacity;
+}
+
+template<typename TKey, typename TElement>
+TElement ShardedHashTable<TKey, TElement>::Get(const TKey &key) const {
+    Shard &shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.Get(key);
+}
+
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::ContainsKey(const TKey &key) const {
+    Shard &shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.ContainsKey(key);
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::Add(const TKey &key, const TElement &element) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.table.Add(key, element);
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::Remove(const TKey &key) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.table.Remove(key);
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::Update(const TKey &key, const TElement &element) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.table.Update(key, element);
+}
+
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::TryGet(const TKey &key, TElement &element) const {
+    Shard &shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.TryGet(key, element);
+}
+
+template<typename TKey, typename TElement>
+TElement *ShardedHashTable<TKey, TElement>::FindPtr(const TKey &key) {
+    Shard &shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.FindPtr(key);
+}
+
+template<typename TKey, typename TElement>
+const TElement *ShardedHashTable<TKey, TElement>::FindPtr(const TKey &key) const {
+    Shard &shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return static_cast<const HashTable<TKey, TElement> &>(shard.table).FindPtr(key);
+}
+
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::Upsert(const TKey &key, const TElement &element) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.Upsert(key, element);
+}
+
+template<typename TKey, typename TElement>
+TElement &ShardedHashTable<TKey, TElement>::GetOrAdd(const TKey &key) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.GetOrAdd(key);
+}
+
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::TryRemove(const TKey &key) {
+    Shard &shard = GetShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.table.TryRemove(key);
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::BulkLoad(const KeyValue<TKey, TElement> *items, size_t count) {
+    BulkInsert(items, count);
+}
+
+// Routes the items to their shards first, so each shard is locked and presized once.
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::BulkInsert(const KeyValue<TKey, TElement> *items, size_t count) {
+    std::vector<std::vector<KeyValue<TKey, TElement>>> routed(shardCount);
+    for (size_t i = 0; i < count; ++i) {
+        routed[ShardIndex(items[i].key)].push_back(items[i]);
+    }
+    for (size_t i = 0; i < shardCount; ++i) {
+        std::unique_lock<std::shared_mutex> lock(shards[i]->mutex);
+        shards[i]->table.BulkInsert(routed[i].data(), routed[i].size());
+    }
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ShardedHashTable<TKey, TElement>::GetIterator() const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(new SnapshotIterator(this, 0, shardCount));
+}
+
+// Each shard is held exclusively while its values are visited.
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::VisitMutable(IEntryVisitor<TKey, TElement> &visitor) {
+    VisitMutablePart(visitor, 0, 1);
+}
+
+template<typename TKey, typename TElement>
+UnqPtr<IDictionaryIterator<TKey, TElement>> ShardedHashTable<TKey, TElement>::GetPartIterator(int part,
+                                                                                              int parts) const {
+    return UnqPtr<IDictionaryIterator<TKey, TElement>>(
+            new SnapshotIterator(this, shardCount * part / parts, shardCount * (part + 1) / parts));
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::VisitMutablePart(IEntryVisitor<TKey, TElement> &visitor, int part,
+                                                        int parts) {
+    for (size_t i = shardCount * part / parts; i < shardCount * (part + 1) / parts; ++i) {
+        std::unique_lock<std::shared_mutex> lock(shards[i]->mutex);
+        shards[i]->table.VisitMutable(visitor);
+    }
+}
+
+template<typename TKey, typename TElement>
+ShardedHashTable<TKey, TElement>::SnapshotIterator::SnapshotIterator(const ShardedHashTable *hashTable,
+                                                                     size_t firstShard, size_t endShard)
+        : hashTable(hashTable), firstShard(firstShard), endShard(endShard), nextShard(firstShard), index(0),
+          started(false) {
+}
+
+// Copies the next non-empty shard; false once every shard of the range has been read.
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::SnapshotIterator::LoadNextShard() {
+    entries.clear();
+    index = 0;
+    while (entries.empty() && nextShard < endShard) {
+        const Shard &shard = *hashTable->shards[nextShard++];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        entries.reserve(shard.table.GetCount());
+        auto iterator = shard.table.GetIterator();
+        ForEachEntry(*iterator, [this](const TKey &key, const TElement &value) {
+            entries.push_back(KeyValue<TKey, TElement>(key, value));
+        });
+    }
+    return !entries.empty();
+}
+
+template<typename TKey, typename TElement>
+bool ShardedHashTable<TKey, TElement>::SnapshotIterator::MoveNext() {
+    if (started && index < entries.size())
+        ++index;
+    started = true;
+    return index < entries.size() || LoadNextShard();
+}
+
+template<typename TKey, typename TElement>
+size_t ShardedHashTable<TKey, TElement>::SnapshotIterator::NextBatch(TKey *keys, TElement *values,
+                                                                     size_t capacity) {
+    size_t copied = 0;
+    while (copied < capacity && SnapshotIterator::MoveNext()) {
+        size_t run = entries.size() - index;
+        if (run > capacity - copied)
+            run = capacity - copied;
+        for (size_t i = 0; i < run; ++i) {
+            keys[copied + i] = entries[index + i].key;
+            values[copied + i] = entries[index + i].value;
+        }
+        copied += run;
+        index += run - 1;
+    }
+    return copied;
+}
+
+template<typename TKey, typename TElement>
+void ShardedHashTable<TKey, TElement>::SnapshotIterator::Reset() {
+    nextShard = firstShard;
+    entries.clear();
+    index = 0;
+    started = false;
+}
+
+template<typename TKey, typename TElement>
+TKey ShardedHashTable<TKey, TElement>::SnapshotIterator::GetCurrentKey() const {
+    if (!started || index >= entries.size())
+        throw std::out_of_range("Iterator out of range");
+    return entries[index].key;
+}
+
+template<typename TKey, typename TElement>
+TElement ShardedHashTable<TKey, TElement>::SnapshotIterator::GetCurrentValue() const {
+    if (!started || index >= entries.size())
+        throw std::out_of_range("Iterator out of range");
+    return entries[index].value;
+}
+
+#endif // SHARDEDHASHTABLE_H
@@ -0,0 +1,301 @@
+#ifndef SPARSEBLAS_H
+#define SPARSEBLAS_H
+
+#include "IDictionary.h"
+#include "IOrderedDictionary.h"
+#include "KeyValue.h"
+#include "SparseVector.h"
+#include "UnqPtr.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Level-1 kernels on sparse vectors: dot products, the Euclidean norm, and moving
+// values between sparse and dense form.
+//
+// A sparse dot product is an intersection of two sorted index lists. SortedDot works on
+// raw arrays: lists of similar length are intersected a block at a time, comparing
+// every index of a block of one list against every index of a block of the other with
+// SIMD compares and rotations; when one list is much shorter each of its indices
+// gallops (exponential then binary search) through the longer one.
+//
+// Dot on two SparseVectors picks the cheapest access for their dictionaries: if one
+// vector is much shorter, or either is a hash table, the shorter one is walked and the
+// other probed with FindPtr; two ordered vectors of similar size are copied out in
+// index order and intersected with SortedDot.
+
+// Length ratio above which the shorter list gallops through the longer one.
+constexpr size_t kDotGallopRatio = 32;
+
+namespace SparseBlasDetail {
+
+// First position in [from, count) whose index is not less than the key, searching
+// exponentially from `from`.
+inline size_t Gallop(const int* indices, size_t from, size_t count, int key)
+{
+    size_t bound = 1;
+    while (from + bound < count && indices[from + bound] < key)
+    {
+        bound *= 2;
+    }
+    size_t low = from + bound / 2;
+    size_t high = std::min(from + bound + 1, count);
+    return static_cast<size_t>(std::lower_bound(indices + low, indices + high, key) - indices);
+}
+
+template<typename TElement>
+TElement GallopDot(const int* shortIndices, const TElement* shortValues, size_t shortCount,
+                   const int* longIndices, const TElement* longValues, size_t longCount)
+{
+    TElement sum = TElement();
+    size_t position = 0;
+    for (size_t i = 0; i < shortCount && position < longCount; ++i)
+    {
+        position = Gallop(longIndices, position, longCount, shortIndices[i]);
+        if (position < longCount && longIndices[position] == shortIndices[i])
+        {
+            sum += shortValues[i] * longValues[position];
+        }
+    }
+    return sum;
+}
+
+// Merges the tails left over after the block loop.
+template<typename TElement>
+TElement MergeDot(const int* leftIndices, const TElement* leftValues, size_t i, size_t leftCount,
+                  const int* rightIndices, const TElement* rightValues, size_t j, size_t rightCount, TElement sum)
+{
+    while (i < leftCount && j < rightCount)
+    {
+        if (leftIndices[i] < rightIndices[j])
+        {
+            ++i;
+        }
+        else if (rightIndices[j] < leftIndices[i])
+        {
+            ++j;
+        }
+        else
+        {
+            sum += leftValues[i++] * rightValues[j++];
+        }
+    }
+    return sum;
+}
+
+// Block intersection. Lane k of rotation r compares left[i + k] with
+// right[j + (k + r) % kBlock], so the masks of all rotations together name every equal
+// pair in the two blocks. The block whose last index is smaller is then consumed.
+#if defined(__AVX2__)
+constexpr size_t kBlock = 8;
+
+inline void BlockMasks(const int* left, const int* right, int* masks)
+{
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(left));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(right));
+    __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    for (size_t r = 0; r < kBlock; ++r)
+    {
+        masks[r] = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)));
+        b = _mm256_permutevar8x32_epi32(b, rotate);
+    }
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+constexpr size_t kBlock = 4;
+
+inline void BlockMasks(const int* left, const int* right, int* masks)
+{
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right));
+    masks[0] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)));
+    masks[1] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x39))));
+    masks[2] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x4E))));
+    masks[3] = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, 0x93))));
+}
+#else
+constexpr size_t kBlock = 4;
+
+inline void BlockMasks(const int* left, const int* right, int* masks)
+{
+    for (size_t r = 0; r < kBlock; ++r)
+    {
+        masks[r] = 0;
+        for (size_t k = 0; k < kBlock; ++k)
+        {
+            masks[r] |= (left[k] == right[(k + r) % kBlock]) << k;
+        }
+    }
+}
+#endif
+
+template<typename TElement>
+TElement BlockDot(const int* leftIndices, const TElement* leftValues, size_t leftCount,
+                  const int* rightIndices, const TElement* rightValues, size_t rightCount)
+{
+    TElement sum = TElement();
+    size_t i = 0;
+    size_t j = 0;
+    int masks[kBlock];
+    while (i + kBlock <= leftCount && j + kBlock <= rightCount)
+    {
+        BlockMasks(leftIndices + i, rightIndices + j, masks);
+        for (size_t r = 0; r < kBlock; ++r)
+        {
+            for (int mask = masks[r]; mask != 0; mask &= mask - 1)
+            {
+                size_t k = static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+                sum += leftValues[i + k] * rightValues[j + (k + r) % kBlock];
+            }
+        }
+
+        int leftLast = leftIndices[i + kBlock - 1];
+        int rightLast = rightIndices[j + kBlock - 1];
+        if (leftLast <= rightLast)
+        {
+            i += kBlock;
+        }
+        if (rightLast <= leftLast)
+        {
+            j += kBlock;
+        }
+    }
+    return MergeDot(leftIndices, leftValues, i, leftCount, rightIndices, rightValues, j, rightCount, sum);
+}
+
+// Copies the entries of an ordered dictionary out in index order.
+template<typename TElement>
+void ExtractSorted(const IDictionary<int, TElement>& elements, std::vector<int>& indices,
+                   std::vector<TElement>& values)
+{
+    indices.reserve(elements.GetCount());
+    values.reserve(elements.GetCount());
+    auto iterator = elements.GetIterator();
+    ForEachEntry(*iterator, [&](int index, const TElement& value) {
+        indices.push_back(index);
+        values.push_back(value);
+    });
+}
+
+} // namespace SparseBlasDetail
+
+// Dot product of two sparse vectors given as strictly increasing index arrays with
+// their values.
+template<typename TElement>
+TElement SortedDot(const int* leftIndices, const TElement* leftValues, size_t leftCount,
+                   const int* rightIndices, const TElement* rightValues, size_t rightCount)
+{
+    if (leftCount > rightCount)
+    {
+        return SortedDot(rightIndices, rightValues, rightCount, leftIndices, leftValues, leftCount);
+    }
+    if (leftCount * kDotGallopRatio < rightCount)
+    {
+        return SparseBlasDetail::GallopDot(leftIndices, leftValues, leftCount, rightIndices, rightValues, rightCount);
+    }
+    return SparseBlasDetail::BlockDot(leftIndices, leftValues, leftCount, rightIndices, rightValues, rightCount);
+}
+
+template<typename TElement>
+TElement Dot(const SparseVector<TElement>& left, const SparseVector<TElement>& right)
+{
+    if (left.GetLength() != right.GetLength())
+    {
+        throw std::invalid_argument("Vectors must have the same length.");
+    }
+
+    const IDictionary<int, TElement>& leftElements = left.GetElements();
+    const IDictionary<int, TElement>& rightElements = right.GetElements();
+    bool leftSmaller = leftElements.GetCount() <= rightElements.GetCount();
+    const IDictionary<int, TElement>& walked = leftSmaller ? leftElements : rightElements;
+    const IDictionary<int, TElement>& probed = leftSmaller ? rightElements : leftElements;
+
+    bool bothOrdered = dynamic_cast<const IOrderedDictionary<int, TElement>*>(&leftElements) &&
+                       dynamic_cast<const IOrderedDictionary<int, TElement>*>(&rightElements);
+    if (bothOrdered && walked.GetCount() * kDotGallopRatio >= probed.GetCount())
+    {
+        std::vector<int> leftIndices;
+        std::vector<int> rightIndices;
+        std::vector<TElement> leftValues;
+        std::vector<TElement> rightValues;
+        SparseBlasDetail::ExtractSorted(leftElements, leftIndices, leftValues);
+        SparseBlasDetail::ExtractSorted(rightElements, rightIndices, rightValues);
+        return SortedDot(leftIndices.data(), leftValues.data(), leftIndices.size(), rightIndices.data(),
+                         rightValues.data(), rightIndices.size());
+    }
+
+    TElement sum = TElement();
+    auto iterator = walked.GetIterator();
+    while (iterator->MoveNext())
+    {
+        const TElement* other = probed.FindPtr(iterator->GetCurrentKey());
+        if (other)
+        {
+            sum += iterator->GetCurrentValue() * *other;
+        }
+    }
+    return sum;
+}
+
+template<typename TElement>
+TElement Dot(const SparseVector<TElement>& left, const std::vector<TElement>& dense)
+{
+    if (static_cast<size_t>(left.GetLength()) != dense.size())
+    {
+        throw std::invalid_argument("Vectors must have the same length.");
+    }
+
+    TElement sum = TElement();
+    auto iterator = left.GetIterator();
+    ForEachEntry(*iterator, [&](int index, const TElement& value) { sum += value * dense[index]; });
+    return sum;
+}
+
+template<typename TElement>
+TElement Norm2(const SparseVector<TElement>& vector)
+{
+    TElement sum = TElement();
+    auto iterator = vector.GetIterator();
+    ForEachEntry(*iterator, [&sum](int, const TElement& value) { sum += value * value; });
+    return std::sqrt(sum);
+}
+
+// Writes the stored entries into a dense vector of the same length; positions that are
+// not stored are left as they are.
+template<typename TElement>
+void Scatter(const SparseVector<TElement>& vector, std::vector<TElement>& dense)
+{
+    if (static_cast<size_t>(vector.GetLength()) != dense.size())
+    {
+        throw std::invalid_argument("Vectors must have the same length.");
+    }
+
+    auto iterator = vector.GetIterator();
+    ForEachEntry(*iterator, [&dense](int index, const TElement& value) { dense[index] = value; });
+}
+
+// Collects the nonzeros of a dense vector into the given dictionary with one sorted
+// bulk load.
+template<typename TElement>
+SparseVector<TElement> Gather(const std::vector<TElement>& dense, UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    std::vector<KeyValue<int, TElement>> entries;
+    for (size_t i = 0; i < dense.size(); ++i)
+    {
+        if (dense[i] != TElement())
+        {
+            entries.emplace_back(static_cast<int>(i), dense[i]);
+        }
+    }
+    return SparseVector<TElement>(static_cast<int>(dense.size()), std::move(dictionary), entries.data(),
+                                  entries.size(), true);
+}
+
+#endif // SPARSEBLAS_H
@@ -0,0 +1,332 @@
+#ifndef SPARSEELEMENTWISE_H
+#define SPARSEELEMENTWISE_H
+
+#include "IDictionary.h"
+#include "IOrderedDictionary.h"
+#include "IndexPair.h"
+#include "KeyValue.h"
+#include "SparseMatrix.h"
+#include "SparseVector.h"
+#include "UnqPtr.h"
+#include <stdexcept>
+#include <vector>
+
+// Element-wise arithmetic. Each operation reads its operands once and builds the result
+// in the dictionary the caller passes in, through the bulk-loading constructors rather
+// than one SetElement per entry. When both operands are ordered dictionaries their
+// iterators are merged in key order and the result is loaded as already sorted;
+// otherwise the operation is a hash join that probes one operand with FindPtr for each
+// key of the other. Results never store zeros, including sums that cancel out.
+
+namespace SparseElementwiseDetail {
+
+template<typename TKey, typename TElement>
+bool BothOrdered(const IDictionary<TKey, TElement>& left, const IDictionary<TKey, TElement>& right)
+{
+    return dynamic_cast<const IOrderedDictionary<TKey, TElement>*>(&left) &&
+           dynamic_cast<const IOrderedDictionary<TKey, TElement>*>(&right);
+}
+
+template<typename TKey, typename TElement>
+void Emit(std::vector<KeyValue<TKey, TElement>>& entries, const TKey& key, const TElement& value)
+{
+    if (value != TElement())
+    {
+        entries.emplace_back(key, value);
+    }
+}
+
+// Keys present in either operand; a missing value is passed to combine as zero.
+// `sorted` reports whether the entries came out in key order.
+template<typename TKey, typename TElement, typename TCombine>
+std::vector<KeyValue<TKey, TElement>> Union(const IDictionary<TKey, TElement>& left,
+                                            const IDictionary<TKey, TElement>& right, TCombine combine, bool& sorted)
+{
+    std::vector<KeyValue<TKey, TElement>> entries;
+    entries.reserve(left.GetCount() + right.GetCount());
+    sorted = BothOrdered(left, right);
+
+    if (sorted)
+    {
+        auto a = left.GetIterator();
+        auto b = right.GetIterator();
+        bool hasA = a->MoveNext();
+        bool hasB = b->MoveNext();
+        while (hasA && hasB)
+        {
+            TKey keyA = a->GetCurrentKey();
+            TKey keyB = b->GetCurrentKey();
+            if (keyA < keyB)
+            {
+                Emit(entries, keyA, combine(a->GetCurrentValue(), TElement()));
+                hasA = a->MoveNext();
+            }
+            else if (keyB < keyA)
+            {
+                Emit(entries, keyB, combine(TElement(), b->GetCurrentValue()));
+                hasB = b->MoveNext();
+            }
+            else
+            {
+                Emit(entries, keyA, combine(a->GetCurrentValue(), b->GetCurrentValue()));
+                hasA = a->MoveNext();
+                hasB = b->MoveNext();
+            }
+        }
+        for (; hasA; hasA = a->MoveNext())
+        {
+            Emit(entries, a->GetCurrentKey(), combine(a->GetCurrentValue(), TElement()));
+        }
+        for (; hasB; hasB = b->MoveNext())
+        {
+            Emit(entries, b->GetCurrentKey(), combine(TElement(), b->GetCurrentValue()));
+        }
+        return entries;
+    }
+
+    auto a = left.GetIterator();
+    while (a->MoveNext())
+    {
+        TKey key = a->GetCurrentKey();
+        const TElement* other = right.FindPtr(key);
+        Emit(entries, key, combine(a->GetCurrentValue(), other ? *other : TElement()));
+    }
+    auto b = right.GetIterator();
+    while (b->MoveNext())
+    {
+        TKey key = b->GetCurrentKey();
+        if (!left.FindPtr(key))
+        {
+            Emit(entries, key, combine(TElement(), b->GetCurrentValue()));
+        }
+    }
+    return entries;
+}
+
+// Keys present in both operands. The hash join walks the smaller operand.
+template<typename TKey, typename TElement, typename TCombine>
+std::vector<KeyValue<TKey, TElement>> Intersection(const IDictionary<TKey, TElement>& left,
+                                                   const IDictionary<TKey, TElement>& right, TCombine combine,
+                                                   bool& sorted)
+{
+    std::vector<KeyValue<TKey, TElement>> entries;
+    sorted = BothOrdered(left, right);
+
+    if (sorted)
+    {
+        auto a = left.GetIterator();
+        auto b = right.GetIterator();
+        bool hasA = a->MoveNext();
+        bool hasB = b->MoveNext();
+        while (hasA && hasB)
+        {
+            TKey keyA = a->GetCurrentKey();
+            TKey keyB = b->GetCurrentKey();
+            if (keyA < keyB)
+            {
+                hasA = a->MoveNext();
+            }
+            else if (keyB < keyA)
+            {
+                hasB = b->MoveNext();
+            }
+            else
+            {
+                Emit(entries, keyA, combine(a->GetCurrentValue(), b->GetCurrentValue()));
+                hasA = a->MoveNext();
+                hasB = b->MoveNext();
+            }
+        }
+        return entries;
+    }
+
+    bool leftSmaller = left.GetCount() <= right.GetCount();
+    const IDictionary<TKey, TElement>& walked = leftSmaller ? left : right;
+    const IDictionary<TKey, TElement>& probed = leftSmaller ? right : left;
+    auto iterator = walked.GetIterator();
+    while (iterator->MoveNext())
+    {
+        TKey key = iterator->GetCurrentKey();
+        const TElement* other = probed.FindPtr(key);
+        if (other)
+        {
+            TElement value = iterator->GetCurrentValue();
+            Emit(entries, key, leftSmaller ? combine(value, *other) : combine(*other, value));
+        }
+    }
+    return entries;
+}
+
+template<typename TKey, typename TElement, typename TTransform>
+std::vector<KeyValue<TKey, TElement>> Transform(const IDictionary<TKey, TElement>& source, TTransform transform,
+                                                bool& sorted)
+{
+    std::vector<KeyValue<TKey, TElement>> entries;
+    entries.reserve(source.GetCount());
+    sorted = dynamic_cast<const IOrderedDictionary<TKey, TElement>*>(&source) != nullptr;
+    auto iterator = source.GetIterator();
+    while (iterator->MoveNext())
+    {
+        Emit(entries, iterator->GetCurrentKey(), transform(iterator->GetCurrentValue()));
+    }
+    return entries;
+}
+
+template<typename TElement>
+void CheckSameShape(const SparseVector<TElement>& left, const SparseVector<TElement>& right)
+{
+    if (left.GetLength() != right.GetLength())
+    {
+        throw std::invalid_argument("Vectors must have the same length.");
+    }
+}
+
+template<typename TElement>
+void CheckSameShape(const SparseMatrix<TElement>& left, const SparseMatrix<TElement>& right)
+{
+    if (left.GetRows() != right.GetRows() || left.GetColumns() != right.GetColumns())
+    {
+        throw std::invalid_argument("Matrices must have the same dimensions.");
+    }
+}
+
+// BulkLoad takes strictly increasing keys, so an ordered dictionary gets the entries
+// sorted unless they already are. Any other dictionary takes them through BulkInsert in
+// the order they were gathered; they never repeat a key and hold no zeros.
+template<typename TElement>
+SparseVector<TElement> MakeLike(const SparseVector<TElement>& shape, UnqPtr<IDictionary<int, TElement>> dictionary,
+                                const std::vector<KeyValue<int, TElement>>& entries, bool sorted)
+{
+    if (!dynamic_cast<const IOrderedDictionary<int, TElement>*>(dictionary.get()))
+    {
+        dictionary->BulkInsert(entries.data(), entries.size());
+        return SparseVector<TElement>(shape.GetLength(), std::move(dictionary));
+    }
+    return SparseVector<TElement>(shape.GetLength(), std::move(dictionary), entries.data(), entries.size(), sorted);
+}
+
+template<typename TElement>
+SparseMatrix<TElement> MakeLike(const SparseMatrix<TElement>& shape,
+                                UnqPtr<IDictionary<IndexPair, TElement>> dictionary,
+                                const std::vector<KeyValue<IndexPair, TElement>>& entries, bool sorted)
+{
+    if (!dynamic_cast<const IOrderedDictionary<IndexPair, TElement>*>(dictionary.get()))
+    {
+        dictionary->BulkInsert(entries.data(), entries.size());
+        return SparseMatrix<TElement>(shape.GetRows(), shape.GetColumns(), std::move(dictionary));
+    }
+    return SparseMatrix<TElement>(shape.GetRows(), shape.GetColumns(), std::move(dictionary), entries.data(),
+                                  entries.size(), sorted);
+}
+
+// The two-operand operations are written once over either container type.
+template<typename TContainer, typename TKey, typename TElement, typename TCombine>
+TContainer UnionOf(const TContainer& left, const TContainer& right, UnqPtr<IDictionary<TKey, TElement>> dictionary,
+                   TCombine combine)
+{
+    CheckSameShape(left, right);
+    bool sorted = false;
+    auto entries = Union(left.GetElements(), right.GetElements(), combine, sorted);
+    return MakeLike(left, std::move(dictionary), entries, sorted);
+}
+
+} // namespace SparseElementwiseDetail
+
+// left + right
+template<typename TElement>
+SparseVector<TElement> Add(const SparseVector<TElement>& left, const SparseVector<TElement>& right,
+                           UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(left, right, std::move(dictionary),
+                                            [](const TElement& a, const TElement& b) { return a + b; });
+}
+
+template<typename TElement>
+SparseMatrix<TElement> Add(const SparseMatrix<TElement>& left, const SparseMatrix<TElement>& right,
+                           UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(left, right, std::move(dictionary),
+                                            [](const TElement& a, const TElement& b) { return a + b; });
+}
+
+// left - right
+template<typename TElement>
+SparseVector<TElement> Subtract(const SparseVector<TElement>& left, const SparseVector<TElement>& right,
+                                UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(left, right, std::move(dictionary),
+                                            [](const TElement& a, const TElement& b) { return a - b; });
+}
+
+template<typename TElement>
+SparseMatrix<TElement> Subtract(const SparseMatrix<TElement>& left, const SparseMatrix<TElement>& right,
+                                UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(left, right, std::move(dictionary),
+                                            [](const TElement& a, const TElement& b) { return a - b; });
+}
+
+// alpha * x + y
+template<typename TElement>
+SparseVector<TElement> Axpy(const TElement& alpha, const SparseVector<TElement>& x, const SparseVector<TElement>& y,
+                            UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(x, y, std::move(dictionary),
+                                            [&alpha](const TElement& a, const TElement& b) { return alpha * a + b; });
+}
+
+template<typename TElement>
+SparseMatrix<TElement> Axpy(const TElement& alpha, const SparseMatrix<TElement>& x, const SparseMatrix<TElement>& y,
+                            UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
+{
+    return SparseElementwiseDetail::UnionOf(x, y, std::move(dictionary),
+                                            [&alpha](const TElement& a, const TElement& b) { return alpha * a + b; });
+}
+
+// The Hadamard product: only positions stored in both operands can be nonzero.
+template<typename TElement>
+SparseVector<TElement> ElementwiseMultiply(const SparseVector<TElement>& left, const SparseVector<TElement>& right,
+                                           UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    SparseElementwiseDetail::CheckSameShape(left, right);
+    bool sorted = false;
+    auto entries = SparseElementwiseDetail::Intersection(
+            left.GetElements(), right.GetElements(), [](const TElement& a, const TElement& b) { return a * b; },
+            sorted);
+    return SparseElementwiseDetail::MakeLike(left, std::move(dictionary), entries, sorted);
+}
+
+template<typename TElement>
+SparseMatrix<TElement> ElementwiseMultiply(const SparseMatrix<TElement>& left, const SparseMatrix<TElement>& right,
+                                           UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
+{
+    SparseElementwiseDetail::CheckSameShape(left, right);
+    bool sorted = false;
+    auto entries = SparseElementwiseDetail::Intersection(
+            left.GetElements(), right.GetElements(), [](const TElement& a, const TElement& b) { return a * b; },
+            sorted);
+    return SparseElementwiseDetail::MakeLike(left, std::move(dictionary), entries, sorted);
+}
+
+// alpha * source
+template<typename TElement>
+SparseVector<TElement> Scale(const SparseVector<TElement>& source, const TElement& alpha,
+                             UnqPtr<IDictionary<int, TElement>> dictionary)
+{
+    bool sorted = false;
+    auto entries = SparseElementwiseDetail::Transform(
+            source.GetElements(), [&alpha](const TElement& value) { return alpha * value; }, sorted);
+    return SparseElementwiseDetail::MakeLike(source, std::move(dictionary), entries, sorted);
+}
+
+template<typename TElement>
+SparseMatrix<TElement> Scale(const SparseMatrix<TElement>& source, const TElement& alpha,
+                             UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
+{
+    bool sorted = false;
+    auto entries = SparseElementwiseDetail::Transform(
+            source.GetElements(), [&alpha](const TElement& value) { return alpha * value; }, sorted);
+    return SparseElementwiseDetail::MakeLike(source, std::move(dictionary), entries, sorted);
+}
+
+#endif // SPARSEELEMENTWISE_H
@@ -2,10 +2,13 @@
 #define SPARSEMATRIX_H
 
 #include "IDictionary.h"
+#include "ParallelTraversal.h"
+#include "IOrderedDictionary.h"
 #include "IndexPair.h"
 #include "ShrdPtr.h"
 #include "DynamicArraySmart.h"
 #include "KeyValue.h"
+#include <algorithm>
 #include <vector>
 
 template<typename TElement>
@@ -14,6 +17,43 @@ public:
     SparseMatrix(int rows, int columns, UnqPtr<IDictionary<IndexPair, TElement>> dictionary)
             : rows(rows), columns(columns), elements(std::move(dictionary)) {}
 
+    // Builds the matrix in one pass through IDictionary::BulkLoad. Unless `sorted` is
+    // set the entries are sorted by (row, column) first; a repeated position keeps its
+    // last value and zero values are dropped.
+    SparseMatrix(int rows, int columns, UnqPtr<IDictionary<IndexPair, TElement>> dictionary,
+                 const KeyValue<IndexPair, TElement>* entries, size_t count, bool sorted = false)
+            : rows(rows), columns(columns), elements(std::move(dictionary))
+    {
+        std::vector<KeyValue<IndexPair, TElement>> items(entries, entries + count);
+        for (const KeyValue<IndexPair, TElement>& item : items)
+        {
+            if (item.key.row < 0 || item.key.row >= rows || item.key.column < 0 || item.key.column >= columns)
+            {
+                throw std::out_of_range("Row or column index is out of bounds.");
+            }
+        }
+
+        if (!sorted)
+        {
+            std::stable_sort(items.begin(), items.end(),
+                             [](const KeyValue<IndexPair, TElement>& a, const KeyValue<IndexPair, TElement>& b) {
+                                 return a.key < b.key;
+                             });
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (i + 1 < items.size() && items[i + 1].key == items[i].key)
+                continue;
+            if (items[i].value == TElement())
+                continue;
+            items[kept++] = items[i];
+        }
+
+        elements->BulkLoad(items.data(), kept);
+    }
+
     ~SparseMatrix(){}
 
     int GetRows() const
@@ -33,15 +73,11 @@ public:
             throw std::out_of_range("Row or column index is out of bounds.");
         }
 
-        IndexPair key(row, column);
-        if (elements->ContainsKey(key))
-        {
-            return elements->Get(key);
-        }
-        else
-        {
-            return TElement();
-        }
+        // TryGet copies the value out inside the dictionary, so reads stay safe alongside
+        // writers on the concurrent dictionaries.
+        TElement value = TElement();
+        elements->TryGet(IndexPair(row, column), value);
+        return value;
     }
 
     void SetElement(int row, int column, const TElement& value)
@@ -54,18 +90,11 @@ public:
         IndexPair key(row, column);
         if (value != TElement())
         {
-            if (elements->ContainsKey(key))
-            {
-                elements->Update(key, value);
-            }
-            else
-            {
-                elements->Add(key, value);
-            }
+            elements->Add(key, value);
         }
         else
         {
-            RemoveElement(key.row, key.column);
+            elements->Discard(key);
         }
     }
 
@@ -74,55 +103,65 @@ public:
             throw std::out_of_range("Row or column index is out of bounds.");
         }
 
-        IndexPair key(row, column);
-        if (elements->ContainsKey(key)) {
-            elements->Remove(key);
-        }
+        elements->Discard(IndexPair(row, column));
     }
 
-    void ForEach(void (*func)(const IndexPair &, const TElement &)) const {
+    // The callables can be lambdas, capturing or not. Entries are read through
+    // IDictionaryIterator::NextBatch, so there is one virtual call per batch rather than
+    // three per element, and the call to func can be inlined.
+    template<typename TFunc>
+    void ForEach(TFunc func) const {
         auto iterator = elements->GetIterator();
-
-        while (iterator->MoveNext()) {
-            IndexPair key = iterator->GetCurrentKey();
-            TElement value = iterator->GetCurrentValue();
-            func(key, value);
-        }
+        ForEachEntry(*iterator, func);
     }
 
-
-
-    void Map(TElement (*func)(TElement))
+    // Rewrites the stored values in place in one pass. Entries that map to zero are
+    // removed afterwards, so only their keys are buffered.
+    template<typename TFunc>
+    void Map(TFunc func)
     {
-        DynamicArraySmart<KeyValue<IndexPair, TElement>> updates;
-        auto iterator = elements->GetIterator();
-        while (iterator->MoveNext())
-        {
-            IndexPair key = iterator->GetCurrentKey();
-            TElement value = iterator->GetCurrentValue();
-            TElement newValue = func(value);
-            updates.Append(KeyValue<IndexPair, TElement>(key, newValue));
-        }
-        for (int i = 0; i < updates.GetLength(); ++i)
+        std::vector<IndexPair> zeros;
+        ForEachMutable(*elements, [&](const IndexPair& key, TElement& value) {
+            value = func(value);
+            if (value == TElement())
+                zeros.push_back(key);
+        });
+        for (const IndexPair& key : zeros)
         {
-            const KeyValue<IndexPair, TElement>& kv = updates.Get(i);
-            elements->Update(kv.key, kv.value);
+            elements->Discard(key);
         }
     }
 
-
-    TElement Reduce(TElement (*func)(TElement, TElement), TElement initial) const
+    template<typename TFunc>
+    TElement Reduce(TFunc func, TElement initial) const
     {
         TElement result = initial;
         auto iterator = elements->GetIterator();
-        while (iterator->MoveNext())
-        {
-            TElement value = iterator->GetCurrentValue();
-            result = func(result, value);
-        }
+        ForEachEntry(*iterator, [&](const IndexPair&, const TElement& value) { result = func(result, value); });
         return result;
     }
 
+    // ForEach, Map and Reduce spread over `threads` threads (0 means one per hardware
+    // thread), each walking its own parts of the dictionary; see ParallelTraversal.h for
+    // what the callables must allow and for the deterministic Reduce.
+    template<typename TFunc>
+    void ParallelForEach(TFunc func, int threads = 0) const
+    {
+        ParallelForEachEntry(*elements, func, threads);
+    }
+
+    template<typename TFunc>
+    void ParallelMap(TFunc func, int threads = 0)
+    {
+        ParallelMapValues(*elements, func, threads);
+    }
+
+    template<typename TFunc>
+    TElement ParallelReduce(TFunc func, TElement initial, int threads = 0, bool deterministic = false) const
+    {
+        return ParallelReduceValues(*elements, func, initial, threads, deterministic);
+    }
+
     UnqPtr<IDictionaryIterator<IndexPair, TElement>> GetIterator() const
     {
         return elements->GetIterator();
@@ -132,10 +171,150 @@ public:
         return *elements;
     }
 
+    // A matrix over IDictionary::Snapshot of the elements: it keeps the current values
+    // while this one goes on changing, and can be read from another thread meanwhile.
+    SparseMatrix<TElement> Snapshot() const
+    {
+        return SparseMatrix<TElement>(rows, columns, elements->Snapshot());
+    }
+
+    // Iterates the nonzeros of one row. An ordered dictionary keeps a row's keys together,
+    // so the row is a single range scan in O(log n + k); other dictionaries are filtered.
+    UnqPtr<IDictionaryIterator<IndexPair, TElement>> GetRowIterator(int row) const
+    {
+        if (row < 0 || row >= rows)
+        {
+            throw std::out_of_range("Row index is out of bounds.");
+        }
+
+        const IOrderedDictionary<IndexPair, TElement>* ordered =
+                dynamic_cast<const IOrderedDictionary<IndexPair, TElement>*>(elements.get());
+        if (ordered)
+        {
+            return ordered->GetRange(IndexPair(row, 0), IndexPair(row, columns));
+        }
+        return UnqPtr<IDictionaryIterator<IndexPair, TElement>>(new SliceIterator(elements->GetIterator(), row, -1));
+    }
+
+    // Iterates the nonzeros of one column in row order. Keys are ordered by row first, so
+    // a column is never one range: every row is probed when there are fewer rows than
+    // nonzeros, and a full iteration is filtered otherwise.
+    UnqPtr<IDictionaryIterator<IndexPair, TElement>> GetColumnIterator(int column) const
+    {
+        if (column < 0 || column >= columns)
+        {
+            throw std::out_of_range("Column index is out of bounds.");
+        }
+
+        if (static_cast<size_t>(rows) < elements->GetCount())
+        {
+            return UnqPtr<IDictionaryIterator<IndexPair, TElement>>(
+                    new ColumnProbeIterator(elements.get(), rows, column));
+        }
+        return UnqPtr<IDictionaryIterator<IndexPair, TElement>>(new SliceIterator(elements->GetIterator(), -1, column));
+    }
+
 private:
     int rows;
     int columns;
     UnqPtr<IDictionary<IndexPair, TElement>> elements;
+
+    // Skips the entries of another iterator outside the given row or column (-1 = any).
+    class SliceIterator : public IDictionaryIterator<IndexPair, TElement>
+    {
+    public:
+        SliceIterator(UnqPtr<IDictionaryIterator<IndexPair, TElement>> inner, int row, int column)
+                : inner(std::move(inner)), row(row), column(column) {}
+
+        bool MoveNext() override
+        {
+            while (inner->MoveNext())
+            {
+                IndexPair key = inner->GetCurrentKey();
+                if ((row < 0 || key.row == row) && (column < 0 || key.column == column))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Reset() override
+        {
+            inner->Reset();
+        }
+
+        IndexPair GetCurrentKey() const override
+        {
+            return inner->GetCurrentKey();
+        }
+
+        TElement GetCurrentValue() const override
+        {
+            return inner->GetCurrentValue();
+        }
+
+    private:
+        UnqPtr<IDictionaryIterator<IndexPair, TElement>> inner;
+        int row;
+        int column;
+    };
+
+    // Looks up (row, column) for every row in turn. Values are copied out with TryGet, so
+    // no pointer into the dictionary is held between calls.
+    class ColumnProbeIterator : public IDictionaryIterator<IndexPair, TElement>
+    {
+    public:
+        ColumnProbeIterator(const IDictionary<IndexPair, TElement>* elements, int rows, int column)
+                : elements(elements), rows(rows), column(column), row(-1), value(), found(false) {}
+
+        bool MoveNext() override
+        {
+            while (row + 1 < rows)
+            {
+                ++row;
+                found = elements->TryGet(IndexPair(row, column), value);
+                if (found)
+                {
+                    return true;
+                }
+            }
+            found = false;
+            return false;
+        }
+
+        void Reset() override
+        {
+            row = -1;
+            found = false;
+        }
+
+        IndexPair GetCurrentKey() const override
+        {
+            if (!found)
+            {
+                throw std::out_of_range("Iterator out of range");
+            }
+            return IndexPair(row, column);
+        }
+
+        TElement GetCurrentValue() const override
+        {
+            if (!found)
+            {
+                throw std::out_of_range("Iterator out of range");
+            }
+            return value;
+        }
+
+    private:
+        const IDictionary<IndexPair, TElement>* elements;
+        int rows;
+        int column;
+        int row;
+        TElement value;
+        bool found;
+    };
 };
 
 #endif // SPARSEMATRIX_H
@@ -0,0 +1,447 @@
+#ifndef SPARSEMULTIPLY_H
+#define SPARSEMULTIPLY_H
+
+#include "CsrMatrix.h"
+#include "IDictionary.h"
+#include "IOrderedDictionary.h"
+#include "IndexPair.h"
+#include "Parallel.h"
+#include "SparseBlas.h"
+#include "SparseMatrix.h"
+#include "SparseVector.h"
+#include "UnqPtr.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// Matrix-vector products. Every kernel computes y = A * x into a dense vector of
+// A.GetRows() values, with the rows split into contiguous blocks that run on separate
+// threads; each thread writes only its own rows, so no synchronisation is needed. A
+// sparse x is scattered into a dense vector first, which turns the per-nonzero lookup
+// into an array read. `threads` = 0 uses one thread per core; small products run on the
+// calling thread.
+
+// Nonzeros per thread below which starting another thread costs more than it saves.
+constexpr size_t kMultiplyMinNonZerosPerThread = 1 << 15;
+
+namespace SparseMultiplyDetail {
+
+inline void CheckDimensions(int columns, size_t length)
+{
+    if (static_cast<size_t>(columns) != length)
+    {
+        throw std::invalid_argument("Vector length must equal the number of matrix columns.");
+    }
+}
+
+// First row of block `part` when rows are split into `parts` blocks of about equal
+// work, given the running total of work before each row (prefix[rows] is the total).
+inline int BlockStart(const size_t* prefix, int rows, int parts, int part)
+{
+    if (part >= parts)
+    {
+        return rows;
+    }
+    size_t target = prefix[rows] / parts * part;
+    return static_cast<int>(std::lower_bound(prefix, prefix + rows, target) - prefix);
+}
+
+template<typename TElement>
+std::vector<TElement> ToDense(const SparseVector<TElement>& vector)
+{
+    std::vector<TElement> dense(vector.GetLength(), TElement());
+    Scatter(vector, dense);
+    return dense;
+}
+
+} // namespace SparseMultiplyDetail
+
+// The blocks hold roughly equal numbers of nonzeros rather than equal numbers of rows,
+// and each row is a sequential scan of the column and value arrays.
+template<typename TElement>
+std::vector<TElement> Multiply(const CsrMatrix<TElement>& matrix, const std::vector<TElement>& vector, int threads = 0)
+{
+    SparseMultiplyDetail::CheckDimensions(matrix.GetColumns(), vector.size());
+
+    int rows = matrix.GetRows();
+    std::vector<TElement> result(rows, TElement());
+    const size_t* rowPointers = matrix.GetRowPointers().data();
+    const int* columnIndices = matrix.GetColumnIndices().data();
+    const TElement* values = matrix.GetValues().data();
+    const TElement* x = vector.data();
+    size_t nonZeros = matrix.GetNonZeroCount();
+
+    int parts = ResolveThreadCount(threads, nonZeros, kMultiplyMinNonZerosPerThread);
+    RunPartitioned(parts, [&](int part) {
+        int end = SparseMultiplyDetail::BlockStart(rowPointers, rows, parts, part + 1);
+        for (int row = SparseMultiplyDetail::BlockStart(rowPointers, rows, parts, part); row < end; ++row)
+        {
+            TElement sum = TElement();
+            for (size_t k = rowPointers[row]; k < rowPointers[row + 1]; ++k)
+            {
+                sum += values[k] * x[columnIndices[k]];
+            }
+            result[row] = sum;
+        }
+    });
+    return result;
+}
+
+template<typename TElement>
+SparseVector<TElement> Multiply(const CsrMatrix<TElement>& matrix, const SparseVector<TElement>& vector,
+                                UnqPtr<IDictionary<int, TElement>> dictionary, int threads = 0)
+{
+    SparseMultiplyDetail::CheckDimensions(matrix.GetColumns(), vector.GetLength());
+    return Gather(Multiply(matrix, SparseMultiplyDetail::ToDense(vector), threads), std::move(dictionary));
+}
+
+// With an ordered dictionary each block of rows is one range scan, so the threads read
+// disjoint parts of the tree. Hash tables have no row order to split on and are read in
+// a single pass on the calling thread; convert such a matrix to CsrMatrix once when it
+// is multiplied repeatedly.
+template<typename TElement>
+std::vector<TElement> Multiply(const SparseMatrix<TElement>& matrix, const std::vector<TElement>& vector, int threads = 0)
+{
+    SparseMultiplyDetail::CheckDimensions(matrix.GetColumns(), vector.size());
+
+    int rows = matrix.GetRows();
+    std::vector<TElement> result(rows, TElement());
+    const IDictionary<IndexPair, TElement>& elements = matrix.GetElements();
+    auto ordered = dynamic_cast<const IOrderedDictionary<IndexPair, TElement>*>(&elements);
+
+    if (!ordered)
+    {
+        auto iterator = elements.GetIterator();
+        while (iterator->MoveNext())
+        {
+            IndexPair key = iterator->GetCurrentKey();
+            result[key.row] += iterator->GetCurrentValue() * vector[key.column];
+        }
+        return result;
+    }
+
+    int parts = ResolveThreadCount(threads, elements.GetCount(), kMultiplyMinNonZerosPerThread);
+    parts = std::max(1, std::min(parts, rows));
+    RunPartitioned(parts, [&](int part) {
+        int begin = static_cast<int>(static_cast<long long>(rows) * part / parts);
+        int end = static_cast<int>(static_cast<long long>(rows) * (part + 1) / parts);
+        auto iterator = ordered->GetRange(IndexPair(begin, 0), IndexPair(end, 0));
+        while (iterator->MoveNext())
+        {
+            IndexPair key = iterator->GetCurrentKey();
+            result[key.row] += iterator->GetCurrentValue() * vector[key.column];
+        }
+    });
+    return result;
+}
+
+template<typename TElement>
+SparseVector<TElement> Multiply(const SparseMatrix<TElement>& matrix, const SparseVector<TElement>& vector,
+                                UnqPtr<IDictionary<int, TElement>> dictionary, int threads = 0)
+{
+    SparseMultiplyDetail::CheckDimensions(matrix.GetColumns(), vector.GetLength());
+    return Gather(Multiply(matrix, SparseMultiplyDetail::ToDense(vector), threads), std::move(dictionary));
+}
+
+// Sparse matrix products, C = A * B, use Gustavson's row-wise method: row i of C is the
+// sum of the rows of B selected by the nonzeros of row i of A, added up in an
+// accumulator. A symbolic pass counts the distinct columns of every output row, touching
+// only the column indices, so the CSR arrays are allocated once at their final size,
+// and a numeric pass then multiplies and fills each row in place. Rows are split into
+// blocks of about equal multiply-add count, and every thread keeps its own accumulator:
+// a dense array indexed by column when B is narrow enough, an open-addressing hash table
+// sized to the row otherwise.
+
+// Widest B for which each thread uses a dense accumulator.
+constexpr int kMultiplyDenseAccumulatorColumns = 1 << 17;
+
+namespace SparseMultiplyDetail {
+
+// Column-indexed accumulator; a row is reset by clearing only the columns it touched.
+template<typename TElement>
+class DenseAccumulator {
+public:
+    explicit DenseAccumulator(int columns)
+            : sums(columns, TElement()), occupied(columns, false) {}
+
+    void BeginRow(size_t) {}
+
+    // Records the column for GetCount without storing a value.
+    void Mark(int column)
+    {
+        if (!occupied[column])
+        {
+            occupied[column] = true;
+            touched.push_back(column);
+        }
+    }
+
+    void Add(int column, const TElement& value)
+    {
+        if (!occupied[column])
+        {
+            occupied[column] = true;
+            touched.push_back(column);
+            sums[column] = value;
+        }
+        else
+        {
+            sums[column] += value;
+        }
+    }
+
+    size_t GetCount() const
+    {
+        return touched.size();
+    }
+
+    // Writes the row sorted by column and resets the accumulator.
+    void Flush(int* columns, TElement* values)
+    {
+        std::sort(touched.begin(), touched.end());
+        for (size_t i = 0; i < touched.size(); ++i)
+        {
+            columns[i] = touched[i];
+            values[i] = sums[touched[i]];
+        }
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (int column : touched)
+        {
+            occupied[column] = false;
+        }
+        touched.clear();
+    }
+
+private:
+    std::vector<TElement> sums;
+    std::vector<char> occupied;
+    std::vector<int> touched;
+};
+
+// Linear-probing table sized to twice the row's multiply-add count, so it never fills.
+template<typename TElement>
+class HashAccumulator {
+public:
+    explicit HashAccumulator(int) {}
+
+    void BeginRow(size_t products)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * products)
+        {
+            capacity *= 2;
+        }
+        if (capacity > columns.size())
+        {
+            columns.assign(capacity, -1);
+            sums.assign(capacity, TElement());
+        }
+        mask = capacity - 1;
+    }
+
+    void Mark(int column)
+    {
+        size_t slot = Probe(column);
+        if (columns[slot] == -1)
+        {
+            columns[slot] = column;
+            used.push_back(slot);
+        }
+    }
+
+    void Add(int column, const TElement& value)
+    {
+        size_t slot = Probe(column);
+        if (columns[slot] == -1)
+        {
+            columns[slot] = column;
+            sums[slot] = value;
+            used.push_back(slot);
+        }
+        else
+        {
+            sums[slot] += value;
+        }
+    }
+
+    size_t GetCount() const
+    {
+        return used.size();
+    }
+
+    void Flush(int* outColumns, TElement* outValues)
+    {
+        std::sort(used.begin(), used.end(), [this](size_t a, size_t b) { return columns[a] < columns[b]; });
+        for (size_t i = 0; i < used.size(); ++i)
+        {
+            outColumns[i] = columns[used[i]];
+            outValues[i] = sums[used[i]];
+        }
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (size_t slot : used)
+        {
+            columns[slot] = -1;
+        }
+        used.clear();
+    }
+
+private:
+    std::vector<int> columns;
+    std::vector<TElement> sums;
+    std::vector<size_t> used;
+    size_t mask = 0;
+
+    // The slot holding the column, or the empty slot where it belongs.
+    size_t Probe(int column) const
+    {
+        size_t slot = (static_cast<size_t>(column) * 0x9E3779B1u) & mask;
+        while (columns[slot] != -1 && columns[slot] != column)
+        {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+};
+
+template<typename TElement, typename TAccumulator>
+CsrMatrix<TElement> MultiplyRows(const CsrMatrix<TElement>& left, const CsrMatrix<TElement>& right, int threads)
+{
+    int rows = left.GetRows();
+    int columns = right.GetColumns();
+    const size_t* leftPointers = left.GetRowPointers().data();
+    const int* leftColumns = left.GetColumnIndices().data();
+    const TElement* leftValues = left.GetValues().data();
+    const size_t* rightPointers = right.GetRowPointers().data();
+    const int* rightColumns = right.GetColumnIndices().data();
+    const TElement* rightValues = right.GetValues().data();
+
+    // Multiply-adds before each row; this is the work measure the blocks are balanced on.
+    std::vector<size_t> products(static_cast<size_t>(rows) + 1, 0);
+    for (int row = 0; row < rows; ++row)
+    {
+        size_t count = 0;
+        for (size_t k = leftPointers[row]; k < leftPointers[row + 1]; ++k)
+        {
+            count += rightPointers[leftColumns[k] + 1] - rightPointers[leftColumns[k]];
+        }
+        products[row + 1] = products[row] + count;
+    }
+
+    int parts = ResolveThreadCount(threads, products[rows], kMultiplyMinNonZerosPerThread);
+
+    // Symbolic pass: the number of distinct columns in each output row.
+    std::vector<size_t> rowPointers(static_cast<size_t>(rows) + 1, 0);
+    RunPartitioned(parts, [&](int part) {
+        TAccumulator accumulator(columns);
+        int end = BlockStart(products.data(), rows, parts, part + 1);
+        for (int row = BlockStart(products.data(), rows, parts, part); row < end; ++row)
+        {
+            accumulator.BeginRow(products[row + 1] - products[row]);
+            for (size_t k = leftPointers[row]; k < leftPointers[row + 1]; ++k)
+            {
+                int middle = leftColumns[k];
+                for (size_t j = rightPointers[middle]; j < rightPointers[middle + 1]; ++j)
+                {
+                    accumulator.Mark(rightColumns[j]);
+                }
+            }
+            rowPointers[row + 1] = accumulator.GetCount();
+            accumulator.Clear();
+        }
+    });
+    for (int row = 0; row < rows; ++row)
+    {
+        rowPointers[row + 1] += rowPointers[row];
+    }
+
+    // Numeric pass: every row is written straight into its final place.
+    std::vector<int> columnIndices(rowPointers[rows]);
+    std::vector<TElement> values(rowPointers[rows]);
+    RunPartitioned(parts, [&](int part) {
+        TAccumulator accumulator(columns);
+        int end = BlockStart(products.data(), rows, parts, part + 1);
+        for (int row = BlockStart(products.data(), rows, parts, part); row < end; ++row)
+        {
+            accumulator.BeginRow(products[row + 1] - products[row]);
+            for (size_t k = leftPointers[row]; k < leftPointers[row + 1]; ++k)
+            {
+                int middle = leftColumns[k];
+                TElement scale = leftValues[k];
+                for (size_t j = rightPointers[middle]; j < rightPointers[middle + 1]; ++j)
+                {
+                    accumulator.Add(rightColumns[j], scale * rightValues[j]);
+                }
+            }
+            accumulator.Flush(columnIndices.data() + rowPointers[row], values.data() + rowPointers[row]);
+        }
+    });
+
+    // Terms that cancelled out leave zeros behind; CsrMatrix never stores them.
+    if (std::find(values.begin(), values.end(), TElement()) != values.end())
+    {
+        size_t kept = 0;
+        size_t begin = 0;
+        for (int row = 0; row < rows; ++row)
+        {
+            size_t end = rowPointers[row + 1];
+            for (size_t k = begin; k < end; ++k)
+            {
+                if (values[k] != TElement())
+                {
+                    columnIndices[kept] = columnIndices[k];
+                    values[kept] = values[k];
+                    ++kept;
+                }
+            }
+            begin = end;
+            rowPointers[row + 1] = kept;
+        }
+        columnIndices.resize(kept);
+        values.resize(kept);
+    }
+
+    return CsrMatrix<TElement>(rows, columns, std::move(rowPointers), std::move(columnIndices), std::move(values));
+}
+
+} // namespace SparseMultiplyDetail
+
+template<typename TElement>
+CsrMatrix<TElement> Multiply(const CsrMatrix<TElement>& left, const CsrMatrix<TElement>& right, int threads = 0)
+{
+    if (left.GetColumns() != right.GetRows())
+    {
+        throw std::invalid_argument("The left matrix must have as many columns as the right matrix has rows.");
+    }
+    if (right.GetColumns() <= kMultiplyDenseAccumulatorColumns)
+    {
+        return SparseMultiplyDetail::MultiplyRows<TElement, SparseMultiplyDetail::DenseAccumulator<TElement>>(
+                left, right, threads);
+    }
+    return SparseMultiplyDetail::MultiplyRows<TElement, SparseMultiplyDetail::HashAccumulator<TElement>>(
+            left, right, threads);
+}
+
+// Both operands are converted to CSR, multiplied, and the product is bulk-loaded into
+// the given dictionary in key order.
+template<typename TElement>
+SparseMatrix<TElement> Multiply(const SparseMatrix<TElement>& left, const SparseMatrix<TElement>& right,
+                                UnqPtr<IDictionary<IndexPair, TElement>> dictionary, int threads = 0)
+{
+    if (left.GetColumns() != right.GetRows())
+    {
+        throw std::invalid_argument("The left matrix must have as many columns as the right matrix has rows.");
+    }
+    CsrMatrix<TElement> product = Multiply(CsrMatrix<TElement>::FromSparseMatrix(left),
+                                           CsrMatrix<TElement>::FromSparseMatrix(right), threads);
+    return product.ToSparseMatrix(std::move(dictionary));
+}
+
+#endif // SPARSEMULTIPLY_H
@@ -3,11 +3,13 @@
 #define SPARSEVECTOR_H
 
 #include "IDictionary.h"
+#include "ParallelTraversal.h"
 #include "ShrdPtr.h"
 #include "DynamicArraySmart.h"
 #include "KeyValue.h"
 #include "memory"
 #include "stdexcept"
+#include <algorithm>
 #include <vector>
 
 template <typename TElement>
@@ -17,6 +19,43 @@ public:
     SparseVector(int length, UnqPtr<IDictionary<int, TElement>> dictionary)
             : length(length), elements(std::move(dictionary)) {}
 
+    // Builds the vector in one pass through IDictionary::BulkLoad. Unless `sorted` is
+    // set the entries are sorted by index first; a repeated index keeps its last value
+    // and zero values are dropped.
+    SparseVector(int length, UnqPtr<IDictionary<int, TElement>> dictionary,
+                 const KeyValue<int, TElement>* entries, size_t count, bool sorted = false)
+            : length(length), elements(std::move(dictionary))
+    {
+        std::vector<KeyValue<int, TElement>> items(entries, entries + count);
+        for (const KeyValue<int, TElement>& item : items)
+        {
+            if (item.key < 0 || item.key >= length)
+            {
+                throw std::out_of_range("Index is out of bounds.");
+            }
+        }
+
+        if (!sorted)
+        {
+            std::stable_sort(items.begin(), items.end(),
+                             [](const KeyValue<int, TElement>& a, const KeyValue<int, TElement>& b) {
+                                 return a.key < b.key;
+                             });
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (i + 1 < items.size() && items[i + 1].key == items[i].key)
+                continue;
+            if (items[i].value == TElement())
+                continue;
+            items[kept++] = items[i];
+        }
+
+        elements->BulkLoad(items.data(), kept);
+    }
+
     ~SparseVector(){}
 
     int GetLength() const
@@ -31,14 +70,9 @@ public:
             throw std::out_of_range("Index is out of bounds.");
         }
 
-        if (elements->ContainsKey(index))
-        {
-            return elements->Get(index);
-        }
-        else
-        {
-            return TElement();
-        }
+        TElement value = TElement();
+        elements->TryGet(index, value);
+        return value;
     }
 
     void SetElement(int index, const TElement& value)
@@ -50,18 +84,11 @@ public:
 
         if (value != TElement())
         {
-            if (elements->ContainsKey(index))
-            {
-                elements->Update(index, value);
-            }
-            else
-            {
-                elements->Add(index, value);
-            }
+            elements->Add(index, value);
         }
         else
         {
-            RemoveElement(index);
+            elements->Discard(index);
         }
     }
 
@@ -70,54 +97,66 @@ public:
             throw std::out_of_range("Index is out of bounds.");
         }
 
-        if (elements->ContainsKey(index)) {
-            elements->Remove(index);
-        }
+        elements->Discard(index);
     }
 
-    void ForEach(void (*func)(int, const TElement&)) const
+    // The callables can be lambdas, capturing or not. Entries are read through
+    // IDictionaryIterator::NextBatch, so there is one virtual call per batch rather than
+    // three per element, and the call to func can be inlined.
+    template<typename TFunc>
+    void ForEach(TFunc func) const
     {
         auto iterator = elements->GetIterator();
-        while (iterator->MoveNext())
-        {
-            int key = iterator->GetCurrentKey();
-            TElement value = iterator->GetCurrentValue();
-            func(key, value);
-        }
+        ForEachEntry(*iterator, func);
     }
 
-    void Map(TElement (*func)(TElement))
+    // Rewrites the stored values in place in one pass. Entries that map to zero are
+    // removed afterwards, so only their keys are buffered.
+    template<typename TFunc>
+    void Map(TFunc func)
     {
-        DynamicArraySmart<KeyValue<int, TElement>> updates;
-        auto iterator = elements->GetIterator();
-        while (iterator->MoveNext())
+        std::vector<int> zeros;
+        ForEachMutable(*elements, [&](const int& key, TElement& value) {
+            value = func(value);
+            if (value == TElement())
+                zeros.push_back(key);
+        });
+        for (const int& key : zeros)
         {
-            int key = iterator->GetCurrentKey();
-            TElement value = iterator->GetCurrentValue();
-            TElement newValue = func(value);
-            updates.Append(KeyValue<int, TElement>(key, newValue));
-        }
-        for (int i = 0; i < updates.GetLength(); ++i)
-        {
-            const KeyValue<int, TElement>& kv = updates.Get(i);
-            elements->Update(kv.key, kv.value);
+            elements->Discard(key);
         }
     }
 
-
-
-    TElement Reduce(TElement (*func)(TElement, TElement), TElement initial) const
+    template<typename TFunc>
+    TElement Reduce(TFunc func, TElement initial) const
     {
         TElement result = initial;
         auto iterator = elements->GetIterator();
-        while (iterator->MoveNext())
-        {
-            TElement value = iterator->GetCurrentValue();
-            result = func(result, value);
-        }
+        ForEachEntry(*iterator, [&](const int&, const TElement& value) { result = func(result, value); });
         return result;
     }
 
+    // ForEach, Map and Reduce spread over `threads` threads (0 means one per hardware
+    // thread), each walking its own parts of the dictionary; see ParallelTraversal.h for
+    // what the callables must allow and for the deterministic Reduce.
+    template<typename TFunc>
+    void ParallelForEach(TFunc func, int threads = 0) const
+    {
+        ParallelForEachEntry(*elements, func, threads);
+    }
+
+    template<typename TFunc>
+    void ParallelMap(TFunc func, int threads = 0)
+    {
+        ParallelMapValues(*elements, func, threads);
+    }
+
+    template<typename TFunc>
+    TElement ParallelReduce(TFunc func, TElement initial, int threads = 0, bool deterministic = false) const
+    {
+        return ParallelReduceValues(*elements, func, initial, threads, deterministic);
+    }
+
     UnqPtr<IDictionaryIterator<int, TElement>> GetIterator() const
     {
         return elements->GetIterator();
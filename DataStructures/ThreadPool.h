@@ -0,0 +1,393 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "UnqPtr.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Work-stealing task scheduler shared by the parallel kernels.
+//
+// Every worker owns a deque of tasks. A task spawned on a worker goes on the back of that
+// worker's deque, and the worker takes its next task from the back too, so it keeps
+// working on the newest (cache-warm, smallest) pieces. An idle worker first takes tasks
+// submitted from outside the pool, which wait in a shared queue, and then steals from the
+// front of the other deques, where the oldest and, under recursive splitting, largest
+// pieces are. A thread waiting for a TaskGroup runs pending tasks instead of blocking, so
+// groups can nest and the thread that starts a ParallelFor takes part in it.
+//
+// Futures from Submit should be waited on from outside the pool; inside a task use a
+// TaskGroup, whose Wait keeps the worker busy.
+
+class TaskGroup;
+
+class ThreadPool
+{
+public:
+    // 0 threads means one fewer than the hardware threads (the thread that waits for the
+    // work makes up the difference), but at least one.
+    explicit ThreadPool(int threads = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int GetThreadCount() const
+    {
+        return static_cast<int>(workers.size());
+    }
+
+    // Runs func() on the pool; the future receives its result or exception.
+    template<typename Func>
+    std::future<std::invoke_result_t<Func>> Submit(Func func);
+
+    // Calls func(first, last) on disjoint subranges covering [begin, end), none longer
+    // than grain, and returns once all have finished. The range is halved recursively,
+    // one half spawned as a task, so idle workers steal large pieces first.
+    template<typename Func>
+    void ParallelFor(size_t begin, size_t end, size_t grain, Func func);
+
+    // Runs one pending task on the calling thread; false if there was none.
+    bool TryRunPendingTask();
+
+    // The pool the kernels in DataStructures share.
+    static ThreadPool& Default()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    struct Task
+    {
+        virtual ~Task() {}
+
+        virtual void Run() = 0;
+    };
+
+    template<typename Func>
+    struct FuncTask : Task
+    {
+        Func func;
+
+        explicit FuncTask(Func func) : func(std::move(func)) {}
+
+        void Run() override
+        {
+            func();
+        }
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<UnqPtr<Task>> tasks;
+        std::thread thread;
+    };
+
+    std::vector<UnqPtr<Worker>> workers;
+    std::mutex sharedMutex;
+    std::deque<UnqPtr<Task>> sharedTasks;
+    std::condition_variable wake;
+    std::atomic<size_t> queued;
+    bool stopping;
+
+    // The pool and worker index of the calling thread, if it is a worker.
+    inline static thread_local ThreadPool* currentPool = nullptr;
+    inline static thread_local int currentWorker = -1;
+
+    void Push(UnqPtr<Task> task);
+
+    UnqPtr<Task> Pop();
+
+    static bool PopBack(std::mutex& mutex, std::deque<UnqPtr<Task>>& tasks, UnqPtr<Task>& task);
+
+    static bool PopFront(std::mutex& mutex, std::deque<UnqPtr<Task>>& tasks, UnqPtr<Task>& task);
+
+    void WorkerLoop(int index);
+
+    // Blocks until a task is queued or `ready()` holds.
+    template<typename Ready>
+    void WaitForWork(Ready ready);
+
+    // Wakes every sleeping thread to re-check its condition; whatever that condition
+    // reads must be changed before the call.
+    void WakeAll();
+
+    template<typename Func>
+    static void SplitRange(TaskGroup& group, size_t begin, size_t end, size_t grain, Func& func);
+
+    friend class TaskGroup;
+};
+
+// A set of tasks to wait for together. Wait rethrows the first exception a task threw;
+// the destructor waits too but drops any exception.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::Default()) : pool(pool), unfinished(0) {}
+
+    ~TaskGroup()
+    {
+        try
+        {
+            Wait();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    template<typename Func>
+    void Run(Func func)
+    {
+        ++unfinished;
+        auto task = [this, func]() mutable {
+            try
+            {
+                func();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--unfinished == 0)
+            {
+                pool.WakeAll();
+            }
+        };
+        pool.Push(UnqPtr<ThreadPool::Task>(new ThreadPool::FuncTask<decltype(task)>(std::move(task))));
+    }
+
+    // Runs pending tasks of the pool, this group's or others', until every task of the
+    // group has finished. With nothing to run it sleeps alongside the idle workers, so a
+    // newly queued task wakes it as well as the end of the group.
+    void Wait()
+    {
+        while (unfinished > 0)
+        {
+            if (!pool.TryRunPendingTask())
+            {
+                pool.WaitForWork([this]() { return unfinished == 0; });
+            }
+        }
+
+        // The last task may still be inside its notify; taking the lock waits it out, so
+        // the group can be destroyed as soon as Wait returns.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error)
+        {
+            std::exception_ptr thrown = error;
+            error = nullptr;
+            std::rethrow_exception(thrown);
+        }
+    }
+
+private:
+    ThreadPool& pool;
+    std::atomic<size_t> unfinished;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+inline ThreadPool::ThreadPool(int threads) : queued(0), stopping(false)
+{
+    if (threads <= 0)
+    {
+        threads = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+        threads = threads > 0 ? threads : 1;
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back(new Worker());
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        workers[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
+    }
+}
+
+// Workers finish the tasks still queued before they exit.
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (UnqPtr<Worker>& worker : workers)
+    {
+        worker->thread.join();
+    }
+}
+
+template<typename Func>
+std::future<std::invoke_result_t<Func>> ThreadPool::Submit(Func func)
+{
+    std::packaged_task<std::invoke_result_t<Func>()> task(std::move(func));
+    std::future<std::invoke_result_t<Func>> result = task.get_future();
+    Push(UnqPtr<Task>(new FuncTask<decltype(task)>(std::move(task))));
+    return result;
+}
+
+template<typename Func>
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain, Func func)
+{
+    TaskGroup group(*this);
+    SplitRange(group, begin, end, grain > 0 ? grain : 1, func);
+    group.Wait();
+}
+
+template<typename Func>
+void ThreadPool::SplitRange(TaskGroup& group, size_t begin, size_t end, size_t grain, Func& func)
+{
+    while (end - begin > grain)
+    {
+        size_t middle = begin + (end - begin) / 2;
+        group.Run([&group, &func, middle, end, grain]() { SplitRange(group, middle, end, grain, func); });
+        end = middle;
+    }
+    if (begin < end)
+    {
+        func(begin, end);
+    }
+}
+
+inline bool ThreadPool::TryRunPendingTask()
+{
+    UnqPtr<Task> task = Pop();
+    if (!task)
+    {
+        return false;
+    }
+    task->Run();
+    return true;
+}
+
+// The queued count is raised before the task is published, so a thread that takes the
+// task never brings the count below zero, and before taking the mutex the sleeping
+// threads wait on, so one that found nothing either sees the new count or is already
+// waiting when it is notified.
+inline void ThreadPool::Push(UnqPtr<Task> task)
+{
+    ++queued;
+    if (currentPool == this)
+    {
+        Worker& worker = *workers[currentWorker];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> lock(sharedMutex);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        sharedTasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+// A worker looks at the back of its own deque, then the shared queue, then steals from
+// the front of the other workers' deques, starting with its neighbour.
+inline UnqPtr<ThreadPool::Task> ThreadPool::Pop()
+{
+    UnqPtr<Task> task;
+    if (queued == 0)
+    {
+        return task;
+    }
+
+    int self = currentPool == this ? currentWorker : -1;
+    bool found = (self >= 0 && PopBack(workers[self]->mutex, workers[self]->tasks, task)) ||
+                 PopFront(sharedMutex, sharedTasks, task);
+    int count = static_cast<int>(workers.size());
+    for (int i = 1; !found && i <= count; ++i)
+    {
+        int victim = (self + i + count) % count;
+        found = victim != self && PopFront(workers[victim]->mutex, workers[victim]->tasks, task);
+    }
+    if (found)
+    {
+        --queued;
+    }
+    return task;
+}
+
+inline bool ThreadPool::PopBack(std::mutex& mutex, std::deque<UnqPtr<Task>>& tasks, UnqPtr<Task>& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty())
+    {
+        return false;
+    }
+    task = std::move(tasks.back());
+    tasks.pop_back();
+    return true;
+}
+
+inline bool ThreadPool::PopFront(std::mutex& mutex, std::deque<UnqPtr<Task>>& tasks, UnqPtr<Task>& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty())
+    {
+        return false;
+    }
+    task = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+}
+
+inline void ThreadPool::WorkerLoop(int index)
+{
+    currentPool = this;
+    currentWorker = index;
+    while (true)
+    {
+        if (TryRunPendingTask())
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sharedMutex);
+        if (stopping && queued == 0)
+        {
+            return;
+        }
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+    }
+}
+
+template<typename Ready>
+void ThreadPool::WaitForWork(Ready ready)
+{
+    std::unique_lock<std::mutex> lock(sharedMutex);
+    wake.wait(lock, [this, &ready]() { return queued > 0 || ready(); });
+}
+
+// Taking the mutex orders the change before any sleeper's next check of its condition.
+inline void ThreadPool::WakeAll()
+{
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+    }
+    wake.notify_all();
+}
+
+#endif // THREADPOOL_H
@@ -0,0 +1,7 @@
+#include "benchmarks.h"
+
+int main()
+{
+    run_benchmarks();
+    return 0;
+}
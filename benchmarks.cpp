@@ -0,0 +1,1354 @@
+#include "benchmarks.h"
+#include "DataStructures/SparseVector.h"
+#include "DataStructures/SparseMatrix.h"
+#include "DataStructures/UnqPtr.h"
+#include "DataStructures/HashTable.h"
+#include "DataStructures/BTree.h"
+#include "DataStructures/BPlusTree.h"
+#include "DataStructures/FlatHashTable.h"
+#include "DataStructures/CsrMatrix.h"
+#include "DataStructures/SparseMultiply.h"
+#include "DataStructures/SparseElementwise.h"
+#include "DataStructures/SparseBlas.h"
+#include "DataStructures/ThreadPool.h"
+#include "DataStructures/ShardedHashTable.h"
+#include "DataStructures/ConcurrentBTree.h"
+#include "DataStructures/PersistentBTree.h"
+#include "DataStructures/BufferedBTree.h"
+#include "DataStructures/PagedBTree.h"
+#include "DataStructures/BufferPool.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <random>
+#include <cmath>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+void run_benchmarks() {
+    std::ofstream latency_file("latency_results.csv");
+    if (!latency_file.is_open()) {
+        std::cerr << "Cannot open the file latency_results.csv for writing." << std::endl;
+        return;
+    }
+
+    latency_file << "Dictionary,Mode,NumElements,TotalTime(ms),P99Latency(ns),MaxLatency(ns)\n";
+
+    for (int num_elements : {100000, 400000, 1600000, 3600000}) {
+        std::cout << "\nInsert latency with " << num_elements << " elements" << std::endl;
+        benchmark_insert_latency<HashTable<IndexPair, double>>(num_elements, "HashTable", false, latency_file);
+        benchmark_insert_latency<HashTable<IndexPair, double>>(num_elements, "HashTable", true, latency_file);
+    }
+
+    latency_file.close();
+
+    std::ofstream lookup_file("lookup_results.csv");
+    if (!lookup_file.is_open()) {
+        std::cerr << "Cannot open the file lookup_results.csv for writing." << std::endl;
+        return;
+    }
+
+    lookup_file << "Dictionary,Method,NumElements,MissRatio,Lookups,Time(ms)\n";
+
+    for (double miss_ratio : {0.0, 0.5, 0.99}) {
+        std::cout << "\nLookups with miss ratio " << miss_ratio << std::endl;
+        benchmark_lookup_miss_ratio<BTree<int, double>>(100000, "BTree", miss_ratio, lookup_file);
+        benchmark_lookup_miss_ratio<HashTable<int, double>>(100000, "HashTable", miss_ratio, lookup_file);
+    }
+
+    lookup_file.close();
+
+    std::ofstream layout_file("btree_layout_results.csv");
+    if (!layout_file.is_open()) {
+        std::cerr << "Cannot open the file btree_layout_results.csv for writing." << std::endl;
+        return;
+    }
+
+    layout_file << "Layout,Order,NumElements,InsertionTime(ms),SearchTime(ms),IterationTime(ms)\n";
+
+    int layout_elements = 1000000;
+    std::cout << "\nBTree node layouts with " << layout_elements << " elements" << std::endl;
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 3, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 3>>(layout_elements, 3, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 4, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 4>>(layout_elements, 4, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 8, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 8>>(layout_elements, 8, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 16, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 16>>(layout_elements, 16, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 32, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 32>>(layout_elements, 32, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 64, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 64>>(layout_elements, 64, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 128, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 128>>(layout_elements, 128, "Inline", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double>>(layout_elements, 256, "Heap", layout_file);
+    benchmark_btree_layout<BTree<IndexPair, double, 256>>(layout_elements, 256, "Inline", layout_file);
+
+    layout_file.close();
+
+    std::ofstream bulk_file("bulk_load_results.csv");
+    if (!bulk_file.is_open()) {
+        std::cerr << "Cannot open the file bulk_load_results.csv for writing." << std::endl;
+        return;
+    }
+
+    bulk_file << "Dictionary,Method,NumElements,Time(ms)\n";
+
+    for (int num_elements : {100000, 400000, 1600000, 3600000}) {
+        std::cout << "\nBulk loading " << num_elements << " elements" << std::endl;
+        benchmark_bulk_load<BTree<IndexPair, double>>(num_elements, "BTree", bulk_file);
+        benchmark_bulk_load<HashTable<IndexPair, double>>(num_elements, "HashTable", bulk_file);
+    }
+
+    bulk_file.close();
+
+    std::ofstream csr_file("csr_results.csv");
+    if (!csr_file.is_open()) {
+        std::cerr << "Cannot open the file csr_results.csv for writing." << std::endl;
+        return;
+    }
+
+    csr_file << "Source,Size,NonZeros,ConversionTime(ms),SourceScanTime(ms),CsrScanTime(ms),"
+                "SourceLookupTime(ms),CsrLookupTime(ms),CsrBytesPerNonZero\n";
+
+    for (int size : {1000, 2000, 4000}) {
+        std::cout << "\nCSR conversion and scans for a " << size << "x" << size << " matrix" << std::endl;
+        benchmark_csr<BTree<IndexPair, double>>(size, "BTree", csr_file);
+        benchmark_csr<HashTable<IndexPair, double>>(size, "HashTable", csr_file);
+    }
+
+    csr_file.close();
+
+    std::ofstream spmv_file("spmv_results.csv");
+    if (!spmv_file.is_open()) {
+        std::cerr << "Cannot open the file spmv_results.csv for writing." << std::endl;
+        return;
+    }
+
+    spmv_file << "Source,Kernel,Size,NonZeros,Threads,Time(us),GFLOPS\n";
+
+    for (int size : {10000, 20000}) {
+        std::cout << "\nMatrix-vector products for a " << size << "x" << size << " matrix" << std::endl;
+        benchmark_spmv<BTree<IndexPair, double>>(size, "BTree", spmv_file);
+        benchmark_spmv<HashTable<IndexPair, double>>(size, "HashTable", spmv_file);
+    }
+
+    spmv_file.close();
+
+    std::ofstream spgemm_file("spgemm_results.csv");
+    if (!spgemm_file.is_open()) {
+        std::cerr << "Cannot open the file spgemm_results.csv for writing." << std::endl;
+        return;
+    }
+
+    spgemm_file << "Source,Kernel,Size,NonZerosPerRow,ProductNonZeros,Threads,Time(ms)\n";
+
+    for (int size : {1000, 10000, 100000}) {
+        std::cout << "\nMatrix-matrix products for a " << size << "x" << size << " matrix" << std::endl;
+        benchmark_spgemm<BTree<IndexPair, double>>(size, "BTree", spgemm_file);
+        benchmark_spgemm<HashTable<IndexPair, double>>(size, "HashTable", spgemm_file);
+    }
+
+    spgemm_file.close();
+
+    std::ofstream elementwise_file("elementwise_results.csv");
+    if (!elementwise_file.is_open()) {
+        std::cerr << "Cannot open the file elementwise_results.csv for writing." << std::endl;
+        return;
+    }
+
+    elementwise_file << "Dictionary,Method,NumElements,Time(ms)\n";
+
+    for (int num_elements : {100000, 400000, 1600000}) {
+        std::cout << "\nElement-wise sums of matrices with " << num_elements << " elements" << std::endl;
+        benchmark_elementwise<BTree<IndexPair, double>>(num_elements, "BTree", elementwise_file);
+        benchmark_elementwise<HashTable<IndexPair, double>>(num_elements, "HashTable", elementwise_file);
+    }
+
+    elementwise_file.close();
+
+    std::ofstream dot_file("dot_results.csv");
+    if (!dot_file.is_open()) {
+        std::cerr << "Cannot open the file dot_results.csv for writing." << std::endl;
+        return;
+    }
+
+    dot_file << "Dictionary,Method,Length,LeftNonZeros,RightNonZeros,Time(us)\n";
+
+    for (int left_non_zeros : {1000, 100000}) {
+        std::cout << "\nDot products with " << left_non_zeros << " and 100000 nonzeros" << std::endl;
+        benchmark_dot<BTree<int, double>>(left_non_zeros, 100000, "BTree", dot_file);
+        benchmark_dot<HashTable<int, double>>(left_non_zeros, 100000, "HashTable", dot_file);
+    }
+
+    dot_file.close();
+
+    std::ofstream traversal_file("traversal_results.csv");
+    if (!traversal_file.is_open()) {
+        std::cerr << "Cannot open the file traversal_results.csv for writing." << std::endl;
+        return;
+    }
+
+    traversal_file << "Dictionary,Method,NumElements,Time(us)\n";
+
+    int traversal_elements = 1000000;
+    std::cout << "\nReductions over " << traversal_elements << " elements" << std::endl;
+    benchmark_traversal<BTree<int, double>>(traversal_elements, "BTree", traversal_file);
+    benchmark_traversal<BPlusTree<int, double>>(traversal_elements, "BPlusTree", traversal_file);
+    benchmark_traversal<HashTable<int, double>>(traversal_elements, "HashTable", traversal_file);
+    benchmark_traversal<FlatHashTable<int, double>>(traversal_elements, "FlatHashTable", traversal_file);
+
+    traversal_file.close();
+
+    std::ofstream map_file("map_results.csv");
+    if (!map_file.is_open()) {
+        std::cerr << "Cannot open the file map_results.csv for writing." << std::endl;
+        return;
+    }
+
+    map_file << "Dictionary,Method,NumElements,Time(us)\n";
+
+    int map_elements = 1000000;
+    std::cout << "\nMap over " << map_elements << " elements" << std::endl;
+    benchmark_map<BTree<int, double>>(map_elements, "BTree", map_file);
+    benchmark_map<BPlusTree<int, double>>(map_elements, "BPlusTree", map_file);
+    benchmark_map<HashTable<int, double>>(map_elements, "HashTable", map_file);
+    benchmark_map<FlatHashTable<int, double>>(map_elements, "FlatHashTable", map_file);
+
+    map_file.close();
+
+    std::ofstream parallel_file("parallel_results.csv");
+    if (!parallel_file.is_open()) {
+        std::cerr << "Cannot open the file parallel_results.csv for writing." << std::endl;
+        return;
+    }
+
+    parallel_file << "Dictionary,Operation,Threads,NumElements,Time(us)\n";
+
+    int parallel_elements = 1000000;
+    std::cout << "\nParallel Map and Reduce over " << parallel_elements << " elements" << std::endl;
+    benchmark_parallel_traversal<BTree<int, double>>(parallel_elements, "BTree", parallel_file);
+    benchmark_parallel_traversal<BPlusTree<int, double>>(parallel_elements, "BPlusTree", parallel_file);
+    benchmark_parallel_traversal<HashTable<int, double>>(parallel_elements, "HashTable", parallel_file);
+    benchmark_parallel_traversal<FlatHashTable<int, double>>(parallel_elements, "FlatHashTable", parallel_file);
+
+    parallel_file.close();
+
+    std::ofstream pool_file("thread_pool_results.csv");
+    if (!pool_file.is_open()) {
+        std::cerr << "Cannot open the file thread_pool_results.csv for writing." << std::endl;
+        return;
+    }
+
+    pool_file << "Method,Parts,Calls,TimePerCall(us)\n";
+
+    std::cout << "\nDispatching parallel work" << std::endl;
+    for (int parts : {2, 4, 8}) {
+        benchmark_thread_pool(2000, parts, pool_file);
+    }
+
+    pool_file.close();
+
+    std::ofstream writers_file("concurrent_writes_results.csv");
+    if (!writers_file.is_open()) {
+        std::cerr << "Cannot open the file concurrent_writes_results.csv for writing." << std::endl;
+        return;
+    }
+
+    writers_file << "Dictionary,Writers,NumElements,Time(ms),Throughput(Mops/s)\n";
+
+    int written_elements = 1000000;
+    std::cout << "\nConcurrent SetElement of " << written_elements << " elements" << std::endl;
+    for (int writers : {1, 2, 4, 8, 16, 32}) {
+        benchmark_concurrent_writes(written_elements, writers, writers_file);
+    }
+
+    writers_file.close();
+
+    std::ofstream mixed_file("mixed_workload_results.csv");
+    if (!mixed_file.is_open()) {
+        std::cerr << "Cannot open the file mixed_workload_results.csv for writing." << std::endl;
+        return;
+    }
+
+    mixed_file << "Dictionary,Threads,WritePercent,Operations,Time(ms),Throughput(Mops/s)\n";
+
+    int mixed_elements = 1000000;
+    std::cout << "\nMixed GetElement/SetElement on " << mixed_elements << " elements" << std::endl;
+    for (int write_percent : {5, 20}) {
+        for (int threads : {1, 2, 4, 8, 16, 32}) {
+            benchmark_mixed_workload(mixed_elements, threads, write_percent, mixed_file);
+        }
+    }
+
+    mixed_file.close();
+
+    std::ofstream snapshot_file("snapshot_results.csv");
+    if (!snapshot_file.is_open()) {
+        std::cerr << "Cannot open the file snapshot_results.csv for writing." << std::endl;
+        return;
+    }
+
+    snapshot_file << "Dictionary,Reader,NumElements,IngestTime(ms),Reductions,ReadTime(ms)\n";
+
+    for (int ingested : {100000, 1000000}) {
+        std::cout << "\nIngesting " << ingested << " elements next to a reducing reader" << std::endl;
+        benchmark_snapshot_reads(ingested, snapshot_file);
+    }
+
+    snapshot_file.close();
+
+    std::ofstream ingest_file("ingest_results.csv");
+    if (!ingest_file.is_open()) {
+        std::cerr << "Cannot open the file ingest_results.csv for writing." << std::endl;
+        return;
+    }
+
+    ingest_file << "Dictionary,NumElements,IngestTime(ms),RowScanTime(ms)\n";
+
+    for (int ingested : {100000, 1000000}) {
+        std::cout << "\nIngesting " << ingested << " random elements" << std::endl;
+        benchmark_ingest<HashTable<IndexPair, double>>(ingested, "HashTable", ingest_file);
+        benchmark_ingest<BTree<IndexPair, double>>(ingested, "BTree", ingest_file);
+        benchmark_ingest<BPlusTree<IndexPair, double>>(ingested, "BPlusTree", ingest_file);
+        benchmark_ingest<BufferedBTree<IndexPair, double>>(ingested, "BufferedBTree", ingest_file);
+    }
+
+    ingest_file.close();
+
+    std::ofstream paged_file("paged_results.csv");
+    if (!paged_file.is_open()) {
+        std::cerr << "Cannot open the file paged_results.csv for writing." << std::endl;
+        return;
+    }
+
+    paged_file << "Dictionary,NumElements,IngestTime(ms),OpenTime(us),LookupTime(ms),FileSize(MB)\n";
+
+    for (int stored : {100000, 1000000, 4000000}) {
+        std::cout << "\nStoring " << stored << " elements in a page file" << std::endl;
+        benchmark_paged(stored, paged_file);
+    }
+
+    paged_file.close();
+
+    std::ofstream pool_budget_file("buffer_pool_results.csv");
+    if (!pool_budget_file.is_open()) {
+        std::cerr << "Cannot open the file buffer_pool_results.csv for writing." << std::endl;
+        return;
+    }
+
+    pool_budget_file << "Budget(MB),NumElements,FileSize(MB),IngestTime(ms),LookupTime(ms),Hits,Misses,Evictions,"
+                        "WriteBacks\n";
+
+    int pooled_elements = 2000000;
+    std::cout << "\nStoring " << pooled_elements << " elements through buffer pools of several sizes" << std::endl;
+    for (size_t budget_mb : {1, 4, 16, 64}) {
+        benchmark_buffer_pool(pooled_elements, budget_mb << 20, pool_budget_file);
+    }
+
+    pool_budget_file.close();
+    std::cout << "Benchmarks completed. Results saved in latency_results.csv, lookup_results.csv, "
+                 "btree_layout_results.csv, bulk_load_results.csv, csr_results.csv, spmv_results.csv, "
+                 "spgemm_results.csv, elementwise_results.csv, dot_results.csv, traversal_results.csv, "
+                 "map_results.csv, parallel_results.csv, thread_pool_results.csv, "
+                 "concurrent_writes_results.csv, mixed_workload_results.csv, snapshot_results.csv, "
+                 "ingest_results.csv, paged_results.csv and buffer_pool_results.csv"
+              << std::endl;
+}
+
+long long percentile(std::vector<long long>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+
+    size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+template<typename TDictionary>
+void benchmark_insert_latency(int num_elements, const std::string& dict_name, bool incremental,
+                              std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary(16, incremental));
+    SparseMatrix<double> matrix(size, size, std::move(dictionary));
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::vector<long long> latencies;
+    latencies.reserve(num_elements);
+
+    auto total_start = std::chrono::steady_clock::now();
+    for (int n = 0; n < num_elements; ++n) {
+        int i = dis(gen);
+        int j = dis(gen);
+
+        auto start = std::chrono::steady_clock::now();
+        matrix.SetElement(i, j, 1.0 + n);
+        auto finish = std::chrono::steady_clock::now();
+
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+    }
+    auto total_finish = std::chrono::steady_clock::now();
+
+    long long total_time = std::chrono::duration_cast<std::chrono::milliseconds>(total_finish - total_start).count();
+    long long max_latency = *std::max_element(latencies.begin(), latencies.end());
+    long long p99_latency = percentile(latencies, 0.99);
+
+    log_stream << dict_name << "," << (incremental ? "Incremental" : "StopTheWorld") << "," << num_elements << ","
+               << total_time << "," << p99_latency << "," << max_latency << "\n";
+}
+
+// Builds the same matrix three ways: SetElement per entry in random order, the bulk
+// constructor on unsorted entries (sorted on ingest) and on entries already sorted.
+template<typename TDictionary>
+void benchmark_bulk_load(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+
+    std::mt19937 gen(42);
+    std::vector<long long> positions(static_cast<size_t>(size) * size);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positions[i] = static_cast<long long>(i);
+    }
+    std::shuffle(positions.begin(), positions.end(), gen);
+    positions.resize(std::min(positions.size(), static_cast<size_t>(num_elements)));
+
+    std::vector<KeyValue<IndexPair, double>> entries;
+    entries.reserve(positions.size());
+    for (long long position : positions) {
+        entries.emplace_back(IndexPair(static_cast<int>(position / size), static_cast<int>(position % size)),
+                             1.0 + static_cast<double>(position));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+        SparseMatrix<double> matrix(size, size, std::move(dictionary));
+        for (const auto& entry : entries) {
+            matrix.SetElement(entry.key.row, entry.key.column, entry.value);
+        }
+    }
+    auto finish = std::chrono::steady_clock::now();
+    long long set_element_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    {
+        UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+        SparseMatrix<double> matrix(size, size, std::move(dictionary), entries.data(), entries.size());
+    }
+    finish = std::chrono::steady_clock::now();
+    long long unsorted_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    std::sort(entries.begin(), entries.end(),
+              [](const KeyValue<IndexPair, double>& a, const KeyValue<IndexPair, double>& b) {
+                  return a.key < b.key;
+              });
+
+    start = std::chrono::steady_clock::now();
+    {
+        UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+        SparseMatrix<double> matrix(size, size, std::move(dictionary), entries.data(), entries.size(), true);
+    }
+    finish = std::chrono::steady_clock::now();
+    long long sorted_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    log_stream << dict_name << ",SetElement," << num_elements << "," << set_element_time << "\n";
+    log_stream << dict_name << ",BulkUnsorted," << num_elements << "," << unsorted_time << "\n";
+    log_stream << dict_name << ",BulkSorted," << num_elements << "," << sorted_time << "\n";
+}
+
+// Converts a 10% dense dictionary-backed matrix to CSR and compares a full Reduce and a
+// GetElement on every nonzero between the two representations.
+template<typename TDictionary>
+void benchmark_csr(int size, const std::string& dict_name, std::ostream& log_stream) {
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+    SparseMatrix<double> matrix(size, size, std::move(dictionary));
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::vector<IndexPair> positions;
+    long long num_elements = static_cast<long long>(size) * size / 10;
+    for (long long n = 0; n < num_elements; ++n) {
+        IndexPair position(dis(gen), dis(gen));
+        matrix.SetElement(position.row, position.column, 1.0 + static_cast<double>(n % 100));
+        positions.push_back(position);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    CsrMatrix<double> csr = CsrMatrix<double>::FromSparseMatrix(matrix);
+    auto finish = std::chrono::steady_clock::now();
+    long long conversion_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    volatile double sink = 0.0;
+    auto add = [](double acc, double x) { return acc + x; };
+
+    start = std::chrono::steady_clock::now();
+    sink = sink + matrix.Reduce(add, 0.0);
+    finish = std::chrono::steady_clock::now();
+    long long source_scan_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    sink = sink + csr.Reduce(add, 0.0);
+    finish = std::chrono::steady_clock::now();
+    long long csr_scan_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (const IndexPair& position : positions) {
+        sink = sink + matrix.GetElement(position.row, position.column);
+    }
+    finish = std::chrono::steady_clock::now();
+    long long source_lookup_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (const IndexPair& position : positions) {
+        sink = sink + csr.GetElement(position.row, position.column);
+    }
+    finish = std::chrono::steady_clock::now();
+    long long csr_lookup_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    size_t non_zeros = csr.GetNonZeroCount();
+    double bytes_per_non_zero = static_cast<double>(csr.GetRowPointers().size() * sizeof(size_t) +
+                                                    non_zeros * (sizeof(int) + sizeof(double))) /
+                                static_cast<double>(std::max<size_t>(1, non_zeros));
+
+    log_stream << dict_name << "," << size << "," << non_zeros << "," << conversion_time << "," << source_scan_time
+               << "," << csr_scan_time << "," << source_lookup_time << "," << csr_lookup_time << ","
+               << bytes_per_non_zero << "\n";
+}
+
+// One product does two floating-point operations per nonzero, so GFLOP/s is
+// 2 * nonzeros / time. "Lookup" is the loop callers had to write before Multiply
+// existed: iterate the matrix and fetch each x value from a SparseVector. Every kernel
+// is timed as the best of several runs.
+template<typename TDictionary>
+void benchmark_spmv(int size, const std::string& dict_name, std::ostream& log_stream) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::vector<KeyValue<IndexPair, double>> entries;
+    long long num_elements = static_cast<long long>(size) * size / 100;
+    for (long long n = 0; n < num_elements; ++n) {
+        entries.emplace_back(IndexPair(dis(gen), dis(gen)), 1.0 + static_cast<double>(n % 100));
+    }
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+    SparseMatrix<double> matrix(size, size, std::move(dictionary), entries.data(), entries.size());
+    CsrMatrix<double> csr = CsrMatrix<double>::FromSparseMatrix(matrix);
+    size_t non_zeros = csr.GetNonZeroCount();
+
+    std::vector<double> x(size);
+    UnqPtr<IDictionary<int, double>> vector_dictionary(new HashTable<int, double>());
+    SparseVector<double> sparse_x(size, std::move(vector_dictionary));
+    for (int i = 0; i < size; ++i) {
+        x[i] = 1.0 + static_cast<double>(i % 7);
+        sparse_x.SetElement(i, x[i]);
+    }
+
+    auto report = [&](const std::string& kernel, int threads, long long time) {
+        double gflops = time > 0 ? 2.0 * static_cast<double>(non_zeros) / (static_cast<double>(time) * 1000.0) : 0.0;
+        log_stream << dict_name << "," << kernel << "," << size << "," << non_zeros << "," << threads << ","
+                   << time << "," << gflops << "\n";
+    };
+    auto best_of = [](int runs, auto kernel) {
+        long long best = -1;
+        for (int run = 0; run < runs; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            kernel();
+            auto finish = std::chrono::steady_clock::now();
+            long long time = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+            best = best < 0 ? time : std::min(best, time);
+        }
+        return best;
+    };
+    volatile double sink = 0.0;
+    const int runs = 5;
+
+    report("Lookup", 1, best_of(runs, [&]() {
+        std::vector<double> y(size, 0.0);
+        auto iterator = matrix.GetIterator();
+        while (iterator->MoveNext()) {
+            IndexPair key = iterator->GetCurrentKey();
+            y[key.row] += iterator->GetCurrentValue() * sparse_x.GetElement(key.column);
+        }
+        sink = sink + y[0];
+    }));
+
+    for (int threads : {1, 2, 4}) {
+        report("Dictionary", threads, best_of(runs, [&]() {
+            sink = sink + Multiply(matrix, x, threads)[0];
+        }));
+        report("Csr", threads, best_of(runs, [&]() {
+            sink = sink + Multiply(csr, x, threads)[0];
+        }));
+    }
+}
+
+// Squares a matrix with ten nonzeros per row. "GetElement" is the loop callers had to
+// write before Multiply existed, probing a whole row of the right operand for every
+// left nonzero; it only runs on the smallest size. "Dictionary" includes converting both
+// operands to CSR and loading the product back.
+template<typename TDictionary>
+void benchmark_spgemm(int size, const std::string& dict_name, std::ostream& log_stream) {
+    const int per_row = 10;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::vector<KeyValue<IndexPair, double>> entries;
+    for (int row = 0; row < size; ++row) {
+        for (int n = 0; n < per_row; ++n) {
+            entries.emplace_back(IndexPair(row, dis(gen)), 1.0 + static_cast<double>(n));
+        }
+    }
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new TDictionary());
+    SparseMatrix<double> matrix(size, size, std::move(dictionary), entries.data(), entries.size());
+    CsrMatrix<double> csr = CsrMatrix<double>::FromSparseMatrix(matrix);
+    size_t product_non_zeros = 0;
+
+    auto report = [&](const std::string& kernel, int threads, long long time) {
+        log_stream << dict_name << "," << kernel << "," << size << "," << per_row << "," << product_non_zeros << ","
+                   << threads << "," << time << "\n";
+    };
+
+    if (size <= 1000) {
+        auto start = std::chrono::steady_clock::now();
+        UnqPtr<IDictionary<IndexPair, double>> target(new TDictionary());
+        SparseMatrix<double> product(size, size, std::move(target));
+        auto iterator = matrix.GetIterator();
+        while (iterator->MoveNext()) {
+            IndexPair key = iterator->GetCurrentKey();
+            for (int column = 0; column < size; ++column) {
+                double value = matrix.GetElement(key.column, column);
+                if (value != 0.0) {
+                    product.SetElement(key.row, column,
+                                       product.GetElement(key.row, column) + iterator->GetCurrentValue() * value);
+                }
+            }
+        }
+        auto finish = std::chrono::steady_clock::now();
+        product_non_zeros = product.GetElements().GetCount();
+        report("GetElement", 1, std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count());
+    }
+
+    for (int threads : {1, 2, 4}) {
+        auto start = std::chrono::steady_clock::now();
+        UnqPtr<IDictionary<IndexPair, double>> target(new TDictionary());
+        SparseMatrix<double> product = Multiply(matrix, matrix, std::move(target), threads);
+        auto finish = std::chrono::steady_clock::now();
+        product_non_zeros = product.GetElements().GetCount();
+        report("Dictionary", threads, std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count());
+
+        start = std::chrono::steady_clock::now();
+        CsrMatrix<double> csr_product = Multiply(csr, csr, threads);
+        finish = std::chrono::steady_clock::now();
+        report("Csr", threads, std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count());
+    }
+}
+
+// Adds two matrices with half of their positions in common. "SetElement" copies the
+// right operand and then folds the left one in with GetElement/SetElement per entry,
+// which is how a sum had to be written before Add existed.
+template<typename TDictionary>
+void benchmark_elementwise(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::vector<KeyValue<IndexPair, double>> left_entries;
+    std::vector<KeyValue<IndexPair, double>> right_entries;
+    for (int n = 0; n < num_elements; ++n) {
+        IndexPair position(dis(gen), dis(gen));
+        left_entries.emplace_back(position, 1.0);
+        right_entries.emplace_back(n % 2 == 0 ? position : IndexPair(dis(gen), dis(gen)), 2.0);
+    }
+    UnqPtr<IDictionary<IndexPair, double>> left_dictionary(new TDictionary());
+    SparseMatrix<double> left(size, size, std::move(left_dictionary), left_entries.data(), left_entries.size());
+    UnqPtr<IDictionary<IndexPair, double>> right_dictionary(new TDictionary());
+    SparseMatrix<double> right(size, size, std::move(right_dictionary), right_entries.data(), right_entries.size());
+
+    auto start = std::chrono::steady_clock::now();
+    UnqPtr<IDictionary<IndexPair, double>> target(new TDictionary());
+    SparseMatrix<double> sum(size, size, std::move(target));
+    auto iterator = right.GetIterator();
+    while (iterator->MoveNext()) {
+        IndexPair key = iterator->GetCurrentKey();
+        sum.SetElement(key.row, key.column, iterator->GetCurrentValue());
+    }
+    iterator = left.GetIterator();
+    while (iterator->MoveNext()) {
+        IndexPair key = iterator->GetCurrentKey();
+        sum.SetElement(key.row, key.column, sum.GetElement(key.row, key.column) + iterator->GetCurrentValue());
+    }
+    auto finish = std::chrono::steady_clock::now();
+    log_stream << dict_name << ",SetElement," << num_elements << ","
+               << std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count() << "\n";
+
+    start = std::chrono::steady_clock::now();
+    SparseMatrix<double> added = Add(left, right, UnqPtr<IDictionary<IndexPair, double>>(new TDictionary()));
+    finish = std::chrono::steady_clock::now();
+    log_stream << dict_name << ",Add," << num_elements << ","
+               << std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count() << "\n";
+}
+
+// Dot products of two random vectors of length 1M. "Lookup" walks the left vector and
+// calls GetElement on the right one, which is how a dot product had to be written
+// before Dot existed. "Merge" and "SortedDot" intersect the same entries already copied
+// out as sorted arrays, first with a scalar merge and then with the SIMD/galloping
+// kernel. Every method is timed as the best of several runs.
+template<typename TDictionary>
+void benchmark_dot(int left_non_zeros, int right_non_zeros, const std::string& dict_name, std::ostream& log_stream) {
+    const int length = 1000000;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, length - 1);
+    auto make_dense = [&](int non_zeros) {
+        std::vector<double> dense(length, 0.0);
+        for (int n = 0; n < non_zeros; ++n) {
+            dense[dis(gen)] = 1.0 + static_cast<double>(n % 10);
+        }
+        return dense;
+    };
+    std::vector<double> left_dense = make_dense(left_non_zeros);
+    std::vector<double> right_dense = make_dense(right_non_zeros);
+    SparseVector<double> left = Gather(left_dense, UnqPtr<IDictionary<int, double>>(new TDictionary()));
+    SparseVector<double> right = Gather(right_dense, UnqPtr<IDictionary<int, double>>(new TDictionary()));
+
+    std::vector<int> left_indices;
+    std::vector<int> right_indices;
+    std::vector<double> left_values;
+    std::vector<double> right_values;
+    for (int i = 0; i < length; ++i) {
+        if (left_dense[i] != 0.0) {
+            left_indices.push_back(i);
+            left_values.push_back(left_dense[i]);
+        }
+        if (right_dense[i] != 0.0) {
+            right_indices.push_back(i);
+            right_values.push_back(right_dense[i]);
+        }
+    }
+
+    volatile double sink = 0.0;
+    auto report = [&](const std::string& method, auto kernel) {
+        long long best = -1;
+        for (int run = 0; run < 5; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            sink = sink + kernel();
+            auto finish = std::chrono::steady_clock::now();
+            long long time = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+            best = best < 0 ? time : std::min(best, time);
+        }
+        log_stream << dict_name << "," << method << "," << length << "," << left_indices.size() << ","
+                   << right_indices.size() << "," << best << "\n";
+    };
+
+    report("Lookup", [&]() {
+        double sum = 0.0;
+        auto iterator = left.GetIterator();
+        while (iterator->MoveNext()) {
+            sum += iterator->GetCurrentValue() * right.GetElement(iterator->GetCurrentKey());
+        }
+        return sum;
+    });
+    report("Dot", [&]() { return Dot(left, right); });
+    report("DenseDot", [&]() { return Dot(left, right_dense); });
+    report("Merge", [&]() {
+        double sum = 0.0;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < left_indices.size() && j < right_indices.size()) {
+            if (left_indices[i] < right_indices[j]) {
+                ++i;
+            } else if (right_indices[j] < left_indices[i]) {
+                ++j;
+            } else {
+                sum += left_values[i++] * right_values[j++];
+            }
+        }
+        return sum;
+    });
+    report("SortedDot", [&]() {
+        return SortedDot(left_indices.data(), left_values.data(), left_indices.size(), right_indices.data(),
+                         right_values.data(), right_indices.size());
+    });
+}
+
+double add_values(double acc, double x) {
+    return acc + x;
+}
+
+// A sum over every value of a vector. "FunctionPointer" is the loop Reduce used to run:
+// MoveNext and GetCurrentValue per element and an indirect call to a function pointer.
+// "Reduce" is the callable-generic Reduce with a capturing lambda (a scaled sum, which
+// needed a global before), reading the entries through NextBatch.
+template<typename TDictionary>
+void benchmark_traversal(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    std::vector<KeyValue<int, double>> entries;
+    for (int i = 0; i < num_elements; ++i) {
+        entries.emplace_back(i * 3, 1.0 + static_cast<double>(i % 10));
+    }
+    UnqPtr<IDictionary<int, double>> dictionary(new TDictionary());
+    SparseVector<double> vector(num_elements * 3, std::move(dictionary), entries.data(), entries.size(), true);
+
+    volatile double sink = 0.0;
+    double (*volatile func)(double, double) = add_values;
+    auto report = [&](const std::string& method, auto kernel) {
+        long long best = -1;
+        for (int run = 0; run < 5; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            sink = sink + kernel();
+            auto finish = std::chrono::steady_clock::now();
+            long long time = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+            best = best < 0 ? time : std::min(best, time);
+        }
+        log_stream << dict_name << "," << method << "," << num_elements << "," << best << "\n";
+    };
+
+    report("FunctionPointer", [&]() {
+        double result = 0.0;
+        auto iterator = vector.GetIterator();
+        while (iterator->MoveNext()) {
+            result = func(result, iterator->GetCurrentValue());
+        }
+        return result;
+    });
+    double scale = 0.5;
+    report("Reduce", [&]() {
+        return vector.Reduce([scale](double acc, double x) { return acc + scale * x; }, 0.0);
+    });
+}
+
+// "Staged" is the Map SparseVector used to have: every (key, new value) pair appended to
+// a DynamicArraySmart, then written back with one Update (a second lookup) per entry.
+// "InPlace" is the current Map, which rewrites the values through VisitMutable.
+template<typename TDictionary>
+void benchmark_map(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    std::vector<KeyValue<int, double>> entries;
+    for (int i = 0; i < num_elements; ++i) {
+        entries.emplace_back(i * 3, 1.0 + static_cast<double>(i % 10));
+    }
+    TDictionary staged;
+    staged.BulkLoad(entries.data(), entries.size());
+    UnqPtr<IDictionary<int, double>> dictionary(new TDictionary());
+    SparseVector<double> vector(num_elements * 3, std::move(dictionary), entries.data(), entries.size(), true);
+
+    auto report = [&](const std::string& method, auto kernel) {
+        long long best = -1;
+        for (int run = 0; run < 5; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            kernel();
+            auto finish = std::chrono::steady_clock::now();
+            long long time = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+            best = best < 0 ? time : std::min(best, time);
+        }
+        log_stream << dict_name << "," << method << "," << num_elements << "," << best << "\n";
+    };
+
+    report("Staged", [&]() {
+        DynamicArraySmart<KeyValue<int, double>> updates;
+        auto iterator = staged.GetIterator();
+        while (iterator->MoveNext()) {
+            updates.Append(KeyValue<int, double>(iterator->GetCurrentKey(), iterator->GetCurrentValue() * 0.5));
+        }
+        for (int i = 0; i < updates.GetLength(); ++i) {
+            const KeyValue<int, double>& kv = updates.Get(i);
+            staged.Update(kv.key, kv.value);
+        }
+    });
+    report("InPlace", [&]() {
+        vector.Map([](double x) { return x * 0.5; });
+    });
+}
+
+// Serial Reduce and Map against their parallel versions at several thread counts; the
+// reductions use the deterministic combine order.
+template<typename TDictionary>
+void benchmark_parallel_traversal(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    std::vector<KeyValue<int, double>> entries;
+    for (int i = 0; i < num_elements; ++i) {
+        entries.emplace_back(i * 3, 1.0 + static_cast<double>(i % 10));
+    }
+    UnqPtr<IDictionary<int, double>> dictionary(new TDictionary());
+    SparseVector<double> vector(num_elements * 3, std::move(dictionary), entries.data(), entries.size(), true);
+
+    volatile double sink = 0.0;
+    auto report = [&](const std::string& operation, int threads, auto kernel) {
+        long long best = -1;
+        for (int run = 0; run < 5; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            kernel();
+            auto finish = std::chrono::steady_clock::now();
+            long long time = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+            best = best < 0 ? time : std::min(best, time);
+        }
+        log_stream << dict_name << "," << operation << "," << threads << "," << num_elements << "," << best << "\n";
+    };
+
+    auto add = [](double acc, double x) { return acc + x; };
+    report("Reduce", 1, [&]() { sink = sink + vector.Reduce(add, 0.0); });
+    report("Map", 1, [&]() { vector.Map([](double x) { return x * 0.5; }); });
+    for (int threads : {1, 2, 4, 8}) {
+        report("ParallelReduce", threads, [&]() { sink = sink + vector.ParallelReduce(add, 0.0, threads, true); });
+        report("ParallelMap", threads, [&]() { vector.ParallelMap([](double x) { return x * 0.5; }, threads); });
+    }
+}
+
+// Cost of handing `parts` small pieces of work to other threads and waiting for them.
+// "SpawnThreads" starts and joins a std::thread per extra part, as the kernels did before
+// the shared pool; "RunPartitioned" queues them on ThreadPool::Default(); "ParallelFor"
+// splits a range into `parts` pieces on the same pool.
+void benchmark_thread_pool(int calls, int parts, std::ostream& log_stream) {
+    std::vector<double> data(static_cast<size_t>(parts) * 1024, 1.0);
+    std::vector<double> sums(parts, 0.0);
+    auto work = [&](int part) {
+        double sum = 0.0;
+        for (size_t i = static_cast<size_t>(part) * 1024; i < static_cast<size_t>(part + 1) * 1024; ++i) {
+            sum += data[i];
+        }
+        sums[part] = sum;
+    };
+
+    auto report = [&](const std::string& method, auto dispatch) {
+        auto start = std::chrono::steady_clock::now();
+        for (int call = 0; call < calls; ++call) {
+            dispatch();
+        }
+        auto finish = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::micro>(finish - start).count() / calls;
+        log_stream << method << "," << parts << "," << calls << "," << time << "\n";
+    };
+
+    report("SpawnThreads", [&]() {
+        std::vector<std::thread> workers;
+        for (int part = 1; part < parts; ++part) {
+            workers.emplace_back(work, part);
+        }
+        work(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    });
+    report("RunPartitioned", [&]() { RunPartitioned(parts, work); });
+    report("ParallelFor", [&]() {
+        ThreadPool::Default().ParallelFor(0, parts, 1, [&](size_t first, size_t last) {
+            for (size_t part = first; part < last; ++part) {
+                work(static_cast<int>(part));
+            }
+        });
+    });
+}
+
+// `writers` threads SetElement disjoint entries of one 1000-column matrix. "MutexHashTable"
+// is a HashTable-backed matrix with every SetElement behind one mutex, "ShardedHashTable"
+// the sharded dictionary with no outside locking.
+void benchmark_concurrent_writes(int num_elements, int writers, std::ostream& log_stream) {
+    int columns = 1000;
+    int rows = (num_elements + columns - 1) / columns;
+    ThreadPool pool(writers);
+
+    auto report = [&](const std::string& dict_name, auto set_element) {
+        auto start = std::chrono::steady_clock::now();
+        TaskGroup group(pool);
+        for (int writer = 0; writer < writers; ++writer) {
+            group.Run([&set_element, writer, writers, num_elements, columns]() {
+                for (int n = writer; n < num_elements; n += writers) {
+                    set_element(n / columns, n % columns, 1.0 + n % 7);
+                }
+            });
+        }
+        group.Wait();
+        auto finish = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(finish - start).count();
+        log_stream << dict_name << "," << writers << "," << num_elements << "," << time << ","
+                   << num_elements / time / 1000.0 << "\n";
+    };
+
+    SparseMatrix<double> locked(rows, columns, UnqPtr<IDictionary<IndexPair, double>>(
+            new HashTable<IndexPair, double>()));
+    std::mutex mutex;
+    report("MutexHashTable", [&](int row, int column, double value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        locked.SetElement(row, column, value);
+    });
+
+    SparseMatrix<double> sharded(rows, columns, UnqPtr<IDictionary<IndexPair, double>>(
+            new ShardedHashTable<IndexPair, double>(64)));
+    report("ShardedHashTable", [&](int row, int column, double value) {
+        sharded.SetElement(row, column, value);
+    });
+}
+
+// `threads` threads run a random mix of GetElement and SetElement, `write_percent` of them
+// writes, on a 1000-column matrix loaded with num_elements entries. "RwLockBTree" is a
+// BTree-backed matrix behind one reader-writer lock, shared for reads and exclusive for
+// writes; "ConcurrentBTree" needs no outside locking.
+void benchmark_mixed_workload(int num_elements, int threads, int write_percent, std::ostream& log_stream) {
+    int columns = 1000;
+    int rows = (num_elements + columns - 1) / columns;
+    int operations = 1000000;
+    std::vector<KeyValue<IndexPair, double>> entries;
+    entries.reserve(num_elements);
+    for (int n = 0; n < num_elements; ++n) {
+        entries.emplace_back(IndexPair(n / columns, n % columns), 1.0 + n % 7);
+    }
+    ThreadPool pool(threads);
+
+    auto report = [&](const std::string& dict_name, auto get_element, auto set_element) {
+        std::atomic<long long> checksum(0);
+        auto start = std::chrono::steady_clock::now();
+        TaskGroup group(pool);
+        for (int thread = 0; thread < threads; ++thread) {
+            group.Run([&, thread]() {
+                std::mt19937 gen(42 + thread);
+                std::uniform_int_distribution<> dis(0, num_elements - 1);
+                std::uniform_int_distribution<> percent(0, 99);
+                double sum = 0.0;
+                for (int n = thread; n < operations; n += threads) {
+                    int position = dis(gen);
+                    if (percent(gen) < write_percent) {
+                        set_element(position / columns, position % columns, 1.0 + n % 7);
+                    } else {
+                        sum += get_element(position / columns, position % columns);
+                    }
+                }
+                checksum += static_cast<long long>(sum);
+            });
+        }
+        group.Wait();
+        auto finish = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(finish - start).count();
+        log_stream << dict_name << "," << threads << "," << write_percent << "," << operations << "," << time
+                   << "," << operations / time / 1000.0 << "\n";
+    };
+
+    SparseMatrix<double> locked(rows, columns, UnqPtr<IDictionary<IndexPair, double>>(new BTree<IndexPair, double>()),
+                                entries.data(), entries.size(), true);
+    std::shared_mutex mutex;
+    report("RwLockBTree",
+           [&](int row, int column) {
+               std::shared_lock<std::shared_mutex> lock(mutex);
+               return locked.GetElement(row, column);
+           },
+           [&](int row, int column, double value) {
+               std::unique_lock<std::shared_mutex> lock(mutex);
+               locked.SetElement(row, column, value);
+           });
+
+    SparseMatrix<double> concurrent(rows, columns, UnqPtr<IDictionary<IndexPair, double>>(
+            new ConcurrentBTree<IndexPair, double>()), entries.data(), entries.size(), true);
+    report("ConcurrentBTree",
+           [&](int row, int column) { return concurrent.GetElement(row, column); },
+           [&](int row, int column, double value) { concurrent.SetElement(row, column, value); });
+}
+
+// One thread loads num_elements random entries and then SetElements them all again
+// (timed) while, in the "Reduce" rows, another keeps summing a consistent view of the
+// matrix. "LockedBTree" is a BTree-backed matrix
+// behind a mutex that the reader holds for a whole Reduce; "PersistentBTree" readers
+// reduce a Snapshot without locking, and the writer copies only the shared paths it
+// touches. ReadTime is the mean time per view, snapshot included.
+void benchmark_snapshot_reads(int num_elements, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::vector<IndexPair> positions;
+    positions.reserve(num_elements);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    for (int n = 0; n < num_elements; ++n) {
+        positions.emplace_back(dis(gen), dis(gen));
+    }
+    ThreadPool pool(1);
+    auto add = [](double acc, double x) { return acc + x; };
+
+    auto report = [&](const std::string& dict_name, bool reading, auto set_element, auto reduce_view) {
+        for (const IndexPair& position : positions) {
+            set_element(position.row, position.column, 1.0);
+        }
+
+        std::atomic<bool> writing(true);
+        std::future<std::pair<int, double>> reader = pool.Submit([&]() {
+            int reductions = 0;
+            double time = 0.0;
+            while (reading && writing) {
+                auto start = std::chrono::steady_clock::now();
+                reduce_view();
+                auto finish = std::chrono::steady_clock::now();
+                time += std::chrono::duration<double, std::milli>(finish - start).count();
+                ++reductions;
+            }
+            return std::make_pair(reductions, reductions > 0 ? time / reductions : 0.0);
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        for (int n = 0; n < num_elements; ++n) {
+            set_element(positions[n].row, positions[n].column, 1.0 + n % 7);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        writing = false;
+        std::pair<int, double> reads = reader.get();
+        log_stream << dict_name << "," << (reading ? "Reduce" : "None") << "," << num_elements << ","
+                   << std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count() << ","
+                   << reads.first << "," << reads.second << "\n";
+    };
+
+    for (bool reading : {false, true}) {
+        SparseMatrix<double> locked(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+                new BTree<IndexPair, double>()));
+        std::mutex mutex;
+        report("LockedBTree", reading,
+               [&](int row, int column, double value) {
+                   std::lock_guard<std::mutex> lock(mutex);
+                   locked.SetElement(row, column, value);
+               },
+               [&]() {
+                   std::lock_guard<std::mutex> lock(mutex);
+                   return locked.Reduce(add, 0.0);
+               });
+
+        SparseMatrix<double> persistent(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+                new PersistentBTree<IndexPair, double>()));
+        report("PersistentBTree", reading,
+               [&](int row, int column, double value) { persistent.SetElement(row, column, value); },
+               [&]() { return persistent.Snapshot().Reduce(add, 0.0); });
+    }
+}
+
+// SetElement on num_elements random positions, then every row read through
+// GetRowIterator. The rows are range scans on the ordered dictionaries only; a hash table
+// would filter a full iteration per row, so its RowScanTime is left empty.
+template<typename TDictionary>
+void benchmark_ingest(int num_elements, const std::string& dict_name, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::vector<IndexPair> positions;
+    positions.reserve(num_elements);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    for (int n = 0; n < num_elements; ++n) {
+        positions.emplace_back(dis(gen), dis(gen));
+    }
+
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(new TDictionary()));
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < num_elements; ++n) {
+        matrix.SetElement(positions[n].row, positions[n].column, 1.0 + n % 7);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    long long ingest_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    log_stream << dict_name << "," << num_elements << "," << ingest_time << ",";
+    if (dynamic_cast<const IOrderedDictionary<IndexPair, double>*>(&matrix.GetElements())) {
+        volatile double sink = 0.0;
+        start = std::chrono::steady_clock::now();
+        for (int row = 0; row < size; ++row) {
+            auto iterator = matrix.GetRowIterator(row);
+            while (iterator->MoveNext()) {
+                sink = sink + iterator->GetCurrentValue();
+            }
+        }
+        finish = std::chrono::steady_clock::now();
+        log_stream << std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+    }
+    log_stream << "\n";
+}
+
+// Fills a PagedBTree-backed matrix in a file, closes it and opens it again, then looks up
+// random positions. OpenTime covers opening the file and reading the entry count, which
+// does not grow with the tree. "BPlusTree" is the same work in memory; its OpenTime is
+// empty, since reopening it means building it again.
+void benchmark_paged(int num_elements, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::vector<IndexPair> positions;
+    positions.reserve(num_elements);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    for (int n = 0; n < num_elements; ++n) {
+        positions.emplace_back(dis(gen), dis(gen));
+    }
+    const char* path = "benchmark_paged.pages";
+    std::remove(path);
+
+    auto report = [&](const std::string& dict_name, auto open_matrix, bool reopens) {
+        auto start = std::chrono::steady_clock::now();
+        UnqPtr<SparseMatrix<double>> matrix = open_matrix();
+        for (int n = 0; n < num_elements; ++n) {
+            matrix->SetElement(positions[n].row, positions[n].column, 1.0 + n % 7);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        long long ingest_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+        std::string open_time;
+        if (reopens) {
+            matrix.reset();
+            start = std::chrono::steady_clock::now();
+            matrix = open_matrix();
+            size_t count = matrix->GetElements().GetCount();
+            finish = std::chrono::steady_clock::now();
+            open_time = std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count());
+            if (count == 0) {
+                std::cerr << "The page file was empty when opened again." << std::endl;
+            }
+        }
+
+        volatile double sink = 0.0;
+        start = std::chrono::steady_clock::now();
+        for (int n = num_elements - 1; n >= 0; --n) {
+            sink = sink + matrix->GetElement(positions[n].column, positions[n].row);
+        }
+        finish = std::chrono::steady_clock::now();
+        long long lookup_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+        log_stream << dict_name << "," << num_elements << "," << ingest_time << "," << open_time << ","
+                   << lookup_time << ",";
+        if (reopens) {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            log_stream << static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+        }
+        log_stream << "\n";
+    };
+
+    report("BPlusTree", [&]() {
+        return UnqPtr<SparseMatrix<double>>(new SparseMatrix<double>(
+                size, size, UnqPtr<IDictionary<IndexPair, double>>(new BPlusTree<IndexPair, double>(64))));
+    }, false);
+    report("PagedBTree", [&]() {
+        return UnqPtr<SparseMatrix<double>>(new SparseMatrix<double>(
+                size, size, UnqPtr<IDictionary<IndexPair, double>>(new PagedBTree<IndexPair, double>(path))));
+    }, true);
+    std::remove(path);
+}
+
+// Fills a PagedBTree-backed matrix through a BufferPool of the given budget, then looks
+// up random positions. The frames are all the pages the pool keeps in memory, however
+// large the file grows; the counters show what a smaller budget costs in reads and
+// writes of the spill file.
+void benchmark_buffer_pool(int num_elements, size_t budget_bytes, std::ostream& log_stream) {
+    int size = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::vector<IndexPair> positions;
+    positions.reserve(num_elements);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    for (int n = 0; n < num_elements; ++n) {
+        positions.emplace_back(dis(gen), dis(gen));
+    }
+
+    BufferPool* pool = new BufferPool(budget_bytes);
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+            new PagedBTree<IndexPair, double, BufferPool>(UnqPtr<BufferPool>(pool))));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < num_elements; ++n) {
+        matrix.SetElement(positions[n].row, positions[n].column, 1.0 + n % 7);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    long long ingest_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    volatile double sink = 0.0;
+    start = std::chrono::steady_clock::now();
+    for (int n = num_elements - 1; n >= 0; --n) {
+        sink = sink + matrix.GetElement(positions[n].row, positions[n].column);
+    }
+    finish = std::chrono::steady_clock::now();
+    long long lookup_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    log_stream << static_cast<double>(budget_bytes) / (1024.0 * 1024.0) << "," << num_elements << ","
+               << static_cast<double>(pool->GetPageCount() * BufferPool::kPageSize) / (1024.0 * 1024.0) << ","
+               << ingest_time << "," << lookup_time << "," << pool->GetHits() << "," << pool->GetMisses() << ","
+               << pool->GetEvictions() << "," << pool->GetWriteBacks() << "\n";
+}
+
+// Compares SparseVector::GetElement, whose miss path is a plain return value, against
+// the older pattern of calling Get and treating the "Key not found." exception as a zero.
+template<typename TDictionary>
+void benchmark_lookup_miss_ratio(int num_elements, const std::string& dict_name, double miss_ratio,
+                                 std::ostream& log_stream) {
+    int length = num_elements * 2;
+    UnqPtr<IDictionary<int, double>> dictionary(new TDictionary());
+    SparseVector<double> vector(length, std::move(dictionary));
+
+    for (int i = 0; i < num_elements; ++i) {
+        vector.SetElement(2 * i, 1.0 + i);
+    }
+
+    int num_lookups = num_elements;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, num_elements - 1);
+    std::bernoulli_distribution miss(miss_ratio);
+    std::vector<int> lookups;
+    lookups.reserve(num_lookups);
+    for (int i = 0; i < num_lookups; ++i) {
+        lookups.push_back(2 * dis(gen) + (miss(gen) ? 1 : 0));
+    }
+
+    const IDictionary<int, double>& elements = vector.GetElements();
+    volatile double sink = 0.0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int index : lookups) {
+        sink = sink + vector.GetElement(index);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    long long get_element_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int index : lookups) {
+        try {
+            sink = sink + elements.Get(index);
+        }
+        catch (const std::runtime_error&) {
+            sink = sink + 0.0;
+        }
+    }
+    finish = std::chrono::steady_clock::now();
+    long long try_catch_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    log_stream << dict_name << ",GetElement," << num_elements << "," << miss_ratio << "," << num_lookups << ","
+               << get_element_time << "\n";
+    log_stream << dict_name << ",TryCatchGet," << num_elements << "," << miss_ratio << "," << num_lookups << ","
+               << try_catch_time << "\n";
+}
+
+// "Heap" is BTree<..., 0> with the order chosen at run time and separate key, value and
+// child arrays per node; "Inline" is BTree<..., Order> with the arrays inside the node.
+template<typename TDictionary>
+void benchmark_btree_layout(int num_elements, int order, const std::string& layout_name, std::ostream& log_stream) {
+    TDictionary tree(order);
+
+    int side = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(num_elements) * 10.0)));
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, side - 1);
+    std::vector<IndexPair> keys;
+    keys.reserve(num_elements);
+    for (int i = 0; i < num_elements; ++i) {
+        keys.emplace_back(dis(gen), dis(gen));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_elements; ++i) {
+        tree.Upsert(keys[i], 1.0 + i);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    long long insertion_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    std::shuffle(keys.begin(), keys.end(), gen);
+    volatile double sink = 0.0;
+
+    start = std::chrono::steady_clock::now();
+    for (const IndexPair& key : keys) {
+        const double* value = tree.FindPtr(key);
+        sink = sink + (value ? *value : 0.0);
+    }
+    finish = std::chrono::steady_clock::now();
+    long long search_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    start = std::chrono::steady_clock::now();
+    UnqPtr<IDictionaryIterator<IndexPair, double>> iterator = tree.GetIterator();
+    while (iterator->MoveNext()) {
+        sink = sink + iterator->GetCurrentValue();
+    }
+    finish = std::chrono::steady_clock::now();
+    long long iteration_time = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    log_stream << layout_name << "," << order << "," << num_elements << "," << insertion_time << ","
+               << search_time << "," << iteration_time << "\n";
+}
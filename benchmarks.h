@@ -0,0 +1,67 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+void run_benchmarks();
+
+template<typename TDictionary>
+void benchmark_insert_latency(int num_elements, const std::string& dict_name, bool incremental,
+                              std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_lookup_miss_ratio(int num_elements, const std::string& dict_name, double miss_ratio,
+                                 std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_btree_layout(int num_elements, int order, const std::string& layout_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_bulk_load(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_csr(int size, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_spmv(int size, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_spgemm(int size, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_elementwise(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_dot(int left_non_zeros, int right_non_zeros, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_traversal(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_map(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_parallel_traversal(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+template<typename TDictionary>
+void benchmark_ingest(int num_elements, const std::string& dict_name, std::ostream& log_stream);
+
+void benchmark_paged(int num_elements, std::ostream& log_stream);
+
+void benchmark_buffer_pool(int num_elements, size_t budget_bytes, std::ostream& log_stream);
+
+void benchmark_thread_pool(int calls, int parts, std::ostream& log_stream);
+
+void benchmark_concurrent_writes(int num_elements, int writers, std::ostream& log_stream);
+
+void benchmark_mixed_workload(int num_elements, int threads, int write_percent, std::ostream& log_stream);
+
+void benchmark_snapshot_reads(int num_elements, std::ostream& log_stream);
+
+double add_values(double acc, double x);
+
+long long percentile(std::vector<long long>& samples, double fraction);
+
+#endif // BENCHMARKS_H
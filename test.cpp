@@ -4,6 +4,19 @@
 #include "DataStructures/BTree.h"
 #include "DataStructures/UnqPtr.h"
 #include "DataStructures/HashTable.h"
+#include "DataStructures/FlatHashTable.h"
+#include "DataStructures/BPlusTree.h"
+#include "DataStructures/CsrMatrix.h"
+#include "DataStructures/SparseMultiply.h"
+#include "DataStructures/SparseElementwise.h"
+#include "DataStructures/SparseBlas.h"
+#include "DataStructures/ThreadPool.h"
+#include "DataStructures/ShardedHashTable.h"
+#include "DataStructures/ConcurrentBTree.h"
+#include "DataStructures/PersistentBTree.h"
+#include "DataStructures/BufferedBTree.h"
+#include "DataStructures/PagedBTree.h"
+#include "DataStructures/BufferPool.h"
 #include <iostream>
 #include <fstream>
 #include <chrono>
@@ -11,8 +24,13 @@
 #include <string>
 #include <cstdlib>
 #include <unordered_set>
+#include <map>
+#include <set>
 #include <algorithm>
 #include <random>
+#include <cmath>
+#include <atomic>
+#include <cstring>
 
 void run_tests() {
     std::cout << "Starting functional tests..." << std::endl;
@@ -29,11 +47,100 @@ void functional_tests() {
 
     test_dictionary<BTree<int, std::string>, int, std::string>("BTree");
 
+    test_dictionary<BTree<int, std::string, 3>, int, std::string>("BTree with inline nodes");
+
+    test_dictionary<FlatHashTable<int, std::string>, int, std::string>("FlatHashTable");
+
+    test_dictionary<BPlusTree<int, std::string>, int, std::string>("BPlusTree");
+
+    test_dictionary<ShardedHashTable<int, std::string>, int, std::string>("ShardedHashTable");
+
+    test_dictionary<PersistentBTree<int, std::string>, int, std::string>("PersistentBTree");
+
+    test_dictionary<BufferedBTree<int, std::string>, int, std::string>("BufferedBTree");
+
     test_sparse_vector<HashTable<int, double>>("HashTable", true);
     test_sparse_vector<BTree<int, double>>("BTree", true);
+    test_sparse_vector<BTree<int, double, 3>>("BTree with inline nodes", true);
+    test_sparse_vector<FlatHashTable<int, double>>("FlatHashTable", true);
+    test_sparse_vector<BPlusTree<int, double>>("BPlusTree", true);
+    test_sparse_vector<ConcurrentBTree<int, double>>("ConcurrentBTree", true);
+    test_sparse_vector<BufferedBTree<int, double>>("BufferedBTree", true);
+    test_sparse_vector<PagedBTree<int, double>>("PagedBTree", true);
+    test_sparse_vector<PagedBTree<int, double, BufferPool>>("PagedBTree over BufferPool", true);
 
     test_sparse_matrix<HashTable<IndexPair, double>>("HashTable", true);
     test_sparse_matrix<BTree<IndexPair, double>>("BTree", true);
+    test_sparse_matrix<BTree<IndexPair, double, 4>>("BTree with inline nodes", true);
+    test_sparse_matrix<FlatHashTable<IndexPair, double>>("FlatHashTable", true);
+    test_sparse_matrix<BPlusTree<IndexPair, double>>("BPlusTree", true);
+    test_sparse_matrix<ShardedHashTable<IndexPair, double>>("ShardedHashTable", true);
+    test_sparse_matrix<ConcurrentBTree<IndexPair, double>>("ConcurrentBTree", true);
+    test_sparse_matrix<PersistentBTree<IndexPair, double>>("PersistentBTree", true);
+    test_sparse_matrix<BufferedBTree<IndexPair, double>>("BufferedBTree", true);
+    test_sparse_matrix<PagedBTree<IndexPair, double>>("PagedBTree", true);
+    test_sparse_matrix<PagedBTree<IndexPair, double, BufferPool>>("PagedBTree over BufferPool", true);
+
+    test_bulk_load<HashTable<IndexPair, double>>("HashTable");
+    test_bulk_load<BTree<IndexPair, double>>("BTree");
+    test_bulk_load<BTree<IndexPair, double, 4>>("BTree with inline nodes");
+    test_bulk_load<FlatHashTable<IndexPair, double>>("FlatHashTable");
+    test_bulk_load<BPlusTree<IndexPair, double>>("BPlusTree");
+    test_bulk_load<BufferedBTree<IndexPair, double>>("BufferedBTree");
+    test_bulk_load<PagedBTree<IndexPair, double>>("PagedBTree");
+
+    test_csr_matrix<HashTable<IndexPair, double>>("HashTable");
+    test_csr_matrix<BTree<IndexPair, double>>("BTree");
+
+    test_multiply<HashTable<IndexPair, double>>("HashTable");
+    test_multiply<BTree<IndexPair, double>>("BTree");
+
+    test_matrix_product<HashTable<IndexPair, double>>("HashTable");
+    test_matrix_product<BTree<IndexPair, double>>("BTree");
+
+    test_elementwise<HashTable<int, double>, HashTable<IndexPair, double>>("HashTable");
+    test_elementwise<BTree<int, double>, BTree<IndexPair, double>>("BTree");
+    test_elementwise<FlatHashTable<int, double>, FlatHashTable<IndexPair, double>>("FlatHashTable");
+
+    test_sparse_blas<HashTable<int, double>>("HashTable");
+    test_sparse_blas<BTree<int, double>>("BTree");
+
+    test_parallel_traversal<HashTable<IndexPair, double>>("HashTable");
+    test_parallel_traversal<BTree<IndexPair, double>>("BTree");
+    test_parallel_traversal<FlatHashTable<IndexPair, double>>("FlatHashTable");
+    test_parallel_traversal<BPlusTree<IndexPair, double>>("BPlusTree");
+    test_parallel_traversal<PersistentBTree<IndexPair, double>>("PersistentBTree");
+    test_parallel_traversal<BufferedBTree<IndexPair, double>>("BufferedBTree");
+    test_parallel_traversal<PagedBTree<IndexPair, double>>("PagedBTree");
+
+    test_ordered_bounds<BTree<int, int>>("BTree");
+    test_ordered_bounds<BTree<int, int, 4>>("BTree with inline nodes");
+    test_ordered_bounds<BPlusTree<int, int>>("BPlusTree");
+    test_ordered_bounds<ConcurrentBTree<int, int>>("ConcurrentBTree");
+    test_ordered_bounds<PersistentBTree<int, int>>("PersistentBTree");
+    test_ordered_bounds<BufferedBTree<int, int>>("BufferedBTree");
+    test_ordered_bounds<PagedBTree<int, int>>("PagedBTree");
+    test_ordered_bounds<PagedBTree<int, int, BufferPool>>("PagedBTree over BufferPool");
+
+    test_btree_removal();
+
+    test_bplus_tree();
+
+    test_incremental_rehash();
+
+    test_thread_pool();
+
+    test_sharded_hash_table();
+
+    test_concurrent_btree();
+
+    test_persistent_btree();
+
+    test_buffered_btree();
+
+    test_paged_btree();
+
+    test_buffer_pool();
 
     std::cout << "All functional tests completed successfully." << std::endl;
 }
@@ -77,6 +184,23 @@ void test_dictionary(const std::string& dictionary_name) {
         std::cout << "Remove succeeded, key 3 is no longer in the " << dictionary_name << "." << std::endl;
     }
 
+    ValueType found;
+    if (dictionary.TryGet(3, found) || dictionary.FindPtr(3) != nullptr || dictionary.TryRemove(3)) {
+        std::cerr << "Error: lookups of removed key 3 should report a miss." << std::endl;
+    } else {
+        std::cout << "TryGet/FindPtr/TryRemove report key 3 as missing." << std::endl;
+    }
+
+    bool inserted = dictionary.Upsert(4, "Four");
+    bool updated = !dictionary.Upsert(4, "Fourth");
+    dictionary.GetOrAdd(5) = "Five";
+    dictionary.GetOrAdd(5) += "!";
+    if (!inserted || !updated || !dictionary.TryGet(4, found) || found != "Fourth" || dictionary.Get(5) != "Five!") {
+        std::cerr << "Error: Upsert/GetOrAdd produced unexpected values." << std::endl;
+    } else {
+        std::cout << "Upsert and GetOrAdd succeeded, Get(4): " << found << ", Get(5): " << dictionary.Get(5) << std::endl;
+    }
+
     std::cout << "Iterating over " << dictionary_name << ":" << std::endl;
     auto iterator = dictionary.GetIterator();
     while (iterator->MoveNext()) {
@@ -127,6 +251,42 @@ void test_sparse_vector(const std::string& dictionary_name, bool extended) {
         std::cout << "Reduce succeeded, sum: " << sum << std::endl;
     }
 
+    double weight = 0.5;
+    int visited = 0;
+    double weighted = 0.0;
+    vector.ForEach([&](int, const double& value) {
+        weighted += weight * value;
+        ++visited;
+    });
+    double scaled_sum = vector.Reduce([weight](double acc, double x) { return acc + weight * x; }, 0.0);
+    if (visited != 3 || std::fabs(weighted - 0.5 * expected_sum) > 1e-12 ||
+        std::fabs(scaled_sum - 0.5 * expected_sum) > 1e-12) {
+        std::cerr << "Error in capturing ForEach/Reduce: visited " << visited << ", got " << weighted
+                  << " and " << scaled_sum << std::endl;
+    } else {
+        std::cout << "Capturing ForEach/Reduce succeeded" << std::endl;
+    }
+
+    // Enough entries for several mutable batches; every value that maps to zero is dropped.
+    SparseVector<double> mapped(2000, UnqPtr<IDictionary<int, double>>(new DictionaryType()));
+    for (int i = 0; i < 2000; i += 2) {
+        mapped.SetElement(i, static_cast<double>(i % 3));
+    }
+    mapped.Map([](double x) { return x == 1.0 ? 0.0 : x * 2; });
+    bool map_ok = true;
+    size_t expected_count = 0;
+    for (int i = 0; i < 2000; ++i) {
+        double expected = (i % 2 == 0 && i % 3 == 2) ? 4.0 : 0.0;
+        expected_count += expected != 0.0;
+        map_ok = map_ok && mapped.GetElement(i) == expected;
+    }
+    if (!map_ok || mapped.GetElements().GetCount() != expected_count) {
+        std::cerr << "Error in in-place Map: " << mapped.GetElements().GetCount() << " entries, expected "
+                  << expected_count << std::endl;
+    } else {
+        std::cout << "In-place Map succeeded, " << expected_count << " entries left" << std::endl;
+    }
+
     if (extended) {
         std::cout << "Extended Testing SparseVector with " << dictionary_name << "..." << std::endl;
 
@@ -235,6 +395,23 @@ void test_sparse_matrix(const std::string& dictionary_name, bool extended) {
             std::cout << "Position: (" << index.row << ", " << index.column << "), Value: " << value << std::endl;
         });
 
+        double row_sum = 0.0;
+        auto row_iterator = matrix.GetRowIterator(3);
+        while (row_iterator->MoveNext()) {
+            row_sum += row_iterator->GetCurrentValue();
+        }
+        double column_sum = 0.0;
+        auto column_iterator = matrix.GetColumnIterator(0);
+        while (column_iterator->MoveNext()) {
+            column_sum += column_iterator->GetCurrentValue();
+        }
+        if (row_sum != 30.0 || column_sum != 28.0) {
+            std::cerr << "Error in row/column slices: expected sums 30 and 28, got " << row_sum << " and "
+                      << column_sum << std::endl;
+        } else {
+            std::cout << "Row and column slices succeeded." << std::endl;
+        }
+
         matrix.RemoveElement(1, 1);
         if (matrix.GetElement(1, 1) != 0.0) {
             std::cerr << "Error: Element at (1,1) should have been removed." << std::endl;
@@ -244,6 +421,1249 @@ void test_sparse_matrix(const std::string& dictionary_name, bool extended) {
     }
 }
 
+template <typename DictionaryType>
+void test_bulk_load(const std::string& dictionary_name) {
+    std::cout << "Testing SparseMatrix bulk load with " << dictionary_name << "..." << std::endl;
+
+    // Unsorted, with a repeated position (the last value wins) and an explicit zero.
+    std::vector<KeyValue<IndexPair, double>> entries = {
+            {IndexPair(2, 1), 5.0}, {IndexPair(0, 0), 1.0}, {IndexPair(2, 1), 7.0},
+            {IndexPair(1, 3), 0.0}, {IndexPair(0, 2), 3.0}};
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new DictionaryType());
+    SparseMatrix<double> matrix(3, 4, std::move(dictionary), entries.data(), entries.size());
+
+    if (matrix.GetElement(2, 1) != 7.0 || matrix.GetElement(0, 0) != 1.0 || matrix.GetElement(0, 2) != 3.0 ||
+        matrix.GetElement(1, 3) != 0.0 || matrix.GetElements().GetCount() != 3) {
+        std::cerr << "Error in bulk load: unexpected contents after loading unsorted entries." << std::endl;
+    } else {
+        std::cout << "Bulk load of unsorted entries succeeded." << std::endl;
+    }
+
+    int size = 100;
+    std::vector<KeyValue<IndexPair, double>> sorted_entries;
+    for (int i = 0; i < size; ++i) {
+        for (int j = i % 3; j < size; j += 3) {
+            sorted_entries.emplace_back(IndexPair(i, j), i + j + 1.0);
+        }
+    }
+    UnqPtr<IDictionary<IndexPair, double>> large_dictionary(new DictionaryType());
+    SparseMatrix<double> large(size, size, std::move(large_dictionary), sorted_entries.data(),
+                               sorted_entries.size(), true);
+
+    large.SetElement(0, 1, 42.0);
+    large.RemoveElement(1, 1);
+
+    bool correct = large.GetElements().GetCount() == sorted_entries.size();
+    for (const auto& entry : sorted_entries) {
+        double expected = entry.value;
+        if (entry.key == IndexPair(1, 1)) {
+            expected = 0.0;
+        }
+        correct = correct && large.GetElement(entry.key.row, entry.key.column) == expected;
+    }
+    correct = correct && large.GetElement(0, 1) == 42.0;
+
+    if (!correct) {
+        std::cerr << "Error in bulk load: sorted load followed by updates gave wrong contents." << std::endl;
+    } else {
+        std::cout << "Bulk load of " << sorted_entries.size() << " sorted entries succeeded." << std::endl;
+    }
+}
+
+template <typename DictionaryType>
+void test_csr_matrix(const std::string& dictionary_name) {
+    std::cout << "Testing CsrMatrix conversion from " << dictionary_name << "..." << std::endl;
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new DictionaryType());
+    SparseMatrix<double> matrix(4, 5, std::move(dictionary));
+
+    matrix.SetElement(3, 4, 6.0);
+    matrix.SetElement(0, 1, 1.0);
+    matrix.SetElement(2, 0, 4.0);
+    matrix.SetElement(0, 3, 2.0);
+    matrix.SetElement(2, 2, 5.0);
+
+    CsrMatrix<double> csr = CsrMatrix<double>::FromSparseMatrix(matrix);
+
+    bool correct = csr.GetRows() == 4 && csr.GetColumns() == 5 && csr.GetNonZeroCount() == 5;
+    for (int i = 0; i < matrix.GetRows(); ++i) {
+        for (int j = 0; j < matrix.GetColumns(); ++j) {
+            correct = correct && csr.GetElement(i, j) == matrix.GetElement(i, j);
+        }
+    }
+    if (!correct) {
+        std::cerr << "Error in CsrMatrix: contents differ from the source matrix." << std::endl;
+    } else {
+        std::cout << "Conversion to CSR succeeded." << std::endl;
+    }
+
+    csr.Map([](double x) { return x * 10; });
+    double sum = csr.Reduce([](double acc, double x) { return acc + x; }, 0.0);
+    if (sum != 180.0) {
+        std::cerr << "Error in CsrMatrix Map/Reduce: expected 180.0, got " << sum << std::endl;
+    } else {
+        std::cout << "CsrMatrix Map/Reduce succeeded, sum: " << sum << std::endl;
+    }
+
+    // Values mapped to zero leave the structure, as they leave a SparseMatrix.
+    CsrMatrix<double> zeroed = csr;
+    zeroed.Map([](double x) { return x == 20.0 || x == 50.0 ? 0.0 : x; });
+    if (zeroed.GetNonZeroCount() != 3 || zeroed.GetElement(0, 3) != 0.0 || zeroed.GetElement(2, 0) != 40.0 ||
+        zeroed.GetElement(3, 4) != 60.0 || zeroed.ToSparseMatrix(UnqPtr<IDictionary<IndexPair, double>>(
+                new DictionaryType())).GetElements().GetCount() != 3) {
+        std::cerr << "Error in CsrMatrix Map: entries mapped to zero were kept." << std::endl;
+    } else {
+        std::cout << "CsrMatrix Map dropped the entries mapped to zero." << std::endl;
+    }
+
+    std::cout << "CsrMatrix elements in row order:" << std::endl;
+    csr.ForEach([](const IndexPair& index, const double& value) {
+        std::cout << "Position: (" << index.row << ", " << index.column << "), Value: " << value << std::endl;
+    });
+
+    UnqPtr<IDictionary<IndexPair, double>> target(new DictionaryType());
+    SparseMatrix<double> back = csr.ToSparseMatrix(std::move(target));
+    if (back.GetElement(2, 2) != 50.0 || back.GetElement(1, 1) != 0.0 || back.GetElements().GetCount() != 5) {
+        std::cerr << "Error in CsrMatrix: conversion back to SparseMatrix lost data." << std::endl;
+    } else {
+        std::cout << "Conversion back to SparseMatrix succeeded." << std::endl;
+    }
+}
+
+template <typename DictionaryType>
+void test_multiply(const std::string& dictionary_name) {
+    std::cout << "Testing matrix-vector multiplication with " << dictionary_name << "..." << std::endl;
+    UnqPtr<IDictionary<IndexPair, double>> dictionary(new DictionaryType());
+    SparseMatrix<double> matrix(3, 4, std::move(dictionary));
+
+    matrix.SetElement(0, 0, 1.0);
+    matrix.SetElement(0, 3, 2.0);
+    matrix.SetElement(1, 1, 3.0);
+    matrix.SetElement(2, 0, 4.0);
+    matrix.SetElement(2, 2, 5.0);
+
+    std::vector<double> dense = {1.0, 2.0, 3.0, 4.0};
+    std::vector<double> expected = {9.0, 6.0, 19.0};
+    std::vector<double> product = Multiply(matrix, dense);
+    std::vector<double> csr_product = Multiply(CsrMatrix<double>::FromSparseMatrix(matrix), dense);
+    if (product != expected || csr_product != expected) {
+        std::cerr << "Error in Multiply: wrong product with a dense vector." << std::endl;
+    } else {
+        std::cout << "Multiplication by a dense vector succeeded." << std::endl;
+    }
+
+    UnqPtr<IDictionary<int, double>> vector_dictionary(new BTree<int, double>());
+    SparseVector<double> vector(4, std::move(vector_dictionary));
+    vector.SetElement(1, 2.0);
+    UnqPtr<IDictionary<int, double>> result_dictionary(new BTree<int, double>());
+    SparseVector<double> sparse_product = Multiply(matrix, vector, std::move(result_dictionary));
+    if (sparse_product.GetElement(0) != 0.0 || sparse_product.GetElement(1) != 6.0 ||
+        sparse_product.GetElement(2) != 0.0 || sparse_product.GetElements().GetCount() != 1) {
+        std::cerr << "Error in Multiply: wrong product with a sparse vector." << std::endl;
+    } else {
+        std::cout << "Multiplication by a sparse vector succeeded." << std::endl;
+    }
+
+    // Enough nonzeros for several threads; every split must give the serial result.
+    int size = 2000;
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::uniform_int_distribution<> small(1, 9);
+    std::vector<KeyValue<IndexPair, double>> entries;
+    for (int i = 0; i < 200000; ++i) {
+        entries.emplace_back(IndexPair(dis(gen), dis(gen)), small(gen));
+    }
+    UnqPtr<IDictionary<IndexPair, double>> large_dictionary(new DictionaryType());
+    SparseMatrix<double> large(size, size, std::move(large_dictionary), entries.data(), entries.size());
+    CsrMatrix<double> large_csr = CsrMatrix<double>::FromSparseMatrix(large);
+    std::vector<double> x(size);
+    for (int i = 0; i < size; ++i) {
+        x[i] = small(gen);
+    }
+
+    std::vector<double> serial = Multiply(large_csr, x, 1);
+    bool correct = Multiply(large_csr, x, 4) == serial && Multiply(large, x, 1) == serial &&
+                   Multiply(large, x, 4) == serial;
+    if (!correct) {
+        std::cerr << "Error in Multiply: threaded product differs from the serial one." << std::endl;
+    } else {
+        std::cout << "Threaded multiplication succeeded." << std::endl;
+    }
+}
+
+template <typename DictionaryType>
+void test_matrix_product(const std::string& dictionary_name) {
+    std::cout << "Testing matrix-matrix multiplication with " << dictionary_name << "..." << std::endl;
+    UnqPtr<IDictionary<IndexPair, double>> left_dictionary(new DictionaryType());
+    SparseMatrix<double> left(2, 3, std::move(left_dictionary));
+    left.SetElement(0, 0, 1.0);
+    left.SetElement(0, 2, 2.0);
+    left.SetElement(1, 1, 3.0);
+    left.SetElement(1, 2, -1.0);
+
+    UnqPtr<IDictionary<IndexPair, double>> right_dictionary(new DictionaryType());
+    SparseMatrix<double> right(3, 2, std::move(right_dictionary));
+    right.SetElement(0, 1, 4.0);
+    right.SetElement(1, 0, 1.0);
+    right.SetElement(2, 0, 3.0);
+    right.SetElement(2, 1, 5.0);
+
+    // Row 1, column 0 is 3 * 1 + (-1) * 3 and cancels out, so it must not be stored.
+    UnqPtr<IDictionary<IndexPair, double>> product_dictionary(new DictionaryType());
+    SparseMatrix<double> product = Multiply(left, right, std::move(product_dictionary));
+    if (product.GetRows() != 2 || product.GetColumns() != 2 || product.GetElement(0, 0) != 6.0 ||
+        product.GetElement(0, 1) != 14.0 || product.GetElement(1, 0) != 0.0 || product.GetElement(1, 1) != -5.0 ||
+        product.GetElements().GetCount() != 3) {
+        std::cerr << "Error in Multiply: wrong product of two small matrices." << std::endl;
+    } else {
+        std::cout << "Product of two small matrices succeeded." << std::endl;
+    }
+
+    // Random operands checked against the triple loop; the wide one takes the hash accumulator.
+    std::mt19937 gen(11);
+    bool correct = true;
+    for (int columns : {40, 300000}) {
+        std::uniform_int_distribution<> column_dis(0, columns - 1);
+        std::uniform_int_distribution<> value_dis(1, 9);
+        CsrMatrix<double> a(50);
+        CsrMatrix<double> b(columns);
+        std::vector<std::vector<KeyValue<int, double>>> a_rows(60);
+        std::vector<std::vector<KeyValue<int, double>>> b_rows(50);
+        for (int i = 0; i < 60; ++i) {
+            for (int j = 0; j < 50; ++j) {
+                if (value_dis(gen) <= 2) {
+                    a_rows[i].emplace_back(j, value_dis(gen));
+                }
+            }
+            a.AppendRow(a_rows[i].data(), a_rows[i].size());
+        }
+        for (int i = 0; i < 50; ++i) {
+            std::vector<int> picked;
+            for (int n = 0; n < 10; ++n) {
+                picked.push_back(column_dis(gen));
+            }
+            std::sort(picked.begin(), picked.end());
+            picked.erase(std::unique(picked.begin(), picked.end()), picked.end());
+            for (int column : picked) {
+                b_rows[i].emplace_back(column, value_dis(gen));
+            }
+            b.AppendRow(b_rows[i].data(), b_rows[i].size());
+        }
+
+        CsrMatrix<double> c = Multiply(a, b, 1);
+        correct = correct && c.GetRows() == 60 && c.GetColumns() == columns;
+        for (int i = 0; i < 60 && correct; ++i) {
+            std::map<int, double> expected;
+            for (const KeyValue<int, double>& a_entry : a_rows[i]) {
+                for (const KeyValue<int, double>& b_entry : b_rows[a_entry.key]) {
+                    expected[b_entry.key] += a_entry.value * b_entry.value;
+                }
+            }
+            auto iterator = c.GetRowIterator(i);
+            for (const std::pair<const int, double>& entry : expected) {
+                correct = correct && iterator->MoveNext() && iterator->GetCurrentKey().column == entry.first &&
+                          iterator->GetCurrentValue() == entry.second;
+            }
+            correct = correct && !iterator->MoveNext();
+        }
+    }
+
+    // Enough work for several threads; every split must give the serial result.
+    int size = 2000;
+    std::uniform_int_distribution<> dis(0, size - 1);
+    std::uniform_int_distribution<> small(1, 9);
+    std::vector<KeyValue<IndexPair, double>> entries;
+    for (int i = 0; i < 40000; ++i) {
+        entries.emplace_back(IndexPair(dis(gen), dis(gen)), small(gen));
+    }
+    UnqPtr<IDictionary<IndexPair, double>> large_dictionary(new DictionaryType());
+    SparseMatrix<double> large(size, size, std::move(large_dictionary), entries.data(), entries.size());
+    CsrMatrix<double> large_csr = CsrMatrix<double>::FromSparseMatrix(large);
+    CsrMatrix<double> serial = Multiply(large_csr, large_csr, 1);
+    CsrMatrix<double> threaded = Multiply(large_csr, large_csr, 4);
+    correct = correct && serial.GetRowPointers() == threaded.GetRowPointers() &&
+              serial.GetColumnIndices() == threaded.GetColumnIndices() && serial.GetValues() == threaded.GetValues();
+
+    if (!correct) {
+        std::cerr << "Error in Multiply: product differs from the reference result." << std::endl;
+    } else {
+        std::cout << "Products of random matrices succeeded, " << serial.GetNonZeroCount()
+                  << " nonzeros in the largest." << std::endl;
+    }
+}
+
+template <typename VectorDictionaryType, typename MatrixDictionaryType>
+void test_elementwise(const std::string& dictionary_name) {
+    std::cout << "Testing element-wise operations with " << dictionary_name << "..." << std::endl;
+    auto make_vector = [](std::initializer_list<KeyValue<int, double>> entries) {
+        std::vector<KeyValue<int, double>> items(entries);
+        UnqPtr<IDictionary<int, double>> dictionary(new VectorDictionaryType());
+        return SparseVector<double>(6, std::move(dictionary), items.data(), items.size());
+    };
+    auto output = []() { return UnqPtr<IDictionary<int, double>>(new VectorDictionaryType()); };
+
+    SparseVector<double> a = make_vector({{0, 1.0}, {2, 2.0}, {4, 3.0}});
+    SparseVector<double> b = make_vector({{1, 5.0}, {2, -2.0}, {4, 1.0}});
+
+    // Position 2 cancels in the sum and must not be stored.
+    SparseVector<double> sum = Add(a, b, output());
+    SparseVector<double> difference = Subtract(a, b, output());
+    SparseVector<double> product = ElementwiseMultiply(a, b, output());
+    SparseVector<double> scaled = Scale(a, 2.0, output());
+    SparseVector<double> axpy = Axpy(2.0, a, b, output());
+
+    bool correct = sum.GetElements().GetCount() == 3 && sum.GetElement(0) == 1.0 && sum.GetElement(1) == 5.0 &&
+                   sum.GetElement(2) == 0.0 && sum.GetElement(4) == 4.0;
+    correct = correct && difference.GetElements().GetCount() == 4 && difference.GetElement(1) == -5.0 &&
+              difference.GetElement(2) == 4.0 && difference.GetElement(4) == 2.0;
+    correct = correct && product.GetElements().GetCount() == 2 && product.GetElement(2) == -4.0 &&
+              product.GetElement(4) == 3.0;
+    correct = correct && scaled.GetElements().GetCount() == 3 && scaled.GetElement(4) == 6.0;
+    correct = correct && axpy.GetElements().GetCount() == 4 && axpy.GetElement(0) == 2.0 &&
+              axpy.GetElement(1) == 5.0 && axpy.GetElement(2) == 2.0 && axpy.GetElement(4) == 7.0;
+    correct = correct && Scale(a, 0.0, output()).GetElements().GetCount() == 0;
+    if (!correct) {
+        std::cerr << "Error in element-wise vector operations." << std::endl;
+    } else {
+        std::cout << "Element-wise vector operations succeeded." << std::endl;
+    }
+
+    // Matrices, with the right operand in a hash table so mixed operands take the hash join.
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<> dis(0, 29);
+    std::uniform_int_distribution<> value_dis(-3, 3);
+    std::vector<KeyValue<IndexPair, double>> left_entries;
+    std::vector<KeyValue<IndexPair, double>> right_entries;
+    for (int i = 0; i < 300; ++i) {
+        left_entries.emplace_back(IndexPair(dis(gen), dis(gen)), value_dis(gen));
+        right_entries.emplace_back(IndexPair(dis(gen), dis(gen)), value_dis(gen));
+    }
+    UnqPtr<IDictionary<IndexPair, double>> left_dictionary(new MatrixDictionaryType());
+    SparseMatrix<double> left(30, 30, std::move(left_dictionary), left_entries.data(), left_entries.size());
+    for (int pass = 0; pass < 2; ++pass) {
+        UnqPtr<IDictionary<IndexPair, double>> right_dictionary;
+        if (pass == 0) {
+            right_dictionary = UnqPtr<IDictionary<IndexPair, double>>(new MatrixDictionaryType());
+        } else {
+            right_dictionary = UnqPtr<IDictionary<IndexPair, double>>(new HashTable<IndexPair, double>());
+        }
+        SparseMatrix<double> right(30, 30, std::move(right_dictionary), right_entries.data(), right_entries.size());
+        auto matrix_output = []() {
+            return UnqPtr<IDictionary<IndexPair, double>>(new MatrixDictionaryType());
+        };
+
+        SparseMatrix<double> matrix_sum = Add(left, right, matrix_output());
+        SparseMatrix<double> matrix_difference = Subtract(left, right, matrix_output());
+        SparseMatrix<double> matrix_product = ElementwiseMultiply(left, right, matrix_output());
+        SparseMatrix<double> matrix_axpy = Axpy(-0.5, left, right, matrix_output());
+        size_t sum_count = 0;
+        size_t product_count = 0;
+        for (int i = 0; i < 30; ++i) {
+            for (int j = 0; j < 30; ++j) {
+                double l = left.GetElement(i, j);
+                double r = right.GetElement(i, j);
+                sum_count += l + r != 0.0;
+                product_count += l * r != 0.0;
+                correct = correct && matrix_sum.GetElement(i, j) == l + r &&
+                          matrix_difference.GetElement(i, j) == l - r &&
+                          matrix_product.GetElement(i, j) == l * r &&
+                          matrix_axpy.GetElement(i, j) == -0.5 * l + r;
+            }
+        }
+        correct = correct && matrix_sum.GetElements().GetCount() == sum_count &&
+                  matrix_product.GetElements().GetCount() == product_count;
+    }
+    if (!correct) {
+        std::cerr << "Error in element-wise matrix operations." << std::endl;
+    } else {
+        std::cout << "Element-wise matrix operations succeeded." << std::endl;
+    }
+}
+
+template <typename DictionaryType>
+void test_sparse_blas(const std::string& dictionary_name) {
+    std::cout << "Testing dot products and norms with " << dictionary_name << "..." << std::endl;
+    std::vector<double> dense_a = {0.0, 3.0, 0.0, 4.0, 0.0, 1.0};
+    std::vector<double> dense_b = {2.0, 5.0, 0.0, 0.0, 7.0, 2.0};
+    SparseVector<double> a = Gather(dense_a, UnqPtr<IDictionary<int, double>>(new DictionaryType()));
+    SparseVector<double> b = Gather(dense_b, UnqPtr<IDictionary<int, double>>(new DictionaryType()));
+
+    std::vector<double> scattered(6, 0.0);
+    Scatter(a, scattered);
+    bool correct = a.GetElements().GetCount() == 3 && scattered == dense_a;
+    correct = correct && Dot(a, b) == 17.0 && Dot(a, dense_b) == 17.0 && Norm2(a) == std::sqrt(26.0);
+    if (!correct) {
+        std::cerr << "Error in sparse BLAS kernels: wrong result on a small vector." << std::endl;
+    } else {
+        std::cout << "Small dot product, norm, gather and scatter succeeded." << std::endl;
+    }
+
+    // Random vectors of similar and of very different sizes, against the dense dot product.
+    std::mt19937 gen(13);
+    int length = 20000;
+    std::uniform_int_distribution<> dis(0, length - 1);
+    std::uniform_int_distribution<> value_dis(1, 9);
+    for (int left_count : {10, 3000}) {
+        std::vector<double> left_dense(length, 0.0);
+        std::vector<double> right_dense(length, 0.0);
+        for (int n = 0; n < left_count; ++n) {
+            left_dense[dis(gen)] = value_dis(gen);
+        }
+        for (int n = 0; n < 3000; ++n) {
+            right_dense[dis(gen)] = value_dis(gen);
+        }
+        double expected = 0.0;
+        for (int i = 0; i < length; ++i) {
+            expected += left_dense[i] * right_dense[i];
+        }
+        SparseVector<double> left = Gather(left_dense, UnqPtr<IDictionary<int, double>>(new DictionaryType()));
+        SparseVector<double> right = Gather(right_dense, UnqPtr<IDictionary<int, double>>(new DictionaryType()));
+        correct = correct && Dot(left, right) == expected && Dot(right, left) == expected &&
+                  Dot(left, right_dense) == expected;
+    }
+    if (!correct) {
+        std::cerr << "Error in sparse BLAS kernels: dot product differs from the dense one." << std::endl;
+    } else {
+        std::cout << "Dot products of random vectors succeeded." << std::endl;
+    }
+}
+
+template <typename DictionaryType>
+void test_parallel_traversal(const std::string& dictionary_name) {
+    std::cout << "Testing parallel traversal with " << dictionary_name << "..." << std::endl;
+    // 67500 entries, enough for four threads of kTraversalMinEntriesPerThread each, so the
+    // traversals below really split the dictionary instead of falling back to one thread.
+    int size = 450;
+    std::vector<KeyValue<IndexPair, double>> entries;
+    for (int i = 0; i < size; ++i) {
+        for (int j = i % 3; j < size; j += 3) {
+            entries.emplace_back(IndexPair(i, j), 1.0 / (1 + i + j));
+        }
+    }
+    DictionaryType* dictionary = new DictionaryType();
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(dictionary), entries.data(),
+                                entries.size(), true);
+    IDictionary<IndexPair, double>& elements = *dictionary;
+    bool correct = ResolveThreadCount(4, elements.GetCount(), kTraversalMinEntriesPerThread) == 4;
+
+    // The parts of a split are disjoint, in iteration order, and cover every entry, both
+    // for reading and for visiting the values in place; every part but the degenerate
+    // ones of a 64-way split holds entries.
+    std::vector<IndexPair> expected;
+    auto all = elements.GetIterator();
+    while (all->MoveNext()) {
+        expected.push_back(all->GetCurrentKey());
+    }
+    for (int parts : {1, 3, 8, 64}) {
+        std::vector<IndexPair> keys;
+        std::vector<IndexPair> visited;
+        int nonEmpty = 0;
+        for (int part = 0; part < parts; ++part) {
+            size_t before = keys.size();
+            auto iterator = elements.GetPartIterator(part, parts);
+            while (iterator->MoveNext()) {
+                keys.push_back(iterator->GetCurrentKey());
+            }
+            nonEmpty += keys.size() > before;
+            ForEachMutable(elements, [&visited](const IndexPair& key, double&) { visited.push_back(key); }, part,
+                           parts);
+        }
+        correct = correct && keys == expected && visited == expected && (parts == 64 || nonEmpty == parts);
+    }
+    if (!correct) {
+        std::cerr << "Error in GetPartIterator: the parts do not cover the dictionary." << std::endl;
+    } else {
+        std::cout << "Part iterators succeeded." << std::endl;
+    }
+
+    std::atomic<int> visited(0);
+    matrix.ParallelForEach([&visited](const IndexPair&, const double&) { ++visited; }, 4);
+    auto add = [](double acc, double x) { return acc + x; };
+    double single = matrix.ParallelReduce(add, 0.0, 1, true);
+    bool same = true;
+    for (int threads : {2, 3, 4}) {
+        double sum = matrix.ParallelReduce(add, 0.0, threads, true);
+        same = same && std::memcmp(&sum, &single, sizeof(double)) == 0;
+    }
+    double serial = matrix.Reduce(add, 0.0);
+    if (visited != static_cast<int>(entries.size()) || !same || std::fabs(single - serial) > 1e-9) {
+        std::cerr << "Error in ParallelForEach/ParallelReduce: visited " << visited << ", sum " << single
+                  << " against " << serial << std::endl;
+    } else {
+        std::cout << "ParallelForEach and deterministic ParallelReduce succeeded, sum: " << single << std::endl;
+    }
+
+    matrix.ParallelMap([](double x) { return x < 0.01 ? 0.0 : x * 2; }, 4);
+    size_t kept = 0;
+    correct = true;
+    for (const KeyValue<IndexPair, double>& entry : entries) {
+        double expected = entry.value < 0.01 ? 0.0 : entry.value * 2;
+        kept += expected != 0.0;
+        correct = correct && matrix.GetElement(entry.key.row, entry.key.column) == expected;
+    }
+    if (!correct || elements.GetCount() != kept) {
+        std::cerr << "Error in ParallelMap: " << elements.GetCount() << " entries, expected " << kept << std::endl;
+    } else {
+        std::cout << "ParallelMap succeeded, " << kept << " entries left" << std::endl;
+    }
+}
+
+// Positions every cursor of an ordered dictionary at the edges: an empty tree, keys before
+// the first and past the last, exact keys, keys between two stored ones, a gap left by
+// removals, empty and inverted ranges, and ranges spanning many leaves. Each result is
+// compared with std::map's lower_bound and upper_bound over the same keys.
+template <typename DictionaryType>
+void test_ordered_bounds(const std::string& dictionary_name) {
+    std::cout << "Testing ordered bounds with " << dictionary_name << "..." << std::endl;
+    DictionaryType tree;
+    std::map<int, int> expected;
+
+    auto matches = [&expected](IDictionaryIterator<int, int>& iterator, std::map<int, int>::const_iterator first,
+                               std::map<int, int>::const_iterator last) {
+        for (int pass = 0; pass < 2; ++pass) {
+            auto entry = first;
+            while (iterator.MoveNext()) {
+                if (entry == last || iterator.GetCurrentKey() != entry->first ||
+                    iterator.GetCurrentValue() != entry->second) {
+                    return false;
+                }
+                ++entry;
+            }
+            if (entry != last || iterator.MoveNext()) {
+                return false;
+            }
+            iterator.Reset();
+        }
+        return true;
+    };
+    auto check = [&](int lo, int hi) {
+        auto first = expected.lower_bound(lo);
+        auto last = hi < lo ? first : expected.lower_bound(hi);
+        return matches(*tree.LowerBound(lo), first, expected.end()) &&
+               matches(*tree.UpperBound(lo), expected.upper_bound(lo), expected.end()) &&
+               matches(*tree.GetRange(lo, hi), first, last);
+    };
+
+    bool correct = check(0, 10) && check(-5, 5);
+
+    // Even keys 0..5998, with the gap [2000, 2400) removed.
+    for (int key = 0; key < 6000; key += 2) {
+        tree.Add(key, 3 * key);
+        expected[key] = 3 * key;
+    }
+    for (int key = 2000; key < 2400; key += 2) {
+        tree.Remove(key);
+        expected.erase(key);
+    }
+
+    const int queries[][2] = {
+            {-10, -1}, {-10, 0}, {-10, 1}, {0, 0}, {0, 1}, {1, 3}, {3, 3}, {7, 5},
+            {101, 4001}, {-1, 100000}, {1998, 2001}, {2001, 2399}, {2100, 2500}, {2399, 2401},
+            {5998, 5999}, {5997, 100000}, {5999, 100000}, {100000, 200000}};
+    for (const auto& query : queries) {
+        correct = correct && check(query[0], query[1]);
+    }
+
+    if (!correct) {
+        std::cerr << "Error in " << dictionary_name << " bounds: LowerBound, UpperBound or GetRange disagreed "
+                  << "with std::map." << std::endl;
+    } else {
+        std::cout << "LowerBound, UpperBound and GetRange matched std::map at every boundary." << std::endl;
+    }
+}
+
+// Regressions for two removal bugs. With minimum degree 2, inserting 1..4 leaves 2 in the
+// root over [1] and [3, 4], so removing 2 takes its successor; inserting 4..1 leaves 3 over
+// [1, 2] and [4], so removing 3 takes its predecessor. Each neighbour must keep its own
+// value. Removing the last root key then merges the two leaves and collapses the root.
+void test_btree_removal() {
+    std::cout << "Testing BTree removal through inner nodes..." << std::endl;
+    BTree<int, int> successorTree(2);
+    for (int key = 1; key <= 4; ++key) {
+        successorTree.Add(key, 10 * key);
+    }
+    successorTree.Remove(2);
+    BTree<int, int> predecessorTree(2);
+    for (int key = 4; key >= 1; --key) {
+        predecessorTree.Add(key, 10 * key);
+    }
+    predecessorTree.Remove(3);
+    bool neighbours = successorTree.Get(3) == 30 && successorTree.Get(4) == 40 &&
+                      predecessorTree.Get(2) == 20 && predecessorTree.Get(1) == 10;
+
+    predecessorTree.Remove(2);
+    predecessorTree.Add(5, 50);
+    bool collapsed = predecessorTree.GetCount() == 3 && predecessorTree.Get(1) == 10 &&
+                     predecessorTree.Get(4) == 40 && predecessorTree.Get(5) == 50;
+
+    // Every key is removed in a shuffled order, so both cases recur at every height, in
+    // runtime-order nodes and in inline ones.
+    auto removeShuffled = [](auto& tree) {
+        std::map<int, int> expected;
+        std::vector<int> keys(500);
+        for (int key = 0; key < 500; ++key) {
+            keys[key] = key;
+            tree.Add(key, 10 * key);
+            expected[key] = 10 * key;
+        }
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+        bool correct = true;
+        for (size_t i = 0; i < keys.size() && correct; ++i) {
+            tree.Remove(keys[i]);
+            expected.erase(keys[i]);
+            if (i % 25 == 0 || expected.size() < 10) {
+                for (const auto& entry : expected) {
+                    int value = 0;
+                    correct = correct && tree.TryGet(entry.first, value) && value == entry.second;
+                }
+            }
+        }
+        return correct && tree.GetCount() == 0 && !tree.ContainsKey(keys[0]);
+    };
+    BTree<int, int> tree(2);
+    BTree<int, int, 2> inlineTree;
+    bool shuffled = removeShuffled(tree) && removeShuffled(inlineTree);
+
+    if (!neighbours || !collapsed || !shuffled) {
+        std::cerr << "Error in BTree removal: a replacement key lost its value or the root collapse "
+                  << "broke the tree." << std::endl;
+    } else {
+        std::cout << "Removal through predecessors, successors and root collapses succeeded." << std::endl;
+    }
+}
+
+// Random inserts and removals against a std::map at the two smallest orders, so leaves and
+// inner nodes split, borrow from both siblings and merge at every height, followed by
+// removing every key so the tree shrinks back to an empty root.
+void test_bplus_tree() {
+    std::cout << "Testing BPlusTree splits, borrows and merges..." << std::endl;
+    bool correct = true;
+    for (int order = 2; order <= 3 && correct; ++order) {
+        BPlusTree<int, int> tree(order);
+        std::map<int, int> expected;
+        std::mt19937 random(order);
+        std::uniform_int_distribution<int> keys(0, 1999);
+        for (int step = 0; step < 20000 && correct; ++step) {
+            int key = keys(random);
+            // Inserts outweigh removals for the first half and removals the second.
+            if (static_cast<int>(random() % 10) < (step < 10000 ? 7 : 3)) {
+                correct = tree.Upsert(key, step) == (expected.count(key) == 0);
+                expected[key] = step;
+            } else {
+                correct = tree.TryRemove(key) == (expected.erase(key) > 0);
+            }
+
+            if (step % 500 == 0) {
+                auto iterator = tree.GetIterator();
+                auto entry = expected.begin();
+                while (correct && iterator->MoveNext()) {
+                    correct = entry != expected.end() && iterator->GetCurrentKey() == entry->first &&
+                              iterator->GetCurrentValue() == entry->second;
+                    ++entry;
+                }
+                correct = correct && entry == expected.end() && tree.GetCount() == expected.size();
+            }
+        }
+
+        for (int key = 0; key < 2000 && correct; ++key) {
+            int value = 0;
+            auto entry = expected.find(key);
+            correct = tree.TryGet(key, value) == (entry != expected.end()) &&
+                      (entry == expected.end() || value == entry->second);
+        }
+        for (int key = 0; key < 2000 && correct; ++key) {
+            correct = tree.TryRemove(key) == (expected.erase(key) > 0);
+        }
+        correct = correct && tree.GetCount() == 0 && !tree.GetIterator()->MoveNext();
+    }
+
+    if (!correct) {
+        std::cerr << "Error in BPlusTree: random inserts and removals disagreed with std::map." << std::endl;
+    } else {
+        std::cout << "BPlusTree matched std::map through 20000 random inserts and removals." << std::endl;
+    }
+}
+
+void test_incremental_rehash() {
+    std::cout << "Testing HashTable incremental rehashing..." << std::endl;
+    HashTable<int, int> table(4, true);
+    std::map<int, int> expected;
+
+    // Every call made while the old table is still being drained is checked against a
+    // std::map: lookups of moved and unmoved keys, removals, updates and a full iteration.
+    size_t resizes = 0;
+    size_t rehashingChecks = 0;
+    size_t capacity = table.GetCapacity();
+    bool correct = true;
+    for (int i = 0; i < 3000 && correct; ++i) {
+        table.Add(i, 3 * i);
+        expected[i] = 3 * i;
+        if (table.GetCapacity() != capacity) {
+            capacity = table.GetCapacity();
+            ++resizes;
+        }
+        if (!table.IsRehashing()) {
+            continue;
+        }
+
+        ++rehashingChecks;
+        int victim = i / 2;
+        correct = correct && table.TryRemove(victim) == (expected.erase(victim) > 0);
+        int updated = i / 3;
+        if (expected.count(updated)) {
+            table.Update(updated, -updated);
+            expected[updated] = -updated;
+        }
+        correct = correct && table.GetCount() == expected.size() && !table.ContainsKey(-1);
+        for (int key = 0; key <= i && correct; ++key) {
+            auto entry = expected.find(key);
+            int value = 0;
+            bool found = table.TryGet(key, value);
+            correct = found == (entry != expected.end()) && (!found || value == entry->second);
+        }
+
+        std::set<int> seen;
+        auto iterator = table.GetIterator();
+        while (correct && iterator->MoveNext()) {
+            int key = iterator->GetCurrentKey();
+            auto entry = expected.find(key);
+            correct = entry != expected.end() && entry->second == iterator->GetCurrentValue() &&
+                      seen.insert(key).second;
+        }
+        correct = correct && seen.size() == expected.size();
+    }
+
+    if (!correct || resizes < 5 || rehashingChecks == 0) {
+        std::cerr << "Error in HashTable incremental rehash: lookups, removals or iteration disagreed with "
+                  << "std::map after " << resizes << " resizes." << std::endl;
+    } else {
+        std::cout << "Incremental rehash succeeded through " << resizes << " resizes, "
+                  << rehashingChecks << " checks while rehashing." << std::endl;
+    }
+}
+
+void test_thread_pool() {
+    std::cout << "Testing ThreadPool..." << std::endl;
+    ThreadPool pool(3);
+
+    // Every index is visited once, including from a ParallelFor nested inside a task.
+    std::vector<std::atomic<int>> visits(100000);
+    pool.ParallelFor(0, visits.size(), 1000, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            ++visits[i];
+        }
+    });
+    std::future<long long> nested = pool.Submit([&pool]() {
+        std::atomic<long long> sum(0);
+        pool.ParallelFor(0, 1000, 10, [&sum](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                sum += static_cast<long long>(i);
+            }
+        });
+        return sum.load();
+    });
+    bool correct = nested.get() == 999LL * 1000 / 2;
+    for (const std::atomic<int>& count : visits) {
+        correct = correct && count == 1;
+    }
+    if (!correct) {
+        std::cerr << "Error in ThreadPool::ParallelFor: wrong coverage or sum." << std::endl;
+    } else {
+        std::cout << "ParallelFor and Submit succeeded." << std::endl;
+    }
+
+    bool thrown = false;
+    std::atomic<int> finished(0);
+    try {
+        TaskGroup group(pool);
+        for (int i = 0; i < 8; ++i) {
+            group.Run([i, &finished]() {
+                if (i == 5) {
+                    throw std::runtime_error("task failed");
+                }
+                ++finished;
+            });
+        }
+        group.Wait();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    if (!thrown || finished != 7) {
+        std::cerr << "Error in TaskGroup: the exception was not rethrown or tasks were lost." << std::endl;
+    } else {
+        std::cout << "TaskGroup rethrew the task's exception after the others finished." << std::endl;
+    }
+}
+
+void test_sharded_hash_table() {
+    std::cout << "Testing ShardedHashTable with concurrent writers..." << std::endl;
+    int size = 200;
+    int writers = 4;
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+            new ShardedHashTable<IndexPair, double>(8, 4)));
+
+    // The writers' rows are disjoint but their keys share every shard. Each writer fills
+    // its rows, clears their diagonal, then iterates a snapshot while the others write.
+    ThreadPool pool(writers);
+    TaskGroup group(pool);
+    std::atomic<bool> torn(false);
+    for (int writer = 0; writer < writers; ++writer) {
+        group.Run([&matrix, &torn, writer, writers, size]() {
+            for (int i = writer; i < size; i += writers) {
+                for (int j = 0; j < size; ++j) {
+                    matrix.SetElement(i, j, 1.0 + i + j);
+                }
+            }
+            for (int i = writer; i < size; i += writers) {
+                matrix.SetElement(i, i, 0.0);
+            }
+            auto iterator = matrix.GetIterator();
+            while (iterator->MoveNext()) {
+                IndexPair key = iterator->GetCurrentKey();
+                if (iterator->GetCurrentValue() != 1.0 + key.row + key.column) {
+                    torn = true;
+                }
+            }
+        });
+    }
+    group.Wait();
+
+    bool correct = !torn && matrix.GetElements().GetCount() == static_cast<size_t>(size * size - size);
+    for (int i = 0; i < size && correct; ++i) {
+        for (int j = 0; j < size; ++j) {
+            correct = correct && matrix.GetElement(i, j) == (i == j ? 0.0 : 1.0 + i + j);
+        }
+    }
+    if (!correct) {
+        std::cerr << "Error in ShardedHashTable: concurrent writes were lost or torn." << std::endl;
+    } else {
+        std::cout << "Concurrent SetElement from " << writers << " writers succeeded, "
+                  << matrix.GetElements().GetCount() << " entries." << std::endl;
+    }
+}
+
+void test_concurrent_btree() {
+    std::cout << "Testing ConcurrentBTree with concurrent readers and writers..." << std::endl;
+    int size = 200;
+    int writers = 2;
+    int readers = 4;
+    ConcurrentBTree<IndexPair, double> tree;
+
+    // The even rows are loaded up front and stay; the writers fill the odd rows and then
+    // remove their diagonal, while the readers look up the even rows and scan the tree.
+    for (int i = 0; i < size; i += 2) {
+        for (int j = 0; j < size; ++j) {
+            tree.Add(IndexPair(i, j), 1.0 + i + j);
+        }
+    }
+
+    ThreadPool pool(writers + readers);
+    TaskGroup group(pool);
+    std::atomic<bool> wrong(false);
+    for (int writer = 0; writer < writers; ++writer) {
+        group.Run([&tree, writer, writers, size]() {
+            for (int i = 1 + 2 * writer; i < size; i += 2 * writers) {
+                for (int j = size - 1; j >= 0; --j) {
+                    tree.Upsert(IndexPair(i, j), 1.0 + i + j);
+                }
+            }
+            for (int i = 1 + 2 * writer; i < size; i += 2 * writers) {
+                tree.Remove(IndexPair(i, i));
+            }
+        });
+    }
+    for (int reader = 0; reader < readers; ++reader) {
+        group.Run([&tree, &wrong, reader, size]() {
+            for (int round = 0; round < 3; ++round) {
+                for (int i = 0; i < size; i += 2) {
+                    int j = (i * 7 + reader + round) % size;
+                    double value = 0.0;
+                    if (!tree.TryGet(IndexPair(i, j), value) || value != 1.0 + i + j) {
+                        wrong = true;
+                    }
+                }
+                // Keys come out ascending and every even row is seen whole.
+                size_t evenEntries = 0;
+                bool first = true;
+                IndexPair previous(0, 0);
+                auto iterator = tree.GetIterator();
+                while (iterator->MoveNext()) {
+                    IndexPair key = iterator->GetCurrentKey();
+                    if ((!first && !(previous < key)) || iterator->GetCurrentValue() != 1.0 + key.row + key.column) {
+                        wrong = true;
+                    }
+                    evenEntries += key.row % 2 == 0;
+                    previous = key;
+                    first = false;
+                }
+                if (evenEntries != static_cast<size_t>(size / 2 * size)) {
+                    wrong = true;
+                }
+            }
+        });
+    }
+    group.Wait();
+
+    bool correct = !wrong && tree.GetCount() == static_cast<size_t>(size * size - size / 2);
+    for (int i = 0; i < size && correct; ++i) {
+        for (int j = 0; j < size; ++j) {
+            double value = 0.0;
+            bool found = tree.TryGet(IndexPair(i, j), value);
+            correct = correct && (i % 2 == 1 && i == j ? !found : found && value == 1.0 + i + j);
+        }
+    }
+    size_t inRange = 0;
+    auto range = tree.GetRange(IndexPair(10, 5), IndexPair(12, 0));
+    while (range->MoveNext()) {
+        ++inRange;
+    }
+    correct = correct && inRange == static_cast<size_t>(size - 5 + size - 1);
+    if (!correct) {
+        std::cerr << "Error in ConcurrentBTree: a read saw a missing, torn or unordered entry." << std::endl;
+    } else {
+        std::cout << "Concurrent reads alongside " << writers << " writers succeeded, height "
+                  << tree.GetHeight() << ", " << tree.GetCount() << " entries." << std::endl;
+    }
+}
+
+void test_persistent_btree() {
+    std::cout << "Testing PersistentBTree snapshots..." << std::endl;
+    int size = 120;
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+            new PersistentBTree<IndexPair, double, 3>()));
+    for (int i = 0; i < size; ++i) {
+        for (int j = i % 2; j < size; j += 2) {
+            matrix.SetElement(i, j, 1.0);
+        }
+    }
+    size_t entries = matrix.GetElements().GetCount();
+
+    // The snapshot keeps its values through overwrites, removals and inserts that split
+    // and merge the nodes it shares with the matrix.
+    SparseMatrix<double> snapshot = matrix.Snapshot();
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            matrix.SetElement(i, j, (i + j) % 3 == 0 ? 0.0 : 2.0);
+        }
+    }
+    auto add = [](double acc, double x) { return acc + x; };
+    bool correct = snapshot.GetElements().GetCount() == entries &&
+                   snapshot.Reduce(add, 0.0) == static_cast<double>(entries);
+    for (int i = 0; i < size && correct; ++i) {
+        for (int j = 0; j < size; ++j) {
+            correct = correct && snapshot.GetElement(i, j) == ((i + j) % 2 == 0 ? 1.0 : 0.0) &&
+                      matrix.GetElement(i, j) == ((i + j) % 3 == 0 ? 0.0 : 2.0);
+        }
+    }
+    if (!correct) {
+        std::cerr << "Error in PersistentBTree: a write showed through the snapshot." << std::endl;
+    } else {
+        std::cout << "Snapshot kept " << entries << " entries while the matrix was rewritten." << std::endl;
+    }
+
+    // A reader reduces snapshots of a matrix of ones while the writer keeps filling it;
+    // each snapshot must sum to its own entry count.
+    SparseMatrix<double> ingest(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+            new PersistentBTree<IndexPair, double, 3>()));
+    ThreadPool pool(1);
+    std::atomic<bool> writing(true);
+    std::atomic<int> snapshots(0);
+    std::set<IndexPair> removed;
+    std::future<bool> reader = pool.Submit([&]() {
+        bool consistent = true;
+        while (writing || snapshots == 0) {
+            SparseMatrix<double> view = ingest.Snapshot();
+            double sum = view.ParallelReduce(add, 0.0, 2, true);
+            consistent = consistent && sum == static_cast<double>(view.GetElements().GetCount());
+            ++snapshots;
+        }
+        return consistent;
+    });
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            ingest.SetElement(i, j, 1.0);
+        }
+        if (i % 10 == 0) {
+            ingest.SetElement(i / 2, i / 3, 0.0);
+            removed.insert(IndexPair(i / 2, i / 3));
+        }
+    }
+    writing = false;
+    bool consistent = reader.get();
+    if (!consistent || ingest.GetElements().GetCount() != static_cast<size_t>(size * size) - removed.size()) {
+        std::cerr << "Error in PersistentBTree: a snapshot taken during writes was inconsistent." << std::endl;
+    } else {
+        std::cout << snapshots << " snapshots reduced consistently during " << size * size << " writes." << std::endl;
+    }
+
+    // Map rewrites the whole tree, but a reader that takes a snapshot in the middle of it
+    // gets the old version at once instead of waiting for the traversal to end.
+    double before = ingest.Reduce(add, 0.0);
+    std::future<double> during;
+    bool waited = false;
+    ingest.Map([&](double x) {
+        if (!during.valid()) {
+            during = pool.Submit([&]() { return ingest.Snapshot().Reduce(add, 0.0); });
+            waited = during.wait_for(std::chrono::seconds(5)) != std::future_status::ready;
+        }
+        return x * 3.0;
+    });
+    if (waited || during.get() != before || ingest.Reduce(add, 0.0) != 3.0 * before) {
+        std::cerr << "Error in PersistentBTree: a snapshot waited for Map or saw its changes." << std::endl;
+    } else {
+        std::cout << "A snapshot taken during Map read the old version without waiting." << std::endl;
+    }
+}
+
+void test_buffered_btree() {
+    std::cout << "Testing BufferedBTree with pending writes..." << std::endl;
+    BufferedBTree<int, int> tree;
+    std::map<int, int> expected;
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<> dis(0, 49999);
+
+    // Lookups between the writes must see what is still sitting in the buffers: blind
+    // Adds, overwrites and removals alike.
+    bool correct = true;
+    size_t mostPending = 0;
+    for (int n = 0; n < 200000; ++n) {
+        int key = dis(gen);
+        if (n % 10 == 4) {
+            correct = correct && tree.TryRemove(key) == (expected.erase(key) == 1);
+        } else if (n % 10 == 9) {
+            tree.Discard(key);
+            expected.erase(key);
+        } else {
+            tree.Add(key, n);
+            expected[key] = n;
+        }
+        mostPending = std::max(mostPending, tree.GetPendingCount());
+        int probe = dis(gen);
+        int value = -1;
+        auto found = expected.find(probe);
+        correct = correct && tree.TryGet(probe, value) == (found != expected.end()) &&
+                  (found == expected.end() || value == found->second);
+    }
+
+    correct = correct && mostPending > 0 && tree.GetCount() == expected.size() && tree.GetPendingCount() == 0;
+    auto iterator = tree.GetIterator();
+    auto next = expected.begin();
+    while (correct && iterator->MoveNext()) {
+        correct = next != expected.end() && iterator->GetCurrentKey() == next->first &&
+                  iterator->GetCurrentValue() == next->second;
+        ++next;
+    }
+    correct = correct && next == expected.end();
+
+    tree.Add(20000, -1);
+    expected[20000] = -1;
+    auto range = tree.GetRange(19990, 20010);
+    auto inRange = expected.lower_bound(19990);
+    while (correct && range->MoveNext()) {
+        correct = inRange != expected.end() && range->GetCurrentKey() == inRange->first &&
+                  range->GetCurrentValue() == inRange->second;
+        ++inRange;
+    }
+    correct = correct && (inRange == expected.end() || inRange->first >= 20010);
+
+    // Const calls from several threads while writes are pending: one of them flushes, the
+    // others wait for it or read through the buffers under the same lock.
+    for (int key = 0; key < 50000; key += 7) {
+        tree.Add(key, -key);
+        expected[key] = -key;
+    }
+    correct = correct && tree.GetPendingCount() > 0;
+    ThreadPool pool(4);
+    TaskGroup group(pool);
+    std::atomic<bool> wrong(false);
+    for (int reader = 0; reader < 4; ++reader) {
+        group.Run([&tree, &expected, &wrong, reader]() {
+            for (int key = reader; key < 50000; key += 13) {
+                int value = 0;
+                auto found = expected.find(key);
+                if (tree.TryGet(key, value) != (found != expected.end()) ||
+                    (found != expected.end() && value != found->second)) {
+                    wrong = true;
+                }
+                if (key % 1000 == reader && tree.GetCount() != expected.size()) {
+                    wrong = true;
+                }
+            }
+            size_t seen = 0;
+            auto all = tree.GetIterator();
+            while (all->MoveNext()) {
+                ++seen;
+            }
+            if (seen != expected.size()) {
+                wrong = true;
+            }
+        });
+    }
+    group.Wait();
+    correct = correct && !wrong && tree.GetPendingCount() == 0;
+    if (!correct) {
+        std::cerr << "Error in BufferedBTree: a pending write was lost or read wrong." << std::endl;
+    } else {
+        std::cout << "Buffered writes read back correctly, up to " << mostPending << " writes buffered, "
+                  << tree.GetCount() << " entries." << std::endl;
+    }
+}
+
+void test_paged_btree() {
+    std::cout << "Testing PagedBTree persistence..." << std::endl;
+    const char* path = "paged_btree_test.pages";
+    std::remove(path);
+    int size = 300;
+
+    // The matrix is written, closed, and opened again from the file: the second matrix
+    // must see the same elements without having them added again.
+    size_t entries = 0;
+    {
+        SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+                new PagedBTree<IndexPair, double>(path)));
+        for (int i = 0; i < size; ++i) {
+            for (int j = i % 3; j < size; j += 3) {
+                matrix.SetElement(i, j, 1.0 + i * size + j);
+            }
+            matrix.SetElement(i, i % 3, 0.0);
+        }
+        entries = matrix.GetElements().GetCount();
+    }
+
+    bool correct = true;
+    size_t pages = 0;
+    {
+        PagedBTree<IndexPair, double>* tree = new PagedBTree<IndexPair, double>(path);
+        pages = tree->GetStore().GetPageCount();
+        SparseMatrix<double> reopened(size, size, UnqPtr<IDictionary<IndexPair, double>>(tree));
+        correct = reopened.GetElements().GetCount() == entries;
+        for (int i = 0; i < size && correct; ++i) {
+            for (int j = 0; j < size; ++j) {
+                double expected = (j - i) % 3 == 0 && j != i % 3 ? 1.0 + i * size + j : 0.0;
+                correct = correct && reopened.GetElement(i, j) == expected;
+            }
+        }
+
+        // Rows come back ordered, and removing every entry frees the pages for reuse.
+        auto row = reopened.GetRowIterator(7);
+        int previous = -1;
+        while (correct && row->MoveNext()) {
+            correct = row->GetCurrentKey().row == 7 && row->GetCurrentKey().column > previous;
+            previous = row->GetCurrentKey().column;
+        }
+        for (int i = 0; i < size; ++i) {
+            for (int j = 0; j < size; ++j) {
+                reopened.RemoveElement(i, j);
+            }
+        }
+        for (int i = 0; i < size; ++i) {
+            for (int j = i % 3; j < size; j += 3) {
+                reopened.SetElement(i, j, 1.0);
+            }
+        }
+        correct = correct && tree->GetStore().GetPageCount() <= 2 * pages;
+    }
+    std::remove(path);
+
+    // A store given a small address range grows to it and then refuses more pages; what
+    // was added before stays readable.
+    int added = 0;
+    {
+        PagedBTree<int, int> bounded(UnqPtr<MappedPageStore>(new MappedPageStore(64 * MappedPageStore::kPageSize)));
+        bool full = false;
+        try {
+            for (; added < 1000000; ++added) {
+                bounded.Add(added, -added);
+            }
+        } catch (const std::runtime_error&) {
+            full = true;
+        }
+        correct = correct && full && added > 0 && bounded.GetStore().GetPageCount() <= 64;
+        for (int key = 0; key < added && correct; ++key) {
+            int value = 0;
+            correct = bounded.TryGet(key, value) && value == -key;
+        }
+    }
+
+    if (!correct) {
+        std::cerr << "Error in PagedBTree: the reopened file did not hold the written matrix." << std::endl;
+    } else {
+        std::cout << "Reopened " << entries << " entries from " << pages << " pages without a rebuild; "
+                  << added << " entries filled a 64-page store." << std::endl;
+    }
+}
+
+void test_buffer_pool() {
+    std::cout << "Testing PagedBTree over a BufferPool smaller than the matrix..." << std::endl;
+    int size = 300;
+    size_t frames = 32;
+    BufferPool* pool = new BufferPool(frames * BufferPool::kPageSize);
+    SparseMatrix<double> matrix(size, size, UnqPtr<IDictionary<IndexPair, double>>(
+            new PagedBTree<IndexPair, double, BufferPool>(UnqPtr<BufferPool>(pool))));
+
+    // The nonzeros take several times the budget, so pages keep being evicted, written to
+    // the spill file and read back while the matrix is filled, read and rewritten.
+    for (int i = 0; i < size; ++i) {
+        int row = (i * 37) % size;
+        for (int j = row % 2; j < size; j += 2) {
+            matrix.SetElement(row, j, 1.0 + j);
+        }
+    }
+    matrix.Map([](double x) { return x * 2.0; });
+
+    bool correct = pool->GetPageCount() > 4 * frames && pool->GetFrameCount() == frames;
+    double expectedSum = 0.0;
+    for (int i = 0; i < size && correct; ++i) {
+        for (int j = 0; j < size; ++j) {
+            double expected = (i + j) % 2 == 0 ? 2.0 + 2.0 * j : 0.0;
+            expectedSum += expected;
+            correct = correct && matrix.GetElement(i, j) == expected;
+        }
+    }
+    correct = correct && matrix.Reduce([](double acc, double x) { return acc + x; }, 0.0) == expectedSum;
+    correct = correct && pool->GetEvictions() > 0 && pool->GetWriteBacks() > 0 && pool->GetMisses() > 0;
+
+    // Parallel SpMV reads the rows through range iterators on several threads at once, so
+    // pins, misses and evictions of one pool come from all of them together.
+    int wide = 600;
+    BufferPool* shared = new BufferPool(frames * BufferPool::kPageSize);
+    SparseMatrix<double> ones(wide, wide, UnqPtr<IDictionary<IndexPair, double>>(
+            new PagedBTree<IndexPair, double, BufferPool>(UnqPtr<BufferPool>(shared))));
+    for (int i = 0; i < wide; ++i) {
+        for (int j = i % 2; j < wide; j += 2) {
+            ones.SetElement(i, j, 1.0);
+        }
+    }
+    size_t missesBefore = shared->GetMisses();
+    std::vector<double> sums = Multiply(ones, std::vector<double>(wide, 1.0), 8);
+    for (int i = 0; i < wide && correct; ++i) {
+        correct = sums[i] == wide / 2;
+    }
+    correct = correct && shared->GetMisses() > missesBefore && shared->GetPageCount() > 4 * frames;
+
+    // Reads pin pages for reading only, so once everything is written back they never
+    // write to the spill file again, however many pages they evict.
+    shared->Sync();
+    size_t writeBacksBefore = shared->GetWriteBacks();
+    size_t evictionsBefore = shared->GetEvictions();
+    const IDictionary<IndexPair, double>& read = ones.GetElements();
+    for (int i = 0; i < wide && correct; ++i) {
+        int j = (i * 7) % wide;
+        const double* pointer = read.FindPtr(IndexPair(i, j));
+        double value = 0.0;
+        bool found = read.TryGet(IndexPair((i * 13) % wide, j), value);
+        correct = (pointer != nullptr) == ((i + j) % 2 == 0) && (!pointer || *pointer == 1.0) &&
+                  found == (((i * 13) % wide + j) % 2 == 0);
+    }
+    correct = correct && shared->GetEvictions() > evictionsBefore && shared->GetWriteBacks() == writeBacksBefore;
+    if (!correct) {
+        std::cerr << "Error in BufferPool: a page came back wrong from the spill file." << std::endl;
+    } else {
+        std::cout << pool->GetPageCount() << " pages through " << frames << " frames: " << pool->GetHits()
+                  << " hits, " << pool->GetMisses() << " misses, " << pool->GetEvictions() << " evictions, "
+                  << pool->GetWriteBacks() << " write-backs." << std::endl;
+    }
+}
+
 template<typename Func>
 long long measure_time(Func func) {
     auto start = std::chrono::high_resolution_clock::now();
@@ -411,9 +1831,13 @@ void performance_tests() {
         if (i % 2 == 0) {
             performance_test_vector<HashTable<int, double>>(size, "HashTable", log_file);
             performance_test_vector<BTree<int, double>>(size, "BTree", log_file);
+            performance_test_vector<FlatHashTable<int, double>>(size, "FlatHashTable", log_file);
+            performance_test_vector<BPlusTree<int, double>>(size, "BPlusTree", log_file);
         } else {
             performance_test_matrix<HashTable<IndexPair, double>>(size, "HashTable", log_file);
             performance_test_matrix<BTree<IndexPair, double>>(size, "BTree", log_file);
+            performance_test_matrix<FlatHashTable<IndexPair, double>>(size, "FlatHashTable", log_file);
+            performance_test_matrix<BPlusTree<IndexPair, double>>(size, "BPlusTree", log_file);
         }
     }
 
@@ -21,6 +21,50 @@ void test_sparse_vector(const std::string& dictionary_name, bool extended = fals
 template <typename DictionaryType>
 void test_sparse_matrix(const std::string& dictionary_name, bool extended = false);
 
+template <typename DictionaryType>
+void test_bulk_load(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_csr_matrix(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_multiply(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_matrix_product(const std::string& dictionary_name);
+
+template <typename VectorDictionaryType, typename MatrixDictionaryType>
+void test_elementwise(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_sparse_blas(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_parallel_traversal(const std::string& dictionary_name);
+
+template <typename DictionaryType>
+void test_ordered_bounds(const std::string& dictionary_name);
+
+void test_btree_removal();
+
+void test_bplus_tree();
+
+void test_incremental_rehash();
+
+void test_thread_pool();
+
+void test_sharded_hash_table();
+
+void test_concurrent_btree();
+
+void test_persistent_btree();
+
+void test_buffered_btree();
+
+void test_paged_btree();
+
+void test_buffer_pool();
+
 
 template<typename Func>
 long long measure_time(Func func);